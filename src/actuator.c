@@ -0,0 +1,458 @@
+/**************************************************
+ * Relay and output line control, see actuator.h
+ * The queue is a bounded MPSC ring with a sequence number
+ * per cell (after D. Vyukov): producers claim a slot with
+ * one CAS on the tail, the worker is the only consumer.
+ * The worker sleeps in ppoll() on an eventfd until the
+ * next edge is due; producers only write the eventfd when
+ * the worker said it is going to sleep.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <bcm2835.h>
+
+#include "actuator.h"
+#include "monotime.h"
+
+//commands applied per wakeup, so a flood cannot starve the scheduled edges
+#define ACTUATOR_BATCH 32
+
+typedef enum {
+    CMD_SET,
+    CMD_PULSE,
+    CMD_TIMED,
+    CMD_PWM
+} act_op;
+
+typedef struct {
+    act_op op;
+    guint ch;
+    gboolean on;
+    gint64 duration_ns;
+    gint64 period_ns;
+    guint duty;
+    gint64 enqueue_ns;
+} act_cmd;
+
+typedef struct {
+    _Atomic guint64 seq;
+    act_cmd cmd;
+} act_cell;
+
+typedef enum {
+    MODE_STEADY,
+    MODE_PULSE,     //off at deadline, not retriggerable
+    MODE_TIMED,     //off at deadline, retriggerable
+    MODE_PWM
+} act_mode;
+
+typedef struct {
+    guint pin;
+    gboolean active_low;
+    act_mode mode;
+    gboolean on;
+    gboolean written;   //level the pin has now
+    gint64 deadline;    //next scheduled edge, 0 for none
+    gint64 cycle;       //PWM: start of the current period
+    gint64 period_ns;
+    gint64 on_ns;
+} act_channel;
+
+typedef struct {
+    void (*setup)(actuator *act, guint pin);
+    //one access per bank: bits in set go high, bits in clr go low
+    void (*write)(actuator *act, guint bank, guint32 set, guint32 clr);
+} actuator_backend;
+
+struct actuator {
+    const actuator_backend *backend;
+    act_channel channels[ACTUATOR_MAX_CHANNELS];
+    guint n_channels;
+    volatile gint level[ACTUATOR_MAX_CHANNELS];
+    //simulated bank
+    guint32 sim_bank[2];
+
+    act_cell queue[ACTUATOR_QUEUE_SIZE];
+    _Atomic guint64 tail;
+    guint64 head;
+    _Atomic gint sleeping;
+    int wake_fd;
+    _Atomic gint stop;
+    GThread *thread;
+
+    GMutex lock;
+    actuator_stats stats;
+};
+
+/************** bcm2835 backend **********/
+static void bcm_setup(actuator *act, guint pin)
+{
+    bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+}
+
+static void bcm_write(actuator *act, guint bank, guint32 set, guint32 clr)
+{
+    //the library only has multi-pin access for GPSET0/GPCLR0, bank 1 is not on the header
+    if (bank == 0) {
+        if (set) {bcm2835_gpio_set_multi(set);}
+        if (clr) {bcm2835_gpio_clr_multi(clr);}
+        return;
+    }
+    for (guint b = 0; b < 32; b++) {
+        if (set & (1u << b)) {bcm2835_gpio_write(32 + b, HIGH);}
+        if (clr & (1u << b)) {bcm2835_gpio_write(32 + b, LOW);}
+    }
+}
+
+static const actuator_backend bcm_backend = {
+    bcm_setup, bcm_write
+};
+
+/************** simulated backend **********/
+static void sim_setup(actuator *act, guint pin)
+{
+}
+
+static void sim_write(actuator *act, guint bank, guint32 set, guint32 clr)
+{
+    act->sim_bank[bank] = (act->sim_bank[bank] | set) & ~clr;
+}
+
+static const actuator_backend sim_backend = {
+    sim_setup, sim_write
+};
+
+static actuator *actuator_alloc(const actuator_backend *backend)
+{
+    actuator *act = g_new0(actuator, 1);
+
+    act->backend = backend;
+    act->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (act->wake_fd < 0) {
+        g_free(act);
+        return NULL;
+    }
+    for (guint i = 0; i < ACTUATOR_QUEUE_SIZE; i++) {atomic_init(&act->queue[i].seq, i);}
+    g_mutex_init(&act->lock);
+    return act;
+}
+
+actuator *actuator_open_bcm2835(void)
+{
+    return actuator_alloc(&bcm_backend);
+}
+
+actuator *actuator_open_sim(void)
+{
+    return actuator_alloc(&sim_backend);
+}
+
+gint actuator_add_channel(actuator *act, guint pin, gboolean active_low)
+{
+    act_channel *c;
+
+    if (act->thread != NULL || act->n_channels == ACTUATOR_MAX_CHANNELS || pin >= 64) {return -1;}
+    c = &act->channels[act->n_channels];
+    c->pin = pin;
+    c->active_low = active_low;
+    //drive the inactive level before the pin becomes an output
+    act->backend->write(act, pin / 32, active_low ? 1u << (pin % 32) : 0, active_low ? 0 : 1u << (pin % 32));
+    act->backend->setup(act, pin);
+    return act->n_channels++;
+}
+
+/************** command queue **********/
+static int queue_push(actuator *act, act_cmd *cmd)
+{
+    guint64 pos = atomic_load_explicit(&act->tail, memory_order_relaxed);
+    act_cell *cell;
+
+    if (cmd->ch >= act->n_channels) {return -1;}
+    while (1) {
+        gint64 diff;
+        cell = &act->queue[pos % ACTUATOR_QUEUE_SIZE];
+        diff = (gint64)atomic_load_explicit(&cell->seq, memory_order_acquire) - (gint64)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&act->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {break;}
+        } else if (diff < 0) {
+            g_mutex_lock(&act->lock);
+            act->stats.dropped++;
+            g_mutex_unlock(&act->lock);
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&act->tail, memory_order_relaxed);
+        }
+    }
+    cmd->enqueue_ns = mono_ns();
+    cell->cmd = *cmd;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    //pairs with the fence in the worker before it checks the queue one last time
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&act->sleeping, memory_order_relaxed)) {
+        guint64 one = 1;
+        if (write(act->wake_fd, &one, sizeof(one)) < 0) {return 0;}
+    }
+    return 0;
+}
+
+static gboolean queue_pop(actuator *act, act_cmd *cmd)
+{
+    act_cell *cell = &act->queue[act->head % ACTUATOR_QUEUE_SIZE];
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != act->head + 1) {return FALSE;}
+    *cmd = cell->cmd;
+    atomic_store_explicit(&cell->seq, act->head + ACTUATOR_QUEUE_SIZE, memory_order_release);
+    act->head++;
+    return TRUE;
+}
+
+static gboolean queue_empty(actuator *act)
+{
+    act_cell *cell = &act->queue[act->head % ACTUATOR_QUEUE_SIZE];
+
+    return atomic_load_explicit(&cell->seq, memory_order_acquire) != act->head + 1;
+}
+
+/************** worker **********/
+static void channel_apply(act_channel *c, const act_cmd *cmd, gint64 now)
+{
+    switch (cmd->op) {
+    case CMD_SET:
+        c->mode = MODE_STEADY;
+        c->on = cmd->on;
+        c->deadline = 0;
+        break;
+    case CMD_PULSE:
+        if (c->mode == MODE_PULSE) {break;}
+        c->mode = MODE_PULSE;
+        c->on = TRUE;
+        c->deadline = now + cmd->duration_ns;
+        break;
+    case CMD_TIMED:
+        c->mode = MODE_TIMED;
+        c->on = TRUE;
+        c->deadline = now + cmd->duration_ns;
+        break;
+    case CMD_PWM:
+        c->mode = MODE_PWM;
+        c->period_ns = cmd->period_ns;
+        c->on_ns = cmd->period_ns * cmd->duty / 1000;
+        c->cycle = now;
+        c->on = (c->on_ns > 0);
+        //0% and 100% need no edges at all
+        c->deadline = (c->on_ns > 0 && c->on_ns < c->period_ns) ? now + c->on_ns : 0;
+        if (c->on_ns == 0 || c->on_ns >= c->period_ns) {c->mode = MODE_STEADY;}
+        break;
+    }
+}
+
+//run an edge that is due, returns the deadline it was scheduled for
+static gint64 channel_edge(act_channel *c, gint64 now)
+{
+    gint64 due = c->deadline;
+
+    if (c->mode != MODE_PWM) {
+        c->mode = MODE_STEADY;
+        c->on = FALSE;
+        c->deadline = 0;
+        return due;
+    }
+    if (c->on) {
+        c->on = FALSE;
+        c->deadline = c->cycle + c->period_ns;
+        return due;
+    }
+    //next period, keeping the phase unless we fell a whole period behind
+    c->cycle += c->period_ns;
+    if (c->cycle + c->period_ns <= now) {c->cycle = now;}
+    c->on = TRUE;
+    c->deadline = c->cycle + c->on_ns;
+    return due;
+}
+
+static gpointer actuator_thread(gpointer data)
+{
+    actuator *act = data;
+    struct sched_param param;
+    struct pollfd pfd;
+
+    //keep edge jitter low if we are allowed to, otherwise run as a normal thread
+    param.sched_priority = 20;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    pfd.fd = act->wake_fd;
+    pfd.events = POLLIN;
+    while (1) {
+        gint64 enq[ACTUATOR_BATCH];
+        gint64 due[ACTUATOR_MAX_CHANNELS];
+        guint n_cmd = 0;
+        guint n_due = 0;
+        guint32 set[2] = {0, 0};
+        guint32 clr[2] = {0, 0};
+        guint writes = 0;
+        gint64 now = mono_ns();
+        gint64 next = 0;
+        gboolean stopping;
+        act_cmd cmd;
+
+        while (n_cmd < ACTUATOR_BATCH && queue_pop(act, &cmd)) {
+            channel_apply(&act->channels[cmd.ch], &cmd, now);
+            enq[n_cmd++] = cmd.enqueue_ns;
+        }
+        for (guint i = 0; i < act->n_channels; i++) {
+            act_channel *c = &act->channels[i];
+            if (c->deadline != 0 && c->deadline <= now) {due[n_due++] = channel_edge(c, now);}
+        }
+        //leave every output off behind us
+        stopping = atomic_load(&act->stop);
+        for (guint i = 0; stopping && i < act->n_channels; i++) {
+            act->channels[i].mode = MODE_STEADY;
+            act->channels[i].on = FALSE;
+            act->channels[i].deadline = 0;
+        }
+        //collect every changed line into one set and one clear mask per bank
+        for (guint i = 0; i < act->n_channels; i++) {
+            act_channel *c = &act->channels[i];
+            guint32 bit = 1u << (c->pin % 32);
+            if (c->on != c->written) {
+                if (c->on != c->active_low) {set[c->pin / 32] |= bit;}
+                else {clr[c->pin / 32] |= bit;}
+                c->written = c->on;
+                g_atomic_int_set(&act->level[i], c->on);
+            }
+            if (c->deadline != 0 && (next == 0 || c->deadline < next)) {next = c->deadline;}
+        }
+        for (guint b = 0; b < 2; b++) {
+            if (set[b] == 0 && clr[b] == 0) {continue;}
+            act->backend->write(act, b, set[b], clr[b]);
+            writes++;
+        }
+        if (n_cmd || n_due) {
+            gint64 written = mono_ns();
+            g_mutex_lock(&act->lock);
+            act->stats.writes += writes;
+            act->stats.commands += n_cmd;
+            for (guint i = 0; i < n_cmd; i++) {
+                act->stats.latency_max_ns = MAX(act->stats.latency_max_ns, written - enq[i]);
+                act->stats.latency_sum_ns += written - enq[i];
+            }
+            act->stats.edges += n_due;
+            for (guint i = 0; i < n_due; i++) {
+                act->stats.late_max_ns = MAX(act->stats.late_max_ns, written - due[i]);
+                act->stats.late_sum_ns += written - due[i];
+            }
+            g_mutex_unlock(&act->lock);
+        }
+        if (stopping) {break;}
+
+        //tell producers we may sleep, then look at the queue once more
+        atomic_store_explicit(&act->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (queue_empty(act)) {
+            gint64 wait = next ? next - mono_ns() : -1;
+            if (next == 0 || wait > 0) {
+                struct timespec ts = ns_to_timespec(MAX(wait, 0));
+                guint64 value;
+                if (ppoll(&pfd, 1, next ? &ts : NULL, NULL) > 0) {
+                    if (read(act->wake_fd, &value, sizeof(value)) < 0) {value = 0;}
+                }
+            }
+        }
+        atomic_store_explicit(&act->sleeping, 0, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int actuator_start(actuator *act)
+{
+    if (act->thread != NULL) {return 0;}
+    atomic_store(&act->stop, 0);
+    act->thread = g_thread_new("actuator", actuator_thread, act);
+    return 0;
+}
+
+void actuator_stop(actuator *act)
+{
+    guint64 one = 1;
+
+    if (act->thread == NULL) {return;}
+    //the worker turns the outputs off in its last pass
+    atomic_store(&act->stop, 1);
+    if (write(act->wake_fd, &one, sizeof(one)) < 0) {return;}
+    g_thread_join(act->thread);
+    act->thread = NULL;
+}
+
+void actuator_free(actuator *act)
+{
+    if (act == NULL) {return;}
+    actuator_stop(act);
+    close(act->wake_fd);
+    g_mutex_clear(&act->lock);
+    g_free(act);
+}
+
+int actuator_set(actuator *act, guint ch, gboolean on)
+{
+    act_cmd cmd = {CMD_SET, ch, on, 0, 0, 0, 0};
+    return queue_push(act, &cmd);
+}
+
+int actuator_pulse(actuator *act, guint ch, gint64 width_ns)
+{
+    act_cmd cmd = {CMD_PULSE, ch, TRUE, width_ns, 0, 0, 0};
+    return queue_push(act, &cmd);
+}
+
+int actuator_timed_on(actuator *act, guint ch, gint64 duration_ns)
+{
+    act_cmd cmd = {CMD_TIMED, ch, TRUE, duration_ns, 0, 0, 0};
+    return queue_push(act, &cmd);
+}
+
+int actuator_pwm(actuator *act, guint ch, gint64 period_ns, guint duty_permille)
+{
+    act_cmd cmd = {CMD_PWM, ch, TRUE, 0, period_ns, MIN(duty_permille, 1000), 0};
+
+    if (period_ns <= 0) {return -1;}
+    return queue_push(act, &cmd);
+}
+
+gboolean actuator_get_level(actuator *act, guint ch)
+{
+    if (ch >= act->n_channels) {return FALSE;}
+    return g_atomic_int_get(&act->level[ch]);
+}
+
+void actuator_get_stats(actuator *act, actuator_stats *stats)
+{
+    g_mutex_lock(&act->lock);
+    *stats = act->stats;
+    g_mutex_unlock(&act->lock);
+}
+
+void actuator_print_stats(actuator *act)
+{
+    actuator_stats st;
+
+    actuator_get_stats(act, &st);
+    printf("Outputs: %llu commands, %llu dropped, %llu timed edges, %llu register writes\n",
+           (unsigned long long)st.commands, (unsigned long long)st.dropped,
+           (unsigned long long)st.edges, (unsigned long long)st.writes);
+    if (st.commands > 0) {
+        printf("Outputs: command to pin %.1f us mean, %.1f us max\n",
+               (double)st.latency_sum_ns / st.commands / NSEC_PER_USEC, (double)st.latency_max_ns / NSEC_PER_USEC);
+    }
+    if (st.edges > 0) {
+        printf("Outputs: timed edge late %.1f us mean, %.1f us max\n",
+               (double)st.late_sum_ns / st.edges / NSEC_PER_USEC, (double)st.late_max_ns / NSEC_PER_USEC);
+    }
+}
@@ -0,0 +1,63 @@
+/**************************************************
+ * Relay and output line control
+ * One worker thread owns every output line. Any thread
+ * posts commands into a bounded lock-free MPSC queue and
+ * returns at once; the worker applies them, runs the
+ * timed edges (pulse, timed-on, software PWM) on absolute
+ * deadlines and writes each GPIO bank with one set and
+ * one clear register access per wakeup, however many
+ * lines changed. Outputs go to the bcm2835 registers or
+ * to a simulated bank.
+ * ************************************************/
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <glib.h>
+
+#define ACTUATOR_MAX_CHANNELS 16
+#define ACTUATOR_QUEUE_SIZE 256
+
+typedef struct actuator actuator;
+
+typedef struct {
+    guint64 commands;
+    guint64 dropped;        //queue full
+    guint64 edges;          //scheduled edges (pulse end, timed off, PWM)
+    guint64 writes;         //bank register accesses
+    gint64 latency_max_ns;  //enqueue to pin written
+    gint64 latency_sum_ns;
+    gint64 late_max_ns;     //scheduled edge to pin written
+    gint64 late_sum_ns;
+} actuator_stats;
+
+//bcm2835_init() must have succeeded
+actuator *actuator_open_bcm2835(void);
+//simulated bank, levels can be read back with actuator_get_level()
+actuator *actuator_open_sim(void);
+
+//configure pin as an output, off; returns the channel used by the commands
+//below, -1 when full or already started
+gint actuator_add_channel(actuator *act, guint pin, gboolean active_low);
+
+int actuator_start(actuator *act);
+//drive every channel off and join the worker
+void actuator_stop(actuator *act);
+void actuator_free(actuator *act);
+
+//all commands can be posted from any thread and return -1 if the queue is full;
+//set cancels any pulse, timer or PWM running on the channel
+int actuator_set(actuator *act, guint ch, gboolean on);
+//on for width_ns, a pulse already running is left alone
+int actuator_pulse(actuator *act, guint ch, gint64 width_ns);
+//on for duration_ns, posting again while on extends it
+int actuator_timed_on(actuator *act, guint ch, gint64 duration_ns);
+//software PWM, duty in 1/1000 of the period
+int actuator_pwm(actuator *act, guint ch, gint64 period_ns, guint duty_permille);
+
+//last level written, TRUE for on
+gboolean actuator_get_level(actuator *act, guint ch);
+
+void actuator_get_stats(actuator *act, actuator_stats *stats);
+void actuator_print_stats(actuator *act);
+
+#endif
@@ -0,0 +1,456 @@
+/**************************************************
+ * ADS1115 continuous acquisition, see ads1115.h
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "ads1115.h"
+#include "monotime.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define REG_CONVERSION 0
+#define REG_CONFIG 1
+//retry delay after a failed bus transfer, doubled while the device keeps failing
+#define ERROR_BACKOFF_NS (100 * NSEC_PER_MSEC)
+#define ERROR_BACKOFF_MAX_NS (2 * NSEC_PER_SEC)
+//consecutive failures before the bus is opened again
+#define REOPEN_AFTER 3
+
+static const guint data_rate_sps[] = {8, 16, 32, 64, 128, 250, 475, 860};
+
+//byte level access to the device
+typedef struct {
+    int (*write)(ads1115 *adc, const guint8 *buf, int len);
+    int (*read)(ads1115 *adc, guint8 *buf, int len);
+    //drop the bus and open it again, for a device that stopped answering
+    int (*reopen)(ads1115 *adc);
+    void (*close)(ads1115 *adc);
+} ads1115_backend;
+
+struct ads1115 {
+    const ads1115_backend *backend;
+    int fd;
+    gchar bus[64];
+    guint8 addr;
+    //register pointer currently selected on the device
+    int pointer;
+    //fake register model
+    guint16 fake_config;
+    gint64 fake_start;
+    volatile gint fake_nak;
+    //data rate asked for from another thread, applied between conversions
+    volatile gint want_rate;
+    //replay backend, the conversion register as recorded
+    guint8 replay_word[2];
+    capture *cap;
+
+    ads1115_config cfg;
+    sample_ring *ring;
+    reactor_source *timer;
+    //conversion state, only touched by the reactor thread
+    gint64 period;
+    gint64 settle;
+    gint64 start;
+    gint64 deadline;
+    //when the conversion being waited for started
+    gint64 conv_start;
+    guint ch;
+    gboolean selected;
+    //failure state, only touched by the reactor thread
+    guint fails;
+    gint64 fail_since;
+    gint64 backoff;
+    GMutex lock;
+    ads1115_stats stats;
+    metrics_histogram *m_wait;
+};
+
+/************** i2c-dev backend **********/
+static int dev_write(ads1115 *adc, const guint8 *buf, int len)
+{
+    return write(adc->fd, buf, len) == len ? 0 : -1;
+}
+
+static int dev_read(ads1115 *adc, guint8 *buf, int len)
+{
+    return read(adc->fd, buf, len) == len ? 0 : -1;
+}
+
+static int dev_open(const gchar *bus, guint8 addr)
+{
+    int fd;
+
+    // open device on /dev/i2c-1 the default on Raspberry Pi B
+    if ((fd = open(bus, O_RDWR | O_CLOEXEC)) < 0) {return -1;}
+    // connect to ads1115 as i2c slave
+    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int dev_reopen(ads1115 *adc)
+{
+    if (adc->fd >= 0) {close(adc->fd);}
+    adc->fd = dev_open(adc->bus, adc->addr);
+    return adc->fd >= 0 ? 0 : -1;
+}
+
+static void dev_close(ads1115 *adc)
+{
+    if (adc->fd >= 0) {close(adc->fd);}
+}
+
+static const ads1115_backend dev_backend = {
+    dev_write, dev_read, dev_reopen, dev_close
+};
+
+/************** fake backend **********/
+static int fake_write(ads1115 *adc, const guint8 *buf, int len)
+{
+    if (g_atomic_int_get(&adc->fake_nak)) {return -1;}
+    if (len >= 3 && buf[0] == REG_CONFIG) {
+        adc->fake_config = (buf[1] << 8) | buf[2];
+    }
+    return 0;
+}
+
+static int fake_read(ads1115 *adc, guint8 *buf, int len)
+{
+    guint16 value;
+
+    if (g_atomic_int_get(&adc->fake_nak)) {return -1;}
+    if (adc->pointer == REG_CONFIG) {
+        //conversion always complete
+        value = adc->fake_config | 0x8000;
+    } else {
+        int mux = (adc->fake_config >> 12) & 7;
+        double t = (double)(mono_ns() - adc->fake_start) / NSEC_PER_SEC;
+        double v = 8000.0 + 2000.0 * sin(2 * G_PI * 0.1 * t + mux) + (rand() % 64) - 32;
+        value = (guint16)(gint16)v;
+    }
+    buf[0] = value >> 8;
+    if (len > 1) {buf[1] = value & 0xFF;}
+    return 0;
+}
+
+static int fake_reopen(ads1115 *adc)
+{
+    return 0;
+}
+
+static void fake_close(ads1115 *adc)
+{
+}
+
+static const ads1115_backend fake_backend = {
+    fake_write, fake_read, fake_reopen, fake_close
+};
+
+/************** replay backend **********/
+static int replay_write(ads1115 *adc, const guint8 *buf, int len)
+{
+    return 0;
+}
+
+static int replay_read(ads1115 *adc, guint8 *buf, int len)
+{
+    buf[0] = adc->replay_word[0];
+    if (len > 1) {buf[1] = adc->replay_word[1];}
+    return 0;
+}
+
+static const ads1115_backend replay_backend = {
+    replay_write, replay_read, fake_reopen, fake_close
+};
+
+ads1115 *ads1115_open(const gchar *bus, guint8 addr)
+{
+    ads1115 *adc;
+    int fd = dev_open(bus, addr);
+
+    if (fd < 0) {
+        printf("Error: Couldn't open the converter at 0x%02x on %s: %s\n", addr, bus, strerror(errno));
+        return NULL;
+    }
+    adc = g_new0(ads1115, 1);
+    adc->backend = &dev_backend;
+    adc->fd = fd;
+    g_strlcpy(adc->bus, bus, sizeof(adc->bus));
+    adc->addr = addr;
+    adc->pointer = -1;
+    g_mutex_init(&adc->lock);
+    return adc;
+}
+
+ads1115 *ads1115_open_fake(void)
+{
+    ads1115 *adc = g_new0(ads1115, 1);
+
+    adc->backend = &fake_backend;
+    adc->fd = -1;
+    adc->pointer = -1;
+    adc->fake_start = mono_ns();
+    g_mutex_init(&adc->lock);
+    return adc;
+}
+
+ads1115 *ads1115_open_replay(void)
+{
+    ads1115 *adc = g_new0(ads1115, 1);
+
+    adc->backend = &replay_backend;
+    adc->fd = -1;
+    adc->pointer = -1;
+    g_mutex_init(&adc->lock);
+    return adc;
+}
+
+void ads1115_set_capture(ads1115 *adc, capture *cap)
+{
+    adc->cap = cap;
+}
+
+int ads1115_set_data_rate(ads1115 *adc, guint8 data_rate)
+{
+    if (data_rate > ADS1115_DR_860 || adc->backend == &replay_backend) {return -1;}
+    g_atomic_int_set(&adc->want_rate, data_rate);
+    return 0;
+}
+
+guint ads1115_rate_sps(guint8 data_rate)
+{
+    return data_rate <= ADS1115_DR_860 ? data_rate_sps[data_rate] : 0;
+}
+
+//one conversion period plus 10% for the internal oscillator tolerance
+static void ads1115_set_period(ads1115 *adc, guint8 data_rate)
+{
+    adc->cfg.data_rate = data_rate;
+    adc->period = NSEC_PER_SEC / data_rate_sps[data_rate];
+    adc->settle = adc->period + adc->period / 10;
+}
+
+int ads1115_fake_nak(ads1115 *adc, gboolean nak)
+{
+    if (adc->backend != &fake_backend) {return -1;}
+    g_atomic_int_set(&adc->fake_nak, nak ? 1 : 0);
+    return 0;
+}
+
+//write the config register: continuous mode, +-4.096 V, comparator off
+static int ads1115_select(ads1115 *adc, guint8 mux)
+{
+    guint8 buf[3];
+
+    buf[0] = REG_CONFIG;
+    buf[1] = (mux << 4) | (1 << 1);
+    buf[2] = (adc->cfg.data_rate << 5) | 0x03;
+    adc->pointer = REG_CONFIG;
+    return adc->backend->write(adc, buf, 3);
+}
+
+static int ads1115_read_conversion(ads1115 *adc, gint16 *raw)
+{
+    guint8 buf[2];
+
+    //the pointer stays on the conversion register between reads
+    if (adc->pointer != REG_CONVERSION) {
+        buf[0] = REG_CONVERSION;
+        if (adc->backend->write(adc, buf, 1) < 0) {return -1;}
+        adc->pointer = REG_CONVERSION;
+    }
+    if (adc->backend->read(adc, buf, 2) < 0) {return -1;}
+    *raw = (gint16)((buf[0] << 8) | buf[1]);
+    return 0;
+}
+
+//a transfer failed: retry with backoff, and reopen the bus once the device
+//keeps failing; the next attempt starts over with a select
+static void ads1115_failed(ads1115 *adc, gint64 now)
+{
+    gboolean reopen = ++adc->fails >= REOPEN_AFTER;
+
+    if (adc->fails == 1) {
+        adc->fail_since = now;
+        adc->backoff = ERROR_BACKOFF_NS;
+    }
+    if (adc->fails == REOPEN_AFTER) {printf("ADC: not answering, reopening the bus\n");}
+    if (reopen) {adc->backend->reopen(adc);}
+    g_mutex_lock(&adc->lock);
+    adc->stats.errors++;
+    if (reopen) {adc->stats.reopens++;}
+    g_mutex_unlock(&adc->lock);
+    adc->pointer = -1;
+    adc->selected = FALSE;
+    reactor_timer_arm(adc->timer, now + adc->backoff);
+    if (reopen) {adc->backoff = MIN(adc->backoff * 2, ERROR_BACKOFF_MAX_NS);}
+}
+
+//a mux change restarts the conversion, wait a full period for the new channel
+static void ads1115_select_next(ads1115 *adc, gint64 now)
+{
+    adc->selected = (ads1115_select(adc, adc->cfg.mux[adc->ch]) == 0);
+    if (!adc->selected) {
+        ads1115_failed(adc, now);
+        return;
+    }
+    adc->conv_start = now;
+    adc->deadline = now + adc->settle;
+    reactor_timer_arm(adc->timer, adc->deadline);
+}
+
+//hand a conversion of scan position ch to the ring
+static void ads1115_push(ads1115 *adc, guint ch, gint16 raw, gint64 ts)
+{
+    adc_sample sample;
+
+    sample.raw = raw;
+    sample.ts_ns = ts;
+    sample.channel = ch;
+    trace_flow_start("sample", ts);
+    sample_ring_push(adc->ring, &sample);
+    g_mutex_lock(&adc->lock);
+    adc->stats.samples++;
+    adc->stats.run_ns = ts - adc->start;
+    g_mutex_unlock(&adc->lock);
+}
+
+static void ads1115_on_timer(reactor_source *src, guint32 events, gpointer data)
+{
+    ads1115 *adc = data;
+    adc_sample sample;
+    guint8 word[3];
+    guint8 rate;
+
+    if (!adc->selected) {
+        ads1115_select_next(adc, mono_ns());
+        return;
+    }
+    if (ads1115_read_conversion(adc, &sample.raw) < 0) {
+        ads1115_failed(adc, mono_ns());
+        return;
+    }
+    sample.ts_ns = mono_ns();
+    if (adc->fails > 0) {
+        if (adc->fails >= REOPEN_AFTER) {
+            printf("ADC: recovered after %.1f s\n", (double)(sample.ts_ns - adc->fail_since) / NSEC_PER_SEC);
+        }
+        adc->fails = 0;
+    }
+    metrics_observe(adc->m_wait, sample.ts_ns - adc->conv_start);
+    trace_begin("adc_sample");
+    if (adc->cap) {
+        word[0] = adc->cfg.mux[adc->ch];
+        word[1] = (guint16)sample.raw >> 8;
+        word[2] = (guint16)sample.raw & 0xFF;
+        capture_write(adc->cap, CAPTURE_ADC, adc->ch, sample.ts_ns, word, sizeof(word));
+    }
+    ads1115_push(adc, adc->ch, sample.raw, sample.ts_ns);
+    trace_end("adc_sample");
+
+    adc->ch = (adc->ch + 1) % adc->cfg.n_channels;
+    //a new data rate goes out with the config register, like a mux change
+    rate = g_atomic_int_get(&adc->want_rate);
+    if (rate != adc->cfg.data_rate) {
+        ads1115_set_period(adc, rate);
+        g_mutex_lock(&adc->lock);
+        adc->stats.rate_changes++;
+        g_mutex_unlock(&adc->lock);
+        ads1115_select_next(adc, sample.ts_ns);
+        return;
+    }
+    if (adc->cfg.n_channels > 1) {
+        ads1115_select_next(adc, sample.ts_ns);
+        return;
+    }
+    //single channel keeps converting, next result one period after the last deadline
+    adc->conv_start = sample.ts_ns;
+    adc->deadline += adc->period;
+    if (adc->deadline < sample.ts_ns) {adc->deadline = sample.ts_ns + adc->period;}
+    reactor_timer_arm(adc->timer, adc->deadline);
+}
+
+int ads1115_start(ads1115 *adc, const ads1115_config *cfg, reactor *r, sample_ring *ring)
+{
+    if (adc->timer != NULL) {return 0;}
+    if (cfg->n_channels == 0 || cfg->n_channels > ADS1115_MAX_CHANNELS) {return -1;}
+    if (cfg->data_rate > ADS1115_DR_860) {return -1;}
+    adc->cfg = *cfg;
+    adc->ring = ring;
+    ads1115_set_period(adc, cfg->data_rate);
+    g_atomic_int_set(&adc->want_rate, cfg->data_rate);
+    adc->ch = 0;
+    adc->selected = FALSE;
+    adc->start = mono_ns();
+    adc->m_wait = metrics_histogram_new("adc_conversion_wait", "Time from starting an ADC conversion to reading its result");
+    //a replayed converter only converts when ads1115_replay() says so
+    if (adc->backend == &replay_backend) {return 0;}
+    adc->timer = reactor_add_timer(r, ads1115_on_timer, adc);
+    if (adc->timer == NULL) {return -1;}
+    //the first select happens on the reactor thread like every other bus transfer
+    reactor_timer_arm(adc->timer, adc->start);
+    return 0;
+}
+
+int ads1115_replay(ads1115 *adc, guint ch, const guint8 *data, guint len, gint64 ts_ns)
+{
+    gint16 raw;
+
+    //a capture of another scan does not belong to this converter
+    if (adc->backend != &replay_backend || adc->ring == NULL || len < 3
+        || ch >= adc->cfg.n_channels || data[0] != adc->cfg.mux[ch]) {return -1;}
+    //unlike a live converter a replay can wait for the consumer
+    if (sample_ring_full(adc->ring)) {return 1;}
+    adc->replay_word[0] = data[1];
+    adc->replay_word[1] = data[2];
+    if (ads1115_read_conversion(adc, &raw) < 0) {return -1;}
+    ads1115_push(adc, ch, raw, ts_ns);
+    return 0;
+}
+
+void ads1115_stop(ads1115 *adc)
+{
+    if (adc->timer == NULL) {return;}
+    reactor_remove(adc->timer);
+    adc->timer = NULL;
+}
+
+void ads1115_free(ads1115 *adc)
+{
+    if (adc == NULL) {return;}
+    ads1115_stop(adc);
+    adc->backend->close(adc);
+    g_mutex_clear(&adc->lock);
+    g_free(adc);
+}
+
+void ads1115_get_stats(ads1115 *adc, ads1115_stats *stats)
+{
+    g_mutex_lock(&adc->lock);
+    *stats = adc->stats;
+    g_mutex_unlock(&adc->lock);
+    stats->dropped = adc->ring ? sample_ring_dropped(adc->ring) : 0;
+}
+
+void ads1115_print_stats(ads1115 *adc)
+{
+    ads1115_stats st;
+
+    ads1115_get_stats(adc, &st);
+    printf("ADC: %llu samples, %llu dropped, %llu bus errors, %llu reopens\n", (unsigned long long)st.samples,
+           (unsigned long long)st.dropped, (unsigned long long)st.errors, (unsigned long long)st.reopens);
+    if (st.run_ns > 0) {
+        printf("ADC: %.1f samples/s, %llu data rate changes\n", (double)st.samples * NSEC_PER_SEC / st.run_ns,
+               (unsigned long long)st.rate_changes);
+    }
+}
@@ -0,0 +1,99 @@
+/**************************************************
+ * ADS1115 acquisition in continuous conversion mode
+ * A reactor timer fires once per conversion period on an
+ * absolute deadline instead of spinning on the OS bit; the
+ * callback scans the configured multiplexer channels and
+ * pushes time stamped raw words into a sample_ring.
+ * The device is reached through /dev/i2c-N or through a
+ * fake register model for running without hardware.
+ * Conversion words can be recorded to a capture, and a
+ * replay converter takes them back from one instead of
+ * converting on its own timer.
+ * Failed transfers are retried after a backoff that grows
+ * while the device keeps failing, and the i2c device is
+ * opened again after a few failures in a row.
+ * ************************************************/
+#ifndef ADS1115_H
+#define ADS1115_H
+
+#include <glib.h>
+#include "sample_ring.h"
+#include "reactor.h"
+#include "capture.h"
+
+#define ADS1115_MAX_CHANNELS 8
+
+//multiplexer settings (config register bits 14:12)
+enum {
+    ADS1115_MUX_DIFF_0_1 = 0,
+    ADS1115_MUX_DIFF_0_3 = 1,
+    ADS1115_MUX_DIFF_1_3 = 2,
+    ADS1115_MUX_DIFF_2_3 = 3,
+    ADS1115_MUX_AIN0 = 4,
+    ADS1115_MUX_AIN1 = 5,
+    ADS1115_MUX_AIN2 = 6,
+    ADS1115_MUX_AIN3 = 7
+};
+
+//data rate settings (config register bits 7:5)
+enum {
+    ADS1115_DR_8 = 0,
+    ADS1115_DR_16,
+    ADS1115_DR_32,
+    ADS1115_DR_64,
+    ADS1115_DR_128,
+    ADS1115_DR_250,
+    ADS1115_DR_475,
+    ADS1115_DR_860
+};
+
+//full scale of the +-4.096 V range used by the pressure sensor
+#define ADS1115_VOLTS(raw) ((raw) * 4.096 / 32768.0)
+
+typedef struct {
+    guint8 mux[ADS1115_MAX_CHANNELS];
+    guint n_channels;
+    guint8 data_rate;
+} ads1115_config;
+
+typedef struct {
+    guint64 samples;
+    guint64 dropped;
+    guint64 errors;
+    guint64 reopens;
+    guint64 rate_changes;
+    gint64 run_ns;
+} ads1115_stats;
+
+typedef struct ads1115 ads1115;
+
+//open the converter on an i2c-dev bus, NULL if the bus can't be opened
+ads1115 *ads1115_open(const gchar *bus, guint8 addr);
+//fake converter, every channel reads a slow sine with a little noise
+ads1115 *ads1115_open_fake(void);
+//converter fed by ads1115_replay(), start does not arm a timer
+ads1115 *ads1115_open_replay(void);
+
+//convert from r, stop must be called while r is stopped or from its thread
+int ads1115_start(ads1115 *adc, const ads1115_config *cfg, reactor *r, sample_ring *ring);
+void ads1115_stop(ads1115 *adc);
+void ads1115_free(ads1115 *adc);
+
+//record every conversion word, set before start
+void ads1115_set_capture(ads1115 *adc, capture *cap);
+//switch to another ADS1115_DR_ setting from any thread, it takes effect after
+//the conversion in progress; -1 for a replayed converter, whose rate is recorded
+int ads1115_set_data_rate(ads1115 *adc, guint8 data_rate);
+//samples per second of a data rate setting
+guint ads1115_rate_sps(guint8 data_rate);
+//make the fake converter fail every transfer like a device that NAKs, for fault tests
+int ads1115_fake_nak(ads1115 *adc, gboolean nak);
+//one recorded conversion of scan position ch, read back through the conversion
+//register as if it happened at ts_ns; 1 if the ring is full and nothing was
+//done, -1 if the capture used another scan
+int ads1115_replay(ads1115 *adc, guint ch, const guint8 *data, guint len, gint64 ts_ns);
+
+void ads1115_get_stats(ads1115 *adc, ads1115_stats *stats);
+void ads1115_print_stats(ads1115 *adc);
+
+#endif
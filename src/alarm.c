@@ -0,0 +1,695 @@
+/**************************************************
+ * Alarm rule engine, see alarm.h
+ * Every rule becomes two edges on one track of its
+ * signal: the key where the condition starts and the key
+ * where it ends, the deadband apart. A track is one of
+ * the value, minus the value, the rate or minus the rate,
+ * so a below or falling rule is an above rule on the
+ * negated key. Each track keeps its start and end edges
+ * sorted; a sample moving the key from k0 up to k1 can
+ * only start the rules with a start edge in (k0, k1], and
+ * moving it down can only end the rules with an end edge
+ * in (k1, k0]. Both are found by binary search, so the
+ * cost of a sample is the log of the rule count plus the
+ * rules that actually change.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "alarm.h"
+#include "monotime.h"
+
+enum {TRACK_VALUE, TRACK_NEG_VALUE, TRACK_RATE, TRACK_NEG_RATE, TRACKS};
+
+typedef struct {
+    gdouble key;
+    guint rule;
+} alarm_edge;
+
+typedef struct {
+    guint start;        //first start edge in edges
+    guint end;          //first end edge in edges
+    guint n;
+    gdouble key;        //last key, valid once primed
+    gboolean primed;
+} alarm_track;
+
+typedef struct {
+    gchar *name;
+    alarm_track tracks[TRACKS];
+    gboolean has_value;
+    gboolean has_rate;
+    gdouble value;
+    gdouble rate;       //per minute
+    gint64 ts_ns;
+    guint alarms;
+} alarm_signal;
+
+typedef struct {
+    alarm_rule def;
+    gint signal;
+    guint track;
+    gdouble start_key;
+    gdouble end_key;
+    gboolean cond;
+    alarm_state state;
+    gint64 due_ns;      //end of the delay while pending
+    gint heap_pos;      //in the delay heap, -1 if not pending
+} alarm_entry;
+
+typedef struct {
+    alarm_event ev;
+    guint64 seq;
+} queued_event;
+
+struct alarm_engine {
+    GMutex lock;
+    gint64 rate_window_ns;
+    alarm_entry *rules;
+    guint n_rules;
+    guint cap_rules;
+    gboolean compiled;
+    alarm_signal *signals;
+    guint n_signals;
+    alarm_edge *edges;
+    //rules waiting out their delay, earliest first
+    guint *delays;
+    guint n_delays;
+    //pending events, most urgent first
+    queued_event events[ALARM_MAX_EVENTS];
+    guint n_events;
+    guint64 event_seq;
+    //alarm output
+    actuator *act;
+    gint channel;
+    guint out_priority;
+    guint unacked;
+    gboolean out_on;
+    alarm_stats stats;
+};
+
+static const gchar *kind_names[] = {"above", "below", "rising", "falling"};
+
+/********** delay heap, keyed on due_ns **********/
+
+static void delay_swap(alarm_engine *eng, guint a, guint b)
+{
+    guint r = eng->delays[a];
+
+    eng->delays[a] = eng->delays[b];
+    eng->delays[b] = r;
+    eng->rules[eng->delays[a]].heap_pos = a;
+    eng->rules[eng->delays[b]].heap_pos = b;
+}
+
+static gboolean delay_before(alarm_engine *eng, guint a, guint b)
+{
+    return eng->rules[eng->delays[a]].due_ns < eng->rules[eng->delays[b]].due_ns;
+}
+
+static void delay_sift(alarm_engine *eng, guint i)
+{
+    while (i > 0 && delay_before(eng, i, (i - 1) / 2)) {
+        delay_swap(eng, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        guint l = 2 * i + 1, m = i;
+        if (l < eng->n_delays && delay_before(eng, l, m)) {m = l;}
+        if (l + 1 < eng->n_delays && delay_before(eng, l + 1, m)) {m = l + 1;}
+        if (m == i) {break;}
+        delay_swap(eng, i, m);
+        i = m;
+    }
+}
+
+static void delay_push(alarm_engine *eng, guint rule)
+{
+    guint i = eng->n_delays++;
+
+    eng->delays[i] = rule;
+    eng->rules[rule].heap_pos = i;
+    delay_sift(eng, i);
+}
+
+static void delay_remove(alarm_engine *eng, guint rule)
+{
+    guint i = eng->rules[rule].heap_pos;
+
+    eng->rules[rule].heap_pos = -1;
+    if (--eng->n_delays == i) {return;}
+    eng->delays[i] = eng->delays[eng->n_delays];
+    eng->rules[eng->delays[i]].heap_pos = i;
+    delay_sift(eng, i);
+}
+
+/********** event heap, by priority then age **********/
+
+static gboolean event_before(const queued_event *a, const queued_event *b)
+{
+    if (a->ev.priority != b->ev.priority) {return a->ev.priority > b->ev.priority;}
+    return a->seq < b->seq;
+}
+
+static void event_sift_down(alarm_engine *eng, guint i)
+{
+    for (;;) {
+        guint l = 2 * i + 1, m = i;
+        queued_event t;
+        if (l < eng->n_events && event_before(&eng->events[l], &eng->events[m])) {m = l;}
+        if (l + 1 < eng->n_events && event_before(&eng->events[l + 1], &eng->events[m])) {m = l + 1;}
+        if (m == i) {break;}
+        t = eng->events[i];
+        eng->events[i] = eng->events[m];
+        eng->events[m] = t;
+        i = m;
+    }
+}
+
+static void emit(alarm_engine *eng, guint rule, alarm_event_kind kind, gint64 ts_ns)
+{
+    alarm_entry *r = &eng->rules[rule];
+    alarm_signal *s = &eng->signals[r->signal];
+    queued_event q;
+    guint i;
+
+    eng->stats.events++;
+    if (eng->n_events == ALARM_MAX_EVENTS) {
+        eng->stats.dropped++;
+        return;
+    }
+    q.ev.rule = rule;
+    q.ev.name = r->def.name;
+    q.ev.priority = r->def.priority;
+    q.ev.kind = kind;
+    q.ev.value = (r->track >= TRACK_RATE) ? s->rate : s->value;
+    q.ev.ts_ns = ts_ns;
+    q.seq = eng->event_seq++;
+    i = eng->n_events++;
+    while (i > 0 && event_before(&q, &eng->events[(i - 1) / 2])) {
+        eng->events[i] = eng->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    eng->events[i] = q;
+}
+
+/********** rule states **********/
+
+static gboolean unacked(alarm_state st) {return st == ALARM_ACTIVE || st == ALARM_RETURNED;}
+
+static void set_state(alarm_engine *eng, alarm_entry *r, alarm_state st)
+{
+    alarm_signal *s = &eng->signals[r->signal];
+
+    if (r->state == ALARM_NORMAL) {s->alarms++;}
+    if (st == ALARM_NORMAL) {s->alarms--;}
+    if (r->def.priority >= eng->out_priority) {
+        if (unacked(r->state)) {eng->unacked--;}
+        if (unacked(st)) {eng->unacked++;}
+    }
+    r->state = st;
+}
+
+static void raise_alarm(alarm_engine *eng, guint rule, gint64 ts_ns)
+{
+    alarm_entry *r = &eng->rules[rule];
+
+    if (r->state != ALARM_NORMAL && r->state != ALARM_RETURNED) {return;}
+    set_state(eng, r, ALARM_ACTIVE);
+    emit(eng, rule, ALARM_RAISED, ts_ns);
+}
+
+static void cond_start(alarm_engine *eng, guint rule, gint64 ts_ns)
+{
+    alarm_entry *r = &eng->rules[rule];
+
+    if (r->cond) {return;}
+    r->cond = TRUE;
+    if (r->def.delay_ms == 0) {
+        raise_alarm(eng, rule, ts_ns);
+        return;
+    }
+    r->due_ns = ts_ns + r->def.delay_ms * NSEC_PER_MSEC;
+    delay_push(eng, rule);
+}
+
+static void cond_end(alarm_engine *eng, guint rule, gint64 ts_ns)
+{
+    alarm_entry *r = &eng->rules[rule];
+
+    if (!r->cond) {return;}
+    r->cond = FALSE;
+    if (r->heap_pos >= 0) {delay_remove(eng, rule);}
+    if (r->state == ALARM_ACTIVE && r->def.latch) {set_state(eng, r, ALARM_RETURNED);}
+    else if (r->state == ALARM_ACTIVE || r->state == ALARM_ACKED) {
+        set_state(eng, r, ALARM_NORMAL);
+        emit(eng, rule, ALARM_CLEARED, ts_ns);
+    }
+}
+
+static void run_delays(alarm_engine *eng, gint64 now)
+{
+    while (eng->n_delays > 0 && eng->rules[eng->delays[0]].due_ns <= now) {
+        guint rule = eng->delays[0];
+        gint64 due = eng->rules[rule].due_ns;
+        delay_remove(eng, rule);
+        raise_alarm(eng, rule, due);
+    }
+}
+
+static void update_output(alarm_engine *eng)
+{
+    gboolean on = eng->unacked > 0;
+
+    if (eng->act == NULL || on == eng->out_on) {return;}
+    if (actuator_set(eng->act, eng->channel, on) == 0) {eng->out_on = on;}
+}
+
+/********** tracks **********/
+
+//first edge in [first, first + n) with a key above key
+static guint upper_bound(const alarm_edge *e, guint first, guint n, gdouble key)
+{
+    guint lo = first, hi = first + n;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (e[mid].key <= key) {lo = mid + 1;}
+        else {hi = mid;}
+    }
+    return lo;
+}
+
+static void track_update(alarm_engine *eng, alarm_track *t, gdouble key, gint64 ts_ns)
+{
+    const alarm_edge *e = eng->edges;
+    guint i, last;
+
+    if (t->n == 0) {return;}
+    if (!t->primed) {
+        //first sample: every rule with its start edge at or below the key starts
+        last = upper_bound(e, t->start, t->n, key);
+        for (i = t->start; i < last; i++) {cond_start(eng, e[i].rule, ts_ns);}
+        eng->stats.visited += last - t->start;
+        t->primed = TRUE;
+    }
+    else if (key > t->key) {
+        last = t->start + t->n;
+        for (i = upper_bound(e, t->start, t->n, t->key); i < last && e[i].key <= key; i++) {
+            cond_start(eng, e[i].rule, ts_ns);
+            eng->stats.visited++;
+        }
+    }
+    else if (key < t->key) {
+        last = t->end + t->n;
+        for (i = upper_bound(e, t->end, t->n, key); i < last && e[i].key <= t->key; i++) {
+            cond_end(eng, e[i].rule, ts_ns);
+            eng->stats.visited++;
+        }
+    }
+    t->key = key;
+}
+
+static int edge_cmp(const void *a, const void *b)
+{
+    gdouble ka = ((const alarm_edge *)a)->key, kb = ((const alarm_edge *)b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/********** public **********/
+
+alarm_engine *alarm_engine_new(guint rate_window_ms)
+{
+    alarm_engine *eng = g_new0(alarm_engine, 1);
+
+    g_mutex_init(&eng->lock);
+    eng->rate_window_ns = MAX(rate_window_ms, 1) * NSEC_PER_MSEC;
+    eng->channel = -1;
+    return eng;
+}
+
+void alarm_engine_free(alarm_engine *eng)
+{
+    if (eng == NULL) {return;}
+    for (guint i = 0; i < eng->n_rules; i++) {
+        g_free((gchar *)eng->rules[i].def.name);
+        g_free((gchar *)eng->rules[i].def.signal);
+    }
+    for (guint i = 0; i < eng->n_signals; i++) {g_free(eng->signals[i].name);}
+    g_free(eng->rules);
+    g_free(eng->signals);
+    g_free(eng->edges);
+    g_free(eng->delays);
+    g_mutex_clear(&eng->lock);
+    g_free(eng);
+}
+
+int alarm_engine_add_rules(alarm_engine *eng, const alarm_rule *rules, guint n)
+{
+    int rc = 0;
+
+    g_mutex_lock(&eng->lock);
+    if (eng->compiled) {rc = -1;}
+    for (guint i = 0; rc == 0 && i < n; i++) {
+        alarm_entry *r;
+        if (rules[i].deadband < 0 || rules[i].limit != rules[i].limit) {
+            printf("Error: alarm %s has a bad limit or deadband\n", rules[i].name);
+            continue;
+        }
+        if (eng->n_rules == eng->cap_rules) {
+            eng->cap_rules = MAX(eng->cap_rules * 2, 16);
+            eng->rules = g_renew(alarm_entry, eng->rules, eng->cap_rules);
+        }
+        r = &eng->rules[eng->n_rules++];
+        memset(r, 0, sizeof(*r));
+        r->def = rules[i];
+        r->def.name = g_strdup(rules[i].name);
+        r->def.signal = g_strdup(rules[i].signal);
+        r->heap_pos = -1;
+    }
+    g_mutex_unlock(&eng->lock);
+    return rc;
+}
+
+int alarm_engine_load(alarm_engine *eng, const gchar *file)
+{
+    GKeyFile *keys = g_key_file_new();
+    GError *error = NULL;
+    gchar **groups;
+    int added = 0;
+
+    if (!g_key_file_load_from_file(keys, file, G_KEY_FILE_NONE, &error)) {
+        //no file is not an error, the caller falls back to its built-in rules
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            printf("Error: alarm rules %s: %s\n", file, error->message);
+        }
+        g_error_free(error);
+        g_key_file_free(keys);
+        return -1;
+    }
+    groups = g_key_file_get_groups(keys, NULL);
+    for (guint i = 0; groups[i]; i++) {
+        const gchar *group = groups[i];
+        gchar *signal, *when;
+        alarm_rule rule;
+        gboolean ok = FALSE;
+
+        if (!g_str_has_prefix(group, "alarm ")) {continue;}
+        signal = g_key_file_get_string(keys, group, "signal", NULL);
+        when = g_key_file_get_string(keys, group, "when", NULL);
+        memset(&rule, 0, sizeof(rule));
+        rule.name = group + strlen("alarm ");
+        rule.signal = signal;
+        for (guint k = 0; when && k < G_N_ELEMENTS(kind_names); k++) {
+            if (g_strcmp0(when, kind_names[k]) == 0) {
+                rule.kind = k;
+                ok = TRUE;
+            }
+        }
+        rule.limit = g_key_file_get_double(keys, group, "limit", &error);
+        if (error) {
+            g_clear_error(&error);
+            ok = FALSE;
+        }
+        rule.deadband = g_key_file_get_double(keys, group, "deadband", NULL);
+        rule.delay_ms = g_key_file_get_integer(keys, group, "delay_ms", NULL);
+        rule.latch = g_key_file_get_boolean(keys, group, "latch", NULL);
+        rule.priority = g_key_file_get_integer(keys, group, "priority", NULL);
+        if (signal == NULL || !ok) {printf("Error: [%s] needs a signal, a limit and when=above|below|rising|falling\n", group);}
+        else if (alarm_engine_add_rules(eng, &rule, 1) == 0) {added++;}
+        g_free(signal);
+        g_free(when);
+    }
+    g_strfreev(groups);
+    g_key_file_free(keys);
+    return added;
+}
+
+void alarm_engine_compile(alarm_engine *eng)
+{
+    guint *count;
+    guint next = 0;
+
+    g_mutex_lock(&eng->lock);
+    if (eng->compiled) {
+        g_mutex_unlock(&eng->lock);
+        return;
+    }
+    //signals in the order rules first name them
+    eng->signals = g_new0(alarm_signal, MAX(eng->n_rules, 1));
+    for (guint i = 0; i < eng->n_rules; i++) {
+        alarm_entry *r = &eng->rules[i];
+        gint s = -1;
+        for (guint k = 0; k < eng->n_signals && s < 0; k++) {
+            if (g_strcmp0(eng->signals[k].name, r->def.signal) == 0) {s = k;}
+        }
+        if (s < 0) {
+            s = eng->n_signals++;
+            eng->signals[s].name = g_strdup(r->def.signal);
+        }
+        r->signal = s;
+        switch (r->def.kind) {
+        case ALARM_ABOVE:
+            r->track = TRACK_VALUE;
+            r->start_key = r->def.limit;
+            break;
+        case ALARM_BELOW:
+            r->track = TRACK_NEG_VALUE;
+            r->start_key = -r->def.limit;
+            break;
+        case ALARM_RISING:
+            r->track = TRACK_RATE;
+            r->start_key = r->def.limit;
+            break;
+        default:
+            r->track = TRACK_NEG_RATE;
+            r->start_key = r->def.limit;
+            break;
+        }
+        r->end_key = r->start_key - r->def.deadband;
+        eng->signals[s].tracks[r->track].n++;
+    }
+    //lay the tracks out one after the other, start edges then end edges
+    for (guint s = 0; s < eng->n_signals; s++) {
+        for (guint t = 0; t < TRACKS; t++) {
+            alarm_track *tr = &eng->signals[s].tracks[t];
+            tr->start = next;
+            tr->end = next + tr->n;
+            next += 2 * tr->n;
+        }
+    }
+    eng->edges = g_new(alarm_edge, MAX(next, 1));
+    count = g_new0(guint, eng->n_signals * TRACKS + 1);
+    for (guint i = 0; i < eng->n_rules; i++) {
+        alarm_entry *r = &eng->rules[i];
+        alarm_track *tr = &eng->signals[r->signal].tracks[r->track];
+        guint k = count[r->signal * TRACKS + r->track]++;
+        eng->edges[tr->start + k].key = r->start_key;
+        eng->edges[tr->start + k].rule = i;
+        eng->edges[tr->end + k].key = r->end_key;
+        eng->edges[tr->end + k].rule = i;
+    }
+    for (guint s = 0; s < eng->n_signals; s++) {
+        for (guint t = 0; t < TRACKS; t++) {
+            alarm_track *tr = &eng->signals[s].tracks[t];
+            qsort(eng->edges + tr->start, tr->n, sizeof(alarm_edge), edge_cmp);
+            qsort(eng->edges + tr->end, tr->n, sizeof(alarm_edge), edge_cmp);
+        }
+    }
+    g_free(count);
+    eng->delays = g_new(guint, MAX(eng->n_rules, 1));
+    eng->compiled = TRUE;
+    g_mutex_unlock(&eng->lock);
+}
+
+void alarm_engine_set_output(alarm_engine *eng, actuator *act, gint channel, guint min_priority)
+{
+    g_mutex_lock(&eng->lock);
+    eng->act = act;
+    eng->channel = channel;
+    eng->out_priority = min_priority;
+    eng->unacked = 0;
+    for (guint i = 0; i < eng->n_rules; i++) {
+        if (eng->rules[i].def.priority >= min_priority && unacked(eng->rules[i].state)) {eng->unacked++;}
+    }
+    if (channel < 0) {eng->act = NULL;}
+    //the first write always goes out
+    eng->out_on = !(eng->unacked > 0);
+    update_output(eng);
+    g_mutex_unlock(&eng->lock);
+}
+
+gint alarm_engine_find_signal(alarm_engine *eng, const gchar *name)
+{
+    gint id = -1;
+
+    g_mutex_lock(&eng->lock);
+    for (guint s = 0; s < eng->n_signals && id < 0; s++) {
+        if (g_strcmp0(eng->signals[s].name, name) == 0) {id = s;}
+    }
+    g_mutex_unlock(&eng->lock);
+    return id;
+}
+
+void alarm_engine_update(alarm_engine *eng, gint signal, gdouble value, gint64 ts_ns)
+{
+    gint64 t0 = mono_ns(), dt;
+    alarm_signal *s;
+
+    if (signal < 0 || isnan(value)) {return;}
+    g_mutex_lock(&eng->lock);
+    if (!eng->compiled || (guint)signal >= eng->n_signals) {
+        g_mutex_unlock(&eng->lock);
+        return;
+    }
+    s = &eng->signals[signal];
+    //delays that ran out before this sample are raised with the value they saw
+    run_delays(eng, ts_ns);
+    //rate per minute, smoothed with a first order filter over the rate window
+    if (s->has_value && ts_ns > s->ts_ns && (s->tracks[TRACK_RATE].n || s->tracks[TRACK_NEG_RATE].n)) {
+        gdouble rate = (value - s->value) * 60 * NSEC_PER_SEC / (ts_ns - s->ts_ns);
+        if (s->has_rate) {s->rate += (rate - s->rate) * -expm1(-(gdouble)(ts_ns - s->ts_ns) / eng->rate_window_ns);}
+        else {s->rate = rate;}
+        s->has_rate = TRUE;
+    }
+    s->value = value;
+    s->ts_ns = ts_ns;
+    s->has_value = TRUE;
+    track_update(eng, &s->tracks[TRACK_VALUE], value, ts_ns);
+    track_update(eng, &s->tracks[TRACK_NEG_VALUE], -value, ts_ns);
+    if (s->has_rate) {
+        track_update(eng, &s->tracks[TRACK_RATE], s->rate, ts_ns);
+        track_update(eng, &s->tracks[TRACK_NEG_RATE], -s->rate, ts_ns);
+    }
+    update_output(eng);
+    eng->stats.samples++;
+    dt = mono_ns() - t0;
+    eng->stats.eval_ns += dt;
+    if (dt > eng->stats.eval_max_ns) {eng->stats.eval_max_ns = dt;}
+    g_mutex_unlock(&eng->lock);
+}
+
+void alarm_engine_tick(alarm_engine *eng, gint64 now)
+{
+    g_mutex_lock(&eng->lock);
+    run_delays(eng, now);
+    update_output(eng);
+    g_mutex_unlock(&eng->lock);
+}
+
+static void ack_rule(alarm_engine *eng, guint rule, gint64 ts_ns)
+{
+    alarm_entry *r = &eng->rules[rule];
+
+    if (r->state == ALARM_ACTIVE) {
+        set_state(eng, r, ALARM_ACKED);
+        emit(eng, rule, ALARM_ACK, ts_ns);
+    }
+    else if (r->state == ALARM_RETURNED) {
+        set_state(eng, r, ALARM_NORMAL);
+        emit(eng, rule, ALARM_CLEARED, ts_ns);
+    }
+}
+
+void alarm_engine_ack(alarm_engine *eng, guint rule, gint64 ts_ns)
+{
+    g_mutex_lock(&eng->lock);
+    if (eng->compiled && rule < eng->n_rules) {ack_rule(eng, rule, ts_ns);}
+    update_output(eng);
+    g_mutex_unlock(&eng->lock);
+}
+
+void alarm_engine_ack_all(alarm_engine *eng, gint64 ts_ns)
+{
+    g_mutex_lock(&eng->lock);
+    for (guint i = 0; eng->compiled && i < eng->n_rules; i++) {ack_rule(eng, i, ts_ns);}
+    update_output(eng);
+    g_mutex_unlock(&eng->lock);
+}
+
+gboolean alarm_engine_next_event(alarm_engine *eng, alarm_event *ev)
+{
+    gboolean found = FALSE;
+
+    g_mutex_lock(&eng->lock);
+    if (eng->n_events > 0) {
+        *ev = eng->events[0].ev;
+        eng->events[0] = eng->events[--eng->n_events];
+        event_sift_down(eng, 0);
+        found = TRUE;
+    }
+    g_mutex_unlock(&eng->lock);
+    return found;
+}
+
+alarm_state alarm_engine_get_state(alarm_engine *eng, guint rule)
+{
+    alarm_state st = ALARM_NORMAL;
+
+    g_mutex_lock(&eng->lock);
+    if (rule < eng->n_rules) {st = eng->rules[rule].state;}
+    g_mutex_unlock(&eng->lock);
+    return st;
+}
+
+guint alarm_engine_signal_alarms(alarm_engine *eng, gint signal)
+{
+    guint n = 0;
+
+    g_mutex_lock(&eng->lock);
+    if (signal >= 0 && (guint)signal < eng->n_signals) {n = eng->signals[signal].alarms;}
+    g_mutex_unlock(&eng->lock);
+    return n;
+}
+
+gdouble alarm_engine_signal_margin(alarm_engine *eng, gint signal, gdouble value, gint *direction)
+{
+    gdouble margin = G_MAXDOUBLE, below;
+    gint dir = 0;
+
+    g_mutex_lock(&eng->lock);
+    if (eng->compiled && signal >= 0 && (guint)signal < eng->n_signals) {
+        alarm_signal *s = &eng->signals[signal];
+        //the lowest start edge of a value track is the limit reached first
+        if (s->tracks[TRACK_VALUE].n) {
+            margin = eng->edges[s->tracks[TRACK_VALUE].start].key - value;
+            dir = 1;
+        }
+        if (s->tracks[TRACK_NEG_VALUE].n) {
+            below = eng->edges[s->tracks[TRACK_NEG_VALUE].start].key + value;
+            if (below < margin) {
+                margin = below;
+                dir = -1;
+            }
+        }
+    }
+    g_mutex_unlock(&eng->lock);
+    if (direction) {*direction = dir;}
+    return margin;
+}
+
+guint alarm_engine_n_rules(alarm_engine *eng) {return eng->n_rules;}
+
+void alarm_engine_get_stats(alarm_engine *eng, alarm_stats *stats)
+{
+    g_mutex_lock(&eng->lock);
+    *stats = eng->stats;
+    g_mutex_unlock(&eng->lock);
+}
+
+void alarm_engine_print_stats(alarm_engine *eng)
+{
+    alarm_stats st;
+
+    alarm_engine_get_stats(eng, &st);
+    printf("Alarms: %u rules on %u signals, %llu samples, %llu events (%llu dropped)\n",
+           eng->n_rules, eng->n_signals, (unsigned long long)st.samples,
+           (unsigned long long)st.events, (unsigned long long)st.dropped);
+    if (st.samples == 0) {return;}
+    printf("Alarms: %.2f rules visited and %.0f ns per sample, worst %.1f us\n",
+           (double)st.visited / st.samples, (double)st.eval_ns / st.samples,
+           (double)st.eval_max_ns / NSEC_PER_USEC);
+}
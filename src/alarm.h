@@ -0,0 +1,125 @@
+/**************************************************
+ * Alarm rule engine
+ * Rules watch a named signal for a limit or a rate of
+ * change, with a deadband the value has to come back
+ * through before the condition ends, a time it has to
+ * hold before the alarm is raised, and optional latching
+ * until acknowledged. The rule set is compiled once into
+ * flat tables sorted by limit, so a new sample only
+ * visits the rules whose limit it crossed, not every
+ * rule of the signal. Raised, cleared and acknowledged
+ * alarms come out as events, most urgent first, and an
+ * actuator channel can follow the unacknowledged alarms
+ * directly from the evaluating thread.
+ * Rules can be added from code or from a key file:
+ *
+ *   [alarm temp_high]
+ *   signal=temperature
+ *   when=above          (above, below, rising or falling)
+ *   limit=28            (rising and falling: units per minute)
+ *   deadband=0.5
+ *   delay_ms=60000
+ *   latch=false
+ *   priority=2          (1 is the least urgent)
+ *
+ * All functions can be called from any thread.
+ * ************************************************/
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <glib.h>
+#include "actuator.h"
+
+#define ALARM_MAX_EVENTS 64
+
+typedef enum {
+    ALARM_ABOVE,
+    ALARM_BELOW,
+    ALARM_RISING,       //rate of change above limit
+    ALARM_FALLING       //rate of change below -limit
+} alarm_kind;
+
+typedef struct {
+    const gchar *name;
+    const gchar *signal;
+    alarm_kind kind;
+    gdouble limit;
+    gdouble deadband;   //the condition ends only this far back inside the limit
+    guint delay_ms;     //the condition must hold this long before the alarm is raised
+    gboolean latch;     //stays up after the condition ends, until acknowledged
+    guint priority;
+} alarm_rule;
+
+typedef enum {
+    ALARM_NORMAL,
+    ALARM_ACTIVE,       //condition present, not acknowledged
+    ALARM_ACKED,        //condition present, acknowledged
+    ALARM_RETURNED      //latched, condition gone, not acknowledged
+} alarm_state;
+
+typedef enum {
+    ALARM_RAISED,
+    ALARM_CLEARED,
+    ALARM_ACK
+} alarm_event_kind;
+
+typedef struct {
+    guint rule;
+    const gchar *name;  //owned by the engine
+    guint priority;
+    alarm_event_kind kind;
+    gdouble value;      //signal value or rate when it happened
+    gint64 ts_ns;
+} alarm_event;
+
+typedef struct {
+    guint64 samples;
+    guint64 visited;        //rules looked at by the samples
+    guint64 events;
+    guint64 dropped;        //events lost to a full queue
+    gint64 eval_ns;
+    gint64 eval_max_ns;
+} alarm_stats;
+
+typedef struct alarm_engine alarm_engine;
+
+//rates are smoothed over rate_window_ms
+alarm_engine *alarm_engine_new(guint rate_window_ms);
+void alarm_engine_free(alarm_engine *eng);
+
+//rules are copied; only before alarm_engine_compile(), 0 on success
+int alarm_engine_add_rules(alarm_engine *eng, const alarm_rule *rules, guint n);
+//add the rules of a key file, returns the number added or -1 if it cannot be read
+int alarm_engine_load(alarm_engine *eng, const gchar *file);
+//build the lookup tables, samples are ignored until then
+void alarm_engine_compile(alarm_engine *eng);
+
+//drive channel on while an unacknowledged alarm of at least min_priority is up
+void alarm_engine_set_output(alarm_engine *eng, actuator *act, gint channel, guint min_priority);
+
+//signal id, -1 if no rule uses the signal
+gint alarm_engine_find_signal(alarm_engine *eng, const gchar *name);
+//new sample of a signal, a no-op for signal -1
+void alarm_engine_update(alarm_engine *eng, gint signal, gdouble value, gint64 ts_ns);
+//raise the alarms whose delay ran out by now, for signals that went quiet
+void alarm_engine_tick(alarm_engine *eng, gint64 now);
+
+void alarm_engine_ack(alarm_engine *eng, guint rule, gint64 ts_ns);
+void alarm_engine_ack_all(alarm_engine *eng, gint64 ts_ns);
+
+//most urgent pending event, oldest first within a priority; FALSE if there is none
+gboolean alarm_engine_next_event(alarm_engine *eng, alarm_event *ev);
+alarm_state alarm_engine_get_state(alarm_engine *eng, guint rule);
+//rules of the signal that are not normal
+guint alarm_engine_signal_alarms(alarm_engine *eng, gint signal);
+//how far value is from the nearest above or below limit of the signal,
+//negative by how far it is past one and G_MAXDOUBLE when the signal has no
+//limits; direction (may be NULL) is set to 1 when that limit is an above limit,
+//-1 when a below limit and 0 without limits
+gdouble alarm_engine_signal_margin(alarm_engine *eng, gint signal, gdouble value, gint *direction);
+guint alarm_engine_n_rules(alarm_engine *eng);
+
+void alarm_engine_get_stats(alarm_engine *eng, alarm_stats *stats);
+void alarm_engine_print_stats(alarm_engine *eng);
+
+#endif
@@ -0,0 +1,189 @@
+/**************************************************
+ * Capture of raw device traffic, see capture.h
+ * Records are small and come at most a few thousand a
+ * second, so writes go through a stdio buffer under a
+ * mutex; the buffer reaches the file when it fills and
+ * when the capture is closed.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "capture.h"
+#include "monotime.h"
+
+#define CAPTURE_MAGIC 0x5041434D   //"MCAP"
+#define CAPTURE_BUFFER (64 * 1024)
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 record_header;  //size of the fixed part of a record
+    guint32 reserved;
+    gint64 start_real_ns;   //when the capture was made, for the user
+} capture_header;
+
+//the fixed part of capture_record as it is stored
+#define RECORD_HEADER G_STRUCT_OFFSET(capture_record, data)
+
+struct capture {
+    FILE *f;
+    gchar *file;
+    gboolean writing;
+    gint64 start_ns;
+    GMutex lock;
+    capture_stats stats;
+};
+
+static capture *capture_alloc(FILE *f, const gchar *file, gboolean writing)
+{
+    capture *cap = g_new0(capture, 1);
+
+    cap->f = f;
+    cap->file = g_strdup(file);
+    cap->writing = writing;
+    g_mutex_init(&cap->lock);
+    return cap;
+}
+
+capture *capture_create(const gchar *file)
+{
+    capture_header head;
+    capture *cap;
+    FILE *f = fopen(file, "wb");
+
+    if (f == NULL) {
+        printf("Error: cannot create capture %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, CAPTURE_BUFFER);
+    memset(&head, 0, sizeof(head));
+    head.magic = CAPTURE_MAGIC;
+    head.version = CAPTURE_VERSION;
+    head.record_header = RECORD_HEADER;
+    head.start_real_ns = real_ns();
+    if (fwrite(&head, sizeof(head), 1, f) != 1) {
+        printf("Error: cannot write capture %s: %s\n", file, strerror(errno));
+        fclose(f);
+        return NULL;
+    }
+    cap = capture_alloc(f, file, TRUE);
+    cap->start_ns = mono_ns();
+    return cap;
+}
+
+capture *capture_open(const gchar *file)
+{
+    capture_header head;
+    FILE *f = fopen(file, "rb");
+
+    if (f == NULL) {
+        printf("Error: cannot open capture %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+    if (fread(&head, sizeof(head), 1, f) != 1 || head.magic != CAPTURE_MAGIC
+        || head.version != CAPTURE_VERSION || head.record_header != RECORD_HEADER) {
+        printf("Error: %s is not a version %d capture\n", file, CAPTURE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, CAPTURE_BUFFER);
+    return capture_alloc(f, file, FALSE);
+}
+
+void capture_close(capture *cap)
+{
+    if (cap == NULL) {return;}
+    if (fclose(cap->f) != 0 && cap->writing) {
+        printf("Error: capture %s is incomplete: %s\n", cap->file, strerror(errno));
+    }
+    g_mutex_clear(&cap->lock);
+    g_free(cap->file);
+    g_free(cap);
+}
+
+//write one record, the caller holds the lock
+static void capture_put(capture *cap, capture_record *rec)
+{
+    if (cap->stats.errors > 0) {return;}
+    if (fwrite(rec, RECORD_HEADER + rec->len, 1, cap->f) != 1) {
+        printf("Error: capture %s stopped: %s\n", cap->file, strerror(errno));
+        cap->stats.errors++;
+        return;
+    }
+    cap->stats.records++;
+    cap->stats.kind_records[rec->kind]++;
+    cap->stats.bytes += RECORD_HEADER + rec->len;
+    cap->stats.span_ns = MAX(cap->stats.span_ns, rec->ts_ns);
+}
+
+void capture_write(capture *cap, capture_kind kind, guint source, gint64 ts_ns, const guint8 *data, guint len)
+{
+    capture_record rec;
+
+    if (cap == NULL || len > CAPTURE_MAX_DATA) {return;}
+    rec.kind = kind;
+    rec.source = source;
+    rec.split = 0;
+    rec.reserved = 0;
+    rec.len = len;
+    memcpy(rec.data, data, len);
+    g_mutex_lock(&cap->lock);
+    rec.ts_ns = ts_ns - cap->start_ns;
+    capture_put(cap, &rec);
+    g_mutex_unlock(&cap->lock);
+}
+
+void capture_write_frames(capture *cap, guint source, gint64 ts_ns, const guint8 *req, guint req_len,
+                          const guint8 *rsp, guint rsp_len)
+{
+    capture_record rec;
+
+    if (cap == NULL || req_len > G_MAXUINT8 || req_len + rsp_len > CAPTURE_MAX_DATA) {return;}
+    rec.kind = CAPTURE_MODBUS;
+    rec.source = source;
+    rec.split = req_len;
+    rec.reserved = 0;
+    rec.len = req_len + rsp_len;
+    memcpy(rec.data, req, req_len);
+    memcpy(rec.data + req_len, rsp, rsp_len);
+    g_mutex_lock(&cap->lock);
+    rec.ts_ns = ts_ns - cap->start_ns;
+    capture_put(cap, &rec);
+    g_mutex_unlock(&cap->lock);
+}
+
+gboolean capture_read(capture *cap, capture_record *rec)
+{
+    if (cap->writing) {return FALSE;}
+    if (fread(rec, RECORD_HEADER, 1, cap->f) != 1) {return FALSE;}
+    //a record that does not make sense ends the capture like a short one
+    if (rec->kind == 0 || rec->kind >= CAPTURE_KINDS || rec->len > CAPTURE_MAX_DATA || rec->split > rec->len) {
+        cap->stats.errors++;
+        return FALSE;
+    }
+    if (rec->len > 0 && fread(rec->data, rec->len, 1, cap->f) != 1) {return FALSE;}
+    cap->stats.records++;
+    cap->stats.kind_records[rec->kind]++;
+    cap->stats.bytes += RECORD_HEADER + rec->len;
+    cap->stats.span_ns = MAX(cap->stats.span_ns, rec->ts_ns);
+    return TRUE;
+}
+
+void capture_get_stats(capture *cap, capture_stats *stats)
+{
+    g_mutex_lock(&cap->lock);
+    *stats = cap->stats;
+    g_mutex_unlock(&cap->lock);
+}
+
+void capture_print_stats(capture *cap)
+{
+    capture_stats st;
+
+    capture_get_stats(cap, &st);
+    printf("Capture %s: %llu records (%llu Modbus, %llu ADC, %llu GPIO), %.1f KiB over %.1f s%s\n",
+           cap->file, (unsigned long long)st.records, (unsigned long long)st.kind_records[CAPTURE_MODBUS],
+           (unsigned long long)st.kind_records[CAPTURE_ADC], (unsigned long long)st.kind_records[CAPTURE_GPIO],
+           st.bytes / 1024.0, (double)st.span_ns / NSEC_PER_SEC, st.errors ? ", incomplete" : "");
+}
@@ -0,0 +1,69 @@
+/**************************************************
+ * Capture of raw device traffic
+ * A capture file holds what the acquisition drivers saw
+ * on the wire, time stamped in the order it happened:
+ * every Modbus transaction (request and response bytes,
+ * no response for a timeout), every ADS1115 conversion
+ * word and every raw GPIO edge before debouncing. The
+ * drivers write it while recording; replay.h feeds it
+ * back through the same decoding paths.
+ * The file is a header followed by variable length
+ * records in host byte order; a tail cut short by a
+ * crash is ignored by the reader.
+ * ************************************************/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <glib.h>
+
+#define CAPTURE_VERSION 1
+//largest payload, a Modbus request plus a full RTU response
+#define CAPTURE_MAX_DATA 272
+
+typedef enum {
+    CAPTURE_MODBUS = 1,     //source: bus index, data: request then response
+    CAPTURE_ADC,            //source: scan position, data: mux, conversion MSB, LSB
+    CAPTURE_GPIO,           //source: line index, data: level
+    CAPTURE_KINDS
+} capture_kind;
+
+typedef struct {
+    gint64 ts_ns;           //since the start of the capture
+    guint8 kind;
+    guint8 source;
+    guint8 split;           //Modbus: request length, the response follows
+    guint8 reserved;
+    guint16 len;
+    guint8 data[CAPTURE_MAX_DATA];
+} capture_record;
+
+typedef struct {
+    guint64 records;
+    guint64 kind_records[CAPTURE_KINDS];
+    guint64 bytes;
+    guint64 errors;         //write failures, the capture stops at the first
+    gint64 span_ns;         //time stamp of the last record
+} capture_stats;
+
+typedef struct capture capture;
+
+//create a capture file, NULL if it cannot be written
+capture *capture_create(const gchar *file);
+//open a capture file for reading, NULL if it is missing or not a capture
+capture *capture_open(const gchar *file);
+//flush and close either kind
+void capture_close(capture *cap);
+
+//append one record stamped ts_ns (CLOCK_MONOTONIC), safe from any thread;
+//a no-op for a NULL capture so drivers can call it unconditionally
+void capture_write(capture *cap, capture_kind kind, guint source, gint64 ts_ns, const guint8 *data, guint len);
+//one Modbus transaction, rsp_len 0 for a timeout
+void capture_write_frames(capture *cap, guint source, gint64 ts_ns, const guint8 *req, guint req_len,
+                          const guint8 *rsp, guint rsp_len);
+//next record of a capture opened for reading, FALSE at the end
+gboolean capture_read(capture *cap, capture_record *rec);
+
+void capture_get_stats(capture *cap, capture_stats *stats);
+void capture_print_stats(capture *cap);
+
+#endif
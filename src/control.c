@@ -0,0 +1,323 @@
+/**************************************************
+ * Closed-loop climate control, see control.h
+ * The PID uses derivative on measurement (no kick when
+ * the target changes) and conditional integration: the
+ * integrator stops while the output is saturated in the
+ * direction the error pushes, so it does not wind up
+ * while the heater is already at full power.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "control.h"
+#include "monotime.h"
+
+typedef struct {
+    pid_gains g;
+    gdouble integral;   //already multiplied by ki
+    gdouble prev_meas;
+    gdouble out;
+    gboolean primed;
+} pid_state;
+
+typedef struct {
+    gboolean on;
+    gint64 changed_ns;
+} relay_state;
+
+//first order rooms: heat input against losses to the ambient
+typedef struct {
+    gdouble temp;
+    gdouble humid;
+    gint64 next_sample;
+    guint64 seq;
+} thermal_plant;
+
+struct control {
+    control_config cfg;
+    control_outputs out;
+    snapshot_cell *climate;
+    actuator *act;
+    //targets in 0.01 units, 0 until set
+    volatile gint target_temp;
+    volatile gint target_humid;
+    volatile gint stop;
+    GThread *thread;
+
+    //loop state, only touched by the control thread
+    pid_state heater;
+    guint last_duty;
+    gint64 next_window;
+    relay_state fan;
+    relay_state humidifier;
+    gboolean outputs_on;
+    gboolean simulate;
+    thermal_plant plant;
+    control_plant_func plant_func;
+    gpointer plant_data;
+
+    snapshot_cell status;
+    GMutex lock;
+    control_stats stats;
+};
+
+static gdouble pid_step(pid_state *p, gdouble target, gdouble meas, gdouble dt)
+{
+    gdouble err = target - meas;
+    gdouble deriv = p->primed ? -(meas - p->prev_meas) / dt : 0.0;
+    gdouble step = p->g.ki * err * dt;
+    gdouble unsat = p->g.kp * err + p->integral + step + p->g.kd * deriv;
+    gdouble out;
+
+    if ((unsat < p->g.out_max || err < 0) && (unsat > p->g.out_min || err > 0)) {p->integral += step;}
+    p->integral = CLAMP(p->integral, p->g.out_min, p->g.out_max);
+    out = CLAMP(p->g.kp * err + p->integral + p->g.kd * deriv, p->g.out_min, p->g.out_max);
+    //slew limit, the first output starts from the low end
+    if (p->g.rate_max > 0) {
+        gdouble max_step = p->g.rate_max * dt;
+        gdouble from = p->primed ? p->out : p->g.out_min;
+        out = CLAMP(out, from - max_step, from + max_step);
+    }
+    p->prev_meas = meas;
+    p->out = out;
+    p->primed = TRUE;
+    return out;
+}
+
+static void pid_reset(pid_state *p)
+{
+    p->integral = 0;
+    p->out = 0;
+    p->primed = FALSE;
+}
+
+//hysteresis with a minimum time between switches, returns TRUE when the relay changed
+static gboolean relay_update(relay_state *r, gboolean want_on, gboolean want_off, gint64 now, gint64 min_ns)
+{
+    gboolean next = r->on ? !want_off : want_on;
+
+    if (next == r->on || now - r->changed_ns < min_ns) {return FALSE;}
+    r->on = next;
+    r->changed_ns = now;
+    return TRUE;
+}
+
+static void control_outputs_off(control *ctl)
+{
+    if (ctl->out.heater >= 0) {actuator_set(ctl->act, ctl->out.heater, FALSE);}
+    if (ctl->out.fan >= 0) {actuator_set(ctl->act, ctl->out.fan, FALSE);}
+    if (ctl->out.humidifier >= 0) {actuator_set(ctl->act, ctl->out.humidifier, FALSE);}
+    pid_reset(&ctl->heater);
+    ctl->last_duty = 0;
+    ctl->next_window = 0;
+    ctl->fan.on = FALSE;
+    ctl->humidifier.on = FALSE;
+    ctl->outputs_on = FALSE;
+}
+
+//advance the simulated room by dt and emit a reading once per second like the sensor
+static void plant_step(control *ctl, gdouble dt, gint64 now)
+{
+    thermal_plant *p = &ctl->plant;
+    gdouble heat = ctl->heater.out * 0.05;                     //degC/s at full power
+    gdouble cool = (p->temp - 22.0) * 0.002;                   //losses to a 22 degC corridor
+    gdouble fan = ctl->fan.on ? (p->temp - 20.0) * 0.01 : 0;   //fresh air at 20 degC
+    gdouble wet = ctl->humidifier.on ? 0.2 : 0;                //%RH/s
+    gdouble dry = (p->humid - 40.0) * 0.003 + (ctl->fan.on ? (p->humid - 35.0) * 0.01 : 0);
+    climate_reading reading;
+
+    p->temp += (heat - cool - fan) * dt;
+    p->humid = CLAMP(p->humid + (wet - dry) * dt, 0.0, 100.0);
+    if (now < p->next_sample) {return;}
+    p->next_sample = now + NSEC_PER_SEC;
+    reading.temp = (guint16)CLAMP(p->temp * 100 + 0.5, 0, G_MAXUINT16);
+    reading.humid = (guint16)(p->humid * 100 + 0.5);
+    reading.seq = ++p->seq;
+    reading.ts_ns = now;
+    if (ctl->plant_func) {ctl->plant_func(&reading, ctl->plant_data);}
+}
+
+static void control_period(control *ctl, gint64 now, gdouble dt)
+{
+    const control_config *cfg = &ctl->cfg;
+    gint64 min_switch = (gint64)cfg->min_switch_ms * NSEC_PER_MSEC;
+    gint target_temp = g_atomic_int_get(&ctl->target_temp);
+    gint target_humid = g_atomic_int_get(&ctl->target_humid);
+    control_status status;
+    climate_reading reading;
+    gdouble temp, humid;
+    guint duty;
+
+    if (ctl->simulate) {plant_step(ctl, dt, now);}
+    memset(&status, 0, sizeof(status));
+    status.ts_ns = now;
+    //no targets yet, or nothing recent to act on: safe state
+    if (target_temp == 0 || climate_get(ctl->climate, &reading) == 0
+        || now - reading.ts_ns > (gint64)cfg->stale_ms * NSEC_PER_MSEC) {
+        if (ctl->outputs_on) {control_outputs_off(ctl);}
+        snapshot_write(&ctl->status, &status, sizeof(status));
+        return;
+    }
+    temp = reading.temp / 100.0;
+    humid = reading.humid / 100.0;
+    ctl->outputs_on = TRUE;
+
+    //a new duty restarts the PWM cycle, so it is only posted once per window
+    pid_step(&ctl->heater, target_temp / 100.0, temp, dt);
+    duty = (guint)(ctl->heater.out * 1000 + 0.5);
+    if (ctl->out.heater >= 0 && now >= ctl->next_window) {
+        if (duty != ctl->last_duty || ctl->next_window == 0) {
+            actuator_pwm(ctl->act, ctl->out.heater, (gint64)cfg->heater_pwm_ms * NSEC_PER_MSEC, duty);
+            ctl->last_duty = duty;
+        }
+        ctl->next_window = now + (gint64)cfg->heater_pwm_ms * NSEC_PER_MSEC;
+    }
+    if (relay_update(&ctl->fan, temp > target_temp / 100.0 + cfg->fan_band,
+                     temp <= target_temp / 100.0, now, min_switch) && ctl->out.fan >= 0) {
+        actuator_set(ctl->act, ctl->out.fan, ctl->fan.on);
+    }
+    if (relay_update(&ctl->humidifier, humid < target_humid / 100.0 - cfg->humid_band,
+                     humid >= target_humid / 100.0, now, min_switch) && ctl->out.humidifier >= 0) {
+        actuator_set(ctl->act, ctl->out.humidifier, ctl->humidifier.on);
+    }
+    status.temp = temp;
+    status.humid = humid;
+    status.heater = ctl->heater.out;
+    status.fan = ctl->fan.on;
+    status.humidifier = ctl->humidifier.on;
+    status.active = TRUE;
+    snapshot_write(&ctl->status, &status, sizeof(status));
+}
+
+static void control_record(control *ctl, gint64 late)
+{
+    guint bucket = 0;
+    gint64 us = late / NSEC_PER_USEC;
+
+    while (us > 0 && bucket < CONTROL_HIST_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    g_mutex_lock(&ctl->lock);
+    ctl->stats.periods++;
+    ctl->stats.hist[bucket]++;
+    ctl->stats.late_max_ns = MAX(ctl->stats.late_max_ns, late);
+    if (late > (gint64)ctl->cfg.max_late_us * NSEC_PER_USEC) {ctl->stats.misses++;}
+    g_mutex_unlock(&ctl->lock);
+}
+
+static gpointer control_thread(gpointer data)
+{
+    control *ctl = data;
+    gint64 period = (gint64)ctl->cfg.period_ms * NSEC_PER_MSEC;
+    gint64 deadline = mono_ns();
+
+    if (ctl->cfg.priority > 0) {
+        struct sched_param param;
+        param.sched_priority = ctl->cfg.priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            printf("Error: control loop runs without real-time priority\n");
+        }
+    }
+    while (!g_atomic_int_get(&ctl->stop)) {
+        gint64 now;
+
+        deadline += period;
+        sleep_until_ns(deadline);
+        now = mono_ns();
+        control_record(ctl, now - deadline);
+        //an overrun skips the lost periods instead of running them back to back
+        if (now - deadline >= period) {deadline = now - (now - deadline) % period;}
+        control_period(ctl, now, period / (gdouble)NSEC_PER_SEC);
+    }
+    control_outputs_off(ctl);
+    return NULL;
+}
+
+static control *control_create(const control_config *cfg, snapshot_cell *climate,
+                               actuator *act, const control_outputs *out)
+{
+    control *ctl;
+
+    if (cfg->period_ms == 0) {return NULL;}
+    ctl = g_new0(control, 1);
+    ctl->cfg = *cfg;
+    ctl->out = *out;
+    ctl->climate = climate;
+    ctl->act = act;
+    ctl->heater.g = cfg->heater;
+    snapshot_init(&ctl->status);
+    g_mutex_init(&ctl->lock);
+    return ctl;
+}
+
+control *control_start(const control_config *cfg, snapshot_cell *climate,
+                       actuator *act, const control_outputs *out)
+{
+    control *ctl = control_create(cfg, climate, act, out);
+
+    if (ctl == NULL) {return NULL;}
+    ctl->thread = g_thread_new("control", control_thread, ctl);
+    return ctl;
+}
+
+control *control_start_sim(const control_config *cfg, snapshot_cell *climate,
+                           actuator *act, const control_outputs *out,
+                           control_plant_func plant_func, gpointer user_data)
+{
+    control *ctl = control_create(cfg, climate, act, out);
+
+    if (ctl == NULL) {return NULL;}
+    ctl->simulate = TRUE;
+    ctl->plant.temp = 22.0;
+    ctl->plant.humid = 40.0;
+    ctl->plant_func = plant_func;
+    ctl->plant_data = user_data;
+    ctl->thread = g_thread_new("control", control_thread, ctl);
+    return ctl;
+}
+
+void control_stop(control *ctl)
+{
+    if (ctl == NULL) {return;}
+    g_atomic_int_set(&ctl->stop, 1);
+    //at most one period
+    g_thread_join(ctl->thread);
+    g_mutex_clear(&ctl->lock);
+    g_free(ctl);
+}
+
+void control_set_target(control *ctl, gdouble temp, gdouble humid)
+{
+    g_atomic_int_set(&ctl->target_humid, (gint)(humid * 100 + 0.5));
+    g_atomic_int_set(&ctl->target_temp, (gint)(temp * 100 + 0.5));
+}
+
+guint32 control_get_status(control *ctl, control_status *status)
+{
+    return snapshot_read(&ctl->status, status, sizeof(*status));
+}
+
+void control_get_stats(control *ctl, control_stats *stats)
+{
+    g_mutex_lock(&ctl->lock);
+    *stats = ctl->stats;
+    g_mutex_unlock(&ctl->lock);
+}
+
+void control_print_stats(control *ctl)
+{
+    control_stats st;
+
+    control_get_stats(ctl, &st);
+    printf("Control: %llu periods, %llu deadline misses (> %u us late), worst %.1f us late\n",
+           (unsigned long long)st.periods, (unsigned long long)st.misses,
+           ctl->cfg.max_late_us, (double)st.late_max_ns / NSEC_PER_USEC);
+    for (guint b = 0; b < CONTROL_HIST_BUCKETS; b++) {
+        if (st.hist[b] == 0) {continue;}
+        printf("Control:   < %8u us late: %llu\n", 1u << b, (unsigned long long)st.hist[b]);
+    }
+}
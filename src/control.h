@@ -0,0 +1,97 @@
+/**************************************************
+ * Closed-loop climate control
+ * A SCHED_FIFO thread wakes up on absolute deadlines
+ * (clock_nanosleep, CLOCK_MONOTONIC) at a fixed period,
+ * reads the latest climate snapshot and drives:
+ * - the heater from a PID loop, as time-proportioned PWM
+ *   on the actuator, with anti-windup and a slew limit,
+ * - the fan and humidifier from hysteresis loops with a
+ *   minimum time between relay switches.
+ * A reading older than the stale limit turns everything
+ * off. The GUI thread never runs control code; it only
+ * sets targets and reads the published status.
+ * For testing without a sensor the thread can advance a
+ * simulated thermal plant from its own outputs and feed
+ * the readings back like the sensor would.
+ * ************************************************/
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <glib.h>
+#include "snapshot.h"
+#include "actuator.h"
+
+#define CONTROL_HIST_BUCKETS 24
+
+typedef struct {
+    gdouble kp;
+    gdouble ki;         //per second
+    gdouble kd;         //seconds
+    gdouble out_min;
+    gdouble out_max;
+    gdouble rate_max;   //largest output change per second
+} pid_gains;
+
+typedef struct {
+    guint period_ms;
+    int priority;           //SCHED_FIFO priority, 0 keeps the normal scheduler
+    guint max_late_us;      //a wakeup later than this counts as a deadline miss
+    guint stale_ms;         //older readings turn the outputs off
+    pid_gains heater;       //output is the heater duty 0..1
+    guint heater_pwm_ms;    //time proportioning window of the heater relay
+    gdouble fan_band;       //degC above target where the fan starts
+    gdouble humid_band;     //%RH below target where the humidifier starts
+    guint min_switch_ms;    //shortest on or off time of the fan and humidifier relays
+} control_config;
+
+//actuator channels, -1 for an output that is not fitted
+typedef struct {
+    gint heater;
+    gint fan;
+    gint humidifier;
+} control_outputs;
+
+//published once per period
+typedef struct {
+    gfloat temp;
+    gfloat humid;
+    gfloat heater;      //duty 0..1
+    gboolean fan;
+    gboolean humidifier;
+    gboolean active;    //targets set and a fresh reading available
+    gint64 ts_ns;
+} control_status;
+
+typedef struct {
+    guint64 periods;
+    guint64 misses;
+    gint64 late_max_ns;
+    //wakeup lateness, bucket i counts [2^(i-1), 2^i) us, bucket 0 is < 1 us
+    guint64 hist[CONTROL_HIST_BUCKETS];
+} control_stats;
+
+typedef struct control control;
+
+//called from the control thread with every simulated reading
+typedef void (*control_plant_func)(const climate_reading *reading, gpointer user_data);
+
+//run against the readings published in climate
+control *control_start(const control_config *cfg, snapshot_cell *climate,
+                       actuator *act, const control_outputs *out);
+//run against a simulated plant, plant_func is expected to publish into climate
+control *control_start_sim(const control_config *cfg, snapshot_cell *climate,
+                           actuator *act, const control_outputs *out,
+                           control_plant_func plant_func, gpointer user_data);
+//turn the outputs off and join the thread
+void control_stop(control *ctl);
+
+//targets from the setup page, safe to call from any thread; control starts with the first call
+void control_set_target(control *ctl, gdouble temp, gdouble humid);
+//0 until the first period has run
+guint32 control_get_status(control *ctl, control_status *status);
+
+void control_get_stats(control *ctl, control_stats *stats);
+//print the deadline misses and the lateness histogram
+void control_print_stats(control *ctl);
+
+#endif
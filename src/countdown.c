@@ -0,0 +1,315 @@
+/**************************************************
+ * Countdown and stopwatch timers, see countdown.h
+ * A timer only stores where it is anchored, the value
+ * shown is always computed from the monotonic clock, so a
+ * wakeup that comes late delays a label by that much but
+ * is never added up into the next second.
+ * ************************************************/
+#include <stdio.h>
+
+#include "countdown.h"
+#include "monotime.h"
+
+typedef struct {
+    gchar *name;
+    countdown_mode mode;
+    countdown_state state;
+    gint64 duration_ns;
+    gint64 anchor_ns;   //running: monotonic deadline (down) or origin (up)
+    gint64 held_ns;     //not running: remaining (down) or elapsed (up)
+    gint64 shown;       //seconds last reported, -1 forces a report
+    countdown_state shown_state;
+    countdown_func func;
+    gpointer user;
+} countdown_timer;
+
+struct countdown_engine {
+    gchar *state_file;
+    GKeyFile *keys;
+    countdown_timer timers[COUNTDOWN_MAX_TIMERS];
+    guint n_timers;
+    const countdown_clock *clock;
+    gpointer clock_user;
+    guint tick_id;
+    gint64 next_ns;     //instant the pending wakeup was armed for
+    countdown_stats stats;
+};
+
+static gint64 engine_now(countdown_engine *eng)
+{
+    return eng->clock->now(eng->clock_user);
+}
+
+static gint64 timer_value(countdown_timer *t, gint64 now)
+{
+    if (t->state != COUNTDOWN_RUNNING) {return t->held_ns;}
+    if (t->mode == COUNTDOWN_UP) {return now - t->anchor_ns;}
+    return MAX(t->anchor_ns - now, 0);
+}
+
+//whole seconds on display, a countdown shows 00:00:01 until it is really over
+static gint64 timer_seconds(countdown_timer *t, gint64 value)
+{
+    if (t->mode == COUNTDOWN_UP) {return value / NSEC_PER_SEC;}
+    return (value + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+//monotonic instant the displayed seconds of a running timer change next
+static gint64 timer_next_change(countdown_timer *t, gint64 now)
+{
+    gint64 value = timer_value(t, now);
+
+    if (t->mode == COUNTDOWN_UP) {
+        return t->anchor_ns + (value / NSEC_PER_SEC + 1) * NSEC_PER_SEC;
+    }
+    return t->anchor_ns - (timer_seconds(t, value) - 1) * NSEC_PER_SEC;
+}
+
+static void engine_save(countdown_engine *eng)
+{
+    //running timers are stored against the wall clock, the monotonic clock restarts with the system
+    gint64 offset = real_ns() - engine_now(eng);
+    GError *error = NULL;
+
+    if (eng->state_file == NULL) {return;}
+    for (guint i = 0; i < eng->n_timers; i++) {
+        countdown_timer *t = &eng->timers[i];
+        g_key_file_set_integer(eng->keys, t->name, "mode", t->mode);
+        g_key_file_set_integer(eng->keys, t->name, "state", t->state);
+        g_key_file_set_int64(eng->keys, t->name, "duration_ns", t->duration_ns);
+        g_key_file_set_int64(eng->keys, t->name, "held_ns", t->held_ns);
+        g_key_file_set_int64(eng->keys, t->name, "anchor_real_ns",
+                             (t->state == COUNTDOWN_RUNNING) ? t->anchor_ns + offset : 0);
+    }
+    //written to a temporary file and renamed, a crash leaves the old or the new state
+    if (!g_key_file_save_to_file(eng->keys, eng->state_file, &error)) {
+        printf("Error: cannot save timers to %s: %s\n", eng->state_file, error->message);
+        g_error_free(error);
+    }
+}
+
+static void engine_load(countdown_engine *eng, countdown_timer *t)
+{
+    gint64 offset = real_ns() - engine_now(eng);
+
+    if (!g_key_file_has_group(eng->keys, t->name)) {return;}
+    if (g_key_file_get_integer(eng->keys, t->name, "mode", NULL) != (gint)t->mode) {return;}
+    t->state = g_key_file_get_integer(eng->keys, t->name, "state", NULL);
+    if (t->state > COUNTDOWN_EXPIRED) {t->state = COUNTDOWN_IDLE;}
+    t->duration_ns = g_key_file_get_int64(eng->keys, t->name, "duration_ns", NULL);
+    t->held_ns = g_key_file_get_int64(eng->keys, t->name, "held_ns", NULL);
+    t->anchor_ns = g_key_file_get_int64(eng->keys, t->name, "anchor_real_ns", NULL) - offset;
+}
+
+static void timer_report(countdown_engine *eng, guint id, gint64 now)
+{
+    countdown_timer *t = &eng->timers[id];
+    gint64 seconds = timer_seconds(t, timer_value(t, now));
+
+    if (seconds == t->shown && t->state == t->shown_state) {return;}
+    t->shown = seconds;
+    t->shown_state = t->state;
+    eng->stats.reports++;
+    if (t->func) {t->func(eng, id, seconds, t->state, t->user);}
+}
+
+//expire what is due, report what changed and arm the tick for the next change
+static void engine_update(countdown_engine *eng, gint64 now)
+{
+    gboolean expired = FALSE;
+    gint64 next = G_MAXINT64;
+
+    for (guint i = 0; i < eng->n_timers; i++) {
+        countdown_timer *t = &eng->timers[i];
+        if (t->state == COUNTDOWN_RUNNING && t->mode == COUNTDOWN_DOWN && now >= t->anchor_ns) {
+            t->state = COUNTDOWN_EXPIRED;
+            t->held_ns = 0;
+            expired = TRUE;
+        }
+    }
+    if (expired) {engine_save(eng);}
+    for (guint i = 0; i < eng->n_timers; i++) {timer_report(eng, i, now);}
+    for (guint i = 0; i < eng->n_timers; i++) {
+        if (eng->timers[i].state == COUNTDOWN_RUNNING) {next = MIN(next, timer_next_change(&eng->timers[i], now));}
+    }
+
+    eng->next_ns = next;
+    eng->clock->arm(eng, next, eng->clock_user);
+}
+
+void countdown_wakeup(countdown_engine *eng)
+{
+    gint64 now = engine_now(eng);
+
+    eng->stats.wakeups++;
+    eng->stats.max_late_ns = MAX(eng->stats.max_late_ns, now - eng->next_ns);
+    engine_update(eng, now);
+}
+
+/************** default clock **********/
+static gint64 mono_clock_now(gpointer user)
+{
+    return mono_ns();
+}
+
+static gboolean mono_clock_tick(countdown_engine *eng)
+{
+    eng->tick_id = 0;
+    countdown_wakeup(eng);
+    return G_SOURCE_REMOVE;
+}
+
+static void mono_clock_arm(countdown_engine *eng, gint64 deadline, gpointer user)
+{
+    gint64 delay;
+
+    if (eng->tick_id) {
+        g_source_remove(eng->tick_id);
+        eng->tick_id = 0;
+    }
+    if (deadline == G_MAXINT64) {return;}
+    delay = deadline - mono_ns();
+    if (delay < 0) {delay = 0;}
+    //GLib never fires a timeout early, rounding up keeps the wakeup at or after the deadline
+    eng->tick_id = g_timeout_add((delay + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC, (GSourceFunc)mono_clock_tick, eng);
+}
+
+static const countdown_clock mono_clock = {
+    mono_clock_now, mono_clock_arm
+};
+
+countdown_engine *countdown_engine_new(const gchar *state_file)
+{
+    countdown_engine *eng = g_new0(countdown_engine, 1);
+
+    eng->clock = &mono_clock;
+    eng->keys = g_key_file_new();
+    if (state_file) {
+        eng->state_file = g_strdup(state_file);
+        //a missing file just means nothing was saved yet
+        g_key_file_load_from_file(eng->keys, state_file, G_KEY_FILE_NONE, NULL);
+    }
+    return eng;
+}
+
+void countdown_engine_free(countdown_engine *eng)
+{
+    if (eng == NULL) {return;}
+    eng->clock->arm(eng, G_MAXINT64, eng->clock_user);
+    for (guint i = 0; i < eng->n_timers; i++) {g_free(eng->timers[i].name);}
+    g_key_file_free(eng->keys);
+    g_free(eng->state_file);
+    g_free(eng);
+}
+
+void countdown_engine_set_clock(countdown_engine *eng, const countdown_clock *clock, gpointer user)
+{
+    g_assert(eng->n_timers == 0);
+    eng->clock = clock;
+    eng->clock_user = user;
+}
+
+guint countdown_add(countdown_engine *eng, const gchar *name, countdown_mode mode,
+                    countdown_func func, gpointer user)
+{
+    countdown_timer *t;
+
+    g_assert(eng->n_timers < COUNTDOWN_MAX_TIMERS);
+    t = &eng->timers[eng->n_timers];
+    t->name = g_strdup(name);
+    t->mode = mode;
+    t->state = COUNTDOWN_IDLE;
+    t->shown = -1;
+    t->func = func;
+    t->user = user;
+    engine_load(eng, t);
+    eng->n_timers++;
+    engine_update(eng, engine_now(eng));
+    return eng->n_timers - 1;
+}
+
+static void timer_changed(countdown_engine *eng)
+{
+    engine_save(eng);
+    engine_update(eng, engine_now(eng));
+}
+
+void countdown_set(countdown_engine *eng, guint id, gint64 duration_ns)
+{
+    countdown_timer *t = &eng->timers[id];
+
+    if (t->mode != COUNTDOWN_DOWN) {return;}
+    t->duration_ns = MAX(duration_ns, 0);
+    t->held_ns = t->duration_ns;
+    t->state = COUNTDOWN_IDLE;
+    timer_changed(eng);
+}
+
+void countdown_start(countdown_engine *eng, guint id)
+{
+    countdown_timer *t = &eng->timers[id];
+    gint64 now = engine_now(eng);
+
+    if (t->state != COUNTDOWN_IDLE && t->state != COUNTDOWN_EXPIRED) {return;}
+    if (t->mode == COUNTDOWN_DOWN) {
+        if (t->duration_ns <= 0) {return;}
+        t->anchor_ns = now + t->duration_ns;
+    } else {
+        t->anchor_ns = now;
+    }
+    t->state = COUNTDOWN_RUNNING;
+    timer_changed(eng);
+}
+
+void countdown_pause(countdown_engine *eng, guint id)
+{
+    countdown_timer *t = &eng->timers[id];
+
+    if (t->state != COUNTDOWN_RUNNING) {return;}
+    t->held_ns = timer_value(t, engine_now(eng));
+    t->state = COUNTDOWN_PAUSED;
+    timer_changed(eng);
+}
+
+void countdown_resume(countdown_engine *eng, guint id)
+{
+    countdown_timer *t = &eng->timers[id];
+    gint64 now = engine_now(eng);
+
+    if (t->state != COUNTDOWN_PAUSED) {return;}
+    t->anchor_ns = (t->mode == COUNTDOWN_DOWN) ? now + t->held_ns : now - t->held_ns;
+    t->state = COUNTDOWN_RUNNING;
+    timer_changed(eng);
+}
+
+void countdown_reset(countdown_engine *eng, guint id)
+{
+    countdown_timer *t = &eng->timers[id];
+
+    if (t->state == COUNTDOWN_IDLE) {return;}
+    t->held_ns = (t->mode == COUNTDOWN_DOWN) ? t->duration_ns : 0;
+    t->state = COUNTDOWN_IDLE;
+    timer_changed(eng);
+}
+
+countdown_state countdown_get_state(countdown_engine *eng, guint id)
+{
+    return eng->timers[id].state;
+}
+
+gint64 countdown_value_ns(countdown_engine *eng, guint id, gint64 now)
+{
+    return timer_value(&eng->timers[id], now);
+}
+
+void countdown_get_stats(countdown_engine *eng, countdown_stats *stats)
+{
+    *stats = eng->stats;
+}
+
+void countdown_print_stats(countdown_engine *eng)
+{
+    printf("Timers: %llu wakeups, %llu label updates, worst wakeup %.1f ms late\n",
+           (unsigned long long)eng->stats.wakeups, (unsigned long long)eng->stats.reports,
+           (double)eng->stats.max_late_ns / NSEC_PER_MSEC);
+}
@@ -0,0 +1,83 @@
+/**************************************************
+ * Countdown and stopwatch timers
+ * A running timer is an absolute CLOCK_MONOTONIC deadline
+ * (or origin for a stopwatch), never a counter that is
+ * decremented, so late or missed wakeups cannot make it
+ * drift. All timers of an engine share one GLib timeout
+ * that is re-armed for the next instant any displayed
+ * second changes. Start, pause, resume and reset are
+ * idempotent, and every state change is saved to a key
+ * file with wall clock deadlines so a running timer keeps
+ * running across an application restart.
+ * The clock and the wakeup can be replaced, so tests can
+ * run an engine through hours of simulated time.
+ * All functions must be called from the GTK main thread.
+ * ************************************************/
+#ifndef COUNTDOWN_H
+#define COUNTDOWN_H
+
+#include <glib.h>
+
+#define COUNTDOWN_MAX_TIMERS 8
+
+typedef enum {
+    COUNTDOWN_IDLE,
+    COUNTDOWN_RUNNING,
+    COUNTDOWN_PAUSED,
+    COUNTDOWN_EXPIRED
+} countdown_state;
+
+typedef enum {
+    COUNTDOWN_DOWN,     //counts from the set duration to zero, then expires
+    COUNTDOWN_UP        //stopwatch, counts up from zero
+} countdown_mode;
+
+typedef struct countdown_engine countdown_engine;
+
+//called whenever the displayed whole seconds or the state of a timer change
+typedef void (*countdown_func)(countdown_engine *eng, guint id, gint64 seconds,
+                               countdown_state state, gpointer user);
+
+//time source of an engine, the default reads mono_ns() and wakes up from a
+//GLib timeout. arm asks for one countdown_wakeup() at or after deadline,
+//replacing the previous request; G_MAXINT64 cancels it
+typedef struct {
+    gint64 (*now)(gpointer user);
+    void (*arm)(countdown_engine *eng, gint64 deadline, gpointer user);
+} countdown_clock;
+
+typedef struct {
+    guint64 wakeups;
+    guint64 reports;
+    gint64 max_late_ns;     //worst wakeup lateness after the instant a second changed
+} countdown_stats;
+
+//state_file may be NULL to keep the timers in memory only
+countdown_engine *countdown_engine_new(const gchar *state_file);
+void countdown_engine_free(countdown_engine *eng);
+//before any timer is added, clock must outlive the engine
+void countdown_engine_set_clock(countdown_engine *eng, const countdown_clock *clock, gpointer user);
+//the deadline given to the clock has come
+void countdown_wakeup(countdown_engine *eng);
+
+//add a timer, restoring its saved state if state_file has one with this name;
+//func is called once right away with the current value
+guint countdown_add(countdown_engine *eng, const gchar *name, countdown_mode mode,
+                    countdown_func func, gpointer user);
+
+//load a new duration and return to idle, for COUNTDOWN_DOWN timers
+void countdown_set(countdown_engine *eng, guint id, gint64 duration_ns);
+//idle or expired -> running from the full duration, otherwise no change
+void countdown_start(countdown_engine *eng, guint id);
+void countdown_pause(countdown_engine *eng, guint id);
+void countdown_resume(countdown_engine *eng, guint id);
+void countdown_reset(countdown_engine *eng, guint id);
+
+countdown_state countdown_get_state(countdown_engine *eng, guint id);
+//remaining (down) or elapsed (up) time at monotonic time now
+gint64 countdown_value_ns(countdown_engine *eng, guint id, gint64 now);
+
+void countdown_get_stats(countdown_engine *eng, countdown_stats *stats);
+void countdown_print_stats(countdown_engine *eng);
+
+#endif
@@ -0,0 +1,18 @@
+/**************************************************
+ * Checksums used by the device protocols
+ * ************************************************/
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//CRC-16/MODBUS (poly 0xA001 reflected, init 0xFFFF), the result is
+//sent low byte first on the wire
+uint16_t crc16_modbus(const uint8_t *buf, size_t len);
+
+//CRC-32 (IEEE 802.3, as used by zlib), pass 0 to start and the
+//previous result to continue over several buffers
+uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,322 @@
+/**************************************************
+ * Streaming filter pipeline, see dsp.h
+ * Samples move through the stages a chunk at a time, each
+ * stage running over the whole chunk before the next one
+ * starts, which keeps the vector loops long and gives
+ * every stage its own timing. Inside, a sample is an
+ * int32 holding the raw word in Q8. The biquad uses Q28
+ * coefficients with error feedback, so its DC gain is
+ * exactly 1 and a steady input gives a steady output even
+ * for corners far below the sample rate.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp.h"
+#include "monotime.h"
+
+#define DSP_FRAC 8
+#define DSP_CHUNK 256
+#define DSP_MAX_DECIMATE 256
+#define BIQUAD_FRAC 28
+#define EMA_FRAC 15
+
+typedef gint16 v8hi __attribute__((vector_size(16)));
+typedef gint32 v8si __attribute__((vector_size(32)));
+typedef gint32 v4si __attribute__((vector_size(16)));
+typedef gfloat v4sf __attribute__((vector_size(16)));
+
+struct dsp_filter {
+    dsp_config cfg;
+    //decimation, the group still being summed
+    gint32 acc;
+    guint acc_n;
+    //median window, oldest first once full
+    gint32 win[DSP_MAX_MEDIAN];
+    guint win_n;
+    guint win_pos;
+    //low-pass
+    gint32 ema_alpha;
+    gint64 b0, b1, b2, a1, a2;
+    gint32 x1, x2, y1, y2;
+    gint64 err;
+    gboolean primed;
+    //calibration segments: start in Q8 raw, value there, slope per Q8 step
+    gint32 cal_x[DSP_MAX_CAL_POINTS];
+    gfloat cal_v[DSP_MAX_CAL_POINTS];
+    gfloat cal_slope[DSP_MAX_CAL_POINTS];
+    guint n_seg;
+    //chunk scratch
+    gint32 work[DSP_CHUNK + 1];
+    guint index[DSP_CHUNK + 1];
+    dsp_stats stats;
+};
+
+//sum of n raw words, eight at a time
+static gint32 sum_block(const gint16 *p, guint n)
+{
+    v8si acc = {0};
+    gint32 sum = 0;
+    guint i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v8hi v;
+        memcpy(&v, p + i, sizeof(v));
+        acc += __builtin_convertvector(v, v8si);
+    }
+    for (guint k = 0; k < 8; k++) {sum += acc[k];}
+    for (; i < n; i++) {sum += p[i];}
+    return sum;
+}
+
+static inline gint32 group_mean(const dsp_filter *f, gint32 sum)
+{
+    return (gint32)(((gint64)sum << DSP_FRAC) / (gint64)f->cfg.decimate);
+}
+
+static guint stage_decimate(dsp_filter *f, const gint16 *in, guint n, guint base)
+{
+    guint N = f->cfg.decimate;
+    guint i = 0, m = 0;
+
+    //finish the group left over from the last chunk
+    if (f->acc_n > 0) {
+        i = MIN(N - f->acc_n, n);
+        f->acc += sum_block(in, i);
+        f->acc_n += i;
+        if (f->acc_n < N) {return 0;}
+        f->index[m] = base + i - 1;
+        f->work[m++] = group_mean(f, f->acc);
+        f->acc_n = 0;
+    }
+    for (; i + N <= n; i += N) {
+        f->index[m] = base + i + N - 1;
+        f->work[m++] = group_mean(f, sum_block(in + i, N));
+    }
+    if (i < n) {
+        f->acc = sum_block(in + i, n - i);
+        f->acc_n = n - i;
+    }
+    return m;
+}
+
+static void stage_median(dsp_filter *f, gint32 *x, guint n)
+{
+    guint N = f->cfg.median;
+
+    for (guint i = 0; i < n; i++) {
+        gint32 sorted[DSP_MAX_MEDIAN];
+
+        f->win[f->win_pos] = x[i];
+        f->win_pos = (f->win_pos + 1) % N;
+        if (f->win_n < N) {f->win_n++;}
+        //insertion sort, N is at most 9
+        for (guint k = 0; k < f->win_n; k++) {
+            gint32 v = f->win[k];
+            guint j = k;
+            while (j > 0 && sorted[j - 1] > v) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = v;
+        }
+        x[i] = sorted[f->win_n / 2];
+    }
+}
+
+static void stage_ema(dsp_filter *f, gint32 *x, guint n)
+{
+    for (guint i = 0; i < n; i++) {
+        if (!f->primed) {
+            f->y1 = x[i];
+            f->primed = TRUE;
+        }
+        f->y1 += (gint32)(((gint64)(x[i] - f->y1) * f->ema_alpha) >> EMA_FRAC);
+        x[i] = f->y1;
+    }
+}
+
+static void stage_biquad(dsp_filter *f, gint32 *x, guint n)
+{
+    for (guint i = 0; i < n; i++) {
+        gint64 acc;
+        gint32 y;
+
+        //start from the steady state of the first sample instead of from 0
+        if (!f->primed) {
+            f->x1 = f->x2 = f->y1 = f->y2 = x[i];
+            f->primed = TRUE;
+        }
+        acc = f->b0 * x[i] + f->b1 * f->x1 + f->b2 * f->x2 - f->a1 * f->y1 - f->a2 * f->y2 + f->err;
+        y = (gint32)(acc >> BIQUAD_FRAC);
+        f->err = acc - ((gint64)y << BIQUAD_FRAC);
+        f->x2 = f->x1;
+        f->x1 = x[i];
+        f->y2 = f->y1;
+        f->y1 = y;
+        x[i] = y;
+    }
+}
+
+static inline gfloat calibrate_q8(const dsp_filter *f, gint32 x)
+{
+    guint s = 0;
+
+    while (s + 1 < f->n_seg && x >= f->cal_x[s + 1]) {s++;}
+    return f->cal_v[s] + (gfloat)(x - f->cal_x[s]) * f->cal_slope[s];
+}
+
+static void stage_calibrate(dsp_filter *f, const gint32 *x, guint n, gfloat *out)
+{
+    guint i = 0;
+
+    //a straight line needs no segment search and goes four at a time
+    if (f->n_seg == 1) {
+        v4sf x0 = {0}, v0 = {0}, slope = {0};
+        x0 += (gfloat)f->cal_x[0];
+        v0 += f->cal_v[0];
+        slope += f->cal_slope[0];
+        for (; i + 4 <= n; i += 4) {
+            v4si v;
+            v4sf r;
+            memcpy(&v, x + i, sizeof(v));
+            r = v0 + (__builtin_convertvector(v, v4sf) - x0) * slope;
+            memcpy(out + i, &r, sizeof(r));
+        }
+    }
+    for (; i < n; i++) {out[i] = calibrate_q8(f, x[i]);}
+}
+
+static void biquad_design(dsp_filter *f, gdouble fs)
+{
+    gdouble w0 = 2 * G_PI * f->cfg.cutoff_hz / fs;
+    //Butterworth, Q = 1/sqrt(2)
+    gdouble alpha = sin(w0) / G_SQRT2;
+    gdouble a0 = 1 + alpha;
+    gdouble one = (gdouble)((gint64)1 << BIQUAD_FRAC);
+
+    f->b0 = llround((1 - cos(w0)) / 2 / a0 * one);
+    f->b2 = f->b0;
+    f->a1 = llround(-2 * cos(w0) / a0 * one);
+    f->a2 = llround((1 - alpha) / a0 * one);
+    //round b1 so the coefficients sum to a DC gain of exactly 1
+    f->b1 = (gint64)one + f->a1 + f->a2 - f->b0 - f->b2;
+}
+
+static void lowpass_design(dsp_filter *f, gdouble fs)
+{
+    if (f->cfg.lowpass == DSP_LOWPASS_EMA) {
+        f->ema_alpha = (gint32)lround((1 - exp(-2 * G_PI * f->cfg.cutoff_hz / fs)) * (1 << EMA_FRAC));
+    }
+    if (f->cfg.lowpass == DSP_LOWPASS_BIQUAD) {biquad_design(f, fs);}
+}
+
+dsp_filter *dsp_filter_new(const dsp_config *cfg)
+{
+    dsp_filter *f;
+    gdouble fs;
+
+    if (cfg->decimate == 0 || cfg->decimate > DSP_MAX_DECIMATE) {return NULL;}
+    if (cfg->median == 0 || cfg->median > DSP_MAX_MEDIAN || cfg->median % 2 == 0) {return NULL;}
+    if (cfg->n_cal < 2 || cfg->n_cal > DSP_MAX_CAL_POINTS) {return NULL;}
+    for (guint i = 1; i < cfg->n_cal; i++) {
+        if (cfg->cal[i].raw <= cfg->cal[i - 1].raw) {return NULL;}
+    }
+    fs = cfg->sample_hz / cfg->decimate;
+    if (cfg->lowpass != DSP_LOWPASS_NONE && (cfg->cutoff_hz <= 0 || cfg->cutoff_hz >= fs / 2)) {return NULL;}
+    f = g_new0(dsp_filter, 1);
+    f->cfg = *cfg;
+    lowpass_design(f, fs);
+    f->n_seg = cfg->n_cal - 1;
+    for (guint s = 0; s < f->n_seg; s++) {
+        f->cal_x[s] = cfg->cal[s].raw * (1 << DSP_FRAC);
+        f->cal_v[s] = cfg->cal[s].value;
+        f->cal_slope[s] = (cfg->cal[s + 1].value - cfg->cal[s].value)
+                        / ((gfloat)(cfg->cal[s + 1].raw - cfg->cal[s].raw) * (1 << DSP_FRAC));
+    }
+    return f;
+}
+
+int dsp_filter_set_rate(dsp_filter *f, gdouble sample_hz)
+{
+    gdouble fs = sample_hz / f->cfg.decimate;
+
+    if (sample_hz <= 0) {return -1;}
+    if (f->cfg.lowpass != DSP_LOWPASS_NONE && f->cfg.cutoff_hz >= fs / 2) {return -1;}
+    f->cfg.sample_hz = sample_hz;
+    lowpass_design(f, fs);
+    return 0;
+}
+
+void dsp_filter_free(dsp_filter *f)
+{
+    g_free(f);
+}
+
+void dsp_filter_reset(dsp_filter *f)
+{
+    f->acc = 0;
+    f->acc_n = 0;
+    f->win_n = 0;
+    f->win_pos = 0;
+    f->err = 0;
+    f->primed = FALSE;
+}
+
+guint dsp_filter_run(dsp_filter *f, const gint16 *in, guint n, gfloat *out, guint *out_index)
+{
+    guint total = 0;
+
+    for (guint pos = 0; pos < n; pos += DSP_CHUNK) {
+        guint len = MIN(DSP_CHUNK, n - pos);
+        gint64 t0 = mono_ns(), t1, t2, t3, t4;
+        guint m = stage_decimate(f, in + pos, len, pos);
+
+        t1 = mono_ns();
+        if (f->cfg.median > 1) {stage_median(f, f->work, m);}
+        t2 = mono_ns();
+        if (f->cfg.lowpass == DSP_LOWPASS_EMA) {stage_ema(f, f->work, m);}
+        else if (f->cfg.lowpass == DSP_LOWPASS_BIQUAD) {stage_biquad(f, f->work, m);}
+        t3 = mono_ns();
+        stage_calibrate(f, f->work, m, out + total);
+        t4 = mono_ns();
+        if (out_index) {memcpy(out_index + total, f->index, m * sizeof(guint));}
+        total += m;
+
+        f->stats.stage_samples[DSP_STAGE_DECIMATE] += len;
+        f->stats.stage_samples[DSP_STAGE_MEDIAN] += m;
+        f->stats.stage_samples[DSP_STAGE_LOWPASS] += m;
+        f->stats.stage_samples[DSP_STAGE_CALIBRATE] += m;
+        f->stats.stage_ns[DSP_STAGE_DECIMATE] += t1 - t0;
+        f->stats.stage_ns[DSP_STAGE_MEDIAN] += t2 - t1;
+        f->stats.stage_ns[DSP_STAGE_LOWPASS] += t3 - t2;
+        f->stats.stage_ns[DSP_STAGE_CALIBRATE] += t4 - t3;
+    }
+    f->stats.samples_in += n;
+    f->stats.samples_out += total;
+    return total;
+}
+
+gfloat dsp_calibrate(const dsp_filter *f, gint16 raw)
+{
+    return calibrate_q8(f, raw * (1 << DSP_FRAC));
+}
+
+void dsp_get_stats(dsp_filter *f, dsp_stats *stats)
+{
+    *stats = f->stats;
+}
+
+void dsp_print_stats(dsp_filter *f)
+{
+    static const char *names[DSP_STAGES] = {"decimate", "median", "low-pass", "calibrate"};
+    dsp_stats st;
+
+    dsp_get_stats(f, &st);
+    printf("DSP: %llu samples in, %llu out\n", (unsigned long long)st.samples_in, (unsigned long long)st.samples_out);
+    for (guint s = 0; s < DSP_STAGES; s++) {
+        if (st.stage_ns[s] <= 0) {continue;}
+        printf("DSP:   %-9s %.2f Msamples/s\n", names[s], (double)st.stage_samples[s] * 1000 / st.stage_ns[s]);
+    }
+}
@@ -0,0 +1,83 @@
+/**************************************************
+ * Streaming filter pipeline for raw ADC words
+ * Batches of raw int16 samples go through, in order:
+ * - oversampling: N raw samples averaged into one,
+ * - median-of-N spike rejection,
+ * - an EMA or biquad low-pass,
+ * - a piecewise linear calibration curve to engineering
+ *   units (pascals for the pressure channel).
+ * Everything up to the calibration is fixed point (Q8 of
+ * the raw word) so the result does not depend on the
+ * FPU; decimation and calibration have a vector path
+ * (GCC vector extensions, SSE2 on x86 and NEON on ARM).
+ * State carries over between batches, the batch size is
+ * free. Not thread safe, one filter per consumer.
+ * ************************************************/
+#ifndef DSP_H
+#define DSP_H
+
+#include <glib.h>
+
+#define DSP_MAX_MEDIAN 9
+#define DSP_MAX_CAL_POINTS 8
+
+typedef enum {
+    DSP_LOWPASS_NONE,
+    DSP_LOWPASS_EMA,
+    DSP_LOWPASS_BIQUAD
+} dsp_lowpass;
+
+typedef enum {
+    DSP_STAGE_DECIMATE,
+    DSP_STAGE_MEDIAN,
+    DSP_STAGE_LOWPASS,
+    DSP_STAGE_CALIBRATE,
+    DSP_STAGES
+} dsp_stage;
+
+typedef struct {
+    gint16 raw;
+    gfloat value;
+} dsp_cal_point;
+
+typedef struct {
+    guint decimate;         //raw samples per output, 1 keeps every sample
+    guint median;           //odd window, 1 turns the spike filter off
+    dsp_lowpass lowpass;
+    gdouble sample_hz;      //raw sample rate
+    gdouble cutoff_hz;      //low-pass corner, must be below half the decimated rate
+    //ascending raw values, at least 2 points; the curve is extended past both ends
+    dsp_cal_point cal[DSP_MAX_CAL_POINTS];
+    guint n_cal;
+} dsp_config;
+
+typedef struct {
+    guint64 samples_in;
+    guint64 samples_out;
+    //samples entering each stage and the time spent in it
+    guint64 stage_samples[DSP_STAGES];
+    gint64 stage_ns[DSP_STAGES];
+} dsp_stats;
+
+typedef struct dsp_filter dsp_filter;
+
+//NULL if the configuration is out of range
+dsp_filter *dsp_filter_new(const dsp_config *cfg);
+void dsp_filter_free(dsp_filter *f);
+//forget the history, the next sample restarts every stage
+void dsp_filter_reset(dsp_filter *f);
+//the raw rate changed: the low-pass is redesigned for it and keeps its state,
+//-1 if the cutoff would not be below half the decimated rate
+int dsp_filter_set_rate(dsp_filter *f, gdouble sample_hz);
+
+//filter n raw samples, writes at most n / decimate + 1 calibrated values to out;
+//out_index (may be NULL) gets the index in `in` of the last sample behind each value
+guint dsp_filter_run(dsp_filter *f, const gint16 *in, guint n, gfloat *out, guint *out_index);
+//calibration curve alone, for a single raw value
+gfloat dsp_calibrate(const dsp_filter *f, gint16 raw);
+
+void dsp_get_stats(dsp_filter *f, dsp_stats *stats);
+//samples/s each stage could sustain
+void dsp_print_stats(dsp_filter *f);
+
+#endif
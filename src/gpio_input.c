@@ -0,0 +1,320 @@
+/**************************************************
+ * Edge-triggered dry contact input, see gpio_input.h
+ * The reactor watches the line event fd and a timer armed
+ * for the end of the earliest debounce window, so an idle
+ * contact costs no CPU and no wakeups.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio_input.h"
+#include "monotime.h"
+
+typedef struct {
+    guint line;
+    gint level;
+    gint64 ts_ns;
+} gpio_edge;
+
+//backend hooks, fd becomes readable when edges are pending
+typedef struct {
+    //drain pending edges without blocking, returns count or -1
+    int (*read_edges)(gpio_input *in, gpio_edge *edges, int max);
+    //current raw level of a line, used to confirm the settled state
+    gint (*read_level)(gpio_input *in, guint line);
+    void (*close)(gpio_input *in);
+} gpio_input_backend;
+
+struct gpio_input {
+    const gpio_input_backend *backend;
+    int fd;
+    guint n_lines;
+    guint offsets[GPIO_INPUT_MAX_LINES];
+    gint64 debounce_ns;
+    //debounce state, only touched by the reactor thread
+    gint raw[GPIO_INPUT_MAX_LINES];
+    gint stable[GPIO_INPUT_MAX_LINES];
+    gint64 last_edge[GPIO_INPUT_MAX_LINES];
+    gint64 settle_at[GPIO_INPUT_MAX_LINES];
+    //published state
+    volatile gint level[GPIO_INPUT_MAX_LINES];
+    guint64 edges;
+    guint64 transitions;
+    //simulated backend
+    int sim_wr;
+    volatile gint sim_level[GPIO_INPUT_MAX_LINES];
+    capture *cap;
+
+    gpio_input_func func;
+    gpointer user_data;
+    reactor_source *edge_src;
+    reactor_source *settle_src;
+};
+
+/************** character device backend **********/
+static int chip_read_edges(gpio_input *in, gpio_edge *edges, int max)
+{
+    struct gpio_v2_line_event ev[16];
+    int n = 0;
+    ssize_t len;
+
+    if (max > (int)G_N_ELEMENTS(ev)) {max = G_N_ELEMENTS(ev);}
+    len = read(in->fd, ev, max * sizeof(ev[0]));
+    if (len < 0) {return (errno == EAGAIN) ? 0 : -1;}
+    for (int i = 0; i < len / (ssize_t)sizeof(ev[0]); i++) {
+        for (guint l = 0; l < in->n_lines; l++) {
+            if (in->offsets[l] != ev[i].offset) {continue;}
+            edges[n].line = l;
+            edges[n].level = (ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+            edges[n].ts_ns = (gint64)ev[i].timestamp_ns;
+            n++;
+            break;
+        }
+    }
+    return n;
+}
+
+static gint chip_read_level(gpio_input *in, guint line)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = 1ULL << line;
+    values.bits = 0;
+    if (ioctl(in->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {return in->raw[line];}
+    return (values.bits >> line) & 1;
+}
+
+static void chip_close(gpio_input *in)
+{
+    close(in->fd);
+}
+
+static const gpio_input_backend chip_backend = {
+    chip_read_edges, chip_read_level, chip_close
+};
+
+/************** simulated backend **********/
+static int sim_read_edges(gpio_input *in, gpio_edge *edges, int max)
+{
+    ssize_t len = read(in->fd, edges, max * sizeof(gpio_edge));
+    if (len < 0) {return (errno == EAGAIN) ? 0 : -1;}
+    return len / sizeof(gpio_edge);
+}
+
+static gint sim_read_level(gpio_input *in, guint line)
+{
+    return g_atomic_int_get(&in->sim_level[line]);
+}
+
+static void sim_close(gpio_input *in)
+{
+    close(in->fd);
+    close(in->sim_wr);
+}
+
+static const gpio_input_backend sim_backend = {
+    sim_read_edges, sim_read_level, sim_close
+};
+
+static gpio_input *gpio_input_alloc(guint n_lines, guint debounce_us)
+{
+    gpio_input *in;
+
+    if (n_lines == 0 || n_lines > GPIO_INPUT_MAX_LINES) {return NULL;}
+    in = g_new0(gpio_input, 1);
+    in->n_lines = n_lines;
+    in->debounce_ns = (gint64)debounce_us * NSEC_PER_USEC;
+    in->fd = -1;
+    in->sim_wr = -1;
+    return in;
+}
+
+gpio_input *gpio_input_open_chip(const gchar *chip, const guint *offsets, guint n_lines, guint debounce_us)
+{
+    struct gpio_v2_line_request req;
+    gpio_input *in;
+    int chip_fd;
+
+    in = gpio_input_alloc(n_lines, debounce_us);
+    if (in == NULL) {return NULL;}
+    chip_fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0) {
+        printf("Error: Couldn't open %s: %s\n", chip, strerror(errno));
+        g_free(in);
+        return NULL;
+    }
+    memset(&req, 0, sizeof(req));
+    for (guint l = 0; l < n_lines; l++) {
+        req.offsets[l] = offsets[l];
+        in->offsets[l] = offsets[l];
+    }
+    req.num_lines = n_lines;
+    g_strlcpy(req.consumer, "monitor_gtk", sizeof(req.consumer));
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP
+                     | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.event_buffer_size = 16 * n_lines;
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        printf("Error: Couldn't request lines on %s: %s\n", chip, strerror(errno));
+        close(chip_fd);
+        g_free(in);
+        return NULL;
+    }
+    close(chip_fd);
+    in->fd = req.fd;
+    fcntl(in->fd, F_SETFL, fcntl(in->fd, F_GETFL) | O_NONBLOCK);
+    in->backend = &chip_backend;
+    return in;
+}
+
+gpio_input *gpio_input_open_sim(guint n_lines, guint debounce_us)
+{
+    gpio_input *in;
+    int fds[2];
+
+    in = gpio_input_alloc(n_lines, debounce_us);
+    if (in == NULL) {return NULL;}
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        g_free(in);
+        return NULL;
+    }
+    in->fd = fds[0];
+    in->sim_wr = fds[1];
+    for (guint l = 0; l < n_lines; l++) {
+        in->offsets[l] = l;
+        in->sim_level[l] = 1;
+    }
+    in->backend = &sim_backend;
+    return in;
+}
+
+int gpio_input_sim_set(gpio_input *in, guint line, gint level)
+{
+    return gpio_input_sim_edge(in, line, level, mono_ns());
+}
+
+int gpio_input_sim_edge(gpio_input *in, guint line, gint level, gint64 ts_ns)
+{
+    gpio_edge edge;
+
+    if (in->backend != &sim_backend || line >= in->n_lines) {return -1;}
+    edge.line = line;
+    edge.level = level ? 1 : 0;
+    edge.ts_ns = ts_ns;
+    g_atomic_int_set(&in->sim_level[line], edge.level);
+    //a single edge is well below PIPE_BUF so the write is atomic
+    if (write(in->sim_wr, &edge, sizeof(edge)) != sizeof(edge)) {return -1;}
+    return 0;
+}
+
+//report every line whose debounce window has expired and re-arm for the next one
+static void gpio_input_settle(gpio_input *in, gint64 now)
+{
+    gint64 next = 0;
+
+    for (guint l = 0; l < in->n_lines; l++) {
+        if (in->settle_at[l] == 0) {continue;}
+        if (in->settle_at[l] > now) {
+            if (next == 0 || in->settle_at[l] < next) {next = in->settle_at[l];}
+            continue;
+        }
+        in->settle_at[l] = 0;
+        in->raw[l] = in->backend->read_level(in, l);
+        if (in->raw[l] == in->stable[l]) {continue;}
+        in->stable[l] = in->raw[l];
+        g_atomic_int_set(&in->level[l], in->stable[l]);
+        in->transitions++;
+        if (in->func) {in->func(l, in->stable[l], in->last_edge[l], in->user_data);}
+    }
+    reactor_timer_arm(in->settle_src, next);
+}
+
+static void gpio_input_on_edges(reactor_source *src, guint32 events, gpointer data)
+{
+    gpio_input *in = data;
+    gpio_edge edges[16];
+    int n;
+
+    while ((n = in->backend->read_edges(in, edges, G_N_ELEMENTS(edges))) > 0) {
+        for (int i = 0; i < n; i++) {
+            guint l = edges[i].line;
+            guint8 level = edges[i].level;
+
+            capture_write(in->cap, CAPTURE_GPIO, l, edges[i].ts_ns, &level, 1);
+            in->raw[l] = edges[i].level;
+            in->last_edge[l] = edges[i].ts_ns;
+            //every edge restarts the window, a bounce storm settles once
+            in->settle_at[l] = edges[i].ts_ns + in->debounce_ns;
+            if (in->settle_at[l] == 0) {in->settle_at[l] = 1;}
+            in->edges++;
+        }
+    }
+    gpio_input_settle(in, mono_ns());
+}
+
+static void gpio_input_on_settle(reactor_source *src, guint32 events, gpointer data)
+{
+    gpio_input_settle(data, mono_ns());
+}
+
+int gpio_input_start(gpio_input *in, reactor *r, gpio_input_func func, gpointer user_data)
+{
+    if (in->edge_src != NULL) {return 0;}
+    in->func = func;
+    in->user_data = user_data;
+    for (guint l = 0; l < in->n_lines; l++) {
+        in->raw[l] = in->backend->read_level(in, l);
+        in->stable[l] = in->raw[l];
+        in->level[l] = in->raw[l];
+    }
+    in->settle_src = reactor_add_timer(r, gpio_input_on_settle, in);
+    if (in->settle_src == NULL) {return -1;}
+    in->edge_src = reactor_add_fd(r, in->fd, EPOLLIN, gpio_input_on_edges, in);
+    if (in->edge_src == NULL) {
+        reactor_remove(in->settle_src);
+        in->settle_src = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void gpio_input_stop(gpio_input *in)
+{
+    if (in->edge_src == NULL) {return;}
+    reactor_remove(in->edge_src);
+    reactor_remove(in->settle_src);
+    in->edge_src = NULL;
+    in->settle_src = NULL;
+}
+
+void gpio_input_free(gpio_input *in)
+{
+    if (in == NULL) {return;}
+    gpio_input_stop(in);
+    in->backend->close(in);
+    g_free(in);
+}
+
+void gpio_input_set_capture(gpio_input *in, capture *cap)
+{
+    in->cap = cap;
+}
+
+gint gpio_input_get_level(gpio_input *in, guint line)
+{
+    if (line >= in->n_lines) {return -1;}
+    return g_atomic_int_get(&in->level[line]);
+}
+
+void gpio_input_get_counts(gpio_input *in, guint64 *edges, guint64 *transitions)
+{
+    //plain loads, the counters are only informational
+    if (edges) {*edges = in->edges;}
+    if (transitions) {*transitions = in->transitions;}
+}
@@ -0,0 +1,50 @@
+/**************************************************
+ * Edge-triggered dry contact input with software debounce.
+ * Lines are requested from the GPIO character device
+ * (/dev/gpiochipN) with edge detection on both edges, or
+ * from a simulated backend where edges are injected by
+ * gpio_input_sim_set(). A line must stay at the same level
+ * for the debounce time before a transition is reported,
+ * so a bouncing contact gives exactly one callback.
+ * Raw edges can be recorded to a capture before they are
+ * debounced, and replayed into a simulated input.
+ * ************************************************/
+#ifndef GPIO_INPUT_H
+#define GPIO_INPUT_H
+
+#include <glib.h>
+#include "reactor.h"
+#include "capture.h"
+
+#define GPIO_INPUT_MAX_LINES 32
+
+typedef struct gpio_input gpio_input;
+
+//called from the reactor thread once per debounced transition,
+//line is the index into the offsets given at open time
+typedef void (*gpio_input_func)(guint line, gint level, gint64 ts_ns, gpointer user_data);
+
+//request n_lines offsets on a gpiochip as pulled-up inputs
+gpio_input *gpio_input_open_chip(const gchar *chip, const guint *offsets, guint n_lines, guint debounce_us);
+//simulated lines, all idle high until gpio_input_sim_set() is called
+gpio_input *gpio_input_open_sim(guint n_lines, guint debounce_us);
+
+//watch the lines from r, stop must be called while r is stopped or from its thread
+int gpio_input_start(gpio_input *in, reactor *r, gpio_input_func func, gpointer user_data);
+void gpio_input_stop(gpio_input *in);
+void gpio_input_free(gpio_input *in);
+
+//last debounced level of a line, safe to call from any thread
+gint gpio_input_get_level(gpio_input *in, guint line);
+//raw edge and debounced transition counters
+void gpio_input_get_counts(gpio_input *in, guint64 *edges, guint64 *transitions);
+
+//record every raw edge, set before start
+void gpio_input_set_capture(gpio_input *in, capture *cap);
+
+//inject a raw edge on a simulated line (time stamped now)
+int gpio_input_sim_set(gpio_input *in, guint line, gint level);
+//same with the time of the edge, for replaying a capture
+int gpio_input_sim_edge(gpio_input *in, guint line, gint level, gint64 ts_ns);
+
+#endif
@@ -0,0 +1,248 @@
+/**************************************************
+ * Polled status input scanner, see gpio_scan.h
+ * The vertical counter keeps bit k of every line's scan
+ * count in count[k]. A line that reads its debounced level
+ * has its count cleared, one that differs counts up with
+ * a ripple carry across the words, and the lines whose
+ * count reaches the debounce setting toggle together.
+ * Lines are only unpacked from pin order when something
+ * changed.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <bcm2835.h>
+
+#include "gpio_scan.h"
+#include "monotime.h"
+
+#define COUNT_BITS 4
+
+typedef struct {
+    void (*setup)(gpio_scan *scan, guint pin);
+    //one access for the levels of all bank 0 pins
+    guint32 (*read)(gpio_scan *scan);
+} gpio_scan_backend;
+
+struct gpio_scan {
+    const gpio_scan_backend *backend;
+    guint pins[GPIO_SCAN_MAX_LINES];
+    guint n_lines;
+    guint32 mask;           //pins in use
+    guint32 invert;         //active low pins
+    //simulated bank
+    volatile guint sim_bank;
+
+    //debounce state in pin order, only touched by the reactor thread
+    guint32 state;
+    guint32 count[COUNT_BITS];
+    guint debounce;
+    gint64 period;
+    gint64 due;
+    gint64 start;
+    reactor_source *timer;
+    gpio_scan_func func;
+    gpointer user_data;
+    //published state in line order
+    volatile guint levels;
+    GMutex lock;
+    gpio_scan_stats stats;
+};
+
+/************** bcm2835 backend **********/
+static void bcm_setup(gpio_scan *scan, guint pin)
+{
+    bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
+    bcm2835_gpio_set_pud(pin, BCM2835_GPIO_PUD_UP);
+}
+
+static guint32 bcm_read(gpio_scan *scan)
+{
+    return bcm2835_peri_read(bcm2835_gpio + BCM2835_GPLEV0 / 4);
+}
+
+static const gpio_scan_backend bcm_backend = {
+    bcm_setup, bcm_read
+};
+
+/************** simulated backend **********/
+static void sim_setup(gpio_scan *scan, guint pin)
+{
+}
+
+static guint32 sim_read(gpio_scan *scan)
+{
+    return g_atomic_int_get(&scan->sim_bank);
+}
+
+static const gpio_scan_backend sim_backend = {
+    sim_setup, sim_read
+};
+
+static gpio_scan *gpio_scan_alloc(const gpio_scan_backend *backend)
+{
+    gpio_scan *scan = g_new0(gpio_scan, 1);
+
+    scan->backend = backend;
+    scan->sim_bank = 0xFFFFFFFF;
+    g_mutex_init(&scan->lock);
+    return scan;
+}
+
+gpio_scan *gpio_scan_open_bcm2835(void)
+{
+    return gpio_scan_alloc(&bcm_backend);
+}
+
+gpio_scan *gpio_scan_open_sim(void)
+{
+    return gpio_scan_alloc(&sim_backend);
+}
+
+gint gpio_scan_add_line(gpio_scan *scan, guint pin, gboolean active_low)
+{
+    if (scan->timer != NULL || scan->n_lines == GPIO_SCAN_MAX_LINES || pin >= 32) {return -1;}
+    if (scan->mask & (1u << pin)) {return -1;}
+    scan->backend->setup(scan, pin);
+    scan->pins[scan->n_lines] = pin;
+    scan->mask |= 1u << pin;
+    if (active_low) {scan->invert |= 1u << pin;}
+    return scan->n_lines++;
+}
+
+//one scan worth of counting, returns the pins that changed
+static guint32 gpio_scan_debounce(gpio_scan *scan, guint32 sample)
+{
+    guint32 diff = (sample ^ scan->state) & scan->mask;
+    guint32 carry = diff;
+    guint32 done = diff;
+
+    for (guint k = 0; k < COUNT_BITS; k++) {
+        guint32 c;
+
+        scan->count[k] &= diff;
+        c = scan->count[k] & carry;
+        scan->count[k] ^= carry;
+        carry = c;
+        done &= (scan->debounce >> k) & 1 ? scan->count[k] : ~scan->count[k];
+    }
+    if (done == 0) {return 0;}
+    for (guint k = 0; k < COUNT_BITS; k++) {scan->count[k] &= ~done;}
+    scan->state ^= done;
+    return done;
+}
+
+//pin order to line order
+static guint32 gpio_scan_lines(gpio_scan *scan, guint32 pins)
+{
+    guint32 lines = 0;
+
+    for (guint l = 0; l < scan->n_lines; l++) {
+        if (pins & (1u << scan->pins[l])) {lines |= 1u << l;}
+    }
+    return lines;
+}
+
+//debounce one read of the bank and report what changed
+static void gpio_scan_once(gpio_scan *scan, gint64 now, gint64 late)
+{
+    guint32 changed = gpio_scan_debounce(scan, scan->backend->read(scan) ^ scan->invert);
+    guint32 lines = 0, levels = 0;
+
+    if (changed) {
+        lines = gpio_scan_lines(scan, changed);
+        levels = gpio_scan_lines(scan, scan->state);
+        g_atomic_int_set(&scan->levels, levels);
+    }
+    g_mutex_lock(&scan->lock);
+    scan->stats.scans++;
+    scan->stats.changes += __builtin_popcount(lines);
+    scan->stats.late_max_ns = MAX(scan->stats.late_max_ns, late);
+    scan->stats.run_ns = now - scan->start;
+    g_mutex_unlock(&scan->lock);
+    if (lines && scan->func) {scan->func(lines, levels, now, scan->user_data);}
+}
+
+static void gpio_scan_on_timer(reactor_source *src, guint32 events, gpointer data)
+{
+    gpio_scan *scan = data;
+    gint64 now = mono_ns();
+
+    gpio_scan_once(scan, now, now - scan->due);
+    //keep the phase, but skip scans we could not keep up with
+    scan->due += scan->period;
+    if (scan->due < now) {scan->due = now + scan->period;}
+    reactor_timer_arm(scan->timer, scan->due);
+}
+
+int gpio_scan_start(gpio_scan *scan, reactor *r, guint period_us, guint debounce, gpio_scan_func func, gpointer user_data)
+{
+    if (scan->timer != NULL) {return 0;}
+    if (period_us == 0 || debounce == 0 || debounce > GPIO_SCAN_MAX_DEBOUNCE) {return -1;}
+    scan->period = (gint64)period_us * NSEC_PER_USEC;
+    scan->debounce = debounce;
+    scan->func = func;
+    scan->user_data = user_data;
+    //the levels at start are taken as settled, they are not reported as changes
+    scan->state = (scan->backend->read(scan) ^ scan->invert) & scan->mask;
+    memset(scan->count, 0, sizeof(scan->count));
+    g_atomic_int_set(&scan->levels, gpio_scan_lines(scan, scan->state));
+    scan->timer = reactor_add_timer(r, gpio_scan_on_timer, scan);
+    if (scan->timer == NULL) {return -1;}
+    scan->start = mono_ns();
+    scan->due = scan->start + scan->period;
+    reactor_timer_arm(scan->timer, scan->due);
+    return 0;
+}
+
+void gpio_scan_stop(gpio_scan *scan)
+{
+    if (scan->timer == NULL) {return;}
+    reactor_remove(scan->timer);
+    scan->timer = NULL;
+}
+
+void gpio_scan_free(gpio_scan *scan)
+{
+    if (scan == NULL) {return;}
+    gpio_scan_stop(scan);
+    g_mutex_clear(&scan->lock);
+    g_free(scan);
+}
+
+void gpio_scan_poll(gpio_scan *scan)
+{
+    if (scan->timer == NULL) {return;}
+    gpio_scan_once(scan, mono_ns(), 0);
+}
+
+guint32 gpio_scan_get_levels(gpio_scan *scan)
+{
+    return g_atomic_int_get(&scan->levels);
+}
+
+int gpio_scan_sim_set(gpio_scan *scan, guint pin, gint level)
+{
+    if (scan->backend != &sim_backend || pin >= 32) {return -1;}
+    if (level) {g_atomic_int_or(&scan->sim_bank, 1u << pin);}
+    else {g_atomic_int_and(&scan->sim_bank, ~(1u << pin));}
+    return 0;
+}
+
+void gpio_scan_get_stats(gpio_scan *scan, gpio_scan_stats *stats)
+{
+    g_mutex_lock(&scan->lock);
+    *stats = scan->stats;
+    g_mutex_unlock(&scan->lock);
+}
+
+void gpio_scan_print_stats(gpio_scan *scan)
+{
+    gpio_scan_stats st;
+
+    gpio_scan_get_stats(scan, &st);
+    printf("Status inputs: %u lines, %llu scans, %llu changes, worst scan %.1f us late\n", scan->n_lines,
+           (unsigned long long)st.scans, (unsigned long long)st.changes, (double)st.late_max_ns / NSEC_PER_USEC);
+    if (st.run_ns > 0) {
+        printf("Status inputs: %.0f scans/s\n", (double)st.scans * NSEC_PER_SEC / st.run_ns);
+    }
+}
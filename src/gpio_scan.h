@@ -0,0 +1,64 @@
+/**************************************************
+ * Polled scanner for a bank of status inputs
+ * Gas supply switches, filter and similar status contacts
+ * change rarely and only need to be seen within a few ms,
+ * so instead of an event per line the whole GPIO bank is
+ * read in one register access per scan (GPLEV0 through
+ * bcm2835, or a simulated bank). All lines are debounced
+ * together with a vertical counter: bit n of every counter
+ * word belongs to GPIO n, so one scan of any number of
+ * lines costs the same few word operations. A line must
+ * read its new level on debounce consecutive scans before
+ * it changes.
+ * ************************************************/
+#ifndef GPIO_SCAN_H
+#define GPIO_SCAN_H
+
+#include <glib.h>
+#include "reactor.h"
+
+#define GPIO_SCAN_MAX_LINES 32
+//longest debounce in scans, the counters are 4 bits wide
+#define GPIO_SCAN_MAX_DEBOUNCE 15
+
+typedef struct gpio_scan gpio_scan;
+
+typedef struct {
+    guint64 scans;
+    guint64 changes;        //debounced line transitions
+    gint64 late_max_ns;     //scan after its due time
+    gint64 run_ns;
+} gpio_scan_stats;
+
+//called from the reactor thread after a scan in which lines changed;
+//bit l of changed and levels is line l, levels are active high
+typedef void (*gpio_scan_func)(guint32 changed, guint32 levels, gint64 ts_ns, gpointer user_data);
+
+//bcm2835_init() must have succeeded
+gpio_scan *gpio_scan_open_bcm2835(void);
+//simulated bank, all pins idle high until gpio_scan_sim_set() is called
+gpio_scan *gpio_scan_open_sim(void);
+
+//configure a bank 0 pin as a pulled-up input; returns its line, -1 when full or started
+gint gpio_scan_add_line(gpio_scan *scan, guint pin, gboolean active_low);
+
+//scan every period_us from r; stop must be called while r is stopped or from its thread
+int gpio_scan_start(gpio_scan *scan, reactor *r, guint period_us, guint debounce, gpio_scan_func func, gpointer user_data);
+void gpio_scan_stop(gpio_scan *scan);
+void gpio_scan_free(gpio_scan *scan);
+
+//one scan right now, between the timer scans; only after start, from the
+//reactor thread or while it is stopped (tests and benchmarks drive the
+//scanner this way without a running reactor)
+void gpio_scan_poll(gpio_scan *scan);
+
+//debounced levels of all lines, safe to call from any thread
+guint32 gpio_scan_get_levels(gpio_scan *scan);
+
+//set a pin of the simulated bank, from any thread
+int gpio_scan_sim_set(gpio_scan *scan, guint pin, gint level);
+
+void gpio_scan_get_stats(gpio_scan *scan, gpio_scan_stats *stats);
+void gpio_scan_print_stats(gpio_scan *scan);
+
+#endif
@@ -0,0 +1,105 @@
+/**************************************************
+ * Decoded icon cache, see image_cache.h
+ * Keys are built on the stack, a lookup that hits does
+ * not allocate.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "image_cache.h"
+#include "monotime.h"
+
+#define IMAGE_KEY_MAX 64
+
+struct image_cache {
+    gchar *prefix;
+    GHashTable *pixbufs;    //"fanon" -> GdkPixbuf, NULL for an icon that failed to load
+    image_cache_stats stats;
+};
+
+static void pixbuf_unref(gpointer pixbuf)
+{
+    if (pixbuf) {g_object_unref(pixbuf);}
+}
+
+image_cache *image_cache_new(const gchar *prefix)
+{
+    image_cache *cache = g_new0(image_cache, 1);
+
+    cache->prefix = g_strdup(prefix);
+    cache->pixbufs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, pixbuf_unref);
+    return cache;
+}
+
+void image_cache_free(image_cache *cache)
+{
+    if (cache == NULL) {return;}
+    g_hash_table_destroy(cache->pixbufs);
+    g_free(cache->prefix);
+    g_free(cache);
+}
+
+static GdkPixbuf *image_decode(image_cache *cache, const gchar *key)
+{
+    gchar path[256];
+    GError *error = NULL;
+    GdkPixbuf *pixbuf;
+    gint64 start = mono_ns();
+
+    g_snprintf(path, sizeof(path), "%s/%s.png", cache->prefix, key);
+    pixbuf = gdk_pixbuf_new_from_resource(path, &error);
+    if (pixbuf == NULL) {
+        printf("Error: cannot load icon %s: %s\n", path, error->message);
+        g_error_free(error);
+        //later lookups neither decode nor report it again
+        g_hash_table_insert(cache->pixbufs, g_strdup(key), NULL);
+        cache->stats.missing++;
+        return NULL;
+    }
+    g_hash_table_insert(cache->pixbufs, g_strdup(key), pixbuf);
+    cache->stats.decoded++;
+    cache->stats.decode_ns += mono_ns() - start;
+    return pixbuf;
+}
+
+GdkPixbuf *image_cache_get(image_cache *cache, const gchar *name, const gchar *state)
+{
+    gchar key[IMAGE_KEY_MAX];
+    gpointer pixbuf;
+
+    g_snprintf(key, sizeof(key), "%s%s", name, state ? state : "");
+    if (g_hash_table_lookup_extended(cache->pixbufs, key, NULL, &pixbuf)) {
+        cache->stats.hits++;
+        return pixbuf;
+    }
+    return image_decode(cache, key);
+}
+
+void image_cache_preload(image_cache *cache)
+{
+    gchar **names = g_resources_enumerate_children(cache->prefix, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+
+    if (names == NULL) {return;}
+    for (guint i = 0; names[i]; i++) {
+        gchar key[IMAGE_KEY_MAX];
+        gsize len = strlen(names[i]);
+
+        if (len < 5 || len - 4 >= sizeof(key) || strcmp(names[i] + len - 4, ".png") != 0) {continue;}
+        memcpy(key, names[i], len - 4);
+        key[len - 4] = '\0';
+        if (!g_hash_table_contains(cache->pixbufs, key)) {image_decode(cache, key);}
+    }
+    g_strfreev(names);
+}
+
+void image_cache_get_stats(image_cache *cache, image_cache_stats *stats)
+{
+    *stats = cache->stats;
+}
+
+void image_cache_print_stats(image_cache *cache)
+{
+    printf("Images: %u decoded in %.1f ms, %u missing, %llu cache hits\n",
+           cache->stats.decoded, (double)cache->stats.decode_ns / NSEC_PER_MSEC, cache->stats.missing,
+           (unsigned long long)cache->stats.hits);
+}
@@ -0,0 +1,39 @@
+/**************************************************
+ * Decoded icon cache
+ * Icons are PNGs in the compiled-in resource bundle and
+ * are looked up by name and state, e.g. ("fan", "on") is
+ * image/fanon.png. Each one is decoded at most once; the
+ * same GdkPixbuf is handed out for every later lookup,
+ * so swapping an icon state is a pointer change and
+ * never touches the PNG decoder. A missing icon is
+ * reported once and remembered as missing.
+ * All functions must be called from the GTK main thread.
+ * ************************************************/
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <gtk/gtk.h>
+
+typedef struct image_cache image_cache;
+
+typedef struct {
+    guint decoded;
+    guint missing;          //names asked for that have no icon
+    guint64 hits;
+    gint64 decode_ns;
+} image_cache_stats;
+
+//prefix is the resource directory holding the icons, e.g. "/com/lfs/monitor/image"
+image_cache *image_cache_new(const gchar *prefix);
+void image_cache_free(image_cache *cache);
+
+//state may be NULL; the pixbuf belongs to the cache, NULL if there is no such icon
+GdkPixbuf *image_cache_get(image_cache *cache, const gchar *name, const gchar *state);
+
+//decode every icon of the bundle that is not cached yet
+void image_cache_preload(image_cache *cache);
+
+void image_cache_get_stats(image_cache *cache, image_cache_stats *stats);
+void image_cache_print_stats(image_cache *cache);
+
+#endif
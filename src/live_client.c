@@ -0,0 +1,83 @@
+/**************************************************
+ * Live data client library, see live_client.h
+ * ************************************************/
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "live_client.h"
+#include "monotime.h"
+
+#define LIVE_READ_TRIES 1000
+
+struct live_client {
+    live_segment *seg;
+};
+
+live_client *live_client_open(const gchar *name)
+{
+    live_client *c;
+    live_segment *seg;
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {return NULL;}
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(live_segment)) {
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(live_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {return NULL;}
+    atomic_thread_fence(memory_order_acquire);
+    if (seg->magic != LIVE_MAGIC || seg->version != LIVE_LAYOUT_VERSION || seg->record_size != sizeof(live_record)) {
+        munmap(seg, sizeof(live_segment));
+        return NULL;
+    }
+    c = g_new0(live_client, 1);
+    c->seg = seg;
+    return c;
+}
+
+void live_client_close(live_client *c)
+{
+    if (c == NULL) {return;}
+    munmap(c->seg, sizeof(live_segment));
+    g_free(c);
+}
+
+guint live_client_n_channels(live_client *c)
+{
+    return MIN(atomic_load_explicit(&c->seg->n_records, memory_order_acquire), LIVE_MAX_RECORDS);
+}
+
+gint live_client_find(live_client *c, const gchar *name)
+{
+    guint n = live_client_n_channels(c);
+
+    for (guint i = 0; i < n; i++) {
+        if (strncmp(c->seg->dir[i].name, name, LIVE_NAME_MAX) == 0) {return i;}
+    }
+    return -1;
+}
+
+const gchar *live_client_name(live_client *c, guint channel) {return c->seg->dir[channel].name;}
+
+const gchar *live_client_unit(live_client *c, guint channel) {return c->seg->dir[channel].unit;}
+
+gboolean live_client_read(live_client *c, guint channel, live_value *v)
+{
+    if (channel >= live_client_n_channels(c)) {return FALSE;}
+    //the mapping is read-only, snapshot reads only load
+    return snapshot_try_read(&c->seg->records[channel].cell, v, sizeof(*v), LIVE_READ_TRIES) != 0;
+}
+
+gboolean live_client_alive(live_client *c, gint64 max_age_ns)
+{
+    gint64 beat = atomic_load_explicit(&c->seg->heartbeat_ns, memory_order_relaxed);
+
+    if (atomic_load_explicit(&c->seg->state, memory_order_acquire) != LIVE_RUNNING) {return FALSE;}
+    return mono_ns() - beat <= max_age_ns;
+}
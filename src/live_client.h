@@ -0,0 +1,39 @@
+/**************************************************
+ * Live data client library
+ * Maps the segment published by the monitor (see
+ * live_shm.h) read-only. Opening costs a few system
+ * calls; a read after that is a seqlock copy out of
+ * mapped memory with no system call and no lock, so any
+ * number of local processes can poll it as fast as they
+ * like without touching the sensor buses. A reader never
+ * blocks the monitor; a read torn by a concurrent write
+ * is retried a bounded number of times.
+ * Build against live_client.o and snapshot.o.
+ * ************************************************/
+#ifndef LIVE_CLIENT_H
+#define LIVE_CLIENT_H
+
+#include <glib.h>
+#include "live_shm.h"
+
+typedef struct live_client live_client;
+
+//NULL if the segment does not exist or has another layout version
+live_client *live_client_open(const gchar *name);
+void live_client_close(live_client *c);
+
+guint live_client_n_channels(live_client *c);
+//channel id by name, -1 if there is none
+gint live_client_find(live_client *c, const gchar *name);
+const gchar *live_client_name(live_client *c, guint channel);
+const gchar *live_client_unit(live_client *c, guint channel);
+
+//consistent copy of the latest value; FALSE if nothing was written yet
+//or the writer kept it busy for every retry
+gboolean live_client_read(live_client *c, guint channel, live_value *v);
+
+//FALSE once the monitor closed the segment or has not sent a heartbeat for
+//max_age_ns; a restarted monitor creates a new segment, reopen to follow it
+gboolean live_client_alive(live_client *c, gint64 max_age_ns);
+
+#endif
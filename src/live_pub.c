@@ -0,0 +1,110 @@
+/**************************************************
+ * Live data publisher, see live_pub.h
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "live_pub.h"
+#include "monotime.h"
+
+struct live_pub {
+    gchar *name;
+    live_segment *seg;
+    guint n_records;
+    //per channel, only touched by the thread writing that channel
+    guint64 seq[LIVE_MAX_RECORDS];
+};
+
+live_pub *live_pub_open(const gchar *name)
+{
+    live_pub *pub;
+    live_segment *seg;
+    int fd;
+
+    //a segment left behind by a crashed run is replaced, its readers see it closed
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        printf("Error: cannot create %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(live_segment)) < 0) {
+        printf("Error: cannot size %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(live_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        printf("Error: cannot map %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+    //ftruncate zero-filled the object, only the header needs setting
+    seg->version = LIVE_LAYOUT_VERSION;
+    seg->record_size = sizeof(live_record);
+    seg->generation = real_ns();
+    for (guint i = 0; i < LIVE_MAX_RECORDS; i++) {snapshot_init(&seg->records[i].cell);}
+    atomic_store_explicit(&seg->heartbeat_ns, mono_ns(), memory_order_relaxed);
+    atomic_store_explicit(&seg->state, LIVE_RUNNING, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    seg->magic = LIVE_MAGIC;
+
+    pub = g_new0(live_pub, 1);
+    pub->name = g_strdup(name);
+    pub->seg = seg;
+    return pub;
+}
+
+void live_pub_close(live_pub *pub)
+{
+    if (pub == NULL) {return;}
+    atomic_store_explicit(&pub->seg->state, LIVE_CLOSED, memory_order_release);
+    munmap(pub->seg, sizeof(live_segment));
+    shm_unlink(pub->name);
+    g_free(pub->name);
+    g_free(pub);
+}
+
+gint live_pub_add(live_pub *pub, const gchar *name, const gchar *unit)
+{
+    live_entry *e;
+
+    if (pub->n_records >= LIVE_MAX_RECORDS) {return -1;}
+    e = &pub->seg->dir[pub->n_records];
+    g_strlcpy(e->name, name, sizeof(e->name));
+    g_strlcpy(e->unit, unit ? unit : "", sizeof(e->unit));
+    //publish the directory entry before the record count that makes it visible
+    atomic_store_explicit(&pub->seg->n_records, pub->n_records + 1, memory_order_release);
+    return pub->n_records++;
+}
+
+void live_pub_set(live_pub *pub, gint channel, gdouble value, gint64 ts_ns)
+{
+    live_value v;
+
+    if (pub == NULL || channel < 0 || (guint)channel >= pub->n_records) {return;}
+    v.value = value;
+    v.ts_ns = ts_ns;
+    v.seq = ++pub->seq[channel];
+    snapshot_write(&pub->seg->records[channel].cell, &v, sizeof(v));
+}
+
+void live_pub_heartbeat(live_pub *pub, gint64 now)
+{
+    if (pub == NULL) {return;}
+    atomic_store_explicit(&pub->seg->heartbeat_ns, now, memory_order_relaxed);
+}
+
+void live_pub_print_stats(live_pub *pub)
+{
+    guint64 writes = 0;
+
+    for (guint i = 0; i < pub->n_records; i++) {writes += pub->seq[i];}
+    printf("Live data: %u channels in %s, %llu writes\n", pub->n_records, pub->name, (unsigned long long)writes);
+}
@@ -0,0 +1,34 @@
+/**************************************************
+ * Live data publisher
+ * Owns the shared memory segment described in live_shm.h
+ * and writes the latest value of each channel into it.
+ * Writing is a seqlock store into mapped memory: no
+ * system call, no lock, never waits for a reader. Each
+ * channel must have a single writing thread; different
+ * channels can be written from different threads.
+ * The segment is marked closed and removed on close; a
+ * new run creates a fresh one with a new generation.
+ * ************************************************/
+#ifndef LIVE_PUB_H
+#define LIVE_PUB_H
+
+#include <glib.h>
+#include "live_shm.h"
+
+typedef struct live_pub live_pub;
+
+//create the segment, replacing a stale one; NULL if shared memory is not available
+live_pub *live_pub_open(const gchar *name);
+//mark the segment closed and remove it
+void live_pub_close(live_pub *pub);
+
+//channel id for the writes below, -1 when full; unit may be NULL
+gint live_pub_add(live_pub *pub, const gchar *name, const gchar *unit);
+//latest value of a channel, a no-op for channel -1 or a NULL publisher
+void live_pub_set(live_pub *pub, gint channel, gdouble value, gint64 ts_ns);
+//tell readers the writer is alive, a no-op for a NULL publisher
+void live_pub_heartbeat(live_pub *pub, gint64 now);
+
+void live_pub_print_stats(live_pub *pub);
+
+#endif
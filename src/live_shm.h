@@ -0,0 +1,61 @@
+/**************************************************
+ * Layout of the live data segment
+ * The monitor publishes every sensor reading and output
+ * state into one POSIX shared memory object, shared by
+ * live_pub.c (the only writer) and live_client.c (any
+ * number of readers in other processes). A record is a
+ * snapshot cell holding the latest value of one channel,
+ * on its own cache lines so channels written by
+ * different threads never share a line. The directory
+ * of names is written before n_records is raised, so a
+ * reader never sees a record without its name.
+ * Change LIVE_LAYOUT_VERSION with any change to this file.
+ * ************************************************/
+#ifndef LIVE_SHM_H
+#define LIVE_SHM_H
+
+#include <glib.h>
+#include <stdatomic.h>
+#include "snapshot.h"
+
+#define LIVE_SHM_NAME "/monitor_live"
+#define LIVE_MAGIC 0x4C495645
+#define LIVE_LAYOUT_VERSION 1
+#define LIVE_MAX_RECORDS 64
+#define LIVE_NAME_MAX 24
+#define LIVE_UNIT_MAX 8
+
+typedef enum {
+    LIVE_CLOSED = 0,
+    LIVE_RUNNING
+} live_state;
+
+//payload of a record
+typedef struct {
+    gdouble value;
+    gint64 ts_ns;       //CLOCK_MONOTONIC of the sample
+    guint64 seq;        //writes to this record so far
+} live_value;
+
+typedef struct {
+    gchar name[LIVE_NAME_MAX];
+    gchar unit[LIVE_UNIT_MAX];
+} live_entry;
+
+typedef struct {
+    snapshot_cell cell;
+} __attribute__((aligned(64))) live_record;
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 record_size;
+    _Atomic guint32 state;
+    _Atomic guint32 n_records;
+    guint64 generation;         //writer start, wall clock ns, changes with every restart
+    _Atomic gint64 heartbeat_ns;    //CLOCK_MONOTONIC, refreshed by the writer
+    live_entry dir[LIVE_MAX_RECORDS];
+    live_record records[LIVE_MAX_RECORDS];
+} live_segment;
+
+#endif
@@ -21,6 +21,8 @@
 //#include <inttypes.h>  // uint8_t, etc
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
 //system access
 #include <sys/ioctl.h>
 #include <fcntl.h>
@@ -30,23 +32,249 @@
 #include <gtk/gtk.h>
 #include <bcm2835.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <X11/Xlib.h>
 #include <modbus.h>
+//local modules
+#include "reactor.h"
+#include "gpio_input.h"
+#include "gpio_scan.h"
+#include "actuator.h"
+#include "control.h"
+#include "alarm.h"
+#include "live_pub.h"
+#include "live_client.h"
+#include "modbus_tcp.h"
+#include "modbus_registry.h"
+#include "capture.h"
+#include "replay.h"
+#include "ads1115.h"
+#include "dsp.h"
+#include "snapshot.h"
+#include "tsdb.h"
+#include "seglog.h"
+#include "trend_chart.h"
+#include "ui_update.h"
+#include "countdown.h"
+#include "image_cache.h"
+#include "monotime.h"
+#include "metrics.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "rate_adapt.h"
 
+//RS-485 buses and sensors, see modbus_registry.h for the format; without
+//the file only the climate sensor below is polled
+#define SENSOR_FILE "sensors.ini"
+#define CLIMATE_SENSOR "climate"
+//medical gas panel, when sensors.ini has one: input registers 0-4 are the
+//O2, N2O, CO2, vacuum and AGSS line pressures in kPa, vacuum negative
+#define GAS_SENSOR "gas"
 //declaration for MODBUS RTU unit
 #define SERVER_ID 1
-const uint8_t req[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x02, 0x71, 0xCB};
-uint8_t req_length;
+//temperature and humidity input registers, polled once per second until the
+//adaptive rates below take over
+const mb_block climate_blocks[] = {
+    {0x04, 0x0000, 2, 1000},
+};
+const mb_device sensor_devices[] = {
+    {CLIMATE_SENSOR, SERVER_ID, climate_blocks, G_N_ELEMENTS(climate_blocks)},
+};
+//adaptive polls may fill half of the bus time
+const mb_poll_config sensor_bus = {
+    "/dev/ttyUSB0", 9600, 'N', 8, 1,
+    500, 100, 10000,
+    sensor_devices, G_N_ELEMENTS(sensor_devices), 50
+};
+//adaptive sampling, see rate_adapt.h: fast and slow period in ms, noise, the
+//rate of change per second and the distance to an alarm limit that call for
+//the fast period. A sensor block is polled at the period of its most urgent
+//register; the slow periods stay well inside the watchdog deadlines. A gas
+//supply can fail within a second without warning, so gas is never polled
+//slower than once a second
+const rate_adapt_config temp_rate = {100, 3000, 0.05, 0.05, 0.5};
+const rate_adapt_config humid_rate = {250, 3000, 0.2, 0.2, 1.0};
+const rate_adapt_config gas_rate = {200, 1000, 2.0, 5.0, 10.0};
+//pressure sets the ADC data rate, 32 to 250 samples/s
+const rate_adapt_config pressure_rate = {4, 32, 0.05, 2.0, 2.0};
+
+//ADS1115 on the default i2c bus of the Raspberry Pi, pressure sensor on AIN0
+#define ADC_BUS "/dev/i2c-1"
+#define ADC_ADDR 0x48
+const ads1115_config adc_config = {
+    {ADS1115_MUX_AIN0}, 1, ADS1115_DR_128
+};
+#define ADC_RING_SIZE 4096
+//differential pressure: 128 SPS averaged 8:1, median of 5 against spikes,
+//0.5 Hz Butterworth low-pass, transducer output 0.5-3.5 V for -50..+50 Pa
+const dsp_config pressure_filter = {
+    8, 5, DSP_LOWPASS_BIQUAD, 128.0, 0.5,
+    {{4000, -50.0}, {28000, 50.0}}, 2
+};
+
+//history kept for trends and alarms: 1 s buckets for a day, 1 min for a week,
+//15 min for a month, plus the most recent raw samples
+#define SEC_NS 1000000000LL
+const tsdb_config climate_history = {
+    3600, {{SEC_NS, 86400}, {60 * SEC_NS, 10080}, {900 * SEC_NS, 2880}}, 3
+};
+const tsdb_config pressure_history = {
+    65536, {{SEC_NS, 86400}, {60 * SEC_NS, 10080}, {900 * SEC_NS, 2880}}, 3
+};
+
+//persistent sensor log: 2 MB segments, at most 64 of them on the SD card,
+//flushed every 16 blocks or every 10 s
+const seglog_config log_config = {"log", 10000, 16, 64};
+enum {LOG_TEMP = 1, LOG_HUMID, LOG_PRESSURE};
+
+//climate loop at 10 Hz: heater PID over a 10 s relay window, full power
+//from 2 degC below target, fan 1 degC above target, humidifier 5 %RH below,
+//relays switch at most every 30 s, outputs off after 5 s without a reading
+const control_config climate_control = {
+    100, 30, 2000, 5000,
+    {0.5, 0.005, 20.0, 0.0, 1.0, 0.02},
+    10000, 1.0, 5.0, 30000
+};
+
+//alarm rules, see alarm.h for the format; without the file the rules below
+//apply. Rates are smoothed over 10 s, the alarm beacon follows unacknowledged
+//alarms of priority 2 and up
+#define ALARM_FILE "alarms.ini"
+#define ALARM_RATE_WINDOW_MS 10000
+#define ALARM_BEACON_PRIORITY 2
+const alarm_rule alarm_rules[] = {
+    {"temperature high", "temperature", ALARM_ABOVE, 28.0, 0.5, 60000, FALSE, 2},
+    {"temperature low", "temperature", ALARM_BELOW, 16.0, 0.5, 60000, FALSE, 2},
+    {"temperature rising fast", "temperature", ALARM_RISING, 2.0, 0.5, 0, FALSE, 1},
+    {"humidity high", "humidity", ALARM_ABOVE, 70.0, 2.0, 60000, FALSE, 1},
+    {"humidity low", "humidity", ALARM_BELOW, 30.0, 2.0, 60000, FALSE, 1},
+    {"room pressure low", "pressure", ALARM_BELOW, 2.5, 1.0, 30000, TRUE, 3},
+    {"O2 supply low", "o2", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 3},
+    {"O2 supply high", "o2", ALARM_ABOVE, 480.0, 10.0, 5000, TRUE, 3},
+    {"N2O supply low", "n2o", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 3},
+    {"CO2 supply low", "co2", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 2},
+    {"vacuum weak", "vacuum", ALARM_ABOVE, -40.0, 5.0, 5000, TRUE, 3},
+    {"AGSS flow low", "agss", ALARM_BELOW, 1.0, 0.2, 10000, TRUE, 2},
+};
+//signals whose widget gets the "alarm" style class while one of their rules is up,
+//the gas signals in the order of the gas panel registers
+enum {VIEW_TEMP, VIEW_HUMID, VIEW_PRESSURE, VIEW_GAS, VIEW_GAS_N = 5, ALARM_VIEWS = VIEW_GAS + VIEW_GAS_N};
+const gchar *alarm_signals[ALARM_VIEWS] = {
+    "temperature", "humidity", "pressure", "o2", "n2o", "co2", "vacuum", "agss"
+};
+
+//every reading and output is published to shared memory for other local
+//processes, see live_client.h and monitor_read
+enum {
+    PUB_TEMP, PUB_HUMID, PUB_PRESSURE, PUB_PRESSURE_RAW, PUB_GAS,
+    PUB_CONTACT = PUB_GAS + 5, PUB_HEATER, PUB_FAN, PUB_HUMIDIFIER,
+    PUB_LIGHT1, PUB_LIGHT2, PUB_UV, PUB_BEACON, PUB_ALARMS, PUB_OP_TIMER, PUB_AN_TIMER, PUB_CHANNELS
+};
+const gchar *live_channels[PUB_CHANNELS][2] = {
+    {"temperature", "degC"}, {"humidity", "%RH"}, {"pressure", "Pa"}, {"pressure_raw", "counts"},
+    {"o2", "kPa"}, {"n2o", "kPa"}, {"co2", "kPa"}, {"vacuum", "kPa"}, {"agss", "kPa"},
+    {"contact", NULL}, {"heater", "duty"}, {"fan", NULL}, {"humidifier", NULL},
+    {"light1", NULL}, {"light2", NULL}, {"uv", NULL}, {"alarm_beacon", NULL}, {"alarms", NULL},
+    {"operation_timer", "s"}, {"anesthesia_timer", "s"}
+};
+
+//Modbus TCP slave for the building management system, answering reads from
+//the live data above, see modbus_tcp.h; it shares the service reactor thread
+//with the metrics endpoint
+#define BMS_PORT 502
+#define BMS_MAX_CLIENTS 256
+#define BMS_IDLE_MS 60000
+#define SERVICE_CPU 2
+//counters and latency histograms in the Prometheus text format, for
+//curl --unix-socket or the --stats option of a second instance
+#define METRICS_SOCKET "/tmp/monitor_metrics.sock"
+//sample trace, SIGUSR1 turns tracing on and off, SIGUSR2 writes what the
+//trace rings hold to this file, for chrome://tracing or ui.perfetto.dev
+#define TRACE_FILE "/tmp/monitor_trace.json"
+//input and holding registers alike: 0-2 climate, 3-7 gas panel, 8-12 contact
+//and outputs, 13-14 countdowns in seconds, 100-105 climate as float32
+const mbtcp_reg bms_registers[] = {
+    {0, "temperature", 100, MBTCP_INT16},
+    {1, "humidity", 100, MBTCP_INT16},
+    {2, "pressure", 10, MBTCP_INT16},
+    {3, "o2", 1, MBTCP_INT16},
+    {4, "n2o", 1, MBTCP_INT16},
+    {5, "co2", 1, MBTCP_INT16},
+    {6, "vacuum", 1, MBTCP_INT16},
+    {7, "agss", 1, MBTCP_INT16},
+    {8, "contact", 1, MBTCP_UINT16},
+    {9, "heater", 1000, MBTCP_UINT16},
+    {10, "fan", 1, MBTCP_UINT16},
+    {11, "humidifier", 1, MBTCP_UINT16},
+    {12, "alarms", 1, MBTCP_UINT16},
+    {13, "operation_timer", 1, MBTCP_UINT16},
+    {14, "anesthesia_timer", 1, MBTCP_UINT16},
+    {100, "temperature", 1, MBTCP_FLOAT32},
+    {102, "humidity", 1, MBTCP_FLOAT32},
+    {104, "pressure", 1, MBTCP_FLOAT32},
+};
+const mbtcp_config bms_config = {
+    BMS_PORT, BMS_MAX_CLIENTS, BMS_IDLE_MS, bms_registers, G_N_ELEMENTS(bms_registers)
+};
+
+//UI, style sheet and icons are compiled in from src/resources.gresource.xml
+#define RESOURCE_PREFIX "/com/lfs/monitor"
+
+//running countdowns are saved here and picked up again after a restart
+#define TIMER_STATE_FILE "timers.ini"
+
+//all acquisition runs on one reactor thread, kept off CPU 0 where the GUI
+//and most interrupts end up
+#define REACTOR_CPU 3
+//freshness deadlines: the acquisition reactor beats every 100 ms, the sensors
+//are polled every second and the ADC converts continuously. A reading past its
+//deadline, or any reading while the reactor is stuck, is shown grayed out;
+//the gas icons follow the gas sensor
+#define WD_BEAT_MS 100
+#define WD_ACQ_MS 1000
+#define WD_CLIMATE_MS 5000
+#define WD_GAS_MS 5000
+#define WD_PRESSURE_MS 2000
+enum {FRESH_REAL_TEMP, FRESH_REAL_HUMID, FRESH_TEMP, FRESH_HUMID, FRESH_PRESSURE, FRESH_GAS,
+      FRESH_VIEWS = FRESH_GAS + VIEW_GAS_N};
 
 //LED output pin 
 #define PIN_OUT RPI_GPIO_P1_11
 #define PIN_IN RPI_GPIO_P1_15
+//relays for the two lights and the UV lamp
+#define PIN_LIGHT1 RPI_GPIO_P1_16
+#define PIN_LIGHT2 RPI_GPIO_P1_18
+#define PIN_UV RPI_GPIO_P1_22
+//climate relays: heater, circulation fan, humidifier
+#define PIN_HEATER RPI_GPIO_P1_12
+#define PIN_FAN RPI_GPIO_P1_13
+#define PIN_HUMID RPI_GPIO_P1_07
+//alarm beacon
+#define PIN_ALARM RPI_GPIO_P1_26
+//dry contact lines are requested from the GPIO character device,
+//the bcm2835 pin numbers are the gpiochip0 line offsets
+#define GPIO_CHIP "/dev/gpiochip0"
+#define CONTACT_DEBOUNCE_US 20000
+//gas supply and filter status switches, each closes to ground while its
+//supply is up; the whole bank is scanned every ms and a switch must hold
+//for 10 scans
+#define STATUS_SCAN_US 1000
+#define STATUS_DEBOUNCE 10
+#define STATUS_LINES 6
+typedef struct {
+    guint pin;
+    const gchar *widget;    //glade id of the icon
+    const gchar *image;     //image_cache name, image/<name>on.png while the line is active, <name>off.png otherwise
+} status_line;
+const status_line status_lines[STATUS_LINES] = {
+    {RPI_BPLUS_GPIO_J8_29, "img_o2", "o2"},
+    {RPI_BPLUS_GPIO_J8_31, "img_n2o", "n2"},
+    {RPI_BPLUS_GPIO_J8_32, "img_co2", "co2"},
+    {RPI_BPLUS_GPIO_J8_33, "img_vac", "vac"},
+    {RPI_BPLUS_GPIO_J8_36, "img_agss", "agss"},
+    {RPI_BPLUS_GPIO_J8_35, "img_filter", "filt"},
+};
 
-//mutex lock to protect access to memory when threading
-GMutex mutex_lock_1;
-GMutex mutex_lock_2;
-GMutex mutex_lock_3;
-GMutex mutex_lock_4;
 uint8_t is_contact;
 
 //widgets struct
@@ -123,212 +351,458 @@ typedef struct {
     
     GtkWidget *btn_run_back;
     GtkWidget *btn_run_shut;
+    //24 hour trend of temperature, humidity and pressure
+    trend_chart *trend;
+    //coalesced label updates, one slot per periodically written label
+    ui_updater *ui;
+    guint ui_real_temp;
+    guint ui_real_hu;
+    guint ui_temp;
+    guint ui_hu;
+    guint ui_pre;
+    guint ui_date;
+    guint ui_time;
+    guint ui_op_hrs;
+    guint ui_op_mnt;
+    guint ui_op_sec;
+    guint ui_an_hrs;
+    guint ui_an_mnt;
+    guint ui_an_sec;
     
-    //clock var
-    int8_t op_hrs;
-    int8_t op_mnt;
-    int8_t op_sec;
-    int8_t an_hrs;
-    int8_t an_mnt;
-    int8_t an_sec;
+    //decoded icons, shared by every image widget
+    image_cache *images;
+    gint64 start_ns;
+    //operation and anethesia countdowns
+    countdown_engine *timers;
+    guint op_timer;
+    guint an_timer;
     int8_t data;
-    //sensor var
-    uint8_t *rsp;
-    uint16_t temp;
-    uint16_t humid;
-    //adc var
-    float adc_val;
+    //acquisition reactor driving the contact, sensor and ADC state machines
+    reactor *acq;
+    //relay outputs, all written by the actuator worker
+    actuator *outputs;
+    gint out_relay1;
+    gint out_light1;
+    gint out_light2;
+    gint out_uv;
+    //temperature and humidity loop
+    control *climate_ctl;
+    gboolean heater_shown;
+    gboolean fan_shown;
+    //alarm rules fed by every producer, and the widgets showing them
+    alarm_engine *alarms;
+    gint alarm_sig[ALARM_VIEWS];
+    GtkWidget *alarm_view[ALARM_VIEWS];
+    gboolean alarm_shown[ALARM_VIEWS];
+    gint out_alarm;
+    //freshness of the acquired signals, and the labels grayed out while stale
+    watchdog *wd;
+    gint wd_acq;
+    gint wd_climate;
+    gint wd_gas;
+    gint wd_pressure;
+    gint fresh_sig[FRESH_VIEWS];
+    GtkWidget *fresh_view[FRESH_VIEWS];
+    gboolean stale_shown[FRESH_VIEWS];
+    //sample rates following the signals
+    rate_adapt *temp_rate;
+    rate_adapt *humid_rate;
+    rate_adapt *gas_rate[VIEW_GAS_N];
+    rate_adapt *pressure_rate;
+    guint8 adc_rate;
+    //raw device traffic being recorded, or the recording played back instead
+    capture *rec;
+    replay *replay;
+    gboolean replay_exit;
+    //live data for other processes, NULL without shared memory
+    live_pub *live;
+    gint live_ch[PUB_CHANNELS];
+    //building management server reading the live data back, and the metrics
+    reactor *svc;
+    live_client *bms_live;
+    mbtcp_server *bms_server;
+    metrics_server *metrics;
+    //dry contact input
+    gpio_input *contacts;
+    volatile gint contact_pending;
+    //status switches and the icons bound to them
+    gpio_scan *status_in;
+    guint status_slot[STATUS_LINES];
+    volatile gint status_pending;
+    //sensor var, latest reading published by the reactor thread
+    mb_registry *sensors;
+    gint climate_sensor;
+    gint gas_sensor;
+    snapshot_cell climate;
+    //adc var, latest reading published by the ring consumer
+    ads1115 *adc;
+    sample_ring *adc_ring;
+    dsp_filter *pressure_dsp;
+    snapshot_cell pressure;
+    guint64 adc_seq;
+    //history
+    tsdb_series *hist_temp;
+    tsdb_series *hist_humid;
+    tsdb_series *hist_pressure;
+    seglog *log;
     //adjust temp&humidity
     uint8_t adj_temp;
     uint8_t adj_hu;
 } app_widgets;
 
-//this function is one of the main thread to send a query to modbus sensor compliant with datasheet, then the 
-//sensor will return an array of data to read and update in app_widgets structure
-//and ready for further processing
-int read_modbus_sensor(app_widgets *widgets)
-{
-    modbus_t *ctx;
-    //allocate memory for sensor reading
-    widgets->rsp = (uint8_t*) malloc(MODBUS_RTU_MAX_ADU_LENGTH * sizeof(uint8_t));
-    memset(widgets->rsp, 0, MODBUS_RTU_MAX_ADU_LENGTH * sizeof(uint8_t));
-    //create new connect to RTU
-    ctx = modbus_new_rtu("/dev/ttyUSB0", 9600, 'N', 8, 1);
-    modbus_set_slave(ctx, SERVER_ID);
-    
-    if (modbus_connect(ctx) == -1) {
-        printf("Connection failed: %s\n",
-        modbus_strerror(errno));
-        modbus_free(ctx);
-        return -1;
-		}
-		else 
-        {printf("Connection succeeded\n");}
-    while(1){   
-    req_length = modbus_send_raw_request(ctx, req, 8*sizeof(uint8_t));
-    if(req_length < 0) {printf("read failed :(\n");}
-	modbus_receive_confirmation(ctx, widgets->rsp);
-	widgets->temp = ((widgets->rsp[3]<<8)|widgets->rsp[4]);
-	widgets->humid = ((widgets->rsp[5]<<8)|widgets->rsp[6]);	
-    }
-	    free(widgets->rsp);
-	    modbus_close(ctx);
-	    modbus_free(ctx);
-        return 0;
+//publish a climate reading and keep it in the history, called from the thread
+//producing the readings: the reactor for the sensor, the control loop for the
+//simulated plant
+void on_climate_reading(const climate_reading *reading_in, app_widgets *widgets)
+{
+    climate_reading reading = *reading_in;
+    
+    climate_publish(&widgets->climate, &reading);
+    watchdog_feed(widgets->wd, widgets->wd_climate, reading.ts_ns);
+    alarm_engine_update(widgets->alarms, widgets->alarm_sig[VIEW_TEMP], (float)(reading.temp)/100, reading.ts_ns);
+    alarm_engine_update(widgets->alarms, widgets->alarm_sig[VIEW_HUMID], (float)(reading.humid)/100, reading.ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_TEMP], (float)(reading.temp)/100, reading.ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_HUMID], (float)(reading.humid)/100, reading.ts_ns);
+    tsdb_append(widgets->hist_temp, reading.ts_ns, (float)(reading.temp)/100);
+    tsdb_append(widgets->hist_humid, reading.ts_ns, (float)(reading.humid)/100);
+    if(widgets->log)
+    {
+    seglog_append(widgets->log, LOG_TEMP, reading.ts_ns, (float)(reading.temp)/100);
+    seglog_append(widgets->log, LOG_HUMID, reading.ts_ns, (float)(reading.humid)/100);
+    }
+}
+
+//next sample period of a signal from how fast it moves and how close it is to an alarm limit
+static gint64 adapt_rate(app_widgets *widgets, rate_adapt *ra, guint view, gdouble value, gint64 ts_ns)
+{
+    gint direction;
+    gdouble margin = alarm_engine_signal_margin(widgets->alarms, widgets->alarm_sig[view], value, &direction);
+    
+    return rate_adapt_update(ra, value, margin, direction, ts_ns);
 }
 
-void ADCread(app_widgets *widgets)
-{
-    int fd;
-    uint8_t ads_addr = 0x48;
-    uint8_t *buf;
-    buf = (uint8_t*)malloc(sizeof(uint8_t)*10);
-    fd = open("/dev/i2c-1", O_RDWR);
-    ioctl(fd, I2C_SLAVE, ads_addr);
-    // open device on /dev/i2c-1 the default on Raspberry Pi B
-    /*if ((fd = open("/dev/i2c-1", O_RDWR)) < 0) {
-	printf("Error: Couldn't open device! %d\n", fd);
-	exit(-1);
-    }
-    // connect to ads1115 as i2c slave
-    if (ioctl(fd, I2C_SLAVE, ads_addr) < 0) {
-	printf("Error: Couldn't find device on address!\n");
-	exit(-1);
-    }*/
-    //conversion
-    while(1){
-	buf[0] = 1;
-	buf[1] = 0xc3;
-	buf[2] = 0x05;
-      if (write(fd, buf, 3) != 3) {
-	perror("Write to register 1");
-	exit(-1);
-	}
-      do{
-	if (read(fd, buf, 2) != 2) {
-	  perror("Read conversion");
-	  exit(-1);
-	}
-	} while ((buf[0] & 0x80) == 0);
-	buf[0] = 0;   // conversion register is 0
-      if (write(fd, buf, 1) != 1) {
-	perror("Write register select");
-	exit(-1);
-	}
-      if (read(fd, buf, 2) != 2) {
-	perror("Read conversion");
-	exit(-1);
-	}
-      widgets->adc_val = (float)(((int16_t)buf[0]*256 + (uint16_t)buf[1])*4.096/32768.0);
-      printf("%f \n", widgets->adc_val);
-	}
-	close(fd);
-	free(buf);
+//called from the polling thread with a validated response from any modbus sensor,
+//register 0 of the climate sensor is temperature and register 1 humidity in 0.01 units
+void on_modbus_sample(const mb_sample *sample, app_widgets *widgets)
+{
+    climate_reading reading;
+    gint64 period = G_MAXINT64, p;
+    
+    if(sample->block != 0) {return;}
+    if(sample->device == (guint)widgets->gas_sensor)
+    {
+    watchdog_feed(widgets->wd, widgets->wd_gas, sample->ts_ns);
+    for(guint i = 0; i < sample->count && i < VIEW_GAS_N; i++)
+    {
+    alarm_engine_update(widgets->alarms, widgets->alarm_sig[VIEW_GAS + i], (gint16)sample->regs[i], sample->ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_GAS + i], (gint16)sample->regs[i], sample->ts_ns);
+    p = adapt_rate(widgets, widgets->gas_rate[i], VIEW_GAS + i, (gint16)sample->regs[i], sample->ts_ns);
+    period = MIN(period, p);
+    }
+    mb_registry_set_period(widgets->sensors, sample->device, sample->block, period / NSEC_PER_MSEC);
+    return;
     }
+    if(sample->device != (guint)widgets->climate_sensor) {return;}
+    reading.temp = sample->regs[0];
+    reading.humid = sample->regs[1];
+    reading.seq = sample->seq;
+    reading.ts_ns = sample->ts_ns;
+    on_climate_reading(&reading, widgets);
+    period = adapt_rate(widgets, widgets->temp_rate, VIEW_TEMP, (float)(reading.temp)/100, reading.ts_ns);
+    p = adapt_rate(widgets, widgets->humid_rate, VIEW_HUMID, (float)(reading.humid)/100, reading.ts_ns);
+    period = MIN(period, p);
+    mb_registry_set_period(widgets->sensors, sample->device, sample->block, period / NSEC_PER_MSEC);
+}
+
+//run the converter at the slowest data rate that still samples every period
+//and that the filter can follow; the samples still converting at the old rate
+//are too few to matter behind its 0.5 Hz corner
+static void set_adc_rate(app_widgets *widgets, gint64 period)
+{
+    guint8 rate = ADS1115_DR_860;
+    
+    for(guint8 dr = ADS1115_DR_8; dr < ADS1115_DR_860; dr++)
+    {
+    if(NSEC_PER_SEC / ads1115_rate_sps(dr) <= period) {rate = dr; break;}
+    }
+    if(rate == widgets->adc_rate) {return;}
+    //the filter refuses rates with its corner at or above half the sample rate
+    while(dsp_filter_set_rate(widgets->pressure_dsp, ads1115_rate_sps(rate)) != 0)
+    {
+    if(rate == ADS1115_DR_860) {return;}
+    rate++;
+    }
+    if(rate == widgets->adc_rate) {return;}
+    if(ads1115_set_data_rate(widgets->adc, rate) != 0)
+    {
+    dsp_filter_set_rate(widgets->pressure_dsp, ads1115_rate_sps(widgets->adc_rate));
+    return;
+    }
+    widgets->adc_rate = rate;
+}
 
 /**************normal clock **********/
 gboolean clock_timer(app_widgets *widgets)
 {
-    GDateTime *date_time;
-    gchar *dmy_format;
-    gchar *dt_format;
-    
-    date_time = g_date_time_new_now_local();
-    dmy_format = g_date_time_format(date_time, "%d %b %y");
-    dt_format = g_date_time_format(date_time, "%H:%M:%S");
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_date), dmy_format);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_time), dt_format);
-    g_free(dt_format);
-    g_free(dmy_format);
-    g_date_time_unref(date_time);
+    struct timespec now;
+    struct tm local;
+    gchar dmy_format[UI_TEXT_MAX];
+    gchar dt_format[UI_TEXT_MAX];
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &local);
+    strftime(dmy_format, sizeof(dmy_format), "%d %b %y", &local);
+    strftime(dt_format, sizeof(dt_format), "%H:%M:%S", &local);
+    ui_set_text(widgets->ui, widgets->ui_date, "%s", dmy_format);
+    ui_set_text(widgets->ui, widgets->ui_time, "%s", dt_format);
     return TRUE;
     }
 
-void relay1_control(app_widgets *widgets)
-{
-      bcm2835_gpio_fsel(PIN_OUT, BCM2835_GPIO_FSEL_OUTP);
-      while(1)
-      {
-            bcm2835_gpio_write(PIN_OUT, HIGH);
-            //delay(500);
-            //bcm2835_gpio_write(PIN_OUT, LOW);
-            //delay(500);
-            while(gtk_events_pending()){gtk_main_iteration();}
-      } 
-      bcm2835_close(); 
-}
-
 /************************************
- * handler when pin 15 is pulled up
+ * handler for a debounced change on pin 15, queued once
+ * per transition from the input thread
  * **********************************/
 gboolean display_dry_contact(app_widgets *widgets)
 {
-    g_mutex_lock(&mutex_lock_2);
+    g_atomic_int_set(&widgets->contact_pending, 0);
+    is_contact = gpio_input_get_level(widgets->contacts, 0);
+    if(is_contact == 1)
+    {
     widgets->data = 2;
     gchar *text2 = g_strdup_printf("%d", widgets->data);
     //gtk_label_set_text(GTK_LABEL(widgets->contact_lbl),text2);
     g_free(text2);
-    g_mutex_unlock(&mutex_lock_2);
-    return TRUE;
+    }
+    return FALSE;
 }
-/**************************************
- * handler when pin 15 is pulled down
- * ***********************************/
-gboolean display_dry_contact_1(app_widgets *widgets)
-{
-    g_mutex_lock(&mutex_lock_2);
-    //widgets->data = 3;
-    //gchar *text2 = g_strdup_printf("%d", widgets->data);
-    //gtk_label_set_text(GTK_LABEL(widgets->contact_lbl),text2);
-    //g_free(text2);
-    g_mutex_unlock(&mutex_lock_2);
-    return TRUE;
+
+gboolean display_status(app_widgets *widgets)
+{
+    guint32 levels;
+    
+    g_atomic_int_set(&widgets->status_pending, 0);
+    levels = gpio_scan_get_levels(widgets->status_in);
+    for(guint l = 0; l < STATUS_LINES; l++)
+    {
+    ui_set_image(widgets->ui, widgets->status_slot[l],
+                 image_cache_get(widgets->images, status_lines[l].image, (levels >> l) & 1 ? "on" : "off"));
+    }
+    return FALSE;
 }
 
-//this function is one of the main thread to check for dry contact, normally pin 15 is pulled up
-//, if it's pulled down to GND then other function will be called
-void check_dry_contact(app_widgets *widgets)
+//called from the reactor thread after a scan in which status lines changed
+void on_status_changed(guint32 changed, guint32 levels, gint64 ts_ns, app_widgets *widgets)
 {
-    // Set RPI pin P1-15 to be an input
-    bcm2835_gpio_fsel(PIN_IN, BCM2835_GPIO_FSEL_INPT);
-    //  with a pullup
-    bcm2835_gpio_set_pud(PIN_IN, BCM2835_GPIO_PUD_UP);
-    while(1)
+    if(g_atomic_int_compare_and_exchange(&widgets->status_pending, 0, 1))
+    {
+    gdk_threads_add_idle((GSourceFunc)display_status, widgets);
+    }
+}
+
+//called from the input thread, normally pin 15 is pulled up, if it's pulled down to GND
+//the display handler runs. Changes that arrive before the GUI ran the last one are coalesced
+void on_dry_contact_changed(guint line, gint level, gint64 ts_ns, app_widgets *widgets)
+{
+    live_pub_set(widgets->live, widgets->live_ch[PUB_CONTACT], level, ts_ns);
+    if(g_atomic_int_compare_and_exchange(&widgets->contact_pending, 0, 1))
     {
-            is_contact = bcm2835_gpio_lev(PIN_IN);
-            if(is_contact == 1)
-            {
-            gdk_threads_add_idle((GSourceFunc)display_dry_contact, widgets);
-            }
-            else if (is_contact == 0)
-            {
-            gdk_threads_add_idle((GSourceFunc)display_dry_contact_1, widgets);
-            }
-            delay(500);
-            while(gtk_events_pending()){gtk_main_iteration();}
-    }
-    //bcm2835_close();
+    gdk_threads_add_idle((GSourceFunc)display_dry_contact, widgets);
+    }
 }
 
-void display(app_widgets *widgets)
+//the last recorded sample was delivered, queued from the acquisition thread
+gboolean display_replay_done(app_widgets *widgets)
 {
-    g_mutex_lock(&mutex_lock_3);
-    gchar *temp = g_strdup_printf("%.1f°C", (float)(widgets->temp)/100);
-    gchar *humid = g_strdup_printf("%.1f %%", (float)(widgets->humid)/100);
+    printf("Replay: complete\n");
+    if(widgets->replay_exit)
+    {
+    gtk_main_quit();
+    }
+    return FALSE;
+}
+
+void on_replay_done(app_widgets *widgets)
+{
+    gdk_threads_add_idle((GSourceFunc)display_replay_done, widgets);
+}
+
+//report new alarm events, most urgent first, and flag the widgets of the signals in alarm
+static void show_alarms(app_widgets *widgets)
+{
+    static const char *kinds[] = {"raised", "cleared", "acknowledged"};
+    alarm_event ev;
+    guint alarms = 0;
     
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_real_temp), temp);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_real_hu), humid);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_temp), temp);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_hu), humid);
+    alarm_engine_tick(widgets->alarms, mono_ns());
+    while(alarm_engine_next_event(widgets->alarms, &ev))
+    {
+    printf("Alarm: %s %s (priority %u, %.2f)\n", ev.name, kinds[ev.kind], ev.priority, ev.value);
+    }
+    for(guint v = 0; v < ALARM_VIEWS; v++)
+    {
+    guint n = alarm_engine_signal_alarms(widgets->alarms, widgets->alarm_sig[v]);
+    gboolean on = n > 0;
+    alarms += n;
+    if(on == widgets->alarm_shown[v]) {continue;}
+    if(on) {gtk_style_context_add_class(gtk_widget_get_style_context(widgets->alarm_view[v]), "alarm");}
+    else {gtk_style_context_remove_class(gtk_widget_get_style_context(widgets->alarm_view[v]), "alarm");}
+    widgets->alarm_shown[v] = on;
+    }
+    live_pub_set(widgets->live, widgets->live_ch[PUB_ALARMS], alarms, mono_ns());
+}
+
+static void on_watchdog(gint id, const gchar *name, gboolean stale, gint64 age_ns, app_widgets *widgets)
+{
+    if(stale) {printf("Watchdog: %s stale, newest value %.1f s old\n", name, (double)age_ns / SEC_NS);}
+    else {printf("Watchdog: %s recovered\n", name);}
+}
+
+//gray out the readings that stopped arriving
+static void show_stale(app_widgets *widgets)
+{
+    gboolean stuck;
     
-    g_free(temp);
-    g_free(humid);
-    g_mutex_unlock(&mutex_lock_3);
+    watchdog_check(widgets->wd, mono_ns(), (watchdog_func)on_watchdog, widgets);
+    stuck = watchdog_is_stale(widgets->wd, widgets->wd_acq);
+    for(guint v = 0; v < FRESH_VIEWS; v++)
+    {
+    gboolean on = stuck || watchdog_is_stale(widgets->wd, widgets->fresh_sig[v]);
+    if(on == widgets->stale_shown[v]) {continue;}
+    if(on) {gtk_style_context_add_class(gtk_widget_get_style_context(widgets->fresh_view[v]), "stale");}
+    else {gtk_style_context_remove_class(gtk_widget_get_style_context(widgets->fresh_view[v]), "stale");}
+    widgets->stale_shown[v] = on;
+    }
+}
+
+//output states for the live data, and the heartbeat that tells readers the monitor runs
+static void publish_outputs(app_widgets *widgets, const control_status *status)
+{
+    gint64 now = mono_ns();
+    
+    if(widgets->live == NULL) {return;}
+    if(status)
+    {
+    live_pub_set(widgets->live, widgets->live_ch[PUB_HEATER], status->heater, status->ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_FAN], status->fan, status->ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_HUMIDIFIER], status->humidifier, status->ts_ns);
+    }
+    live_pub_set(widgets->live, widgets->live_ch[PUB_LIGHT1], actuator_get_level(widgets->outputs, widgets->out_light1), now);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_LIGHT2], actuator_get_level(widgets->outputs, widgets->out_light2), now);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_UV], actuator_get_level(widgets->outputs, widgets->out_uv), now);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_BEACON], actuator_get_level(widgets->outputs, widgets->out_alarm), now);
+    live_pub_heartbeat(widgets->live, now);
+}
+
+gboolean display(app_widgets *widgets)
+{
+    adc_sample samples[256];
+    gint16 raw[256];
+    gfloat pascal[256 + 1];
+    guint last[256 + 1];
+    pressure_reading pressure;
+    climate_reading climate;
+    control_status status;
+    gboolean have_status;
+    guint64 seq_before = widgets->adc_seq;
+    guint n, m;
+    
+    trace_begin("display");
+    //drain everything converted since the last tick, filter it and publish the newest value
+    while((n = sample_ring_drain(widgets->adc_ring, samples, G_N_ELEMENTS(samples))) > 0)
+    {
+    for(guint i = 0; i < n; i++)
+    {
+    raw[i] = samples[i].raw;
+    }
+    widgets->adc_seq += n;
+    watchdog_feed(widgets->wd, widgets->wd_pressure, samples[n - 1].ts_ns);
+    m = dsp_filter_run(widgets->pressure_dsp, raw, n, pascal, last);
+    for(guint i = 0; i < m; i++)
+    {
+    tsdb_append(widgets->hist_pressure, samples[last[i]].ts_ns, pascal[i]);
+    alarm_engine_update(widgets->alarms, widgets->alarm_sig[VIEW_PRESSURE], pascal[i], samples[last[i]].ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_PRESSURE], pascal[i], samples[last[i]].ts_ns);
+    live_pub_set(widgets->live, widgets->live_ch[PUB_PRESSURE_RAW], samples[last[i]].raw, samples[last[i]].ts_ns);
+    }
+    if(m == 0) {continue;}
+    pressure.raw = samples[last[m - 1]].raw;
+    pressure.volts = (float)ADS1115_VOLTS(pressure.raw);
+    pressure.pascal = pascal[m - 1];
+    pressure.seq = widgets->adc_seq;
+    pressure.ts_ns = samples[last[m - 1]].ts_ns;
+    pressure_publish(&widgets->pressure, &pressure);
+    }
+    //the log and the label get one pressure value per tick, the filtered stream stays in memory
+    if(widgets->adc_seq != seq_before && pressure_get(&widgets->pressure, &pressure) != 0)
+    {
+    trace_flow_step("sample", pressure.ts_ns);
+    set_adc_rate(widgets, adapt_rate(widgets, widgets->pressure_rate, VIEW_PRESSURE, pressure.pascal, pressure.ts_ns));
+    ui_set_stamp(widgets->ui, widgets->ui_pre, pressure.ts_ns);
+    ui_set_text(widgets->ui, widgets->ui_pre, "%.1f Pa", pressure.pascal);
+    if(widgets->log)
+    {
+    seglog_append(widgets->log, LOG_PRESSURE, pressure.ts_ns, pressure.pascal);
+    }
+    }
+    trend_chart_update(widgets->trend);
+    show_alarms(widgets);
+    show_stale(widgets);
+    //heater and fan icons are dimmed while the loop keeps them off
+    have_status = control_get_status(widgets->climate_ctl, &status) != 0;
+    publish_outputs(widgets, have_status ? &status : NULL);
+    if(have_status)
+    {
+    gboolean heater_on = status.active && status.heater > 0;
+    if(heater_on != widgets->heater_shown)
+    {
+    gtk_widget_set_sensitive(widgets->img_heater, heater_on);
+    widgets->heater_shown = heater_on;
+    }
+    if(status.fan != widgets->fan_shown)
+    {
+    gtk_widget_set_sensitive(widgets->img_fan, status.fan);
+    widgets->fan_shown = status.fan;
+    }
+    }
+    //temperature and humidity always come from the same poll
+    if(climate_get(&widgets->climate, &climate) == 0)
+    {
+    trace_end("display");
+    return TRUE;
+    }
+    trace_flow_step("sample", climate.ts_ns);
+    ui_set_stamp(widgets->ui, widgets->ui_real_temp, climate.ts_ns);
+    ui_set_stamp(widgets->ui, widgets->ui_real_hu, climate.ts_ns);
+    ui_set_text(widgets->ui, widgets->ui_real_temp, "%.1f°C", (float)(climate.temp)/100);
+    ui_set_text(widgets->ui, widgets->ui_real_hu, "%.1f %%", (float)(climate.humid)/100);
+    ui_set_text(widgets->ui, widgets->ui_temp, "%.1f°C", (float)(climate.temp)/100);
+    ui_set_text(widgets->ui, widgets->ui_hu, "%.1f %%", (float)(climate.humid)/100);
+    trace_end("display");
+    return TRUE;
     }
     
 void on_btn1_clicked(GtkButton *button, app_widgets *widgets)
 {
-    g_thread_new(NULL, (GThreadFunc)relay1_control, (app_widgets*) widgets);
+    actuator_set(widgets->outputs, widgets->out_relay1, TRUE);
+    }
+
+//light and UV switches, returning FALSE lets the switch show the new state
+gboolean on_sw_light1_state_set(GtkSwitch *sw, gboolean state, app_widgets *widgets)
+{
+    actuator_set(widgets->outputs, widgets->out_light1, state);
+    return FALSE;
+    }
+
+gboolean on_sw_light2_state_set(GtkSwitch *sw, gboolean state, app_widgets *widgets)
+{
+    actuator_set(widgets->outputs, widgets->out_light2, state);
+    return FALSE;
+    }
+
+gboolean on_sw_uv_state_set(GtkSwitch *sw, gboolean state, app_widgets *widgets)
+{
+    actuator_set(widgets->outputs, widgets->out_uv, state);
+    return FALSE;
     }
 //waiting    
 void on_btn2_clicked(GtkButton *button, app_widgets *widgets)
@@ -346,65 +820,31 @@ void on_btn4_clicked(GtkButton *button, app_widgets *widgets)
     
     }
 
+//load a countdown from its h/m/s spin buttons, unless it is counting or paused
+static void set_countdown(app_widgets *widgets, guint id, GtkWidget *hrs, GtkWidget *mnt, GtkWidget *sec)
+{
+    countdown_state state = countdown_get_state(widgets->timers, id);
+    gint64 seconds;
+
+    if(state == COUNTDOWN_RUNNING || state == COUNTDOWN_PAUSED) {return;}
+    seconds = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(hrs)) * 3600
+            + gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(mnt)) * 60
+            + gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(sec));
+    countdown_set(widgets->timers, id, seconds * SEC_NS);
+    }
+
 void on_btn_run_clicked(GtkButton *button, app_widgets *widgets)
 {
     //set countdown timer for operation and anethesia
-    widgets->op_hrs = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->hrs_op_in));
-    widgets->op_mnt = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->mnt_op_in));
-    widgets->op_sec = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->sec_op_in));
-    widgets->an_hrs = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->hrs_an_in));
-    widgets->an_mnt = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->mnt_an_in));
-    widgets->an_sec = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->sec_an_in));
+    set_countdown(widgets, widgets->op_timer, widgets->hrs_op_in, widgets->mnt_op_in, widgets->sec_op_in);
+    set_countdown(widgets, widgets->an_timer, widgets->hrs_an_in, widgets->mnt_an_in, widgets->sec_an_in);
     
     //set temperature and humidity value
     widgets->adj_temp = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->spin_temp));
     widgets->adj_hu = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->spin_hu));
-    //set count down clock next page
-    g_timeout_add_seconds(1, (GSourceFunc)clock_timer, widgets);
+    control_set_target(widgets->climate_ctl, widgets->adj_temp, widgets->adj_hu);
     //g_timeout_add_seconds(1, (GSourceFunc)read_modbus_sensor, widgets);
     gtk_stack_set_visible_child_name(widgets->stack, "Run");
-	
-        //format operation time
-	gchar *op_hrs = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->hrs_op_in)));
-	gchar *op_mnt = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->mnt_op_in)));
-	gchar *op_sec = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->sec_op_in)));
-	//format anethesia time
-	gchar *an_hrs = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->hrs_an_in)));
-	gchar *an_mnt = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->mnt_an_in)));
-	gchar *an_sec = g_strdup_printf("%02d", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widgets->sec_an_in)));
-	//set operation time in run display
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_hrs), op_hrs);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_mnt), op_mnt);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_sec), op_sec);
-	//set anethesia time in run display 
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_hrs), an_hrs);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_mnt), an_mnt);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_sec), an_sec);
-    
-/*    //format operation time
-	gchar *op_hrs = g_strdup_printf("%02d", widgets->op_hrs);
-	gchar *op_mnt = g_strdup_printf("%02d", widgets->op_mnt);
-	gchar *op_sec = g_strdup_printf("%02d", widgets->op_sec);
-	//format anethesia time
-	gchar *an_hrs = g_strdup_printf("%02d", widgets->an_hrs);
-	gchar *an_mnt = g_strdup_printf("%02d", widgets->an_mnt);
-	gchar *an_sec = g_strdup_printf("%02d", widgets->an_sec);
-	//set operation time in run display
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_hrs), op_hrs);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_mnt), op_mnt);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_op_sec), op_sec);
-	//set anethesia time in run display 
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_hrs), an_hrs);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_mnt), an_mnt);
-	gtk_label_set_text(GTK_LABEL(widgets->lbl_an_sec), an_sec);
-    * */
-	//free variable
-	g_free(op_hrs);
-	g_free(op_mnt);
-	g_free(op_sec);
-	g_free(an_hrs);
-	g_free(an_mnt);
-	g_free(an_sec);
     }
 
 void on_btn_reset_clicked(GtkButton *button, app_widgets *widgets)
@@ -415,6 +855,11 @@ void on_btn_reset_clicked(GtkButton *button, app_widgets *widgets)
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(widgets->hrs_an_in), 0);
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(widgets->mnt_an_in), 0);
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(widgets->sec_an_in), 0);
+    //a reset also stops countdowns that are still running from before
+    countdown_reset(widgets->timers, widgets->op_timer);
+    countdown_reset(widgets->timers, widgets->an_timer);
+    //and acknowledges the alarms, latched ones that are over go back to normal
+    alarm_engine_ack_all(widgets->alarms, mono_ns());
     }
     
 void on_btn_shut_clicked(GtkButton *button, app_widgets *widgets)
@@ -424,78 +869,36 @@ void on_btn_shut_clicked(GtkButton *button, app_widgets *widgets)
     
 
 //page 1
-//callback function to countdown the operation clock
-gboolean op_countdown(app_widgets *widgets)
-{
-    if((widgets->op_hrs <= 0)&&(widgets->op_mnt <= 0)&&(widgets->op_sec <= 0)) {return 0;}
-    else {
-    widgets->op_sec--;
-    if(widgets->op_sec < 0) 
-        {
-            widgets->op_sec = 59;
-            widgets->op_mnt--;
-            if(widgets->op_mnt < 0)
-            {
-                widgets->op_mnt = 59;
-                widgets->op_hrs--;
-                }
-            }
-    gchar *op_hrs = g_strdup_printf("%02d", widgets->op_hrs);
-    gchar *op_mnt = g_strdup_printf("%02d", widgets->op_mnt);
-    gchar *op_sec = g_strdup_printf("%02d", widgets->op_sec);
-    
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_op_hrs), op_hrs);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_op_mnt), op_mnt);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_op_sec), op_sec);
-    
-    g_free(op_hrs);
-    g_free(op_mnt);
-    g_free(op_sec);
-    
-    return 1;
-        }
+//show the remaining time of the operation or anethesia countdown
+void on_countdown_changed(countdown_engine *eng, guint id, gint64 seconds, countdown_state state, app_widgets *widgets)
+{
+    if(id == widgets->op_timer)
+    {
+    ui_set_text(widgets->ui, widgets->ui_op_hrs, "%02d", (int)(seconds / 3600));
+    ui_set_text(widgets->ui, widgets->ui_op_mnt, "%02d", (int)(seconds / 60 % 60));
+    ui_set_text(widgets->ui, widgets->ui_op_sec, "%02d", (int)(seconds % 60));
+    live_pub_set(widgets->live, widgets->live_ch[PUB_OP_TIMER], seconds, mono_ns());
+    }
+    else
+    {
+    ui_set_text(widgets->ui, widgets->ui_an_hrs, "%02d", (int)(seconds / 3600));
+    ui_set_text(widgets->ui, widgets->ui_an_mnt, "%02d", (int)(seconds / 60 % 60));
+    ui_set_text(widgets->ui, widgets->ui_an_sec, "%02d", (int)(seconds % 60));
+    live_pub_set(widgets->live, widgets->live_ch[PUB_AN_TIMER], seconds, mono_ns());
+    }
     }
     
+//start is a no-op while the countdown runs, a paused one continues
 void on_btn_op_start_clicked(GtkButton *button, app_widgets *widgets)
 {
-    g_timeout_add_seconds(1, (GSourceFunc)op_countdown, widgets);
-    }
-
-//callback function to countdown the anethesia clock
-gboolean an_countdown(app_widgets *widgets)
-{
-    if((widgets->an_hrs <= 0) && (widgets->an_mnt <= 0) && (widgets->an_sec <= 0)) {return 0;}
-    else{
-    widgets->an_sec--;
-    if(widgets->an_sec < 0) 
-        {
-            widgets->an_sec = 59;
-            widgets->an_mnt--;
-            if(widgets->an_mnt < 0)
-            {
-                widgets->an_mnt = 59;
-                widgets->an_hrs--;
-                }
-            }
-    gchar *an_hrs = g_strdup_printf("%02d", widgets->an_hrs);
-    gchar *an_mnt = g_strdup_printf("%02d", widgets->an_mnt);
-    gchar *an_sec = g_strdup_printf("%02d", widgets->an_sec);
-    
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_an_hrs), an_hrs);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_an_mnt), an_mnt);
-    gtk_label_set_text(GTK_LABEL(widgets->lbl_an_sec), an_sec);
-    
-    g_free(an_hrs);
-    g_free(an_mnt);
-    g_free(an_sec);
-    
-    return 1;
-        }
+    countdown_start(widgets->timers, widgets->op_timer);
+    countdown_resume(widgets->timers, widgets->op_timer);
     }
-    
+
 void on_btn_an_start_clicked(GtkButton *button, app_widgets *widgets)
 {
-    g_timeout_add_seconds(1, (GSourceFunc)an_countdown, widgets);
+    countdown_start(widgets->timers, widgets->an_timer);
+    countdown_resume(widgets->timers, widgets->an_timer);
     }
 
 void on_btn_back_clicked(GtkButton *button, app_widgets *widgets)
@@ -503,13 +906,65 @@ void on_btn_back_clicked(GtkButton *button, app_widgets *widgets)
     gtk_stack_set_visible_child_name(widgets->stack, "Setup");
     }
     
+//decode the icons nobody asked for yet once the window is up, so a later state swap never decodes
+gboolean preload_images(app_widgets *widgets)
+{
+    image_cache_preload(widgets->images);
+    return FALSE;
+    }
+
+//report how long it took from main() to the first painted frame
+gboolean on_first_draw(GtkWidget *window, cairo_t *cr, app_widgets *widgets)
+{
+    g_signal_handlers_disconnect_by_func(window, on_first_draw, widgets);
+    printf("Startup: first frame after %.1f ms\n", (double)(mono_ns() - widgets->start_ns) / NSEC_PER_MSEC);
+    g_idle_add((GSourceFunc)preload_images, widgets);
+    return FALSE;
+    }
+    
+gboolean on_trace_toggle(app_widgets *widgets)
+{
+    trace_set_enabled(!trace_enabled());
+    printf("Trace: %s\n", trace_enabled() ? "on" : "off");
+    return G_SOURCE_CONTINUE;
+    }
+    
+gboolean on_trace_dump(app_widgets *widgets)
+{
+    gint64 n = trace_dump(TRACE_FILE);
+    
+    if(n >= 0)
+    {
+    printf("Trace: %lld events written to %s\n", (long long)n, TRACE_FILE);
+    }
+    return G_SOURCE_CONTINUE;
+    }
+    
+//time the GTK main loop spends between two polls, dispatching and preparing
+static GPollFunc gtk_poll;
+static metrics_histogram *gtk_dispatch;
+static gint64 gtk_poll_returned;
+
+static gint timed_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+    gint ret;
+    
+    if(gtk_poll_returned)
+    {
+    metrics_observe(gtk_dispatch, mono_ns() - gtk_poll_returned);
+    }
+    ret = gtk_poll(fds, nfds, timeout);
+    gtk_poll_returned = mono_ns();
+    return ret;
+    }
+    
 void myCSS(void){
     GtkCssProvider *provider;
     GdkDisplay *display;
     GdkScreen *screen;
     
     provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_path(provider, "/home/pi/Desktop/project/src/style.css", NULL);
+    gtk_css_provider_load_from_resource(provider, RESOURCE_PREFIX "/style.css");
     display = gdk_display_get_default();
     screen = gdk_display_get_default_screen(display);
     gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
@@ -522,25 +977,236 @@ int main(int argc, char *argv[])
     GtkBuilder      *builder; 
     GtkWidget       *window;
     app_widgets *widgets = g_slice_new(app_widgets);
-    GThread *thread1;
-    GThread *thread2;
-    GThread *thread3;
+    gboolean simulated;
+    gchar *record_file = NULL;
+    gchar *replay_file = NULL;
+    gdouble replay_speed = 1;
+    gboolean replay_exit = FALSE;
+    gboolean stats_only = FALSE;
+    gboolean trace = FALSE;
+    GError *error = NULL;
+    GOptionEntry options[] = {
+        {"record", 0, 0, G_OPTION_ARG_FILENAME, &record_file, "Record the raw device traffic to FILE", "FILE"},
+        {"replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_file, "Play FILE back instead of using the devices", "FILE"},
+        {"speed", 0, 0, G_OPTION_ARG_DOUBLE, &replay_speed, "Replay speed, 0 for as fast as possible", "N"},
+        {"exit-after-replay", 0, 0, G_OPTION_ARG_NONE, &replay_exit, "Quit when the replay is complete", NULL},
+        {"trace", 0, 0, G_OPTION_ARG_NONE, &trace, "Trace samples from the start, written to " TRACE_FILE " at exit", NULL},
+        {"stats", 0, 0, G_OPTION_ARG_NONE, &stats_only, "Print the metrics of the running instance and exit", NULL},
+        {NULL}
+    };
+    GOptionContext *context;
+    widgets->start_ns = mono_ns();
     
-    //init bcm2835 lib
-    if(!bcm2835_init())
+    //parsed before the devices are opened, the GTK options are left to gtk_init
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, options, NULL);
+    g_option_context_add_group(context, gtk_get_option_group(FALSE));
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+    {
+    printf("Error: %s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(context);
+    return 1;
+    }
+    g_option_context_free(context);
+    if(stats_only)
+    {
+    if(metrics_fetch(METRICS_SOCKET, stdout) < 0)
+    {
+    printf("Error: no instance answering on %s\n", METRICS_SOCKET);
+    return 1;
+    }
+    return 0;
+    }
+    //before any producer starts, so the first samples are in the trace
+    trace_set_enabled(trace);
+    widgets->rec = NULL;
+    widgets->replay = NULL;
+    widgets->replay_exit = replay_exit;
+    if(replay_file)
+    {
+    widgets->replay = replay_open(replay_file, replay_speed);
+    if(widgets->replay == NULL)
     return 1;
-    //thread to read ADC via SPI
-    //thread1 = g_thread_new(NULL, (GThreadFunc)readADC, (app_widgets*) widgets);
-    thread1 = g_thread_new(NULL, (GThreadFunc)ADCread, (app_widgets*) widgets);
-    //thread to check dry contact
-    thread2 = g_thread_new(NULL, (GThreadFunc)check_dry_contact, (app_widgets*) widgets);
-    //thread to read modbus sensor 
-    thread3 = g_thread_new(NULL, (GThreadFunc)read_modbus_sensor, (app_widgets*) widgets);
+    }
+    else if(record_file)
+    {
+    widgets->rec = capture_create(record_file);
+    if(widgets->rec == NULL)
+    return 1;
+    }
+    
+    //init bcm2835 lib, the relays and the room are simulated without it;
+    //a replay never drives the real relays
+    simulated = widgets->replay || !bcm2835_init();
+    if(!simulated)
+    {
+    widgets->outputs = actuator_open_bcm2835();
+    }
+    else
+    {
+    printf("Outputs: using simulated relays\n");
+    widgets->outputs = actuator_open_sim();
+    }
+    if(widgets->outputs == NULL)
+    return 1;
+    widgets->out_relay1 = actuator_add_channel(widgets->outputs, PIN_OUT, FALSE);
+    widgets->out_light1 = actuator_add_channel(widgets->outputs, PIN_LIGHT1, FALSE);
+    widgets->out_light2 = actuator_add_channel(widgets->outputs, PIN_LIGHT2, FALSE);
+    widgets->out_uv = actuator_add_channel(widgets->outputs, PIN_UV, FALSE);
+    control_outputs climate_outputs = {
+        actuator_add_channel(widgets->outputs, PIN_HEATER, FALSE),
+        actuator_add_channel(widgets->outputs, PIN_FAN, FALSE),
+        actuator_add_channel(widgets->outputs, PIN_HUMID, FALSE)
+    };
+    widgets->out_alarm = actuator_add_channel(widgets->outputs, PIN_ALARM, FALSE);
+    actuator_start(widgets->outputs);
+    //alarm rules are compiled before any producer starts feeding them
+    widgets->alarms = alarm_engine_new(ALARM_RATE_WINDOW_MS);
+    if(alarm_engine_load(widgets->alarms, ALARM_FILE) <= 0)
+    {
+    alarm_engine_add_rules(widgets->alarms, alarm_rules, G_N_ELEMENTS(alarm_rules));
+    }
+    alarm_engine_compile(widgets->alarms);
+    alarm_engine_set_output(widgets->alarms, widgets->outputs, widgets->out_alarm, ALARM_BEACON_PRIORITY);
+    for(guint v = 0; v < ALARM_VIEWS; v++)
+    {
+    widgets->alarm_sig[v] = alarm_engine_find_signal(widgets->alarms, alarm_signals[v]);
+    widgets->alarm_shown[v] = FALSE;
+    }
+    //live data channels exist before their producers start
+    widgets->live = live_pub_open(LIVE_SHM_NAME);
+    for(guint c = 0; c < PUB_CHANNELS; c++)
+    {
+    widgets->live_ch[c] = widgets->live ? live_pub_add(widgets->live, live_channels[c][0], live_channels[c][1]) : -1;
+    }
+    //history stores, sized once for the whole uptime
+    widgets->hist_temp = tsdb_series_new("temperature", &climate_history);
+    widgets->hist_humid = tsdb_series_new("humidity", &climate_history);
+    widgets->hist_pressure = tsdb_series_new("pressure", &pressure_history);
+    //recover the sensor log before any producer starts
+    widgets->log = seglog_open(&log_config);
+    widgets->acq = reactor_new();
+    if(widgets->acq == NULL)
+    return 1;
+    //watched signals exist before their producers start, the gas panel only
+    //when there is one to poll
+    widgets->wd = watchdog_new();
+    widgets->wd_acq = watchdog_add_heartbeat(widgets->wd, "acquisition", widgets->acq, WD_BEAT_MS, WD_ACQ_MS);
+    widgets->wd_climate = watchdog_add(widgets->wd, "climate", WD_CLIMATE_MS);
+    widgets->wd_pressure = watchdog_add(widgets->wd, "pressure", WD_PRESSURE_MS);
+    widgets->wd_gas = -1;
+    //ADC in continuous conversion, fake converter when there is no i2c bus
+    snapshot_init(&widgets->pressure);
+    widgets->adc_seq = 0;
+    widgets->adc_ring = sample_ring_new(ADC_RING_SIZE);
+    widgets->pressure_dsp = dsp_filter_new(&pressure_filter);
+    widgets->pressure_rate = rate_adapt_new(&pressure_rate);
+    widgets->adc_rate = adc_config.data_rate;
+    widgets->adc = widgets->replay ? ads1115_open_replay() : ads1115_open(ADC_BUS, ADC_ADDR);
+    if(widgets->adc == NULL)
+    {
+    printf("ADC: using simulated converter\n");
+    widgets->adc = ads1115_open_fake();
+    }
+    ads1115_set_capture(widgets->adc, widgets->rec);
+    ads1115_start(widgets->adc, &adc_config, widgets->acq, widgets->adc_ring);
+    //edge events for the dry contact, simulated when the chip is not available
+    guint contact_lines[] = {PIN_IN};
+    widgets->contacts = widgets->replay ? NULL : gpio_input_open_chip(GPIO_CHIP, contact_lines, 1, CONTACT_DEBOUNCE_US);
+    if(widgets->contacts == NULL)
+    {
+    printf("Dry contact: using simulated input\n");
+    widgets->contacts = gpio_input_open_sim(1, CONTACT_DEBOUNCE_US);
+    }
+    widgets->contact_pending = 0;
+    gpio_input_set_capture(widgets->contacts, widgets->rec);
+    gpio_input_start(widgets->contacts, widgets->acq, (gpio_input_func)on_dry_contact_changed, widgets);
+    //status switches, a simulated bank reads all of them inactive
+    widgets->status_in = simulated ? gpio_scan_open_sim() : gpio_scan_open_bcm2835();
+    for(guint l = 0; l < STATUS_LINES; l++)
+    {
+    gpio_scan_add_line(widgets->status_in, status_lines[l].pin, TRUE);
+    }
+    widgets->status_pending = 0;
+    gpio_scan_start(widgets->status_in, widgets->acq, STATUS_SCAN_US, STATUS_DEBOUNCE, (gpio_scan_func)on_status_changed, widgets);
+    //modbus sensor polling, on a bench without the relays the control loop
+    //runs against a simulated room instead
+    snapshot_init(&widgets->climate);
+    widgets->temp_rate = rate_adapt_new(&temp_rate);
+    widgets->humid_rate = rate_adapt_new(&humid_rate);
+    for(guint i = 0; i < VIEW_GAS_N; i++)
+    {
+    widgets->gas_rate[i] = rate_adapt_new(&gas_rate);
+    }
+    widgets->heater_shown = TRUE;
+    widgets->fan_shown = TRUE;
+    widgets->sensors = mb_registry_new();
+    if(mb_registry_load(widgets->sensors, SENSOR_FILE) <= 0)
+    {
+    mb_registry_add_bus(widgets->sensors, &sensor_bus);
+    }
+    widgets->climate_sensor = mb_registry_find(widgets->sensors, CLIMATE_SENSOR);
+    widgets->gas_sensor = mb_registry_find(widgets->sensors, GAS_SENSOR);
+    if(widgets->gas_sensor >= 0 && (widgets->replay || !simulated))
+    {
+    widgets->wd_gas = watchdog_add(widgets->wd, "gas", WD_GAS_MS);
+    }
+    mb_registry_set_capture(widgets->sensors, widgets->rec);
+    if(widgets->replay)
+    {
+    //the loop runs on the recorded readings, driving the simulated relays
+    mb_registry_start_replay(widgets->sensors, (mb_sample_func)on_modbus_sample, widgets);
+    widgets->climate_ctl = control_start(&climate_control, &widgets->climate, widgets->outputs, &climate_outputs);
+    }
+    else if(!simulated)
+    {
+    mb_registry_start(widgets->sensors, widgets->acq, (mb_sample_func)on_modbus_sample, widgets);
+    widgets->climate_ctl = control_start(&climate_control, &widgets->climate, widgets->outputs, &climate_outputs);
+    }
+    else
+    {
+    printf("Sensor: using simulated thermal plant\n");
+    widgets->climate_ctl = control_start_sim(&climate_control, &widgets->climate, widgets->outputs, &climate_outputs,
+                                             (control_plant_func)on_climate_reading, widgets);
+    }
+    if(widgets->climate_ctl == NULL)
+    return 1;
+    if(widgets->replay)
+    {
+    replay_targets targets = {widgets->sensors, widgets->adc, widgets->contacts};
+    printf("Replay: %s, speed %g%s\n", replay_file, replay_speed, replay_speed > 0 ? "" : " (as fast as possible)");
+    replay_start(widgets->replay, widgets->acq, &targets, (replay_done_func)on_replay_done, widgets);
+    }
+    reactor_start(widgets->acq, REACTOR_CPU);
+    //the BMS only sees the live data, without it there is nothing to serve
+    widgets->bms_live = NULL;
+    widgets->bms_server = NULL;
+    widgets->metrics = NULL;
+    widgets->svc = reactor_new();
+    if(widgets->svc && widgets->live)
+    {
+    widgets->bms_live = live_client_open(LIVE_SHM_NAME);
+    }
+    if(widgets->svc && widgets->bms_live)
+    {
+    widgets->bms_server = mbtcp_start(&bms_config, widgets->svc, widgets->bms_live);
+    }
+    if(widgets->svc)
+    {
+    widgets->metrics = metrics_serve(METRICS_SOCKET, widgets->svc);
+    reactor_start(widgets->svc, SERVICE_CPU);
+    }
     
     XInitThreads();
     gtk_init(&argc, &argv);
+    gtk_dispatch = metrics_histogram_new("gtk_dispatch", "Time the GUI main loop spends between two polls");
+    gtk_poll = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, timed_poll);
+    g_unix_signal_add(SIGUSR1, (GSourceFunc)on_trace_toggle, widgets);
+    g_unix_signal_add(SIGUSR2, (GSourceFunc)on_trace_dump, widgets);
     myCSS();
-    builder = gtk_builder_new_from_file("glade/window_main.glade");
+    builder = gtk_builder_new_from_resource(RESOURCE_PREFIX "/window_main.glade");
     window = GTK_WIDGET(gtk_builder_get_object(builder, "window_main"));
     gtk_widget_set_size_request(GTK_WIDGET(window), 1920, 1080);
     
@@ -603,38 +1269,107 @@ int main(int argc, char *argv[])
     
     widgets->btn_run_back = GTK_WIDGET(gtk_builder_get_object(builder, "btn_run_back"));
     widgets->btn_run_shut = GTK_WIDGET(gtk_builder_get_object(builder, "btn_run_shut"));
+    widgets->alarm_view[VIEW_TEMP] = widgets->lbl_temp;
+    widgets->alarm_view[VIEW_HUMID] = widgets->lbl_hu;
+    widgets->alarm_view[VIEW_PRESSURE] = widgets->lbl_pre;
+    widgets->alarm_view[VIEW_GAS] = widgets->img_o2;
+    widgets->alarm_view[VIEW_GAS + 1] = widgets->img_n2o;
+    widgets->alarm_view[VIEW_GAS + 2] = widgets->img_co2;
+    widgets->alarm_view[VIEW_GAS + 3] = widgets->img_vac;
+    widgets->alarm_view[VIEW_GAS + 4] = widgets->img_agss;
+    widgets->fresh_view[FRESH_REAL_TEMP] = widgets->lbl_real_temp;
+    widgets->fresh_view[FRESH_REAL_HUMID] = widgets->lbl_real_hu;
+    widgets->fresh_view[FRESH_TEMP] = widgets->lbl_temp;
+    widgets->fresh_view[FRESH_HUMID] = widgets->lbl_hu;
+    widgets->fresh_view[FRESH_PRESSURE] = widgets->lbl_pre;
+    widgets->fresh_sig[FRESH_REAL_TEMP] = widgets->wd_climate;
+    widgets->fresh_sig[FRESH_REAL_HUMID] = widgets->wd_climate;
+    widgets->fresh_sig[FRESH_TEMP] = widgets->wd_climate;
+    widgets->fresh_sig[FRESH_HUMID] = widgets->wd_climate;
+    widgets->fresh_sig[FRESH_PRESSURE] = widgets->wd_pressure;
+    //wd_gas is -1 without a gas sensor, then the icons only gray out with the reactor
+    for(guint i = 0; i < VIEW_GAS_N; i++)
+    {
+    widgets->fresh_view[FRESH_GAS + i] = widgets->alarm_view[VIEW_GAS + i];
+    widgets->fresh_sig[FRESH_GAS + i] = widgets->wd_gas;
+    }
+    for(guint v = 0; v < FRESH_VIEWS; v++)
+    {
+    widgets->stale_shown[v] = FALSE;
+    }
+    widgets->trend = trend_chart_new(GTK_WIDGET(gtk_builder_get_object(builder, "trend_area")), 24 * 3600 * SEC_NS);
+    trend_chart_add_series(widgets->trend, widgets->hist_temp, 15.0, 35.0, 0.9, 0.3, 0.2);
+    trend_chart_add_series(widgets->trend, widgets->hist_humid, 0.0, 100.0, 0.2, 0.6, 0.9);
+    trend_chart_add_series(widgets->trend, widgets->hist_pressure, -50.0, 50.0, 0.3, 0.8, 0.3);
+    //labels written every second go through the update coalescer
+    widgets->ui = ui_updater_new(window, 32);
+    widgets->ui_real_temp = ui_updater_add_label(widgets->ui, widgets->lbl_real_temp);
+    widgets->ui_real_hu = ui_updater_add_label(widgets->ui, widgets->lbl_real_hu);
+    widgets->ui_temp = ui_updater_add_label(widgets->ui, widgets->lbl_temp);
+    widgets->ui_hu = ui_updater_add_label(widgets->ui, widgets->lbl_hu);
+    widgets->ui_pre = ui_updater_add_label(widgets->ui, widgets->lbl_pre);
+    widgets->ui_date = ui_updater_add_label(widgets->ui, widgets->lbl_date);
+    widgets->ui_time = ui_updater_add_label(widgets->ui, widgets->lbl_time);
+    widgets->ui_op_hrs = ui_updater_add_label(widgets->ui, widgets->lbl_op_hrs);
+    widgets->ui_op_mnt = ui_updater_add_label(widgets->ui, widgets->lbl_op_mnt);
+    widgets->ui_op_sec = ui_updater_add_label(widgets->ui, widgets->lbl_op_sec);
+    widgets->ui_an_hrs = ui_updater_add_label(widgets->ui, widgets->lbl_an_hrs);
+    widgets->ui_an_mnt = ui_updater_add_label(widgets->ui, widgets->lbl_an_mnt);
+    widgets->ui_an_sec = ui_updater_add_label(widgets->ui, widgets->lbl_an_sec);
+    for(guint l = 0; l < STATUS_LINES; l++)
+    {
+    widgets->status_slot[l] = ui_updater_add_image(widgets->ui, GTK_WIDGET(gtk_builder_get_object(builder, status_lines[l].widget)));
+    }
+    //operation and anethesia countdowns share one tick, restored from the last run
+    widgets->timers = countdown_engine_new(TIMER_STATE_FILE);
+    widgets->op_timer = countdown_add(widgets->timers, "operation", COUNTDOWN_DOWN, (countdown_func)on_countdown_changed, widgets);
+    widgets->an_timer = countdown_add(widgets->timers, "anethesia", COUNTDOWN_DOWN, (countdown_func)on_countdown_changed, widgets);
+    if(countdown_get_state(widgets->timers, widgets->op_timer) != COUNTDOWN_IDLE
+       || countdown_get_state(widgets->timers, widgets->an_timer) != COUNTDOWN_IDLE)
+    {
+    gtk_stack_set_visible_child_name(widgets->stack, "Run");
+    }
     //acquire button image
-    widgets->img_play = gtk_image_new_from_file("src/image/play.png");
-    widgets->img_reset = gtk_image_new_from_file("src/image/reset.png");
-    widgets->img_shut = gtk_image_new_from_file("src/image/shut.png");
-    widgets->img_back = gtk_image_new_from_file("src/image/back.png");
-    widgets->img_shut1 = gtk_image_new_from_file("src/image/shut1.png");
-    widgets->img_run_op = gtk_image_new_from_file("src/image/play1.png");
-    widgets->img_run_an = gtk_image_new_from_file("src/image/play2.png");
+    widgets->images = image_cache_new(RESOURCE_PREFIX "/image");
+    //a status icon that cannot be shown would hide a failed gas supply
+    for(guint l = 0; l < STATUS_LINES; l++)
+    {
+    if(image_cache_get(widgets->images, status_lines[l].image, "on") == NULL
+       || image_cache_get(widgets->images, status_lines[l].image, "off") == NULL)
+    {
+    printf("Error: missing status icon %s, need image/%son.png and image/%soff.png\n",
+           status_lines[l].widget, status_lines[l].image, status_lines[l].image);
+    return 1;
+    }
+    }
+    widgets->img_play = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "play", NULL));
+    widgets->img_reset = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "reset", NULL));
+    widgets->img_shut = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "shut", NULL));
+    widgets->img_back = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "back", NULL));
+    widgets->img_shut1 = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "shut1", NULL));
+    widgets->img_run_op = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "play1", NULL));
+    widgets->img_run_an = gtk_image_new_from_pixbuf(image_cache_get(widgets->images, "play2", NULL));
     
     gtk_builder_connect_signals(builder, widgets);
     g_object_unref(builder);
     
     g_timeout_add_seconds(1, (GSourceFunc)display, widgets);
+    g_timeout_add_seconds(1, (GSourceFunc)clock_timer, widgets);
     //set picture
     //page 0
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_fan), "src/image/fanon.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_heater), "src/image/heaton.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_filter), "src/image/filton.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_uv), "src/image/uvoff.png");
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_fan), image_cache_get(widgets->images, "fan", "on"));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_heater), image_cache_get(widgets->images, "heat", "on"));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_uv), image_cache_get(widgets->images, "uv", "off"));
 
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_o2), "src/image/o2off.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_vac), "src/image/vacoff.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_co2), "src/image/co2off.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_agss), "src/image/agssoff.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_n2o), "src/image/n2off.png");
+    //gas and filter icons follow their status switches
+    display_status(widgets);
     
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_light1), "src/image/light.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_light2), "src/image/light.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_lightuv), "src/image/uv.png");
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_light1), image_cache_get(widgets->images, "light", NULL));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_light2), image_cache_get(widgets->images, "light", NULL));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_lightuv), image_cache_get(widgets->images, "uv", NULL));
     
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_temp), "src/image/temp.png");
-    gtk_image_set_from_file(GTK_IMAGE(widgets->img_hu), "src/image/humid.png");
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_temp), image_cache_get(widgets->images, "temp", NULL));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widgets->img_hu), image_cache_get(widgets->images, "humid", NULL));
     
     gtk_button_set_image(GTK_BUTTON(widgets->btn_run), GTK_WIDGET(widgets->img_play));
     gtk_button_set_image(GTK_BUTTON(widgets->btn_reset), GTK_WIDGET(widgets->img_reset));
@@ -646,12 +1381,104 @@ int main(int argc, char *argv[])
     
     gtk_button_set_image(GTK_BUTTON(widgets->btn_op_start), GTK_WIDGET(widgets->img_run_op));
     gtk_button_set_image(GTK_BUTTON(widgets->btn_an_start), GTK_WIDGET(widgets->img_run_an));
+    g_signal_connect_after(window, "draw", G_CALLBACK(on_first_draw), widgets);
     gtk_widget_show(window);
 
     gtk_main();
-    g_thread_unref(thread1);
-    g_thread_unref(thread2);
-    g_thread_unref(thread3);
+    if(trace_enabled())
+    {
+    trace_set_enabled(FALSE);
+    on_trace_dump(widgets);
+    }
+    //drop the BMS connections before the live data they read goes away
+    if(widgets->svc)
+    {
+    reactor_stop(widgets->svc);
+    metrics_server_stop(widgets->metrics);
+    if(widgets->bms_server)
+    {
+    mbtcp_print_stats(widgets->bms_server);
+    mbtcp_stop(widgets->bms_server);
+    }
+    reactor_free(widgets->svc);
+    }
+    live_client_close(widgets->bms_live);
+    //stop acquisition first, then the devices can be torn down from this thread
+    reactor_stop(widgets->acq);
+    reactor_print_stats(widgets->acq);
+    if(widgets->replay)
+    {
+    replay_print_stats(widgets->replay);
+    replay_free(widgets->replay);
+    }
+    ads1115_print_stats(widgets->adc);
+    ads1115_free(widgets->adc);
+    sample_ring_free(widgets->adc_ring);
+    dsp_print_stats(widgets->pressure_dsp);
+    dsp_filter_free(widgets->pressure_dsp);
+    gpio_input_free(widgets->contacts);
+    gpio_scan_print_stats(widgets->status_in);
+    gpio_scan_free(widgets->status_in);
+    if(!simulated || widgets->replay)
+    {
+    mb_registry_print_stats(widgets->sensors);
+    }
+    mb_registry_free(widgets->sensors);
+    watchdog_stop(widgets->wd);
+    reactor_free(widgets->acq);
+    if(widgets->rec)
+    {
+    capture_print_stats(widgets->rec);
+    capture_close(widgets->rec);
+    }
+    //the loop turns its outputs off before the actuator goes away
+    control_print_stats(widgets->climate_ctl);
+    control_stop(widgets->climate_ctl);
+    watchdog_print_stats(widgets->wd);
+    watchdog_free(widgets->wd);
+    if(!simulated || widgets->replay)
+    {
+    rate_adapt_print_stats(widgets->temp_rate, "temperature");
+    rate_adapt_print_stats(widgets->humid_rate, "humidity");
+    }
+    rate_adapt_print_stats(widgets->pressure_rate, "pressure");
+    rate_adapt_free(widgets->temp_rate);
+    rate_adapt_free(widgets->humid_rate);
+    for(guint i = 0; i < VIEW_GAS_N; i++)
+    {
+    rate_adapt_free(widgets->gas_rate[i]);
+    }
+    rate_adapt_free(widgets->pressure_rate);
+    alarm_engine_print_stats(widgets->alarms);
+    alarm_engine_free(widgets->alarms);
+    if(widgets->live)
+    {
+    live_pub_print_stats(widgets->live);
+    live_pub_close(widgets->live);
+    }
+    actuator_print_stats(widgets->outputs);
+    actuator_free(widgets->outputs);
+    tsdb_series_free(widgets->hist_temp);
+    tsdb_series_free(widgets->hist_humid);
+    tsdb_series_free(widgets->hist_pressure);
+    if(widgets->log)
+    {
+    seglog_print_stats(widgets->log);
+    seglog_close(widgets->log);
+    }
+    trend_chart_free(widgets->trend);
+    countdown_print_stats(widgets->timers);
+    countdown_engine_free(widgets->timers);
+    image_cache_print_stats(widgets->images);
+    image_cache_free(widgets->images);
+    ui_update_stats ui_stats;
+    ui_updater_get_stats(widgets->ui, &ui_stats);
+    printf("UI: %llu ticks, %llu labels applied, %llu unchanged updates skipped\n",
+           (unsigned long long)ui_stats.ticks, (unsigned long long)ui_stats.applied,
+           (unsigned long long)ui_stats.unchanged);
+    ui_updater_free(widgets->ui);
+    metrics_print_stats();
+    trace_print_stats();
     g_slice_free(app_widgets, widgets);
     return 0;
 }
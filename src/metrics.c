@@ -0,0 +1,421 @@
+/**************************************************
+ * Runtime metrics, see metrics.h
+ * A thread takes the next slot the first time it updates
+ * a metric; with more threads than slots some share a
+ * slot, which stays correct because the adds are atomic.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "monotime.h"
+
+#define METRICS_SLOTS 8
+#define SUB_BITS 3
+#define SUB (1 << SUB_BITS)
+//values from 2^41 ns on share the last bucket
+#define MAX_MSB 40
+#define N_BUCKETS ((MAX_MSB - SUB_BITS + 2) * SUB)
+//exported le boundaries, powers of two from about 1 us to 17 s
+#define LE_FIRST 10
+#define LE_LAST 34
+//connections that connected but have not sent their request yet
+#define MAX_PENDING 16
+#define PENDING_MAX_AGE_NS (5 * NSEC_PER_SEC)
+
+typedef struct {
+    _Atomic guint64 v;
+} __attribute__((aligned(64))) counter_slot;
+
+typedef struct {
+    _Atomic guint64 buckets[N_BUCKETS];
+    _Atomic gint64 sum;
+    _Atomic gint64 max;
+} __attribute__((aligned(64))) histogram_slot;
+
+struct metrics_counter {
+    counter_slot slot[METRICS_SLOTS];
+    gchar *name;
+    gchar *help;
+};
+
+struct metrics_histogram {
+    histogram_slot slot[METRICS_SLOTS];
+    gchar *name;
+    gchar *help;
+};
+
+typedef struct {
+    int fd;
+    reactor_source *src;
+    gint64 since;
+} metrics_conn;
+
+struct metrics_server {
+    gchar *path;
+    int fd;
+    reactor *r;
+    reactor_source *src;
+    metrics_conn pending[MAX_PENDING];
+    guint n_pending;
+};
+
+static GMutex registry_lock;
+static GPtrArray *counters;
+static GPtrArray *histograms;
+static _Atomic guint next_slot;
+static __thread gint thread_slot = -1;
+
+static inline guint my_slot(void)
+{
+    if (thread_slot < 0) {thread_slot = atomic_fetch_add_explicit(&next_slot, 1, memory_order_relaxed) % METRICS_SLOTS;}
+    return thread_slot;
+}
+
+static gpointer alloc_aligned(gsize size)
+{
+    gpointer p;
+
+    if (posix_memalign(&p, 64, size) != 0) {g_error("metrics: out of memory");}
+    memset(p, 0, size);
+    return p;
+}
+
+static gpointer find(GPtrArray *list, const gchar *name, gsize name_offset)
+{
+    for (guint i = 0; list && i < list->len; i++) {
+        gpointer m = g_ptr_array_index(list, i);
+        if (g_strcmp0(*(gchar **)((guint8 *)m + name_offset), name) == 0) {return m;}
+    }
+    return NULL;
+}
+
+metrics_counter *metrics_counter_new(const gchar *name, const gchar *help)
+{
+    metrics_counter *c;
+
+    g_mutex_lock(&registry_lock);
+    c = find(counters, name, G_STRUCT_OFFSET(metrics_counter, name));
+    if (c == NULL) {
+        c = alloc_aligned(sizeof(metrics_counter));
+        c->name = g_strdup(name);
+        c->help = g_strdup(help);
+        if (counters == NULL) {counters = g_ptr_array_new();}
+        g_ptr_array_add(counters, c);
+    }
+    g_mutex_unlock(&registry_lock);
+    return c;
+}
+
+metrics_histogram *metrics_histogram_new(const gchar *name, const gchar *help)
+{
+    metrics_histogram *h;
+
+    g_mutex_lock(&registry_lock);
+    h = find(histograms, name, G_STRUCT_OFFSET(metrics_histogram, name));
+    if (h == NULL) {
+        h = alloc_aligned(sizeof(metrics_histogram));
+        h->name = g_strdup(name);
+        h->help = g_strdup(help);
+        if (histograms == NULL) {histograms = g_ptr_array_new();}
+        g_ptr_array_add(histograms, h);
+    }
+    g_mutex_unlock(&registry_lock);
+    return h;
+}
+
+void metrics_add(metrics_counter *c, guint64 n)
+{
+    if (c == NULL) {return;}
+    atomic_fetch_add_explicit(&c->slot[my_slot()].v, n, memory_order_relaxed);
+}
+
+//values below SUB have a bucket each, above that SUB buckets per power of two
+static inline guint bucket_of(gint64 ns)
+{
+    guint64 v = ns > 0 ? (guint64)ns : 0;
+    guint msb;
+
+    if (v < SUB) {return v;}
+    if (v >> (MAX_MSB + 1)) {return N_BUCKETS - 1;}
+    msb = 63 - __builtin_clzll(v);
+    return (msb - SUB_BITS + 1) * SUB + ((v >> (msb - SUB_BITS)) & (SUB - 1));
+}
+
+//first value above bucket b
+static gint64 bucket_end(guint b)
+{
+    guint msb;
+
+    if (b < SUB) {return b + 1;}
+    msb = b / SUB + SUB_BITS - 1;
+    return (gint64)(SUB + b % SUB + 1) << (msb - SUB_BITS);
+}
+
+void metrics_observe(metrics_histogram *h, gint64 ns)
+{
+    histogram_slot *s;
+    gint64 max;
+
+    if (h == NULL) {return;}
+    s = &h->slot[my_slot()];
+    atomic_fetch_add_explicit(&s->buckets[bucket_of(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum, ns, memory_order_relaxed);
+    max = atomic_load_explicit(&s->max, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&s->max, &max, ns, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+guint64 metrics_counter_value(metrics_counter *c)
+{
+    guint64 sum = 0;
+
+    for (guint i = 0; i < METRICS_SLOTS; i++) {sum += atomic_load_explicit(&c->slot[i].v, memory_order_relaxed);}
+    return sum;
+}
+
+//sum of the slots; count is the sum of the buckets so quantiles stay consistent
+static void histogram_merge(metrics_histogram *h, guint64 *buckets, metrics_summary *s)
+{
+    memset(s, 0, sizeof(*s));
+    memset(buckets, 0, N_BUCKETS * sizeof(guint64));
+    for (guint i = 0; i < METRICS_SLOTS; i++) {
+        histogram_slot *slot = &h->slot[i];
+        for (guint b = 0; b < N_BUCKETS; b++) {
+            guint64 n = atomic_load_explicit(&slot->buckets[b], memory_order_relaxed);
+            buckets[b] += n;
+            s->count += n;
+        }
+        s->sum_ns += atomic_load_explicit(&slot->sum, memory_order_relaxed);
+        s->max_ns = MAX(s->max_ns, atomic_load_explicit(&slot->max, memory_order_relaxed));
+    }
+}
+
+static gint64 quantile(const guint64 *buckets, guint64 count, gdouble q)
+{
+    guint64 rank = (guint64)(q * count), seen = 0;
+
+    for (guint b = 0; b < N_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > rank) {return bucket_end(b) - 1;}
+    }
+    return 0;
+}
+
+void metrics_histogram_summary(metrics_histogram *h, metrics_summary *s)
+{
+    guint64 buckets[N_BUCKETS];
+
+    histogram_merge(h, buckets, s);
+    if (s->count == 0) {return;}
+    s->p50_ns = MIN(quantile(buckets, s->count, 0.5), s->max_ns);
+    s->p90_ns = MIN(quantile(buckets, s->count, 0.9), s->max_ns);
+    s->p99_ns = MIN(quantile(buckets, s->count, 0.99), s->max_ns);
+    s->p999_ns = MIN(quantile(buckets, s->count, 0.999), s->max_ns);
+}
+
+GString *metrics_render(void)
+{
+    GString *out = g_string_sized_new(16384);
+    guint64 buckets[N_BUCKETS];
+    metrics_summary s;
+
+    g_mutex_lock(&registry_lock);
+    for (guint i = 0; counters && i < counters->len; i++) {
+        metrics_counter *c = g_ptr_array_index(counters, i);
+        g_string_append_printf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", c->name, c->help, c->name,
+                               c->name, (unsigned long long)metrics_counter_value(c));
+    }
+    for (guint i = 0; histograms && i < histograms->len; i++) {
+        metrics_histogram *h = g_ptr_array_index(histograms, i);
+        guint64 cumulative = 0;
+        guint b = 0;
+
+        histogram_merge(h, buckets, &s);
+        g_string_append_printf(out, "# HELP %s_seconds %s\n# TYPE %s_seconds histogram\n", h->name, h->help, h->name);
+        //bucket edges fall on every power of two, so each le is exact
+        for (guint e = LE_FIRST; e <= LE_LAST; e++) {
+            for (; b < N_BUCKETS && bucket_end(b) <= (1LL << e); b++) {cumulative += buckets[b];}
+            g_string_append_printf(out, "%s_seconds_bucket{le=\"%.9g\"} %llu\n", h->name,
+                                   (double)(1LL << e) / NSEC_PER_SEC, (unsigned long long)cumulative);
+        }
+        g_string_append_printf(out, "%s_seconds_bucket{le=\"+Inf\"} %llu\n%s_seconds_sum %.9f\n%s_seconds_count %llu\n",
+                               h->name, (unsigned long long)s.count, h->name, (double)s.sum_ns / NSEC_PER_SEC,
+                               h->name, (unsigned long long)s.count);
+    }
+    g_mutex_unlock(&registry_lock);
+    return out;
+}
+
+void metrics_print_stats(void)
+{
+    metrics_summary s;
+
+    g_mutex_lock(&registry_lock);
+    for (guint i = 0; counters && i < counters->len; i++) {
+        metrics_counter *c = g_ptr_array_index(counters, i);
+        printf("Metrics: %s %llu\n", c->name, (unsigned long long)metrics_counter_value(c));
+    }
+    for (guint i = 0; histograms && i < histograms->len; i++) {
+        metrics_histogram *h = g_ptr_array_index(histograms, i);
+        metrics_histogram_summary(h, &s);
+        if (s.count == 0) {
+            printf("Metrics: %s no samples\n", h->name);
+            continue;
+        }
+        printf("Metrics: %s %llu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", h->name,
+               (unsigned long long)s.count, (double)s.p50_ns / NSEC_PER_USEC, (double)s.p99_ns / NSEC_PER_USEC,
+               (double)s.p999_ns / NSEC_PER_USEC, (double)s.max_ns / NSEC_PER_USEC);
+    }
+    g_mutex_unlock(&registry_lock);
+}
+
+/********** Unix socket endpoint **********/
+
+static void pending_close(metrics_server *srv, guint i)
+{
+    reactor_remove(srv->pending[i].src);
+    close(srv->pending[i].fd);
+    srv->pending[i] = srv->pending[--srv->n_pending];
+}
+
+//the request (or its end) arrived: answer with everything and hang up
+static void on_request(reactor_source *src, guint32 events, gpointer data)
+{
+    metrics_server *srv = data;
+    gchar junk[512];
+    GString *body;
+    gchar *head;
+    guint i;
+
+    for (i = 0; i < srv->n_pending && srv->pending[i].src != src; i++) {}
+    if (i == srv->n_pending) {return;}
+    if (events & EPOLLIN) {
+        //the request itself does not matter, every path gets the metrics
+        if (recv(srv->pending[i].fd, junk, sizeof(junk), MSG_DONTWAIT) > 0) {
+            body = metrics_render();
+            head = g_strdup_printf("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %zu\r\n\r\n", body->len);
+            //the socket is blocking with a send timeout, a stuck reader costs at most that
+            if (send(srv->pending[i].fd, head, strlen(head), MSG_NOSIGNAL) > 0) {
+                send(srv->pending[i].fd, body->str, body->len, MSG_NOSIGNAL);
+            }
+            g_free(head);
+            g_string_free(body, TRUE);
+        }
+    }
+    pending_close(srv, i);
+}
+
+static void on_accept(reactor_source *src, guint32 events, gpointer data)
+{
+    metrics_server *srv = data;
+    struct timeval timeout = {1, 0};
+    gint64 now = mono_ns();
+    int fd;
+
+    while ((fd = accept4(srv->fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        //clients that never send a request are dropped after a while, or
+        //the longest waiting one when a new client would not fit
+        for (guint i = srv->n_pending; i-- > 0;) {
+            if (now - srv->pending[i].since > PENDING_MAX_AGE_NS) {pending_close(srv, i);}
+        }
+        if (srv->n_pending == MAX_PENDING) {
+            guint oldest = 0;
+            for (guint i = 1; i < srv->n_pending; i++) {
+                if (srv->pending[i].since < srv->pending[oldest].since) {oldest = i;}
+            }
+            pending_close(srv, oldest);
+        }
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        srv->pending[srv->n_pending].fd = fd;
+        srv->pending[srv->n_pending].since = now;
+        srv->pending[srv->n_pending].src = reactor_add_fd(srv->r, fd, EPOLLIN, on_request, srv);
+        if (srv->pending[srv->n_pending].src == NULL) {
+            close(fd);
+            continue;
+        }
+        srv->n_pending++;
+    }
+}
+
+metrics_server *metrics_serve(const gchar *path, reactor *r)
+{
+    struct sockaddr_un addr;
+    metrics_server *srv;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {return NULL;}
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {return NULL;}
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    //a socket left behind by a crashed run is replaced
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, MAX_PENDING) < 0) {
+        printf("Error: cannot serve metrics on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    srv = g_new0(metrics_server, 1);
+    srv->path = g_strdup(path);
+    srv->fd = fd;
+    srv->r = r;
+    srv->src = reactor_add_fd(r, fd, EPOLLIN, on_accept, srv);
+    if (srv->src == NULL) {
+        metrics_server_stop(srv);
+        return NULL;
+    }
+    return srv;
+}
+
+void metrics_server_stop(metrics_server *srv)
+{
+    if (srv == NULL) {return;}
+    while (srv->n_pending > 0) {pending_close(srv, srv->n_pending - 1);}
+    reactor_remove(srv->src);
+    close(srv->fd);
+    unlink(srv->path);
+    g_free(srv->path);
+    g_free(srv);
+}
+
+int metrics_fetch(const gchar *path, FILE *out)
+{
+    static const gchar request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    struct sockaddr_un addr;
+    struct timeval timeout = {2, 0};
+    GString *reply = g_string_new(NULL);
+    gchar buf[4096], *body;
+    ssize_t n;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {return -1;}
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0) {
+        close(fd);
+        g_string_free(reply, TRUE);
+        return -1;
+    }
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {g_string_append_len(reply, buf, n);}
+    close(fd);
+    body = strstr(reply->str, "\r\n\r\n");
+    if (body == NULL) {
+        g_string_free(reply, TRUE);
+        return -1;
+    }
+    fputs(body + 4, out);
+    g_string_free(reply, TRUE);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**************************************************
+ * Runtime metrics: counters and latency histograms
+ * Metrics are registered by name, once, while the program
+ * starts; registering a name again returns the same
+ * metric, so every bus or device can share one. Updating
+ * is lock-free and cheap enough to leave on: each thread
+ * writes its own cache-line separated slot with a relaxed
+ * atomic add, and readers sum the slots.
+ * Histograms are log-linear like HDR histograms: 8 linear
+ * sub-buckets per power of two, so any value from 1 ns to
+ * about 36 minutes is kept within 12.5%.
+ * metrics_serve() answers any request on a Unix socket
+ * with all metrics in the Prometheus text format (as an
+ * HTTP/1.0 response, for curl --unix-socket);
+ * metrics_fetch() is the client used by --stats.
+ * ************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <glib.h>
+#include "reactor.h"
+
+typedef struct metrics_counter metrics_counter;
+typedef struct metrics_histogram metrics_histogram;
+typedef struct metrics_server metrics_server;
+
+typedef struct {
+    guint64 count;
+    gint64 sum_ns;
+    gint64 max_ns;
+    gint64 p50_ns;
+    gint64 p90_ns;
+    gint64 p99_ns;
+    gint64 p999_ns;
+} metrics_summary;
+
+//name in Prometheus form, e.g. modbus_timeouts_total; never freed
+metrics_counter *metrics_counter_new(const gchar *name, const gchar *help);
+//name without unit suffix, exported in seconds as name_seconds
+metrics_histogram *metrics_histogram_new(const gchar *name, const gchar *help);
+
+//updates from any thread, no-ops for NULL
+void metrics_add(metrics_counter *c, guint64 n);
+static inline void metrics_inc(metrics_counter *c) {metrics_add(c, 1);}
+void metrics_observe(metrics_histogram *h, gint64 ns);
+
+guint64 metrics_counter_value(metrics_counter *c);
+//quantiles are the upper edge of their bucket
+void metrics_histogram_summary(metrics_histogram *h, metrics_summary *s);
+
+//all metrics in the Prometheus text exposition format
+GString *metrics_render(void);
+//one line per metric, histograms as count, p50/p99/max
+void metrics_print_stats(void);
+
+//serve the metrics on a Unix socket from r; NULL if it cannot be bound
+metrics_server *metrics_serve(const gchar *path, reactor *r);
+//while r is stopped or from its thread
+void metrics_server_stop(metrics_server *srv);
+//copy the metrics of a running program to out, -1 if nobody answers
+int metrics_fetch(const gchar *path, FILE *out);
+
+#endif
@@ -0,0 +1,218 @@
+/**************************************************
+ * Modbus RTU frame codec, see modbus_frame.h
+ * ************************************************/
+#include <string.h>
+
+#include "modbus_frame.h"
+#include "crc.h"
+
+static inline void put16(uint8_t *p, guint16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline guint16 get16(const uint8_t *p) {return (p[0] << 8) | p[1];}
+
+//append the CRC, low byte first
+static size_t finish(uint8_t *buf, size_t len)
+{
+    uint16_t crc = crc16_modbus(buf, len);
+
+    buf[len] = crc & 0xFF;
+    buf[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+static gboolean crc_ok(const uint8_t *buf, size_t len)
+{
+    uint16_t crc = crc16_modbus(buf, len - 2);
+
+    return buf[len - 2] == (crc & 0xFF) && buf[len - 1] == (crc >> 8);
+}
+
+size_t mb_frame_read_request(uint8_t *buf, size_t cap, guint8 slave, guint8 function, guint16 address, guint16 count)
+{
+    if (cap < 8 || count == 0 || count > MB_MAX_READ_REGS) {return 0;}
+    if (function != MB_FC_READ_HOLDING && function != MB_FC_READ_INPUT) {return 0;}
+    buf[0] = slave;
+    buf[1] = function;
+    put16(buf + 2, address);
+    put16(buf + 4, count);
+    return finish(buf, 6);
+}
+
+size_t mb_frame_write_single(uint8_t *buf, size_t cap, guint8 slave, guint16 address, guint16 value)
+{
+    if (cap < 8) {return 0;}
+    buf[0] = slave;
+    buf[1] = MB_FC_WRITE_SINGLE;
+    put16(buf + 2, address);
+    put16(buf + 4, value);
+    return finish(buf, 6);
+}
+
+size_t mb_frame_write_multiple(uint8_t *buf, size_t cap, guint8 slave, guint16 address, const guint16 *values, guint16 count)
+{
+    if (count == 0 || count > MB_MAX_WRITE_REGS || cap < 9 + 2 * (size_t)count) {return 0;}
+    buf[0] = slave;
+    buf[1] = MB_FC_WRITE_MULTIPLE;
+    put16(buf + 2, address);
+    put16(buf + 4, count);
+    buf[6] = 2 * count;
+    for (guint i = 0; i < count; i++) {put16(buf + 7 + 2 * i, values[i]);}
+    return finish(buf, 7 + 2 * count);
+}
+
+size_t mb_pdu_read_response(uint8_t *pdu, size_t cap, guint8 function, const guint16 *regs, guint16 count)
+{
+    if (count > MB_MAX_READ_REGS || cap < 2 + 2 * (size_t)count) {return 0;}
+    pdu[0] = function;
+    pdu[1] = 2 * count;
+    for (guint i = 0; i < count; i++) {put16(pdu + 2 + 2 * i, regs[i]);}
+    return 2 + 2 * count;
+}
+
+size_t mb_pdu_exception(uint8_t *pdu, size_t cap, guint8 function, guint8 code)
+{
+    if (cap < 2) {return 0;}
+    pdu[0] = function | 0x80;
+    pdu[1] = code;
+    return 2;
+}
+
+//RTU frames are the slave address, the PDU and the CRC
+size_t mb_frame_read_response(uint8_t *buf, size_t cap, guint8 slave, guint8 function, const guint16 *regs, guint16 count)
+{
+    size_t n = (cap < 3) ? 0 : mb_pdu_read_response(buf + 1, cap - 3, function, regs, count);
+
+    if (n == 0) {return 0;}
+    buf[0] = slave;
+    return finish(buf, 1 + n);
+}
+
+size_t mb_frame_exception(uint8_t *buf, size_t cap, guint8 slave, guint8 function, guint8 code)
+{
+    size_t n = (cap < 3) ? 0 : mb_pdu_exception(buf + 1, cap - 3, function, code);
+
+    if (n == 0) {return 0;}
+    buf[0] = slave;
+    return finish(buf, 1 + n);
+}
+
+size_t mb_frame_response_len(const uint8_t *buf, size_t len, guint8 function)
+{
+    if (len < 2) {return 0;}
+    if (buf[1] & 0x80) {return 5;}
+    switch (function) {
+    case MB_FC_READ_HOLDING:
+    case MB_FC_READ_INPUT:
+        return len < 3 ? 0 : 5 + (size_t)buf[2];
+    case MB_FC_WRITE_SINGLE:
+    case MB_FC_WRITE_MULTIPLE:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+mb_frame_result mb_frame_parse_response(const uint8_t *buf, size_t len, guint8 function, mb_frame *f)
+{
+    size_t need = mb_frame_response_len(buf, len, function);
+
+    if (need == 0) {return len < 3 ? MB_FRAME_SHORT : MB_FRAME_BAD;}
+    if (len < need) {return MB_FRAME_SHORT;}
+    if (len > need || (buf[1] & 0x7F) != function || !crc_ok(buf, len)) {return MB_FRAME_BAD;}
+    memset(f, 0, sizeof(*f));
+    f->slave = buf[0];
+    f->function = function;
+    f->len = len;
+    if (buf[1] & 0x80) {
+        f->exception = buf[2];
+        return MB_FRAME_EXCEPTION;
+    }
+    switch (function) {
+    case MB_FC_READ_HOLDING:
+    case MB_FC_READ_INPUT:
+        if (buf[2] & 1) {return MB_FRAME_BAD;}
+        f->count = buf[2] / 2;
+        f->data = buf + 3;
+        break;
+    case MB_FC_WRITE_SINGLE:
+        //the echo carries the value written
+        f->address = get16(buf + 2);
+        f->count = 1;
+        f->data = buf + 4;
+        break;
+    default:
+        f->address = get16(buf + 2);
+        f->count = get16(buf + 4);
+        break;
+    }
+    return MB_FRAME_OK;
+}
+
+mb_frame_result mb_pdu_parse_request(const uint8_t *pdu, size_t len, mb_frame *f)
+{
+    size_t need = 5;
+
+    if (len < 1) {return MB_FRAME_SHORT;}
+    memset(f, 0, sizeof(*f));
+    f->function = pdu[0];
+    f->len = len;
+    switch (f->function) {
+    case MB_FC_READ_HOLDING:
+    case MB_FC_READ_INPUT:
+    case MB_FC_WRITE_SINGLE:
+        break;
+    case MB_FC_WRITE_MULTIPLE:
+        if (len < 6) {return MB_FRAME_SHORT;}
+        need = 6 + (size_t)pdu[5];
+        break;
+    default:
+        f->exception = MB_EX_ILLEGAL_FUNCTION;
+        return MB_FRAME_EXCEPTION;
+    }
+    if (len < need) {return MB_FRAME_SHORT;}
+    if (len > need) {return MB_FRAME_BAD;}
+    f->address = get16(pdu + 1);
+    switch (f->function) {
+    case MB_FC_READ_HOLDING:
+    case MB_FC_READ_INPUT:
+        f->count = get16(pdu + 3);
+        if (f->count == 0 || f->count > MB_MAX_READ_REGS) {f->exception = MB_EX_ILLEGAL_VALUE;}
+        break;
+    case MB_FC_WRITE_SINGLE:
+        f->count = 1;
+        f->data = pdu + 3;
+        break;
+    default:
+        f->count = get16(pdu + 3);
+        if (f->count == 0 || f->count > MB_MAX_WRITE_REGS || pdu[5] != 2 * f->count) {f->exception = MB_EX_ILLEGAL_VALUE;}
+        else {f->data = pdu + 6;}
+        break;
+    }
+    return f->exception ? MB_FRAME_EXCEPTION : MB_FRAME_OK;
+}
+
+mb_frame_result mb_frame_parse_request(const uint8_t *buf, size_t len, mb_frame *f)
+{
+    size_t need = 8;
+    mb_frame_result rc;
+
+    if (len < 2) {return MB_FRAME_SHORT;}
+    if (buf[1] == MB_FC_WRITE_MULTIPLE) {
+        if (len < 7) {return MB_FRAME_SHORT;}
+        need = 9 + (size_t)buf[6];
+    }
+    //without a length field an unknown function cannot even be framed
+    else if (buf[1] != MB_FC_READ_HOLDING && buf[1] != MB_FC_READ_INPUT && buf[1] != MB_FC_WRITE_SINGLE) {
+        return MB_FRAME_BAD;
+    }
+    if (len < need) {return MB_FRAME_SHORT;}
+    if (len > need || !crc_ok(buf, len)) {return MB_FRAME_BAD;}
+    rc = mb_pdu_parse_request(buf + 1, len - 3, f);
+    f->slave = buf[0];
+    f->len = len;
+    return rc;
+}
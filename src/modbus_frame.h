@@ -0,0 +1,84 @@
+/**************************************************
+ * Modbus RTU frame codec
+ * Builds and checks the ADUs of function codes 03, 04,
+ * 06 and 16 and their exception responses. Encoders write
+ * into a caller buffer and return the frame length with
+ * the CRC appended. Parsers check length, function, byte
+ * count and CRC and never copy: the decoded frame points
+ * at the register bytes inside the receive buffer, read
+ * them with mb_frame_reg().
+ * The mb_pdu_ functions work on the bare PDU (function
+ * code and data), for transports that frame it
+ * themselves such as Modbus TCP.
+ * ************************************************/
+#ifndef MODBUS_FRAME_H
+#define MODBUS_FRAME_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MB_FC_READ_HOLDING 0x03
+#define MB_FC_READ_INPUT 0x04
+#define MB_FC_WRITE_SINGLE 0x06
+#define MB_FC_WRITE_MULTIPLE 0x10
+
+#define MB_EX_ILLEGAL_FUNCTION 0x01
+#define MB_EX_ILLEGAL_ADDRESS 0x02
+#define MB_EX_ILLEGAL_VALUE 0x03
+#define MB_EX_DEVICE_FAILURE 0x04
+
+//largest RTU frame and register counts the protocol allows
+#define MB_RTU_MAX_ADU 256
+#define MB_MAX_READ_REGS 125
+#define MB_MAX_WRITE_REGS 123
+
+typedef enum {
+    MB_FRAME_OK = 0,
+    MB_FRAME_SHORT,         //not all bytes are in yet
+    MB_FRAME_BAD,           //length, byte count, function or CRC mismatch
+    MB_FRAME_EXCEPTION      //valid exception response, or a request to answer with exception
+} mb_frame_result;
+
+typedef struct {
+    guint8 slave;
+    guint8 function;        //without the exception bit
+    guint8 exception;       //0 unless MB_FRAME_EXCEPTION
+    guint16 address;        //requests and write echoes
+    guint16 count;          //registers in data, or written
+    const uint8_t *data;    //big endian registers inside the parsed buffer
+    size_t len;             //bytes of the frame including the CRC
+} mb_frame;
+
+//register i of a parsed frame
+static inline guint16 mb_frame_reg(const mb_frame *f, guint i)
+{
+    return (f->data[2 * i] << 8) | f->data[2 * i + 1];
+}
+
+//requests, return the frame length or 0 if it does not fit or is out of range
+size_t mb_frame_read_request(uint8_t *buf, size_t cap, guint8 slave, guint8 function, guint16 address, guint16 count);
+size_t mb_frame_write_single(uint8_t *buf, size_t cap, guint8 slave, guint16 address, guint16 value);
+size_t mb_frame_write_multiple(uint8_t *buf, size_t cap, guint8 slave, guint16 address, const guint16 *values, guint16 count);
+
+//responses, for slaves and simulators
+size_t mb_frame_read_response(uint8_t *buf, size_t cap, guint8 slave, guint8 function, const guint16 *regs, guint16 count);
+size_t mb_frame_exception(uint8_t *buf, size_t cap, guint8 slave, guint8 function, guint8 code);
+
+//total length of the response to function once the first len bytes are in,
+//0 while that is not known yet
+size_t mb_frame_response_len(const uint8_t *buf, size_t len, guint8 function);
+//check a response to function, f is filled for MB_FRAME_OK and MB_FRAME_EXCEPTION
+mb_frame_result mb_frame_parse_response(const uint8_t *buf, size_t len, guint8 function, mb_frame *f);
+//check a request of any supported function; a request with a count out of
+//range gives MB_FRAME_EXCEPTION with the exception to answer
+mb_frame_result mb_frame_parse_request(const uint8_t *buf, size_t len, mb_frame *f);
+
+//PDU level, return the PDU length or 0 if it does not fit
+size_t mb_pdu_read_response(uint8_t *pdu, size_t cap, guint8 function, const guint16 *regs, guint16 count);
+size_t mb_pdu_exception(uint8_t *pdu, size_t cap, guint8 function, guint8 code);
+//check a request PDU of exactly len bytes; an unsupported function or a count
+//out of range gives MB_FRAME_EXCEPTION with the exception to answer
+mb_frame_result mb_pdu_parse_request(const uint8_t *pdu, size_t len, mb_frame *f);
+
+#endif
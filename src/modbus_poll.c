@@ -0,0 +1,623 @@
+/**************************************************
+ * Scheduled Modbus RTU polling, see modbus_poll.h
+ * The serial port is opened raw and non-blocking with
+ * termios. The blocks of all slaves are kept in one
+ * flat table and served earliest deadline first, back to
+ * back as soon as the inter-frame gap allows, so the bus
+ * stays busy while anything is due. One reactor timer
+ * carries the schedule: it fires when the next block is
+ * due (send), when the
+ * response timeout runs out (give up) or when a reconnect
+ * attempt is due, and the port fd collects the response
+ * bytes as they arrive. libmodbus has no non-blocking
+ * API, so frames go through the codec in modbus_frame.
+ * A replayed poll has no port and no timer: recorded
+ * transactions are handed to it and go through the same
+ * response checks as live ones.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "modbus_poll.h"
+#include "monotime.h"
+#include "modbus_frame.h"
+#include "metrics.h"
+#include "trace.h"
+
+typedef enum {
+    MB_CLOSED,      //timer: try to open the port
+    MB_IDLE,        //timer: send the request for the next due block
+    MB_WAIT         //fd: response bytes, timer: response timeout
+} mb_link_state;
+
+struct mb_poll {
+    mb_poll_config cfg;
+    mb_device devices[MB_POLL_MAX_DEVICES];
+    //blocks of all devices, each device owns a contiguous run
+    mb_block blocks[MB_POLL_MAX_BLOCKS];
+    guint block_device[MB_POLL_MAX_BLOCKS];
+    guint n_blocks;
+    gint64 next_due[MB_POLL_MAX_BLOCKS];
+    gint64 last_good[MB_POLL_MAX_BLOCKS];
+    //current period and bus time of one transaction, for the budget
+    gint64 period[MB_POLL_MAX_BLOCKS];
+    gint64 bus_time[MB_POLL_MAX_BLOCKS];
+    gdouble budget;
+    guint fails[MB_POLL_MAX_DEVICES];
+    gint64 device_backoff[MB_POLL_MAX_DEVICES];
+    gint64 gap_ns;
+    guint64 seq;
+
+    //link state, only touched by the reactor thread
+    reactor *r;
+    reactor_source *timer;
+    reactor_source *port;
+    int fd;
+    mb_link_state state;
+    gint64 backoff;
+    gint64 start;
+    gint64 last_frame;
+    guint current;
+    uint8_t req[8];
+    size_t req_len;
+    gint64 sent;
+    uint8_t rsp[MB_RTU_MAX_ADU];
+    size_t rsp_len;
+    capture *cap;
+    guint cap_source;
+
+    mb_sample_func func;
+    gpointer user_data;
+    GMutex lock;
+    mb_poll_stats stats;
+    mb_device_stats device_stats[MB_POLL_MAX_DEVICES];
+    //shared by all buses
+    metrics_counter *m_polls;
+    metrics_counter *m_timeouts;
+    metrics_counter *m_bad_frames;
+    metrics_counter *m_exceptions;
+    metrics_histogram *m_rtt;
+};
+
+//3.5 character times between frames, fixed at 1750 us above 19200 baud
+static gint64 rtu_gap_ns(const mb_poll_config *cfg)
+{
+    int bits = 1 + cfg->data_bit + (cfg->parity == 'N' ? 0 : 1) + cfg->stop_bit;
+
+    if (cfg->baud > 19200) {return 1750 * NSEC_PER_USEC;}
+    return (gint64)7 * bits * NSEC_PER_SEC / (2 * cfg->baud);
+}
+
+//a read of count registers on the wire, request and response with their gaps;
+//the slave's turnaround is learned from the transactions
+static gint64 rtu_bus_time(const mb_poll_config *cfg, guint16 count, gint64 gap)
+{
+    int bits = 1 + cfg->data_bit + (cfg->parity == 'N' ? 0 : 1) + cfg->stop_bit;
+
+    return (gint64)(8 + 5 + 2 * count) * bits * NSEC_PER_SEC / cfg->baud + 2 * gap;
+}
+
+static speed_t serial_speed(int baud)
+{
+    switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return B9600;
+    }
+}
+
+//raw 8N1/8E1/... port that never blocks, -1 with errno set on failure
+static int serial_open(const mb_poll_config *cfg)
+{
+    struct termios tio;
+    int fd = open(cfg->device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {return -1;}
+    if (tcgetattr(fd, &tio) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, serial_speed(cfg->baud));
+    cfsetospeed(&tio, serial_speed(cfg->baud));
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    tio.c_cflag |= CLOCAL | CREAD | (cfg->data_bit == 7 ? CS7 : CS8);
+    if (cfg->parity == 'E') {tio.c_cflag |= PARENB;}
+    if (cfg->parity == 'O') {tio.c_cflag |= PARENB | PARODD;}
+    if (cfg->stop_bit == 2) {tio.c_cflag |= CSTOPB;}
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static void mb_poll_on_port(reactor_source *src, guint32 events, gpointer data);
+
+//pick the earliest due block and arm the timer for it, never inside the inter-frame gap
+static void mb_poll_schedule(mb_poll *poll)
+{
+    guint b = 0;
+    gint64 due;
+
+    for (guint i = 1; i < poll->n_blocks; i++) {
+        if (poll->next_due[i] < poll->next_due[b]) {b = i;}
+    }
+    due = poll->next_due[b];
+    if (due < poll->last_frame + poll->gap_ns) {due = poll->last_frame + poll->gap_ns;}
+    poll->current = b;
+    poll->state = MB_IDLE;
+    reactor_timer_arm(poll->timer, due);
+}
+
+static void mb_poll_connect(mb_poll *poll, gint64 now)
+{
+    const mb_poll_config *cfg = &poll->cfg;
+
+    poll->fd = serial_open(cfg);
+    if (poll->fd >= 0) {
+        poll->port = reactor_add_fd(poll->r, poll->fd, EPOLLIN, mb_poll_on_port, poll);
+        if (poll->port == NULL) {
+            close(poll->fd);
+            poll->fd = -1;
+        }
+    }
+    if (poll->fd < 0) {
+        printf("Connection failed: %s\n", strerror(errno));
+        //retry with exponential backoff
+        poll->state = MB_CLOSED;
+        reactor_timer_arm(poll->timer, now + poll->backoff);
+        poll->backoff = MIN(poll->backoff * 2, (gint64)cfg->backoff_max_ms * NSEC_PER_MSEC);
+        return;
+    }
+    printf("Connection succeeded\n");
+    poll->backoff = (gint64)cfg->backoff_min_ms * NSEC_PER_MSEC;
+    mb_poll_schedule(poll);
+}
+
+static void mb_poll_disconnect(mb_poll *poll)
+{
+    if (poll->port) {
+        reactor_remove(poll->port);
+        poll->port = NULL;
+    }
+    if (poll->fd >= 0) {
+        close(poll->fd);
+        poll->fd = -1;
+    }
+}
+
+static void mb_poll_link_lost(mb_poll *poll, int err)
+{
+    printf("Modbus link lost: %s\n", strerror(err));
+    mb_poll_disconnect(poll);
+    g_mutex_lock(&poll->lock);
+    poll->stats.reconnects++;
+    g_mutex_unlock(&poll->lock);
+    poll->state = MB_CLOSED;
+    reactor_timer_arm(poll->timer, mono_ns());
+}
+
+static void mb_poll_send(mb_poll *poll, gint64 now)
+{
+    const mb_block *blk = &poll->blocks[poll->current];
+    guint dev = poll->block_device[poll->current];
+    size_t len = mb_frame_read_request(poll->req, sizeof(poll->req), poll->devices[dev].slave, blk->function, blk->address, blk->count);
+
+    poll->req_len = len;
+    //drop whatever a late answer to an earlier request left behind
+    tcflush(poll->fd, TCIFLUSH);
+    g_mutex_lock(&poll->lock);
+    poll->stats.polls++;
+    poll->device_stats[dev].polls++;
+    g_mutex_unlock(&poll->lock);
+    metrics_inc(poll->m_polls);
+    //8 bytes always fit in an empty transmit buffer
+    if (write(poll->fd, poll->req, len) != (ssize_t)len) {
+        mb_poll_link_lost(poll, errno);
+        return;
+    }
+    poll->sent = now;
+    poll->rsp_len = 0;
+    poll->state = MB_WAIT;
+    reactor_timer_arm(poll->timer, now + (gint64)poll->cfg.timeout_ms * NSEC_PER_MSEC);
+}
+
+//a slave that keeps failing only gets one block polled per backoff interval
+static void mb_poll_device_failed(mb_poll *poll, guint dev, gint64 now)
+{
+    const mb_device *d = &poll->devices[dev];
+    guint first = d->blocks - poll->blocks;
+
+    if (++poll->fails[dev] < MB_POLL_FAIL_LIMIT) {return;}
+    for (guint b = first; b < first + d->n_blocks; b++) {
+        poll->next_due[b] = MAX(poll->next_due[b], now + poll->device_backoff[dev]);
+    }
+    if (poll->fails[dev] == MB_POLL_FAIL_LIMIT) {
+        printf("Modbus %s: slave %d (%s) not answering, backing off\n", poll->cfg.device, d->slave, d->name);
+    }
+    poll->device_backoff[dev] = MIN(poll->device_backoff[dev] * 2, (gint64)poll->cfg.backoff_max_ms * NSEC_PER_MSEC);
+    g_mutex_lock(&poll->lock);
+    poll->device_stats[dev].backed_off = TRUE;
+    g_mutex_unlock(&poll->lock);
+}
+
+//the transaction is over (answered, rejected or timed out), plan the next one
+static void mb_poll_finish(mb_poll *poll, gint64 now, gboolean good)
+{
+    guint b = poll->current;
+    guint dev = poll->block_device[b];
+
+    poll->last_frame = now;
+    //an answered transaction updates the bus time of its block, smoothed over 8
+    if (good) {poll->bus_time[b] += (now - poll->sent + poll->gap_ns - poll->bus_time[b]) / 8;}
+    //keep the phase, but skip periods we could not keep up with
+    poll->next_due[b] += poll->period[b];
+    if (poll->next_due[b] < now) {
+        poll->next_due[b] = now + poll->period[b];
+    }
+    g_mutex_lock(&poll->lock);
+    poll->stats.run_ns = now - poll->start;
+    poll->stats.busy_ns += now - poll->sent;
+    if (good) {
+        poll->device_stats[dev].good++;
+        poll->device_stats[dev].backed_off = FALSE;
+        poll->device_stats[dev].stale_max_ns = MAX(poll->device_stats[dev].stale_max_ns, now - poll->last_good[b]);
+        poll->last_good[b] = now;
+    }
+    else {
+        poll->device_stats[dev].failures++;
+    }
+    g_mutex_unlock(&poll->lock);
+    if (good) {
+        poll->fails[dev] = 0;
+        poll->device_backoff[dev] = (gint64)poll->cfg.backoff_min_ms * NSEC_PER_MSEC;
+    }
+    else {
+        mb_poll_device_failed(poll, dev, now);
+    }
+    mb_poll_schedule(poll);
+}
+
+//check a response to block b and publish it, FALSE if it is rejected
+static gboolean mb_poll_decode(mb_poll *poll, guint b, const uint8_t *rsp, size_t len, gint64 ts)
+{
+    const mb_block *blk = &poll->blocks[b];
+    guint dev = poll->block_device[b];
+    mb_frame_result res;
+    mb_frame frame;
+    mb_sample sample;
+
+    res = mb_frame_parse_response(rsp, len, blk->function, &frame);
+    //the confirmation must answer the request: same slave, all registers asked for
+    if (res == MB_FRAME_OK && (frame.slave != poll->devices[dev].slave || frame.count != blk->count)) {res = MB_FRAME_BAD;}
+    if (res != MB_FRAME_OK) {
+        g_mutex_lock(&poll->lock);
+        if (res == MB_FRAME_EXCEPTION) {poll->stats.exceptions++;}
+        else {poll->stats.bad_frames++;}
+        g_mutex_unlock(&poll->lock);
+        metrics_inc(res == MB_FRAME_EXCEPTION ? poll->m_exceptions : poll->m_bad_frames);
+        return FALSE;
+    }
+    sample.ts_ns = ts;
+    sample.device = dev;
+    sample.block = b - (poll->devices[dev].blocks - poll->blocks);
+    sample.count = blk->count;
+    for (guint r = 0; r < blk->count; r++) {sample.regs[r] = mb_frame_reg(&frame, r);}
+    sample.seq = ++poll->seq;
+    g_mutex_lock(&poll->lock);
+    poll->stats.good++;
+    g_mutex_unlock(&poll->lock);
+    trace_flow_start("sample", sample.ts_ns);
+    if (poll->func) {poll->func(&sample, poll->user_data);}
+    return TRUE;
+}
+
+static void mb_poll_complete(mb_poll *poll)
+{
+    gint64 now = mono_ns();
+
+    metrics_observe(poll->m_rtt, now - poll->sent);
+    trace_complete("modbus_transaction", poll->sent, now);
+    trace_begin("modbus_decode");
+    capture_write_frames(poll->cap, poll->cap_source, now, poll->req, poll->req_len, poll->rsp, poll->rsp_len);
+    mb_poll_finish(poll, now, mb_poll_decode(poll, poll->current, poll->rsp, poll->rsp_len, now));
+    trace_end("modbus_decode");
+}
+
+//CPU time of the calling thread, the reactor's time is shared by all its devices
+static gint64 thread_cpu_ns(void)
+{
+    struct timespec cpu;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    return (gint64)cpu.tv_sec * NSEC_PER_SEC + cpu.tv_nsec;
+}
+
+static void mb_poll_add_cpu(mb_poll *poll, gint64 start)
+{
+    gint64 cpu = thread_cpu_ns() - start;
+
+    g_mutex_lock(&poll->lock);
+    poll->stats.cpu_ns += cpu;
+    g_mutex_unlock(&poll->lock);
+}
+
+static void mb_poll_read_port(mb_poll *poll, guint32 events)
+{
+    uint8_t junk[64];
+    size_t expect;
+    ssize_t len;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        mb_poll_link_lost(poll, EIO);
+        return;
+    }
+    if (poll->state != MB_WAIT) {
+        //nobody asked, throw it away
+        while (read(poll->fd, junk, sizeof(junk)) > 0) {}
+        return;
+    }
+    len = read(poll->fd, poll->rsp + poll->rsp_len, sizeof(poll->rsp) - poll->rsp_len);
+    if (len < 0) {
+        if (errno != EAGAIN) {mb_poll_link_lost(poll, errno);}
+        return;
+    }
+    if (len == 0) {
+        mb_poll_link_lost(poll, EIO);
+        return;
+    }
+    poll->rsp_len += len;
+    expect = mb_frame_response_len(poll->rsp, poll->rsp_len, poll->blocks[poll->current].function);
+    //a corrupt byte count can promise more than any frame holds, fail the
+    //frame now instead of reading on into a full buffer
+    if (expect > sizeof(poll->rsp) || poll->rsp_len == sizeof(poll->rsp)) {expect = poll->rsp_len;}
+    if (expect > 0 && poll->rsp_len >= expect) {mb_poll_complete(poll);}
+}
+
+static void mb_poll_on_port(reactor_source *src, guint32 events, gpointer data)
+{
+    gint64 cpu = thread_cpu_ns();
+
+    mb_poll_read_port(data, events);
+    mb_poll_add_cpu(data, cpu);
+}
+
+static void mb_poll_on_timer(reactor_source *src, guint32 events, gpointer data)
+{
+    mb_poll *poll = data;
+    gint64 cpu = thread_cpu_ns();
+    gint64 now = mono_ns();
+
+    switch (poll->state) {
+    case MB_CLOSED:
+        mb_poll_connect(poll, now);
+        break;
+    case MB_IDLE:
+        mb_poll_send(poll, now);
+        break;
+    case MB_WAIT:
+        capture_write_frames(poll->cap, poll->cap_source, now, poll->req, poll->req_len, poll->rsp, poll->rsp_len);
+        g_mutex_lock(&poll->lock);
+        if (poll->rsp_len == 0) {poll->stats.timeouts++;}
+        else {poll->stats.bad_frames++;}
+        g_mutex_unlock(&poll->lock);
+        metrics_inc(poll->rsp_len == 0 ? poll->m_timeouts : poll->m_bad_frames);
+        mb_poll_finish(poll, now, FALSE);
+        break;
+    }
+    mb_poll_add_cpu(poll, cpu);
+}
+
+static mb_poll *mb_poll_new(const mb_poll_config *cfg, mb_sample_func func, gpointer user_data)
+{
+    mb_poll *poll;
+    guint n_blocks = 0;
+
+    if (cfg->n_devices == 0 || cfg->n_devices > MB_POLL_MAX_DEVICES) {return NULL;}
+    for (guint d = 0; d < cfg->n_devices; d++) {
+        n_blocks += cfg->devices[d].n_blocks;
+        for (guint b = 0; b < cfg->devices[d].n_blocks; b++) {
+            if (cfg->devices[d].blocks[b].count == 0 || cfg->devices[d].blocks[b].count > MB_POLL_MAX_REGS) {return NULL;}
+        }
+    }
+    if (n_blocks == 0 || n_blocks > MB_POLL_MAX_BLOCKS) {return NULL;}
+    poll = g_new0(mb_poll, 1);
+    poll->cfg = *cfg;
+    for (guint d = 0; d < cfg->n_devices; d++) {
+        const mb_device *src = &cfg->devices[d];
+
+        poll->devices[d] = *src;
+        poll->devices[d].blocks = poll->blocks + poll->n_blocks;
+        memcpy(poll->blocks + poll->n_blocks, src->blocks, src->n_blocks * sizeof(mb_block));
+        for (guint b = 0; b < src->n_blocks; b++) {poll->block_device[poll->n_blocks++] = d;}
+        poll->device_backoff[d] = (gint64)cfg->backoff_min_ms * NSEC_PER_MSEC;
+    }
+    poll->cfg.devices = poll->devices;
+    poll->gap_ns = rtu_gap_ns(cfg);
+    poll->budget = cfg->budget_pct > 0 && cfg->budget_pct < 100 ? cfg->budget_pct / 100.0 : 1.0;
+    for (guint b = 0; b < poll->n_blocks; b++) {
+        poll->period[b] = (gint64)poll->blocks[b].period_ms * NSEC_PER_MSEC;
+        poll->bus_time[b] = rtu_bus_time(cfg, poll->blocks[b].count, poll->gap_ns);
+    }
+    poll->func = func;
+    poll->user_data = user_data;
+    poll->fd = -1;
+    poll->state = MB_CLOSED;
+    poll->backoff = (gint64)cfg->backoff_min_ms * NSEC_PER_MSEC;
+    g_mutex_init(&poll->lock);
+    poll->m_polls = metrics_counter_new("modbus_polls_total", "Modbus requests sent");
+    poll->m_timeouts = metrics_counter_new("modbus_timeouts_total", "Modbus requests without any answer");
+    poll->m_bad_frames = metrics_counter_new("modbus_bad_frames_total", "Modbus answers that were cut short or failed the checks");
+    poll->m_exceptions = metrics_counter_new("modbus_exceptions_total", "Modbus exception responses");
+    poll->m_rtt = metrics_histogram_new("modbus_poll_rtt", "Time from sending a Modbus request to its complete answer");
+    poll->start = mono_ns();
+    for (guint b = 0; b < poll->n_blocks; b++) {
+        poll->next_due[b] = poll->start;
+        poll->last_good[b] = poll->start;
+    }
+    return poll;
+}
+
+mb_poll *mb_poll_start(const mb_poll_config *cfg, reactor *r, mb_sample_func func, gpointer user_data)
+{
+    mb_poll *poll = mb_poll_new(cfg, func, user_data);
+
+    if (poll == NULL) {return NULL;}
+    poll->r = r;
+    poll->timer = reactor_add_timer(r, mb_poll_on_timer, poll);
+    if (poll->timer == NULL) {
+        g_mutex_clear(&poll->lock);
+        g_free(poll);
+        return NULL;
+    }
+    //the port is opened on the reactor thread like every other transfer
+    reactor_timer_arm(poll->timer, poll->start);
+    return poll;
+}
+
+mb_poll *mb_poll_start_replay(const mb_poll_config *cfg, mb_sample_func func, gpointer user_data)
+{
+    return mb_poll_new(cfg, func, user_data);
+}
+
+void mb_poll_set_capture(mb_poll *poll, capture *cap, guint source)
+{
+    poll->cap = cap;
+    poll->cap_source = source;
+}
+
+guint mb_poll_set_period(mb_poll *poll, guint device, guint block, guint period_ms)
+{
+    gint64 period = (gint64)MAX(period_ms, 1) * NSEC_PER_MSEC;
+    gdouble load = 0;
+    guint b;
+
+    if (device >= poll->cfg.n_devices || block >= poll->devices[device].n_blocks) {return 0;}
+    b = poll->devices[device].blocks - poll->blocks + block;
+    //bus share of the other blocks, what is left bounds this one
+    for (guint i = 0; i < poll->n_blocks; i++) {
+        if (i != b) {load += (gdouble)poll->bus_time[i] / poll->period[i];}
+    }
+    if (load < poll->budget) {period = MAX(period, (gint64)(poll->bus_time[b] / (poll->budget - load)));}
+    else {period = MAX(period, poll->period[b]);}
+    if (period == poll->period[b]) {return period / NSEC_PER_MSEC;}
+    //move the next poll with the period, unless it is being answered right now
+    if (!(poll->state == MB_WAIT && b == poll->current)) {
+        poll->next_due[b] += period - poll->period[b];
+    }
+    poll->period[b] = period;
+    if (poll->timer && poll->state == MB_IDLE) {mb_poll_schedule(poll);}
+    return period / NSEC_PER_MSEC;
+}
+
+int mb_poll_replay(mb_poll *poll, const uint8_t *req, size_t req_len, const uint8_t *rsp, size_t rsp_len, gint64 ts_ns)
+{
+    mb_frame f;
+    guint b, dev;
+    gboolean good;
+
+    if (poll->timer != NULL || mb_frame_parse_request(req, req_len, &f) != MB_FRAME_OK) {return -1;}
+    //the block that sent this request, a capture of another map has none
+    for (b = 0; b < poll->n_blocks; b++) {
+        const mb_block *blk = &poll->blocks[b];
+        if (poll->devices[poll->block_device[b]].slave == f.slave && blk->function == f.function
+            && blk->address == f.address && blk->count == f.count) {break;}
+    }
+    if (b == poll->n_blocks) {return -1;}
+    dev = poll->block_device[b];
+    g_mutex_lock(&poll->lock);
+    poll->stats.polls++;
+    poll->device_stats[dev].polls++;
+    if (rsp_len == 0) {poll->stats.timeouts++;}
+    g_mutex_unlock(&poll->lock);
+    metrics_inc(poll->m_polls);
+    if (rsp_len == 0) {metrics_inc(poll->m_timeouts);}
+    good = rsp_len > 0 && mb_poll_decode(poll, b, rsp, rsp_len, ts_ns);
+    g_mutex_lock(&poll->lock);
+    poll->stats.run_ns = ts_ns - poll->start;
+    if (good) {
+        poll->device_stats[dev].good++;
+        poll->device_stats[dev].stale_max_ns = MAX(poll->device_stats[dev].stale_max_ns, ts_ns - poll->last_good[b]);
+        poll->last_good[b] = ts_ns;
+    }
+    else {
+        poll->device_stats[dev].failures++;
+    }
+    g_mutex_unlock(&poll->lock);
+    return good ? 0 : 1;
+}
+
+void mb_poll_stop(mb_poll *poll)
+{
+    if (poll == NULL) {return;}
+    mb_poll_disconnect(poll);
+    reactor_remove(poll->timer);
+    g_mutex_clear(&poll->lock);
+    g_free(poll);
+}
+
+void mb_poll_get_stats(mb_poll *poll, mb_poll_stats *stats)
+{
+    g_mutex_lock(&poll->lock);
+    *stats = poll->stats;
+    g_mutex_unlock(&poll->lock);
+}
+
+void mb_poll_get_device_stats(mb_poll *poll, guint device, mb_device_stats *stats)
+{
+    const mb_device *d;
+    gint64 now = mono_ns();
+
+    memset(stats, 0, sizeof(*stats));
+    if (device >= poll->cfg.n_devices) {return;}
+    d = &poll->devices[device];
+    g_mutex_lock(&poll->lock);
+    *stats = poll->device_stats[device];
+    for (guint b = d->blocks - poll->blocks; b < (guint)(d->blocks - poll->blocks) + d->n_blocks; b++) {
+        stats->stale_max_ns = MAX(stats->stale_max_ns, now - poll->last_good[b]);
+    }
+    g_mutex_unlock(&poll->lock);
+}
+
+void mb_poll_print_stats(mb_poll *poll)
+{
+    mb_poll_stats st;
+
+    mb_poll_get_stats(poll, &st);
+    printf("Modbus %s: %llu polls, %llu good, %llu timeouts, %llu bad frames, %llu exceptions, %llu reconnects\n",
+           poll->cfg.device, (unsigned long long)st.polls, (unsigned long long)st.good, (unsigned long long)st.timeouts,
+           (unsigned long long)st.bad_frames, (unsigned long long)st.exceptions, (unsigned long long)st.reconnects);
+    if (st.run_ns > 0 && st.polls > 0) {
+        printf("Modbus %s: %.2f polls/s, %.2f samples/s, bus %.1f%% busy, %.1f us CPU/poll\n", poll->cfg.device,
+               (double)st.polls * NSEC_PER_SEC / st.run_ns, (double)st.good * NSEC_PER_SEC / st.run_ns,
+               100.0 * st.busy_ns / st.run_ns, (double)st.cpu_ns / st.polls / NSEC_PER_USEC);
+    }
+    for (guint d = 0; d < poll->cfg.n_devices; d++) {
+        mb_device_stats ds;
+
+        mb_poll_get_device_stats(poll, d, &ds);
+        printf("Modbus %s:   slave %d (%s): %llu/%llu good, worst staleness %.2f s%s\n",
+               poll->cfg.device, poll->devices[d].slave, poll->devices[d].name,
+               (unsigned long long)ds.good, (unsigned long long)ds.polls,
+               (double)ds.stale_max_ns / NSEC_PER_SEC, ds.backed_off ? ", backed off" : "");
+    }
+}
@@ -0,0 +1,123 @@
+/**************************************************
+ * Scheduled Modbus RTU polling of one bus
+ * Every slave on the bus has its own register blocks,
+ * each read at its own period. The earliest due block of
+ * any slave goes next, frames are spaced by the RTU
+ * inter-frame gap, and every response is checked (length,
+ * slave, function, byte count, CRC) before it is published
+ * with a monotonic timestamp. A slave that stops answering
+ * is polled with exponential backoff so its timeouts do
+ * not eat the bus time of the others; a lost connection
+ * is reopened with exponential backoff.
+ * The port is a non-blocking fd driven by the reactor:
+ * sending, waiting for the answer and the gaps between
+ * frames are states, not blocking calls.
+ * Block periods can be changed while polling, for adaptive
+ * rates; such changes are held to a budget, the share of
+ * the bus time the blocks may take together.
+ * Transactions can be recorded to a capture and a
+ * capture replayed into a poll that has no port.
+ * ************************************************/
+#ifndef MODBUS_POLL_H
+#define MODBUS_POLL_H
+
+#include <glib.h>
+#include "reactor.h"
+#include "capture.h"
+
+#define MB_POLL_MAX_DEVICES 16
+//register blocks of all slaves on one bus
+#define MB_POLL_MAX_BLOCKS 32
+#define MB_POLL_MAX_REGS 32
+//consecutive failed polls before a slave is backed off
+#define MB_POLL_FAIL_LIMIT 3
+
+//one read request, function 3 (holding) or 4 (input registers)
+typedef struct {
+    guint8 function;
+    guint16 address;
+    guint16 count;
+    guint period_ms;
+} mb_block;
+
+//one slave and its register map
+typedef struct {
+    const gchar *name;
+    int slave;
+    const mb_block *blocks;
+    guint n_blocks;
+} mb_device;
+
+//strings, devices and blocks must outlive the poll
+typedef struct {
+    const gchar *device;
+    int baud;
+    char parity;
+    int data_bit;
+    int stop_bit;
+    guint timeout_ms;
+    guint backoff_min_ms;
+    guint backoff_max_ms;
+    const mb_device *devices;
+    guint n_devices;
+    //share of the bus time period changes may fill, 0 for the whole bus
+    guint budget_pct;
+} mb_poll_config;
+
+typedef struct {
+    guint device;   //index in mb_poll_config.devices
+    guint block;    //index in the blocks of that device
+    guint16 count;
+    guint16 regs[MB_POLL_MAX_REGS];
+    gint64 ts_ns;
+    guint64 seq;
+} mb_sample;
+
+typedef struct {
+    guint64 polls;
+    guint64 good;
+    guint64 timeouts;
+    guint64 bad_frames;
+    guint64 exceptions;
+    guint64 reconnects;
+    gint64 busy_ns;         //from sending a request to the end of its transaction
+    gint64 run_ns;
+    gint64 cpu_ns;          //reactor thread CPU in this poll, sample callbacks included
+} mb_poll_stats;
+
+typedef struct {
+    guint64 polls;
+    guint64 good;
+    guint64 failures;       //timeouts, bad frames and exceptions
+    gboolean backed_off;
+    //longest time one of its blocks went without a good sample
+    gint64 stale_max_ns;
+} mb_device_stats;
+
+typedef struct mb_poll mb_poll;
+
+//called from the reactor thread for every validated response
+typedef void (*mb_sample_func)(const mb_sample *sample, gpointer user_data);
+
+//poll from r, stop must be called while r is stopped or from its thread
+mb_poll *mb_poll_start(const mb_poll_config *cfg, reactor *r, mb_sample_func func, gpointer user_data);
+//a poll that never opens the port, fed by mb_poll_replay()
+mb_poll *mb_poll_start_replay(const mb_poll_config *cfg, mb_sample_func func, gpointer user_data);
+void mb_poll_stop(mb_poll *poll);
+//record every transaction as source, set before the first poll
+void mb_poll_set_capture(mb_poll *poll, capture *cap, guint source);
+//poll block of device every period_ms from now on, from the thread that owns the
+//poll; a shorter period is stretched as far as the budget needs. Returns the
+//period applied, 0 if there is no such block
+guint mb_poll_set_period(mb_poll *poll, guint device, guint block, guint period_ms);
+//run a recorded transaction through the response checks as if it happened at ts_ns,
+//from the thread that owns the poll; 0 for a sample, 1 for a failed poll,
+//-1 if no block of this poll sends the request
+int mb_poll_replay(mb_poll *poll, const uint8_t *req, size_t req_len, const uint8_t *rsp, size_t rsp_len, gint64 ts_ns);
+void mb_poll_get_stats(mb_poll *poll, mb_poll_stats *stats);
+//including the staleness of blocks that are overdue right now
+void mb_poll_get_device_stats(mb_poll *poll, guint device, mb_device_stats *stats);
+//print achieved polls/s, CPU per poll and the worst staleness per slave
+void mb_poll_print_stats(mb_poll *poll);
+
+#endif
@@ -0,0 +1,376 @@
+/**************************************************
+ * Registry of the RS-485 sensor fleet, see modbus_registry.h
+ * The registry owns a copy of every bus configuration,
+ * including device names and register maps, so a key
+ * file can be freed as soon as it is parsed.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "modbus_registry.h"
+#include "monotime.h"
+
+typedef struct {
+    mb_registry *reg;
+    gchar *name;
+    mb_poll_config cfg;
+    mb_device devices[MB_POLL_MAX_DEVICES];
+    mb_block blocks[MB_POLL_MAX_BLOCKS];
+    guint n_blocks;
+    guint first_id;
+    mb_poll *poll;
+} mb_bus;
+
+struct mb_registry {
+    GPtrArray *buses;
+    guint n_devices;
+    mb_sample_func func;
+    gpointer user_data;
+    capture *cap;
+};
+
+static mb_bus *bus_new(mb_registry *reg, const gchar *name, const mb_poll_config *cfg)
+{
+    mb_bus *bus = g_new0(mb_bus, 1);
+
+    bus->reg = reg;
+    bus->name = g_strdup(name);
+    bus->cfg = *cfg;
+    bus->cfg.device = g_strdup(cfg->device);
+    bus->cfg.devices = bus->devices;
+    bus->cfg.n_devices = 0;
+    return bus;
+}
+
+static void bus_free(gpointer data)
+{
+    mb_bus *bus = data;
+
+    for (guint d = 0; d < bus->cfg.n_devices; d++) {g_free((gchar *)bus->devices[d].name);}
+    g_free((gchar *)bus->cfg.device);
+    g_free(bus->name);
+    g_free(bus);
+}
+
+static int bus_add_device(mb_bus *bus, const gchar *name, int slave, const mb_block *blocks, guint n_blocks)
+{
+    mb_device *d;
+
+    if (bus->cfg.n_devices >= MB_POLL_MAX_DEVICES || bus->n_blocks + n_blocks > MB_POLL_MAX_BLOCKS) {return -1;}
+    d = &bus->devices[bus->cfg.n_devices++];
+    d->name = g_strdup(name);
+    d->slave = slave;
+    d->blocks = bus->blocks + bus->n_blocks;
+    d->n_blocks = n_blocks;
+    memcpy(bus->blocks + bus->n_blocks, blocks, n_blocks * sizeof(mb_block));
+    bus->n_blocks += n_blocks;
+    return 0;
+}
+
+//device ids run over the buses in the order they were added
+static void registry_number(mb_registry *reg)
+{
+    reg->n_devices = 0;
+    for (guint i = 0; i < reg->buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        bus->first_id = reg->n_devices;
+        reg->n_devices += bus->cfg.n_devices;
+    }
+}
+
+mb_registry *mb_registry_new(void)
+{
+    mb_registry *reg = g_new0(mb_registry, 1);
+
+    reg->buses = g_ptr_array_new_with_free_func(bus_free);
+    return reg;
+}
+
+void mb_registry_free(mb_registry *reg)
+{
+    if (reg == NULL) {return;}
+    mb_registry_stop(reg);
+    g_ptr_array_free(reg->buses, TRUE);
+    g_free(reg);
+}
+
+int mb_registry_add_bus(mb_registry *reg, const mb_poll_config *cfg)
+{
+    mb_bus *bus = bus_new(reg, cfg->device, cfg);
+
+    for (guint d = 0; d < cfg->n_devices; d++) {
+        const mb_device *dev = &cfg->devices[d];
+        if (bus_add_device(bus, dev->name, dev->slave, dev->blocks, dev->n_blocks) < 0) {
+            bus_free(bus);
+            return -1;
+        }
+    }
+    g_ptr_array_add(reg->buses, bus);
+    registry_number(reg);
+    return 0;
+}
+
+//kind:address:count:period_ms
+static gboolean parse_block(const gchar *text, mb_block *blk)
+{
+    gchar **f = g_strsplit(text, ":", 0);
+    gboolean ok = g_strv_length(f) == 4;
+
+    if (ok) {
+        if (g_strcmp0(f[0], "input") == 0) {blk->function = 0x04;}
+        else if (g_strcmp0(f[0], "holding") == 0) {blk->function = 0x03;}
+        else {ok = FALSE;}
+        blk->address = g_ascii_strtoull(f[1], NULL, 0);
+        blk->count = g_ascii_strtoull(f[2], NULL, 0);
+        blk->period_ms = g_ascii_strtoull(f[3], NULL, 0);
+        ok = ok && blk->count > 0 && blk->count <= MB_POLL_MAX_REGS && blk->period_ms > 0;
+    }
+    g_strfreev(f);
+    return ok;
+}
+
+static gint key_int(GKeyFile *keys, const gchar *group, const gchar *key, gint fallback)
+{
+    GError *error = NULL;
+    gint value = g_key_file_get_integer(keys, group, key, &error);
+
+    if (error) {
+        g_error_free(error);
+        return fallback;
+    }
+    return value;
+}
+
+static mb_bus *load_bus(mb_registry *reg, GKeyFile *keys, const gchar *group)
+{
+    mb_poll_config cfg;
+    gchar *port = g_key_file_get_string(keys, group, "port", NULL);
+    gchar *parity = g_key_file_get_string(keys, group, "parity", NULL);
+    mb_bus *bus = NULL;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.device = port;
+    cfg.baud = key_int(keys, group, "baud", 9600);
+    cfg.parity = parity ? parity[0] : 'N';
+    cfg.data_bit = key_int(keys, group, "data_bits", 8);
+    cfg.stop_bit = key_int(keys, group, "stop_bits", 1);
+    cfg.timeout_ms = key_int(keys, group, "timeout_ms", 500);
+    cfg.backoff_min_ms = key_int(keys, group, "backoff_min_ms", 100);
+    cfg.backoff_max_ms = key_int(keys, group, "backoff_max_ms", 10000);
+    cfg.budget_pct = key_int(keys, group, "budget_pct", 0);
+    if (port) {bus = bus_new(reg, group + strlen("bus "), &cfg);}
+    else {printf("Error: [%s] has no port\n", group);}
+    g_free(port);
+    g_free(parity);
+    return bus;
+}
+
+static int load_device(GPtrArray *buses, GKeyFile *keys, const gchar *group)
+{
+    gchar *bus_name = g_key_file_get_string(keys, group, "bus", NULL);
+    gchar **list = g_key_file_get_string_list(keys, group, "blocks", NULL, NULL);
+    mb_block blocks[MB_POLL_MAX_BLOCKS];
+    mb_bus *bus = NULL;
+    guint n = 0;
+    int rc = -1;
+
+    for (guint i = 0; bus_name && i < buses->len; i++) {
+        mb_bus *b = g_ptr_array_index(buses, i);
+        if (g_strcmp0(b->name, bus_name) == 0) {bus = b;}
+    }
+    for (guint i = 0; list && list[i] && n < MB_POLL_MAX_BLOCKS; i++) {
+        if (!parse_block(list[i], &blocks[n++])) {
+            printf("Error: [%s] bad block \"%s\"\n", group, list[i]);
+            n = 0;
+            break;
+        }
+    }
+    if (bus == NULL) {printf("Error: [%s] is on an unknown bus\n", group);}
+    else if (n == 0) {printf("Error: [%s] has no usable blocks\n", group);}
+    else {
+        rc = bus_add_device(bus, group + strlen("device "), key_int(keys, group, "slave", 1), blocks, n);
+        if (rc < 0) {printf("Error: [%s] does not fit on its bus\n", group);}
+    }
+    g_free(bus_name);
+    g_strfreev(list);
+    return rc;
+}
+
+int mb_registry_load(mb_registry *reg, const gchar *file)
+{
+    GKeyFile *keys = g_key_file_new();
+    GPtrArray *buses = g_ptr_array_new();
+    GError *error = NULL;
+    gchar **groups;
+    int added = 0;
+
+    if (!g_key_file_load_from_file(keys, file, G_KEY_FILE_NONE, &error)) {
+        //no file is not an error, the caller falls back to its built-in buses
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            printf("Error: sensor registry %s: %s\n", file, error->message);
+        }
+        g_error_free(error);
+        g_key_file_free(keys);
+        g_ptr_array_free(buses, TRUE);
+        return -1;
+    }
+    groups = g_key_file_get_groups(keys, NULL);
+    //buses first, so devices can be listed before the bus they are on
+    for (guint i = 0; groups[i]; i++) {
+        if (g_str_has_prefix(groups[i], "bus ")) {
+            mb_bus *bus = load_bus(reg, keys, groups[i]);
+            if (bus) {g_ptr_array_add(buses, bus);}
+        }
+    }
+    for (guint i = 0; groups[i]; i++) {
+        if (g_str_has_prefix(groups[i], "device ")) {load_device(buses, keys, groups[i]);}
+    }
+    //a bus without devices has nothing to poll
+    for (guint i = 0; i < buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(buses, i);
+        if (bus->cfg.n_devices == 0) {
+            bus_free(bus);
+            continue;
+        }
+        g_ptr_array_add(reg->buses, bus);
+        added++;
+    }
+    registry_number(reg);
+    g_strfreev(groups);
+    g_ptr_array_free(buses, TRUE);
+    g_key_file_free(keys);
+    return added;
+}
+
+gint mb_registry_find(mb_registry *reg, const gchar *name)
+{
+    for (guint i = 0; i < reg->buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        for (guint d = 0; d < bus->cfg.n_devices; d++) {
+            if (g_strcmp0(bus->devices[d].name, name) == 0) {return bus->first_id + d;}
+        }
+    }
+    return -1;
+}
+
+guint mb_registry_n_devices(mb_registry *reg) {return reg->n_devices;}
+
+//renumber the device of a bus sample to the registry id
+static void on_bus_sample(const mb_sample *sample, gpointer data)
+{
+    mb_bus *bus = data;
+    mb_sample out = *sample;
+
+    out.device += bus->first_id;
+    bus->reg->func(&out, bus->reg->user_data);
+}
+
+//without a reactor the buses are started for replay
+static int registry_start(mb_registry *reg, reactor *r, mb_sample_func func, gpointer user_data)
+{
+    int started = 0;
+
+    reg->func = func;
+    reg->user_data = user_data;
+    for (guint i = 0; i < reg->buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+
+        if (bus->poll) {continue;}
+        if (r) {bus->poll = mb_poll_start(&bus->cfg, r, func ? on_bus_sample : NULL, bus);}
+        else {bus->poll = mb_poll_start_replay(&bus->cfg, func ? on_bus_sample : NULL, bus);}
+        if (bus->poll == NULL) {
+            printf("Error: cannot poll bus %s\n", bus->name);
+            continue;
+        }
+        //buses are recorded by their index, the order of the configuration
+        mb_poll_set_capture(bus->poll, reg->cap, i);
+        started++;
+    }
+    return started > 0 ? 0 : -1;
+}
+
+int mb_registry_start(mb_registry *reg, reactor *r, mb_sample_func func, gpointer user_data)
+{
+    return registry_start(reg, r, func, user_data);
+}
+
+int mb_registry_start_replay(mb_registry *reg, mb_sample_func func, gpointer user_data)
+{
+    return registry_start(reg, NULL, func, user_data);
+}
+
+guint mb_registry_set_period(mb_registry *reg, gint device, guint block, guint period_ms)
+{
+    for (guint i = 0; i < reg->buses->len && device >= 0; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        if ((guint)device < bus->first_id || (guint)device >= bus->first_id + bus->cfg.n_devices) {continue;}
+        return bus->poll ? mb_poll_set_period(bus->poll, device - bus->first_id, block, period_ms) : 0;
+    }
+    return 0;
+}
+
+void mb_registry_set_capture(mb_registry *reg, capture *cap)
+{
+    reg->cap = cap;
+}
+
+int mb_registry_replay(mb_registry *reg, guint bus_index, const uint8_t *req, size_t req_len,
+                       const uint8_t *rsp, size_t rsp_len, gint64 ts_ns)
+{
+    mb_bus *bus;
+
+    if (bus_index >= reg->buses->len) {return -1;}
+    bus = g_ptr_array_index(reg->buses, bus_index);
+    if (bus->poll == NULL) {return -1;}
+    return mb_poll_replay(bus->poll, req, req_len, rsp, rsp_len, ts_ns);
+}
+
+void mb_registry_stop(mb_registry *reg)
+{
+    for (guint i = 0; i < reg->buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        mb_poll_stop(bus->poll);
+        bus->poll = NULL;
+    }
+}
+
+int mb_registry_get_device_stats(mb_registry *reg, gint device, mb_device_stats *stats)
+{
+    for (guint i = 0; i < reg->buses->len && device >= 0; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        if ((guint)device < bus->first_id || (guint)device >= bus->first_id + bus->cfg.n_devices) {continue;}
+        if (bus->poll == NULL) {break;}
+        mb_poll_get_device_stats(bus->poll, device - bus->first_id, stats);
+        return 0;
+    }
+    memset(stats, 0, sizeof(*stats));
+    return -1;
+}
+
+void mb_registry_print_stats(mb_registry *reg)
+{
+    gdouble samples = 0;
+    gint64 stale_max = 0;
+    const gchar *stalest = NULL;
+
+    for (guint i = 0; i < reg->buses->len; i++) {
+        mb_bus *bus = g_ptr_array_index(reg->buses, i);
+        mb_poll_stats st;
+
+        if (bus->poll == NULL) {continue;}
+        mb_poll_print_stats(bus->poll);
+        mb_poll_get_stats(bus->poll, &st);
+        if (st.run_ns > 0) {samples += (gdouble)st.good * NSEC_PER_SEC / st.run_ns;}
+        for (guint d = 0; d < bus->cfg.n_devices; d++) {
+            mb_device_stats ds;
+            mb_poll_get_device_stats(bus->poll, d, &ds);
+            if (ds.stale_max_ns > stale_max) {
+                stale_max = ds.stale_max_ns;
+                stalest = bus->devices[d].name;
+            }
+        }
+    }
+    printf("Modbus: %u buses, %u devices, %.2f samples/s", reg->buses->len, reg->n_devices, samples);
+    if (stalest) {printf(", worst staleness %.2f s (%s)", (double)stale_max / NSEC_PER_SEC, stalest);}
+    printf("\n");
+}
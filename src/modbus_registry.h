@@ -0,0 +1,73 @@
+/**************************************************
+ * Registry of the RS-485 sensor fleet
+ * Describes any number of buses, the slaves on each bus
+ * and their register maps, and runs one poll state
+ * machine per bus so a slow or dead slave on one bus
+ * never delays another bus. Devices get an id over all
+ * buses that is carried in every sample.
+ * Buses can be added from code or from a key file:
+ *
+ *   [bus rs485a]
+ *   port=/dev/ttyUSB0
+ *   baud=9600
+ *   parity=N            (N, E or O)
+ *   data_bits=8
+ *   stop_bits=1
+ *   timeout_ms=500
+ *   backoff_min_ms=100
+ *   backoff_max_ms=10000
+ *   budget_pct=50       (bus time adaptive periods may fill)
+ *
+ *   [device climate]
+ *   bus=rs485a
+ *   slave=1
+ *   blocks=input:0:2:1000;holding:0x10:4:5000
+ *
+ * where each block is kind:address:count:period_ms and
+ * kind is input (function 4) or holding (function 3).
+ * With a capture set, every transaction is recorded with
+ * the index of its bus; a capture made with the same
+ * configuration can be replayed into the registry.
+ * ************************************************/
+#ifndef MODBUS_REGISTRY_H
+#define MODBUS_REGISTRY_H
+
+#include <glib.h>
+#include "modbus_poll.h"
+#include "reactor.h"
+#include "capture.h"
+
+typedef struct mb_registry mb_registry;
+
+mb_registry *mb_registry_new(void);
+void mb_registry_free(mb_registry *reg);
+
+//add a bus, the configuration and everything it points to is copied; 0 on success
+int mb_registry_add_bus(mb_registry *reg, const mb_poll_config *cfg);
+//add the buses of a key file, returns the number added or -1 if it cannot be read
+int mb_registry_load(mb_registry *reg, const gchar *file);
+
+//device id over all buses, -1 if there is no such device
+gint mb_registry_find(mb_registry *reg, const gchar *name);
+guint mb_registry_n_devices(mb_registry *reg);
+
+//poll every bus from r, sample->device is the registry device id;
+//stop must be called while r is stopped or from its thread
+int mb_registry_start(mb_registry *reg, reactor *r, mb_sample_func func, gpointer user_data);
+//no port is opened, samples come from mb_registry_replay()
+int mb_registry_start_replay(mb_registry *reg, mb_sample_func func, gpointer user_data);
+void mb_registry_stop(mb_registry *reg);
+//change a poll period, see mb_poll_set_period(); from the polling thread
+guint mb_registry_set_period(mb_registry *reg, gint device, guint block, guint period_ms);
+//record the transactions of every bus, set before starting
+void mb_registry_set_capture(mb_registry *reg, capture *cap);
+//hand a recorded transaction to its bus, see mb_poll_replay()
+int mb_registry_replay(mb_registry *reg, guint bus_index, const uint8_t *req, size_t req_len,
+                       const uint8_t *rsp, size_t rsp_len, gint64 ts_ns);
+
+//see mb_poll_get_device_stats(), -1 if the device is not polled
+int mb_registry_get_device_stats(mb_registry *reg, gint device, mb_device_stats *stats);
+//per bus statistics, then the aggregate samples/s and the stalest device
+void mb_registry_print_stats(mb_registry *reg);
+
+#endif
@@ -0,0 +1,414 @@
+/**************************************************
+ * Modbus TCP server, see modbus_tcp.h
+ * A frame is the 7 byte MBAP header (transaction,
+ * protocol 0, length, unit) followed by the PDU, which
+ * modbus_frame.c decodes. Each connection keeps a receive
+ * buffer for a partial frame and a send buffer for the
+ * responses not written yet; while the send buffer is
+ * too full for another response the connection waits for
+ * EPOLLOUT instead of EPOLLIN.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "modbus_tcp.h"
+#include "modbus_frame.h"
+#include "monotime.h"
+
+#define MBAP_LEN 7
+#define MBTCP_MAX_ADU (MBAP_LEN + 253)
+#define MBTCP_TX_SIZE 4096
+#define MBTCP_BACKLOG 512
+#define MBTCP_SWEEP_MS 1000
+
+typedef struct mbtcp_conn mbtcp_conn;
+
+struct mbtcp_conn {
+    mbtcp_server *srv;
+    int fd;
+    reactor_source *src;
+    guint slot;             //index in srv->conns
+    gint64 last_ns;
+    guint rx_len;
+    guint tx_off;
+    guint tx_len;
+    gboolean blocked;       //waiting for EPOLLOUT
+    uint8_t rx[MBTCP_MAX_ADU];
+    uint8_t tx[MBTCP_TX_SIZE];
+};
+
+//register address -> map entry, and which word of it
+typedef struct {
+    gint16 entry;           //-1 unmapped
+    guint8 word;
+} mbtcp_slot;
+
+struct mbtcp_server {
+    mbtcp_config cfg;
+    mbtcp_reg map[MBTCP_MAX_MAP];
+    gint channel[MBTCP_MAX_MAP];
+    mbtcp_slot *slots;
+    guint n_slots;
+    live_client *live;
+    reactor *r;
+    int listen_fd;
+    reactor_source *listen_src;
+    reactor_source *sweep;
+    mbtcp_conn **conns;
+    guint n_conns;
+    mbtcp_stats stats;
+};
+
+static void conn_close(mbtcp_conn *c)
+{
+    mbtcp_server *srv = c->srv;
+
+    reactor_remove(c->src);
+    close(c->fd);
+    //keep conns dense, the last connection takes the freed slot
+    srv->conns[c->slot] = srv->conns[--srv->n_conns];
+    srv->conns[c->slot]->slot = c->slot;
+    srv->stats.clients = srv->n_conns;
+    g_free(c);
+}
+
+/********** register values **********/
+
+static guint16 reg_word(mbtcp_server *srv, guint entry, guint word, const live_value *v, gboolean ok)
+{
+    const mbtcp_reg *m = &srv->map[entry];
+    gdouble x;
+
+    switch (m->format) {
+    case MBTCP_INT16:
+        if (!ok) {return 0x8000;}
+        x = round(v->value * m->scale);
+        return (guint16)(gint16)CLAMP(x, -32767, 32767);
+    case MBTCP_UINT16:
+        if (!ok) {return 0xFFFF;}
+        x = round(v->value * m->scale);
+        return (guint16)CLAMP(x, 0, 65534);
+    default: {
+        union {gfloat f; guint32 u;} bits;
+        bits.f = ok ? (gfloat)v->value : NAN;
+        return (word == 0) ? bits.u >> 16 : bits.u & 0xFFFF;
+    }
+    }
+}
+
+//fill count registers from address, FALSE if any of them is not mapped
+static gboolean read_regs(mbtcp_server *srv, guint16 address, guint16 count, guint16 *regs)
+{
+    gint last = -1;
+    live_value v;
+    gboolean ok = FALSE;
+
+    if ((guint)address + count > srv->n_slots) {return FALSE;}
+    for (guint i = 0; i < count; i++) {
+        const mbtcp_slot *s = &srv->slots[address + i];
+        if (s->entry < 0) {return FALSE;}
+        //both words of a float come from the same read
+        if (s->entry != last) {
+            gint ch = srv->channel[s->entry];
+            ok = ch >= 0 && live_client_read(srv->live, ch, &v);
+            last = s->entry;
+        }
+        regs[i] = reg_word(srv, s->entry, s->word, &v, ok);
+    }
+    return TRUE;
+}
+
+/********** requests **********/
+
+//answer one request PDU into the send buffer, which has room for any response
+static void serve(mbtcp_server *srv, mbtcp_conn *c, const uint8_t *mbap, const uint8_t *pdu, size_t len)
+{
+    gint64 t0 = mono_ns(), dt;
+    uint8_t *out = c->tx + c->tx_len;
+    guint16 regs[MB_MAX_READ_REGS];
+    mb_frame f;
+    size_t n;
+    mb_frame_result rc = mb_pdu_parse_request(pdu, len, &f);
+
+    if (rc == MB_FRAME_OK && f.function != MB_FC_READ_HOLDING && f.function != MB_FC_READ_INPUT) {
+        f.exception = MB_EX_ILLEGAL_FUNCTION;
+        rc = MB_FRAME_EXCEPTION;
+    }
+    if (rc == MB_FRAME_OK && !read_regs(srv, f.address, f.count, regs)) {
+        f.exception = MB_EX_ILLEGAL_ADDRESS;
+        rc = MB_FRAME_EXCEPTION;
+    }
+    if (rc == MB_FRAME_OK) {n = mb_pdu_read_response(out + MBAP_LEN, MBTCP_TX_SIZE - c->tx_len - MBAP_LEN, f.function, regs, f.count);}
+    else {
+        //a PDU too short or too long for its function is answered like a bad value
+        n = mb_pdu_exception(out + MBAP_LEN, MBTCP_TX_SIZE - c->tx_len - MBAP_LEN, pdu[0],
+                             rc == MB_FRAME_EXCEPTION ? f.exception : MB_EX_ILLEGAL_VALUE);
+        srv->stats.exceptions++;
+    }
+    //same transaction and unit, protocol 0, length of unit plus PDU
+    memcpy(out, mbap, 4);
+    out[4] = (n + 1) >> 8;
+    out[5] = (n + 1) & 0xFF;
+    out[6] = mbap[6];
+    c->tx_len += MBAP_LEN + n;
+    srv->stats.requests++;
+    dt = mono_ns() - t0;
+    srv->stats.service_ns += dt;
+    if (dt > srv->stats.service_max_ns) {srv->stats.service_max_ns = dt;}
+}
+
+//length of the first frame in rx once it is complete, else 0
+static guint frame_ready(const mbtcp_conn *c)
+{
+    guint len;
+
+    if (c->rx_len < MBAP_LEN) {return 0;}
+    len = MBAP_LEN - 1 + ((c->rx[4] << 8) | c->rx[5]);
+    return (c->rx_len >= len) ? len : 0;
+}
+
+//serve the complete frames received so far; FALSE on a protocol error
+static gboolean conn_parse(mbtcp_conn *c)
+{
+    guint off = 0;
+
+    while (c->rx_len - off >= MBAP_LEN) {
+        const uint8_t *h = c->rx + off;
+        guint len = (h[4] << 8) | h[5];
+
+        //not Modbus, or a length no PDU can have: drop the connection
+        if (h[2] != 0 || h[3] != 0 || len < 2 || len > MBTCP_MAX_ADU - MBAP_LEN + 1) {return FALSE;}
+        if (c->rx_len - off < MBAP_LEN - 1 + len) {break;}
+        if (MBTCP_TX_SIZE - c->tx_len < MBTCP_MAX_ADU) {break;}
+        serve(c->srv, c, h, h + MBAP_LEN, len - 1);
+        off += MBAP_LEN - 1 + len;
+    }
+    memmove(c->rx, c->rx + off, c->rx_len - off);
+    c->rx_len -= off;
+    return TRUE;
+}
+
+//write what the socket takes; FALSE if the connection is gone
+static gboolean conn_flush(mbtcp_conn *c)
+{
+    while (c->tx_off < c->tx_len) {
+        ssize_t n = send(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, MSG_NOSIGNAL);
+        if (n < 0) {return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;}
+        c->tx_off += n;
+    }
+    c->tx_off = 0;
+    c->tx_len = 0;
+    return TRUE;
+}
+
+static void on_conn(reactor_source *src, guint32 events, gpointer data)
+{
+    mbtcp_conn *c = data;
+    gboolean blocked;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        conn_close(c);
+        return;
+    }
+    if (events & EPOLLIN) {
+        ssize_t n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            conn_close(c);
+            return;
+        }
+        if (n > 0) {
+            c->rx_len += n;
+            c->last_ns = mono_ns();
+        }
+    }
+    //parse, flush and parse again until the frames in rx are served or the socket is full
+    do {
+        if (!conn_parse(c)) {
+            c->srv->stats.bad_frames++;
+            conn_close(c);
+            return;
+        }
+        if (!conn_flush(c)) {
+            conn_close(c);
+            return;
+        }
+    } while (c->tx_len == 0 && frame_ready(c) > 0);
+    blocked = c->tx_len > 0;
+    if (blocked != c->blocked) {
+        reactor_modify(c->src, blocked ? EPOLLOUT : EPOLLIN);
+        c->blocked = blocked;
+    }
+}
+
+static void on_accept(reactor_source *src, guint32 events, gpointer data)
+{
+    mbtcp_server *srv = data;
+    int one = 1;
+
+    for (;;) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        mbtcp_conn *c;
+
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                printf("Error: Modbus TCP accept: %s\n", strerror(errno));
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {continue;}
+            return;
+        }
+        if (srv->n_conns >= srv->cfg.max_clients) {
+            srv->stats.rejected++;
+            close(fd);
+            continue;
+        }
+        //responses are small and must not wait for the next request
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c = g_new0(mbtcp_conn, 1);
+        c->srv = srv;
+        c->fd = fd;
+        c->last_ns = mono_ns();
+        c->src = reactor_add_fd(srv->r, fd, EPOLLIN, on_conn, c);
+        if (c->src == NULL) {
+            close(fd);
+            g_free(c);
+            continue;
+        }
+        c->slot = srv->n_conns;
+        srv->conns[srv->n_conns++] = c;
+        srv->stats.accepted++;
+        srv->stats.clients = srv->n_conns;
+        if (srv->n_conns > srv->stats.clients_max) {srv->stats.clients_max = srv->n_conns;}
+    }
+}
+
+static void on_sweep(reactor_source *src, guint32 events, gpointer data)
+{
+    mbtcp_server *srv = data;
+    gint64 now = mono_ns();
+
+    //walk down, closing moves the last connection into the freed slot
+    for (guint i = srv->n_conns; i-- > 0;) {
+        if (now - srv->conns[i]->last_ns > srv->cfg.idle_ms * NSEC_PER_MSEC) {
+            srv->stats.idle_closed++;
+            conn_close(srv->conns[i]);
+        }
+    }
+    reactor_timer_arm(src, now + MBTCP_SWEEP_MS * NSEC_PER_MSEC);
+}
+
+static gboolean build_map(mbtcp_server *srv)
+{
+    guint top = 0;
+
+    for (guint i = 0; i < srv->cfg.n_map; i++) {
+        guint words = (srv->map[i].format == MBTCP_FLOAT32) ? 2 : 1;
+        top = MAX(top, (guint)srv->map[i].address + words);
+    }
+    srv->n_slots = top;
+    srv->slots = g_new(mbtcp_slot, MAX(top, 1));
+    for (guint a = 0; a < top; a++) {srv->slots[a].entry = -1;}
+    for (guint i = 0; i < srv->cfg.n_map; i++) {
+        const mbtcp_reg *m = &srv->map[i];
+        guint words = (m->format == MBTCP_FLOAT32) ? 2 : 1;
+        for (guint w = 0; w < words; w++) {
+            if (srv->slots[m->address + w].entry >= 0) {
+                printf("Error: Modbus TCP register %u is mapped twice\n", m->address + w);
+                return FALSE;
+            }
+            srv->slots[m->address + w].entry = i;
+            srv->slots[m->address + w].word = w;
+        }
+        //a channel the monitor does not publish reads as missing
+        srv->channel[i] = live_client_find(srv->live, m->channel);
+        if (srv->channel[i] < 0) {printf("Error: Modbus TCP register %u: no channel %s\n", m->address, m->channel);}
+    }
+    return TRUE;
+}
+
+mbtcp_server *mbtcp_start(const mbtcp_config *cfg, reactor *r, live_client *live)
+{
+    mbtcp_server *srv;
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if (cfg->n_map > MBTCP_MAX_MAP || cfg->max_clients == 0) {return NULL;}
+    srv = g_new0(mbtcp_server, 1);
+    srv->cfg = *cfg;
+    memcpy(srv->map, cfg->map, cfg->n_map * sizeof(mbtcp_reg));
+    srv->cfg.map = srv->map;
+    srv->live = live;
+    srv->r = r;
+    srv->listen_fd = -1;
+    srv->conns = g_new0(mbtcp_conn *, cfg->max_clients);
+    if (!build_map(srv)) {
+        mbtcp_stop(srv);
+        return NULL;
+    }
+    srv->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv->listen_fd < 0) {
+        printf("Error: Modbus TCP socket: %s\n", strerror(errno));
+        mbtcp_stop(srv);
+        return NULL;
+    }
+    setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(cfg->port);
+    if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv->listen_fd, MBTCP_BACKLOG) < 0) {
+        printf("Error: Modbus TCP port %u: %s\n", cfg->port, strerror(errno));
+        mbtcp_stop(srv);
+        return NULL;
+    }
+    srv->listen_src = reactor_add_fd(r, srv->listen_fd, EPOLLIN, on_accept, srv);
+    if (cfg->idle_ms > 0) {
+        srv->sweep = reactor_add_timer(r, on_sweep, srv);
+        if (srv->sweep) {reactor_timer_arm(srv->sweep, mono_ns() + MBTCP_SWEEP_MS * NSEC_PER_MSEC);}
+    }
+    if (srv->listen_src == NULL) {
+        mbtcp_stop(srv);
+        return NULL;
+    }
+    return srv;
+}
+
+void mbtcp_stop(mbtcp_server *srv)
+{
+    if (srv == NULL) {return;}
+    while (srv->n_conns > 0) {conn_close(srv->conns[srv->n_conns - 1]);}
+    if (srv->sweep) {reactor_remove(srv->sweep);}
+    if (srv->listen_src) {reactor_remove(srv->listen_src);}
+    if (srv->listen_fd >= 0) {close(srv->listen_fd);}
+    g_free(srv->conns);
+    g_free(srv->slots);
+    g_free(srv);
+}
+
+void mbtcp_get_stats(mbtcp_server *srv, mbtcp_stats *stats)
+{
+    *stats = srv->stats;
+}
+
+void mbtcp_print_stats(mbtcp_server *srv)
+{
+    mbtcp_stats st;
+
+    mbtcp_get_stats(srv, &st);
+    printf("Modbus TCP: %llu connections (%llu refused, %llu idle), at most %u at once\n",
+           (unsigned long long)st.accepted, (unsigned long long)st.rejected,
+           (unsigned long long)st.idle_closed, st.clients_max);
+    printf("Modbus TCP: %llu requests, %llu exceptions, %llu protocol errors",
+           (unsigned long long)st.requests, (unsigned long long)st.exceptions, (unsigned long long)st.bad_frames);
+    if (st.requests > 0) {
+        printf(", %.2f us per request, worst %.1f us", (double)st.service_ns / st.requests / NSEC_PER_USEC,
+               (double)st.service_max_ns / NSEC_PER_USEC);
+    }
+    printf("\n");
+}
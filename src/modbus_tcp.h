@@ -0,0 +1,70 @@
+/**************************************************
+ * Modbus TCP server for the building management system
+ * Answers function 03 and 04 reads from a register map
+ * over the live data channels (see live_client.h), so a
+ * request is served from the latest published values and
+ * never reaches a sensor bus. Input and holding registers
+ * are the same table; writes are refused with an illegal
+ * function exception. All sockets are non-blocking and
+ * run on one reactor: the listening socket, every client
+ * connection and an idle sweep timer. Requests may be
+ * pipelined; a client that does not read its responses
+ * is not read from until it does.
+ * A value that was never published reads as 0x8000
+ * (int16), 0xFFFF (uint16) or NaN (float32).
+ * ************************************************/
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <glib.h>
+#include "reactor.h"
+#include "live_client.h"
+
+#define MBTCP_MAX_MAP 64
+
+typedef enum {
+    MBTCP_INT16,        //value * scale, rounded and clamped
+    MBTCP_UINT16,
+    MBTCP_FLOAT32       //two registers, IEEE 754 big endian, high word first
+} mbtcp_format;
+
+typedef struct {
+    guint16 address;
+    const gchar *channel;   //live data channel name
+    gdouble scale;          //ignored for float32
+    mbtcp_format format;
+} mbtcp_reg;
+
+typedef struct {
+    guint16 port;
+    guint max_clients;      //further connections are closed right away
+    guint idle_ms;          //connections silent this long are closed, 0 never
+    const mbtcp_reg *map;
+    guint n_map;
+} mbtcp_config;
+
+typedef struct {
+    guint64 accepted;
+    guint64 rejected;       //over max_clients
+    guint64 idle_closed;
+    guint clients;
+    guint clients_max;
+    guint64 requests;
+    guint64 exceptions;
+    guint64 bad_frames;     //protocol errors, the connection is closed
+    gint64 service_ns;      //request parsed to response queued
+    gint64 service_max_ns;
+} mbtcp_stats;
+
+typedef struct mbtcp_server mbtcp_server;
+
+//listen on cfg->port and serve from live; NULL if the socket cannot be set up
+//or the map is invalid. The map is copied, live must outlive the server.
+mbtcp_server *mbtcp_start(const mbtcp_config *cfg, reactor *r, live_client *live);
+//close every connection, while r is stopped or from its thread
+void mbtcp_stop(mbtcp_server *srv);
+
+void mbtcp_get_stats(mbtcp_server *srv, mbtcp_stats *stats);
+void mbtcp_print_stats(mbtcp_server *srv);
+
+#endif
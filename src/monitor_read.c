@@ -0,0 +1,85 @@
+/**************************************************
+ * Command line reader of the monitor's live data
+ *   monitor_read                  every channel once
+ *   monitor_read temperature o2   only these channels
+ *   monitor_read -w 500 ...       repeat every 500 ms
+ * Prints name, value, unit and the age of the value.
+ * Reads the shared memory segment only, never a bus.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "live_client.h"
+#include "monotime.h"
+
+//a monitor without a heartbeat for this long is reported as not running
+#define HEARTBEAT_MAX_AGE_NS (5 * NSEC_PER_SEC)
+
+static void print_channel(live_client *c, guint ch, gint64 now)
+{
+    live_value v;
+
+    if (!live_client_read(c, ch, &v)) {
+        printf("%-24s %12s\n", live_client_name(c, ch), "-");
+        return;
+    }
+    printf("%-24s %12.3f %-8s %6.1f s\n", live_client_name(c, ch), v.value,
+           live_client_unit(c, ch), (double)(now - v.ts_ns) / NSEC_PER_SEC);
+}
+
+static int print_all(live_client *c, char **names, int n_names)
+{
+    gint64 now = mono_ns();
+    int missing = 0;
+
+    if (n_names == 0) {
+        for (guint ch = 0; ch < live_client_n_channels(c); ch++) {print_channel(c, ch, now);}
+        return 0;
+    }
+    for (int i = 0; i < n_names; i++) {
+        gint ch = live_client_find(c, names[i]);
+        if (ch < 0) {
+            printf("%-24s no such channel\n", names[i]);
+            missing++;
+            continue;
+        }
+        print_channel(c, ch, now);
+    }
+    return missing;
+}
+
+int main(int argc, char *argv[])
+{
+    live_client *c = NULL;
+    int interval_ms = 0;
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "w:h")) != -1) {
+        if (opt == 'w') {interval_ms = atoi(optarg);}
+        else {
+            printf("usage: %s [-w interval_ms] [channel...]\n", argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    for (;;) {
+        //follow the monitor across restarts, each run has a fresh segment
+        if (c && !live_client_alive(c, HEARTBEAT_MAX_AGE_NS)) {
+            live_client_close(c);
+            c = NULL;
+        }
+        if (c == NULL) {c = live_client_open(LIVE_SHM_NAME);}
+        if (c == NULL) {printf("monitor is not running\n");}
+        else {
+            rc = print_all(c, argv + optind, argc - optind);
+            if (interval_ms <= 0) {break;}
+        }
+        if (interval_ms <= 0) {return 1;}
+        printf("\n");
+        fflush(stdout);
+        usleep(interval_ms * 1000);
+    }
+    live_client_close(c);
+    return rc ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/**************************************************
+ * Monotonic time helpers shared by the acquisition code.
+ * All timestamps in the program are CLOCK_MONOTONIC
+ * nanoseconds, the same clock the kernel uses for
+ * GPIO line events.
+ * ************************************************/
+#ifndef MONOTIME_H
+#define MONOTIME_H
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NSEC_PER_USEC 1000LL
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_SEC  1000000000LL
+
+static inline int64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+//wall clock, only for converting deadlines that must survive a restart
+static inline int64_t real_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline struct timespec ns_to_timespec(int64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / NSEC_PER_SEC;
+    ts.tv_nsec = ns % NSEC_PER_SEC;
+    return ts;
+}
+
+//sleep until an absolute CLOCK_MONOTONIC deadline, retrying on signals;
+//any other error is a bad deadline and a bug in the caller
+static inline void sleep_until_ns(int64_t deadline)
+{
+    struct timespec ts = ns_to_timespec(deadline);
+    int err;
+
+    while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {}
+    assert(err == 0);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**************************************************
+ * Adaptive sample rate, see rate_adapt.h
+ * The urgency of a sample is the largest of
+ * - its rate of change over busy_rate,
+ * - its nearness to a limit on either side: 0 from twice
+ *   busy_margin away or past it, 1 within busy_margin,
+ * - 1 when it moves toward the nearest limit fast enough
+ *   to reach it within two slow periods,
+ * clamped to 0..1; the period is slow * (fast / slow)^urgency.
+ * ************************************************/
+#include <stdio.h>
+#include <math.h>
+
+#include "rate_adapt.h"
+#include "monotime.h"
+
+struct rate_adapt {
+    rate_adapt_config cfg;
+    gint64 fast;
+    gint64 slow;
+    gint64 period;
+    gboolean primed;
+    gdouble value;
+    gint64 ts_ns;
+    rate_adapt_stats stats;
+};
+
+rate_adapt *rate_adapt_new(const rate_adapt_config *cfg)
+{
+    rate_adapt *ra;
+
+    if (cfg->fast_ms == 0 || cfg->slow_ms < cfg->fast_ms) {return NULL;}
+    ra = g_new0(rate_adapt, 1);
+    ra->cfg = *cfg;
+    ra->fast = (gint64)cfg->fast_ms * NSEC_PER_MSEC;
+    ra->slow = (gint64)cfg->slow_ms * NSEC_PER_MSEC;
+    //nothing is known yet, start fast and let the signal slow it down
+    ra->period = ra->fast;
+    return ra;
+}
+
+void rate_adapt_free(rate_adapt *ra)
+{
+    g_free(ra);
+}
+
+gint64 rate_adapt_update(rate_adapt *ra, gdouble value, gdouble margin, gint direction, gint64 ts_ns)
+{
+    gdouble urgency = 0, rate = 0, approach = 0;
+    gint64 target;
+
+    if (isnan(value)) {return ra->period;}
+    if (ra->primed && ts_ns > ra->ts_ns) {
+        gdouble change = value - ra->value;
+        gdouble dt = (gdouble)(ts_ns - ra->ts_ns) / NSEC_PER_SEC;
+
+        if (fabs(change) > ra->cfg.noise) {rate = (fabs(change) - ra->cfg.noise) / dt;}
+        //only the part of the change that closes in on the limit
+        if (change * direction > ra->cfg.noise) {approach = (change * direction - ra->cfg.noise) / dt;}
+    }
+    if (ra->cfg.busy_rate > 0) {urgency = rate / ra->cfg.busy_rate;}
+    if (ra->cfg.busy_margin > 0) {urgency = MAX(urgency, 2 - fabs(margin) / ra->cfg.busy_margin);}
+    if (approach > 0 && margin > 0 && margin / approach * NSEC_PER_SEC < 2 * ra->slow) {urgency = 1;}
+    urgency = CLAMP(urgency, 0, 1);
+    //most samples of a quiet signal end at either end of the scale, no pow() for them
+    if (urgency <= 0) {target = ra->slow;}
+    else if (urgency >= 1) {target = ra->fast;}
+    else {target = (gint64)(ra->slow * pow((gdouble)ra->fast / ra->slow, urgency));}
+    if (target < ra->period) {ra->period = target;}
+    else {ra->period = MIN(target, 2 * ra->period);}
+    ra->primed = TRUE;
+    ra->value = value;
+    ra->ts_ns = ts_ns;
+    ra->stats.updates++;
+    if (ra->period == ra->fast) {ra->stats.fast_ns += ra->period;}
+    ra->stats.period_ns += ra->period;
+    return ra->period;
+}
+
+gint64 rate_adapt_period(rate_adapt *ra) {return ra->period;}
+
+void rate_adapt_get_stats(rate_adapt *ra, rate_adapt_stats *stats)
+{
+    *stats = ra->stats;
+}
+
+void rate_adapt_print_stats(rate_adapt *ra, const gchar *name)
+{
+    rate_adapt_stats st;
+
+    rate_adapt_get_stats(ra, &st);
+    if (st.updates == 0) {return;}
+    printf("Rate %s: %llu samples, %.1f%% of the time fast, mean period %.3f s (%.3f-%.3f s)\n", name,
+           (unsigned long long)st.updates, 100.0 * st.fast_ns / st.period_ns, (double)st.period_ns / st.updates / NSEC_PER_SEC,
+           (double)ra->fast / NSEC_PER_SEC, (double)ra->slow / NSEC_PER_SEC);
+}
@@ -0,0 +1,54 @@
+/**************************************************
+ * Adaptive sample rate for one signal
+ * Picks the period of the next sample from what the last
+ * samples showed: a signal that moves fast, or that is
+ * close to an alarm limit on either side, is sampled at
+ * the fast period, a quiet one far from its limits or
+ * well past one, whose alarm is seen already, at the slow
+ * (floor) period, and everything in between on a
+ * geometric scale.
+ * A signal moving toward its nearest limit fast enough to
+ * reach it within two slow periods is sampled fast,
+ * whatever its distance; moving away from it does not
+ * count.
+ * Speeding up takes effect at once, slowing down at most
+ * doubles the period per sample, so a single quiet sample
+ * in the middle of a swing does not lose it.
+ * The caller turns the period into poll periods or data
+ * rates and keeps them within its bus budget. Not thread
+ * safe, one per producer.
+ * ************************************************/
+#ifndef RATE_ADAPT_H
+#define RATE_ADAPT_H
+
+#include <glib.h>
+
+typedef struct {
+    guint fast_ms;          //period while the signal is busy
+    guint slow_ms;          //period while it is quiet
+    gdouble noise;          //a change this small between two samples is no change
+    gdouble busy_rate;      //units per second that call for the fast period
+    gdouble busy_margin;    //distance to an alarm limit that calls for the fast period
+} rate_adapt_config;
+
+typedef struct {
+    guint64 updates;
+    gint64 fast_ns;         //time spent at the fast period
+    gint64 period_ns;       //sum of the periods asked for, the time covered
+} rate_adapt_stats;
+
+typedef struct rate_adapt rate_adapt;
+
+//NULL if the periods are out of order
+rate_adapt *rate_adapt_new(const rate_adapt_config *cfg);
+void rate_adapt_free(rate_adapt *ra);
+
+//a sample taken at ts_ns, margin and direction of the nearest limit as from
+//alarm_engine_signal_margin(); returns the period until the next sample
+gint64 rate_adapt_update(rate_adapt *ra, gdouble value, gdouble margin, gint direction, gint64 ts_ns);
+gint64 rate_adapt_period(rate_adapt *ra);
+
+void rate_adapt_get_stats(rate_adapt *ra, rate_adapt_stats *stats);
+void rate_adapt_print_stats(rate_adapt *ra, const gchar *name);
+
+#endif
@@ -0,0 +1,253 @@
+/**************************************************
+ * Acquisition reactor, see reactor.h
+ * A source removed while a batch of events is being
+ * dispatched may still be referenced later in the same
+ * batch, so it is only marked dead and freed once the
+ * batch is done.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "reactor.h"
+#include "monotime.h"
+
+#define REACTOR_MAX_EVENTS 16
+
+struct reactor_source {
+    reactor *r;
+    int fd;
+    gboolean timer;
+    gboolean dead;
+    reactor_func func;
+    gpointer user_data;
+    reactor_source *next_dead;
+};
+
+struct reactor {
+    int epfd;
+    int stop_fd;
+    int cpu;
+    GThread *thread;
+    gboolean dispatching;
+    reactor_source *dead;
+    reactor_stats stats;
+};
+
+reactor *reactor_new(void)
+{
+    reactor *r = g_new0(reactor, 1);
+    struct epoll_event ev;
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (r->epfd < 0 || r->stop_fd < 0) {
+        printf("Error: cannot create reactor: %s\n", strerror(errno));
+        if (r->epfd >= 0) {close(r->epfd);}
+        if (r->stop_fd >= 0) {close(r->stop_fd);}
+        g_free(r);
+        return NULL;
+    }
+    //the stop eventfd is the only registration without a source
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->stop_fd, &ev);
+    return r;
+}
+
+void reactor_free(reactor *r)
+{
+    if (r == NULL) {return;}
+    reactor_stop(r);
+    close(r->stop_fd);
+    close(r->epfd);
+    g_free(r);
+}
+
+static void reactor_free_dead(reactor *r)
+{
+    while (r->dead) {
+        reactor_source *src = r->dead;
+        r->dead = src->next_dead;
+        g_free(src);
+    }
+}
+
+static gpointer reactor_thread(gpointer data)
+{
+    reactor *r = data;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    gint64 start = mono_ns();
+    struct timespec cpu;
+
+    if (r->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(r->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            printf("Error: cannot pin reactor to CPU %d\n", r->cpu);
+        }
+    }
+    while (1) {
+        int n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, -1);
+        gboolean stop = FALSE;
+
+        if (n < 0) {
+            if (errno == EINTR) {continue;}
+            printf("Error: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        r->stats.wakeups++;
+        r->dispatching = TRUE;
+        for (int i = 0; i < n; i++) {
+            reactor_source *src = events[i].data.ptr;
+
+            if (src == NULL) {
+                stop = TRUE;
+                continue;
+            }
+            if (src->dead) {continue;}
+            if (src->timer) {
+                guint64 expirations;
+                //the count is not needed, reading just clears readiness
+                if (read(src->fd, &expirations, sizeof(expirations)) < 0) {continue;}
+            }
+            r->stats.dispatches++;
+            src->func(src, events[i].events, src->user_data);
+        }
+        r->dispatching = FALSE;
+        reactor_free_dead(r);
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        r->stats.cpu_ns = (gint64)cpu.tv_sec * NSEC_PER_SEC + cpu.tv_nsec;
+        r->stats.run_ns = mono_ns() - start;
+        if (stop) {break;}
+    }
+    return NULL;
+}
+
+int reactor_start(reactor *r, int cpu)
+{
+    guint64 value;
+
+    if (r->thread != NULL) {return 0;}
+    //drop a stop request left over from an earlier run
+    if (read(r->stop_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {return -1;}
+    r->cpu = cpu;
+    r->thread = g_thread_new("reactor", reactor_thread, r);
+    return 0;
+}
+
+void reactor_stop(reactor *r)
+{
+    guint64 one = 1;
+
+    if (r->thread == NULL) {return;}
+    if (write(r->stop_fd, &one, sizeof(one)) != sizeof(one)) {return;}
+    g_thread_join(r->thread);
+    r->thread = NULL;
+}
+
+static reactor_source *reactor_register(reactor *r, int fd, guint32 events, gboolean timer,
+                                        reactor_func func, gpointer user_data)
+{
+    reactor_source *src = g_new0(reactor_source, 1);
+    struct epoll_event ev;
+
+    src->r = r;
+    src->fd = fd;
+    src->timer = timer;
+    src->func = func;
+    src->user_data = user_data;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = src;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        printf("Error: cannot watch fd %d: %s\n", fd, strerror(errno));
+        g_free(src);
+        return NULL;
+    }
+    return src;
+}
+
+reactor_source *reactor_add_fd(reactor *r, int fd, guint32 events, reactor_func func, gpointer user_data)
+{
+    return reactor_register(r, fd, events, FALSE, func, user_data);
+}
+
+int reactor_modify(reactor_source *src, guint32 events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = src;
+    return epoll_ctl(src->r->epfd, EPOLL_CTL_MOD, src->fd, &ev);
+}
+
+reactor_source *reactor_add_timer(reactor *r, reactor_func func, gpointer user_data)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    reactor_source *src;
+
+    if (fd < 0) {
+        printf("Error: cannot create timer: %s\n", strerror(errno));
+        return NULL;
+    }
+    src = reactor_register(r, fd, EPOLLIN, TRUE, func, user_data);
+    if (src == NULL) {close(fd);}
+    return src;
+}
+
+void reactor_timer_arm(reactor_source *src, gint64 deadline_ns)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    //an all-zero it_value would disarm, a past deadline must still fire
+    if (deadline_ns != 0) {spec.it_value = ns_to_timespec(MAX(deadline_ns, 1));}
+    timerfd_settime(src->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+void reactor_remove(reactor_source *src)
+{
+    reactor *r;
+
+    if (src == NULL) {return;}
+    r = src->r;
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if (src->timer) {close(src->fd);}
+    if (r->dispatching) {
+        src->dead = TRUE;
+        src->next_dead = r->dead;
+        r->dead = src;
+        return;
+    }
+    g_free(src);
+}
+
+void reactor_get_stats(reactor *r, reactor_stats *stats)
+{
+    //plain loads, the counters are only informational
+    *stats = r->stats;
+}
+
+void reactor_print_stats(reactor *r)
+{
+    reactor_stats st;
+
+    reactor_get_stats(r, &st);
+    printf("Reactor: %llu wakeups, %llu callbacks\n",
+           (unsigned long long)st.wakeups, (unsigned long long)st.dispatches);
+    if (st.run_ns > 0) {
+        printf("Reactor: %.1f wakeups/s, %.2f%% CPU\n",
+               (double)st.wakeups * NSEC_PER_SEC / st.run_ns, 100.0 * st.cpu_ns / st.run_ns);
+    }
+}
@@ -0,0 +1,54 @@
+/**************************************************
+ * Acquisition reactor
+ * One thread sleeps in epoll_wait() on every device fd:
+ * GPIO line event fds, the non-blocking serial port and a
+ * timerfd per device for its next deadline. The devices
+ * are state machines driven by the callbacks below, so no
+ * acquisition code blocks or spins and an idle system
+ * only wakes up for the next conversion or poll.
+ * Stopping writes an eventfd; the thread returns as soon
+ * as the callback in progress (if any) returns.
+ * ************************************************/
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <glib.h>
+#include <sys/epoll.h>
+
+typedef struct reactor reactor;
+typedef struct reactor_source reactor_source;
+
+//events are the epoll events that fired, EPOLLIN for a timer
+typedef void (*reactor_func)(reactor_source *src, guint32 events, gpointer user_data);
+
+typedef struct {
+    guint64 wakeups;
+    guint64 dispatches;
+    gint64 cpu_ns;
+    gint64 run_ns;
+} reactor_stats;
+
+reactor *reactor_new(void);
+void reactor_free(reactor *r);
+
+//run the loop in its own thread, pinned to cpu unless cpu < 0
+int reactor_start(reactor *r, int cpu);
+//wake the loop and join it, sources stay registered
+void reactor_stop(reactor *r);
+
+//sources are added and removed before reactor_start, after reactor_stop,
+//or from a callback running on the reactor thread
+reactor_source *reactor_add_fd(reactor *r, int fd, guint32 events, reactor_func func, gpointer user_data);
+int reactor_modify(reactor_source *src, guint32 events);
+//one-shot CLOCK_MONOTONIC timer backed by a timerfd, created disarmed
+reactor_source *reactor_add_timer(reactor *r, reactor_func func, gpointer user_data);
+//absolute monotonic deadline, a deadline in the past fires right away, 0 disarms
+void reactor_timer_arm(reactor_source *src, gint64 deadline_ns);
+//a timer source also closes its timerfd, an fd source leaves the fd open
+void reactor_remove(reactor_source *src);
+
+void reactor_get_stats(reactor *r, reactor_stats *stats);
+//print wakeups/s and the CPU share of the reactor thread
+void reactor_print_stats(reactor *r);
+
+#endif
@@ -0,0 +1,178 @@
+/**************************************************
+ * Replay of a capture, see replay.h
+ * One record is read ahead; the timer is armed for its
+ * due time, and when it fires every record that is due
+ * by then is delivered.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+#include "monotime.h"
+#include "trace.h"
+
+//records per callback when replaying as fast as possible
+#define REPLAY_BATCH 256
+//retry delay while the ADC consumer catches up
+#define REPLAY_STALL_NS (1 * NSEC_PER_MSEC)
+
+struct replay {
+    capture *cap;
+    gdouble speed;
+    replay_targets targets;
+    reactor_source *timer;
+    replay_done_func done;
+    gpointer user_data;
+    //read ahead, only touched by the reactor thread
+    capture_record next;
+    gboolean have_next;
+    gint64 first_ts;
+    gint64 start;
+    GMutex lock;
+    replay_stats stats;
+};
+
+replay *replay_open(const gchar *file, gdouble speed)
+{
+    replay *rp;
+    capture *cap = capture_open(file);
+
+    if (cap == NULL) {return NULL;}
+    rp = g_new0(replay, 1);
+    rp->cap = cap;
+    rp->speed = MAX(speed, 0);
+    rp->have_next = capture_read(cap, &rp->next);
+    rp->first_ts = rp->next.ts_ns;
+    g_mutex_init(&rp->lock);
+    return rp;
+}
+
+//0 delivered, 1 try again later, -1 no driver takes it
+static int replay_deliver(replay *rp, const capture_record *rec, gint64 ts)
+{
+    const replay_targets *t = &rp->targets;
+
+    switch (rec->kind) {
+    case CAPTURE_MODBUS:
+        if (t->sensors == NULL) {return -1;}
+        //a failed poll is part of the recording, only a foreign request is skipped
+        return mb_registry_replay(t->sensors, rec->source, rec->data, rec->split,
+                                  rec->data + rec->split, rec->len - rec->split, ts) < 0 ? -1 : 0;
+    case CAPTURE_ADC:
+        if (t->adc == NULL) {return -1;}
+        return ads1115_replay(t->adc, rec->source, rec->data, rec->len, ts);
+    case CAPTURE_GPIO:
+        if (t->contacts == NULL || rec->len < 1) {return -1;}
+        return gpio_input_sim_edge(t->contacts, rec->source, rec->data[0], ts) < 0 ? -1 : 0;
+    default:
+        return -1;
+    }
+}
+
+static void replay_on_timer(reactor_source *src, guint32 events, gpointer data)
+{
+    replay *rp = data;
+    gint64 now = mono_ns();
+    guint batch = 0;
+
+    while (rp->have_next) {
+        const capture_record *rec = &rp->next;
+        gint64 due = now;
+        int rc;
+
+        if (rp->speed > 0) {
+            due = rp->start + (gint64)((rec->ts_ns - rp->first_ts) / rp->speed);
+            if (due > now) {
+                reactor_timer_arm(rp->timer, due);
+                return;
+            }
+        }
+        else if (batch++ == REPLAY_BATCH) {
+            reactor_timer_arm(rp->timer, now);
+            return;
+        }
+        trace_begin("replay_deliver");
+        rc = replay_deliver(rp, rec, due);
+        trace_end("replay_deliver");
+        if (rc > 0) {
+            g_mutex_lock(&rp->lock);
+            rp->stats.stalls++;
+            g_mutex_unlock(&rp->lock);
+            reactor_timer_arm(rp->timer, now + REPLAY_STALL_NS);
+            return;
+        }
+        g_mutex_lock(&rp->lock);
+        rp->stats.records++;
+        rp->stats.kind_records[rec->kind]++;
+        if (rc < 0) {rp->stats.skipped++;}
+        if (rp->speed > 0) {
+            rp->stats.late_max_ns = MAX(rp->stats.late_max_ns, now - due);
+            rp->stats.late_total_ns += now - due;
+        }
+        rp->stats.span_ns = MAX(rp->stats.span_ns, rec->ts_ns - rp->first_ts);
+        rp->stats.run_ns = now - rp->start;
+        g_mutex_unlock(&rp->lock);
+        rp->have_next = capture_read(rp->cap, &rp->next);
+    }
+    g_mutex_lock(&rp->lock);
+    rp->stats.run_ns = mono_ns() - rp->start;
+    rp->stats.done = TRUE;
+    g_mutex_unlock(&rp->lock);
+    if (rp->done) {rp->done(rp->user_data);}
+}
+
+int replay_start(replay *rp, reactor *r, const replay_targets *targets, replay_done_func done, gpointer user_data)
+{
+    if (rp->timer != NULL) {return 0;}
+    rp->targets = *targets;
+    rp->done = done;
+    rp->user_data = user_data;
+    rp->timer = reactor_add_timer(r, replay_on_timer, rp);
+    if (rp->timer == NULL) {return -1;}
+    rp->start = mono_ns();
+    reactor_timer_arm(rp->timer, rp->start);
+    return 0;
+}
+
+void replay_stop(replay *rp)
+{
+    if (rp->timer == NULL) {return;}
+    reactor_remove(rp->timer);
+    rp->timer = NULL;
+}
+
+void replay_free(replay *rp)
+{
+    if (rp == NULL) {return;}
+    replay_stop(rp);
+    capture_close(rp->cap);
+    g_mutex_clear(&rp->lock);
+    g_free(rp);
+}
+
+void replay_get_stats(replay *rp, replay_stats *stats)
+{
+    g_mutex_lock(&rp->lock);
+    *stats = rp->stats;
+    g_mutex_unlock(&rp->lock);
+}
+
+void replay_print_stats(replay *rp)
+{
+    replay_stats st;
+
+    replay_get_stats(rp, &st);
+    printf("Replay: %llu records (%llu Modbus, %llu ADC, %llu GPIO), %llu skipped, %s\n",
+           (unsigned long long)st.records, (unsigned long long)st.kind_records[CAPTURE_MODBUS],
+           (unsigned long long)st.kind_records[CAPTURE_ADC], (unsigned long long)st.kind_records[CAPTURE_GPIO],
+           (unsigned long long)st.skipped, st.done ? "complete" : "stopped");
+    if (st.run_ns > 0) {
+        printf("Replay: %.1f s of capture in %.3f s, %.0f records/s, %llu stalls on the ADC ring\n",
+               (double)st.span_ns / NSEC_PER_SEC, (double)st.run_ns / NSEC_PER_SEC,
+               (double)st.records * NSEC_PER_SEC / st.run_ns, (unsigned long long)st.stalls);
+    }
+    if (rp->speed > 0 && st.records > 0) {
+        printf("Replay: delivered %.1f us late on average, worst %.1f us\n",
+               (double)st.late_total_ns / st.records / NSEC_PER_USEC, (double)st.late_max_ns / NSEC_PER_USEC);
+    }
+}
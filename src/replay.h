@@ -0,0 +1,65 @@
+/**************************************************
+ * Replay of a capture through the acquisition drivers
+ * A reactor timer walks a capture (see capture.h) in
+ * order and hands every record to its driver when it is
+ * due: Modbus transactions to the registry, conversion
+ * words to the ADC and edges to the simulated dry
+ * contact. From there the samples take the same decoding,
+ * filtering, alarm and display paths as live ones, on a
+ * machine without any of the hardware.
+ * At speed 1 the recorded timing is kept, at speed N
+ * every interval is divided by N, and at speed 0 records
+ * go as fast as the pipeline takes them, in batches so
+ * the other reactor sources still run. Samples are
+ * stamped with their due time, so time based logic
+ * (debounce, alarm delays) sees the compressed time.
+ * A record no driver accepts, because the capture was
+ * made with another configuration, is skipped and counted.
+ * ************************************************/
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <glib.h>
+#include "capture.h"
+#include "reactor.h"
+#include "modbus_registry.h"
+#include "ads1115.h"
+#include "gpio_input.h"
+
+//drivers started for replay, any of them may be NULL
+typedef struct {
+    mb_registry *sensors;   //mb_registry_start_replay()
+    ads1115 *adc;           //ads1115_open_replay()
+    gpio_input *contacts;   //gpio_input_open_sim()
+} replay_targets;
+
+typedef struct {
+    guint64 records;
+    guint64 kind_records[CAPTURE_KINDS];
+    guint64 skipped;
+    guint64 stalls;         //waits for a full ADC ring
+    gint64 late_max_ns;     //worst delivery after the due time, paced replay only
+    gint64 late_total_ns;
+    gint64 run_ns;          //time taken so far
+    gint64 span_ns;         //captured time replayed so far
+    gboolean done;
+} replay_stats;
+
+typedef struct replay replay;
+
+//called once from the reactor thread after the last record
+typedef void (*replay_done_func)(gpointer user_data);
+
+//open a capture to replay at speed, 0 for as fast as possible
+replay *replay_open(const gchar *file, gdouble speed);
+//start delivering from r, the first record is due right away
+int replay_start(replay *rp, reactor *r, const replay_targets *targets, replay_done_func done, gpointer user_data);
+//stop must be called while r is stopped or from its thread
+void replay_stop(replay *rp);
+void replay_free(replay *rp);
+
+void replay_get_stats(replay *rp, replay_stats *stats);
+//records/s and the lateness of paced delivery
+void replay_print_stats(replay *rp);
+
+#endif
@@ -0,0 +1,67 @@
+/**************************************************
+ * SPSC sample ring, see sample_ring.h
+ * ************************************************/
+#include "sample_ring.h"
+
+sample_ring *sample_ring_new(guint capacity)
+{
+    sample_ring *ring;
+    guint size = 1;
+
+    while (size < capacity) {size <<= 1;}
+    ring = g_new0(sample_ring, 1);
+    ring->buf = g_new0(adc_sample, size);
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    return ring;
+}
+
+void sample_ring_free(sample_ring *ring)
+{
+    if (ring == NULL) {return;}
+    g_free(ring->buf);
+    g_free(ring);
+}
+
+gboolean sample_ring_push(sample_ring *ring, const adc_sample *sample)
+{
+    guint head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    guint tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return FALSE;
+    }
+    ring->buf[head & ring->mask] = *sample;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return TRUE;
+}
+
+gboolean sample_ring_full(sample_ring *ring)
+{
+    guint head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    guint tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    return head - tail > ring->mask;
+}
+
+guint sample_ring_drain(sample_ring *ring, adc_sample *out, guint max)
+{
+    guint tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    guint head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    guint n = head - tail;
+
+    if (n > max) {n = max;}
+    for (guint i = 0; i < n; i++) {
+        out[i] = ring->buf[(tail + i) & ring->mask];
+    }
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+guint64 sample_ring_dropped(sample_ring *ring)
+{
+    return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
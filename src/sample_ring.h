@@ -0,0 +1,40 @@
+/**************************************************
+ * Bounded single-producer/single-consumer ring of raw
+ * ADC samples. The acquisition thread pushes one sample at
+ * a time and never blocks, a full ring drops the newest
+ * sample and counts it. The consumer drains in batches.
+ * ************************************************/
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+typedef struct {
+    gint64 ts_ns;
+    gint16 raw;
+    guint8 channel;
+} adc_sample;
+
+typedef struct {
+    adc_sample *buf;
+    guint mask;
+    //head is written by the producer, tail by the consumer; C11 atomics for
+    //the release/acquire hand-over and the 64-bit drop count
+    _Atomic guint head;
+    _Atomic guint tail;
+    _Atomic guint64 dropped;
+} sample_ring;
+
+//capacity is rounded up to a power of two
+sample_ring *sample_ring_new(guint capacity);
+void sample_ring_free(sample_ring *ring);
+
+gboolean sample_ring_push(sample_ring *ring, const adc_sample *sample);
+//producer side: TRUE if the next push would be dropped
+gboolean sample_ring_full(sample_ring *ring);
+//copy up to max samples in arrival order, returns the number copied
+guint sample_ring_drain(sample_ring *ring, adc_sample *out, guint max);
+guint64 sample_ring_dropped(sample_ring *ring);
+
+#endif
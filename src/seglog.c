@@ -0,0 +1,416 @@
+/**************************************************
+ * Append-only binary sensor log, see seglog.h
+ * Segment layout: one header page followed by
+ * SEGLOG_SEGMENT_BLOCKS data blocks, the file is
+ * preallocated so appends never grow it.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "seglog.h"
+#include "monotime.h"
+#include "crc.h"
+
+#define SEGMENT_MAGIC 0x47534C53   //"SLSG"
+#define BLOCK_MAGIC 0x4B424C53     //"SLBK"
+#define SEGMENT_VERSION 1
+#define SEGMENT_SIZE ((gsize)SEGLOG_BLOCK_SIZE * (1 + SEGLOG_SEGMENT_BLOCKS))
+//full blocks allowed to wait for the writer, further records are dropped
+#define PENDING_MAX 64
+#define POOL_SIZE (2 * PENDING_MAX + 1)
+
+G_STATIC_ASSERT(sizeof(seglog_record) == 16);
+G_STATIC_ASSERT(sizeof(seglog_block) == SEGLOG_BLOCK_SIZE);
+G_STATIC_ASSERT(sizeof(seglog_header) <= SEGLOG_BLOCK_SIZE);
+
+struct seglog {
+    seglog_config cfg;
+    gchar *dir;
+    GThread *thread;
+    //shared with producers
+    GMutex lock;
+    GCond cond;
+    gboolean stop;
+    seglog_block *cur;
+    gboolean cur_dirty;
+    guint next_slot;
+    seglog_block *pending[PENDING_MAX];
+    guint n_pending;
+    seglog_block *pool[POOL_SIZE];
+    guint n_pool;
+    seglog_stats stats;
+    //writer thread only
+    int fd;
+    guint32 segment_id;
+    seglog_header header;
+    seglog_block scratch;
+    gint64 start_ns;
+};
+
+static guint32 block_crc(const seglog_block *blk)
+{
+    seglog_block head;
+    guint32 crc;
+
+    memcpy(&head, blk, G_STRUCT_OFFSET(seglog_block, records));
+    head.crc = 0;
+    crc = crc32_ieee(0, &head, G_STRUCT_OFFSET(seglog_block, records));
+    return crc32_ieee(crc, blk->records, blk->n_records * sizeof(seglog_record));
+}
+
+static gboolean block_valid(const seglog_block *blk, guint slot)
+{
+    if (blk->magic != BLOCK_MAGIC || blk->block_seq != slot) {return FALSE;}
+    if (blk->n_records == 0 || blk->n_records > SEGLOG_RECORDS_PER_BLOCK) {return FALSE;}
+    return blk->crc == block_crc(blk);
+}
+
+static gchar *segment_path(const gchar *dir, guint32 id)
+{
+    gchar name[32];
+
+    g_snprintf(name, sizeof(name), "seg-%08u.log", id);
+    return g_build_filename(dir, name, NULL);
+}
+
+//lowest and highest segment ids in the directory, returns the count
+static guint segment_scan(const gchar *dir, guint32 *lowest, guint32 *highest)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    guint count = 0;
+
+    if (d == NULL) {return 0;}
+    while ((ent = readdir(d)) != NULL) {
+        unsigned id;
+        if (sscanf(ent->d_name, "seg-%08u.log", &id) != 1) {continue;}
+        if (count == 0 || id < *lowest) {*lowest = id;}
+        if (count == 0 || id > *highest) {*highest = id;}
+        count++;
+    }
+    closedir(d);
+    return count;
+}
+
+static void segment_prune(seglog *log)
+{
+    guint32 lowest = 0, highest = 0;
+
+    while (segment_scan(log->dir, &lowest, &highest) > log->cfg.max_segments) {
+        gchar *path = segment_path(log->dir, lowest);
+        unlink(path);
+        g_free(path);
+    }
+}
+
+static int segment_create(seglog *log, guint32 id)
+{
+    gchar *path = segment_path(log->dir, id);
+    int err;
+
+    log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log->fd < 0) {
+        printf("Log: couldn't create %s: %s\n", path, strerror(errno));
+        g_free(path);
+        return -1;
+    }
+    g_free(path);
+    //reserve the whole segment up front so appends never allocate
+    err = posix_fallocate(log->fd, 0, SEGMENT_SIZE);
+    if (err != 0) {printf("Log: preallocation failed: %s\n", strerror(err));}
+    memset(&log->header, 0, sizeof(log->header));
+    log->header.magic = SEGMENT_MAGIC;
+    log->header.version = SEGMENT_VERSION;
+    log->header.segment_id = id;
+    log->segment_id = id;
+    if (pwrite(log->fd, &log->header, sizeof(log->header), 0) != sizeof(log->header)) {return -1;}
+    fdatasync(log->fd);
+    return 0;
+}
+
+static void segment_finish(seglog *log)
+{
+    if (log->fd < 0) {return;}
+    log->header.closed = 1;
+    if (pwrite(log->fd, &log->header, sizeof(log->header), 0) != sizeof(log->header)) {
+        printf("Log: couldn't close segment %u: %s\n", log->segment_id, strerror(errno));
+    }
+    fdatasync(log->fd);
+    close(log->fd);
+    log->fd = -1;
+}
+
+//find the valid prefix of an unfinished segment, returns the number of good blocks
+static guint segment_recover(seglog *log, guint32 id, seglog_block *last)
+{
+    gchar *path = segment_path(log->dir, id);
+    seglog_block blk;
+    guint n = 0;
+
+    log->fd = open(path, O_RDWR | O_CLOEXEC);
+    g_free(path);
+    if (log->fd < 0) {return 0;}
+    if (pread(log->fd, &log->header, sizeof(log->header), 0) != sizeof(log->header)
+        || log->header.magic != SEGMENT_MAGIC || log->header.closed) {
+        close(log->fd);
+        log->fd = -1;
+        return 0;
+    }
+    log->segment_id = id;
+    log->header.n_blocks = 0;
+    while (n < SEGLOG_SEGMENT_BLOCKS) {
+        off_t off = (off_t)SEGLOG_BLOCK_SIZE * (1 + n);
+        if (pread(log->fd, &blk, sizeof(blk), off) != sizeof(blk) || !block_valid(&blk, n)) {break;}
+        if (n == 0) {log->header.first_ts = blk.records[0].ts_ns;}
+        log->header.block_ts[n] = blk.records[0].ts_ns;
+        log->header.last_ts = blk.records[blk.n_records - 1].ts_ns;
+        *last = blk;
+        n++;
+    }
+    log->header.n_blocks = n;
+    return n;
+}
+
+//write one block at its slot, starting a new segment when the slots wrap round;
+//only the newest slot is ever rewritten, any lower slot means a wrap.
+//Returns the bytes written
+static gsize write_block(seglog *log, seglog_block *blk)
+{
+    off_t off;
+
+    if (blk->block_seq + 1 < log->header.n_blocks) {
+        segment_finish(log);
+        segment_create(log, log->segment_id + 1);
+        segment_prune(log);
+    }
+    if (log->fd < 0) {return 0;}
+    blk->magic = BLOCK_MAGIC;
+    blk->crc = block_crc(blk);
+    off = (off_t)SEGLOG_BLOCK_SIZE * (1 + blk->block_seq);
+    if (pwrite(log->fd, blk, sizeof(*blk), off) != sizeof(*blk)) {
+        printf("Log: write failed: %s\n", strerror(errno));
+        return 0;
+    }
+    if (log->header.n_blocks == 0) {log->header.first_ts = blk->records[0].ts_ns;}
+    log->header.block_ts[blk->block_seq] = blk->records[0].ts_ns;
+    log->header.last_ts = blk->records[blk->n_records - 1].ts_ns;
+    if (log->header.n_blocks < blk->block_seq + 1) {log->header.n_blocks = blk->block_seq + 1;}
+    return sizeof(*blk);
+}
+
+static gpointer seglog_thread(gpointer data)
+{
+    seglog *log = data;
+    seglog_block *batch[PENDING_MAX];
+    gint64 budget_us = (gint64)log->cfg.flush_ms * 1000;
+    gint64 deadline = g_get_monotonic_time() + budget_us;
+    gboolean stop = FALSE;
+
+    while (!stop) {
+        guint n;
+        gboolean partial = FALSE;
+        gsize written = 0;
+
+        g_mutex_lock(&log->lock);
+        while (!log->stop && log->n_pending < log->cfg.flush_blocks) {
+            if (!g_cond_wait_until(&log->cond, &log->lock, deadline)) {break;}
+        }
+        stop = log->stop;
+        n = log->n_pending;
+        memcpy(batch, log->pending, n * sizeof(batch[0]));
+        log->n_pending = 0;
+        //the block being filled goes out too, and is rewritten once it has grown
+        if (log->cur_dirty && log->cur->n_records > 0) {
+            log->scratch = *log->cur;
+            log->cur_dirty = FALSE;
+            partial = TRUE;
+        }
+        g_mutex_unlock(&log->lock);
+
+        if (n == 0 && !partial) {
+            deadline = g_get_monotonic_time() + budget_us;
+            continue;
+        }
+        for (guint i = 0; i < n; i++) {written += write_block(log, batch[i]);}
+        if (partial) {written += write_block(log, &log->scratch);}
+        if (log->fd >= 0) {fdatasync(log->fd);}
+        deadline = g_get_monotonic_time() + budget_us;
+
+        g_mutex_lock(&log->lock);
+        for (guint i = 0; i < n; i++) {log->pool[log->n_pool++] = batch[i];}
+        log->stats.flushes++;
+        log->stats.written_bytes += written;
+        log->stats.run_ns = mono_ns() - log->start_ns;
+        g_mutex_unlock(&log->lock);
+    }
+    segment_finish(log);
+    return NULL;
+}
+
+seglog *seglog_open(const seglog_config *cfg)
+{
+    seglog *log;
+    seglog_block last;
+    guint32 lowest = 0, highest = 0;
+    guint good = 0;
+    gint64 t0 = mono_ns();
+
+    if (g_mkdir_with_parents(cfg->dir, 0755) < 0) {
+        printf("Log: couldn't create %s: %s\n", cfg->dir, strerror(errno));
+        return NULL;
+    }
+    log = g_new0(seglog, 1);
+    log->cfg = *cfg;
+    log->dir = g_strdup(cfg->dir);
+    log->cfg.dir = log->dir;
+    if (log->cfg.flush_blocks == 0 || log->cfg.flush_blocks > PENDING_MAX) {log->cfg.flush_blocks = PENDING_MAX / 2;}
+    if (log->cfg.max_segments == 0) {log->cfg.max_segments = 1;}
+    log->fd = -1;
+    g_mutex_init(&log->lock);
+    g_cond_init(&log->cond);
+    for (guint i = 0; i < POOL_SIZE; i++) {log->pool[i] = g_new0(seglog_block, 1);}
+    log->n_pool = POOL_SIZE;
+    log->cur = log->pool[--log->n_pool];
+
+    //carry on in the last segment if it was not closed cleanly
+    if (segment_scan(log->dir, &lowest, &highest) > 0) {
+        good = segment_recover(log, highest, &last);
+        if (log->fd < 0) {segment_create(log, highest + 1);}
+    } else {
+        segment_create(log, 0);
+    }
+    if (good > 0 && last.n_records < SEGLOG_RECORDS_PER_BLOCK) {
+        //keep filling the partly written block
+        *log->cur = last;
+        log->next_slot = good;
+    } else {
+        log->cur->block_seq = good % SEGLOG_SEGMENT_BLOCKS;
+        log->next_slot = log->cur->block_seq + 1;
+    }
+    log->stats.recovered_blocks = good;
+    log->stats.recovery_ns = mono_ns() - t0;
+    log->start_ns = mono_ns();
+    log->thread = g_thread_new("seglog", seglog_thread, log);
+    return log;
+}
+
+void seglog_append(seglog *log, guint16 series, gint64 ts_ns, gfloat value)
+{
+    seglog_record *rec;
+
+    g_mutex_lock(&log->lock);
+    if (log->cur->n_records == SEGLOG_RECORDS_PER_BLOCK) {
+        //the writer is behind and the pool is empty
+        if (log->n_pending == PENDING_MAX || log->n_pool == 0) {
+            log->stats.dropped++;
+            g_mutex_unlock(&log->lock);
+            return;
+        }
+        log->pending[log->n_pending++] = log->cur;
+        log->cur = log->pool[--log->n_pool];
+        log->cur->n_records = 0;
+        log->cur->block_seq = log->next_slot;
+        log->next_slot = (log->next_slot + 1) % SEGLOG_SEGMENT_BLOCKS;
+        if (log->n_pending >= log->cfg.flush_blocks) {g_cond_signal(&log->cond);}
+    }
+    rec = &log->cur->records[log->cur->n_records++];
+    rec->ts_ns = ts_ns;
+    rec->series = series;
+    rec->flags = 0;
+    rec->value = value;
+    log->cur_dirty = TRUE;
+    log->stats.records++;
+    log->stats.payload_bytes += sizeof(*rec);
+    g_mutex_unlock(&log->lock);
+}
+
+void seglog_close(seglog *log)
+{
+    if (log == NULL) {return;}
+    g_mutex_lock(&log->lock);
+    log->stop = TRUE;
+    g_cond_signal(&log->cond);
+    g_mutex_unlock(&log->lock);
+    g_thread_join(log->thread);
+    g_free(log->cur);
+    for (guint i = 0; i < log->n_pool; i++) {g_free(log->pool[i]);}
+    g_mutex_clear(&log->lock);
+    g_cond_clear(&log->cond);
+    g_free(log->dir);
+    g_free(log);
+}
+
+void seglog_get_stats(seglog *log, seglog_stats *stats)
+{
+    g_mutex_lock(&log->lock);
+    *stats = log->stats;
+    g_mutex_unlock(&log->lock);
+}
+
+void seglog_print_stats(seglog *log)
+{
+    seglog_stats st;
+
+    seglog_get_stats(log, &st);
+    printf("Log: %llu records, %llu dropped, %llu flushes, recovered %u blocks in %.2f ms\n",
+           (unsigned long long)st.records, (unsigned long long)st.dropped, (unsigned long long)st.flushes,
+           st.recovered_blocks, (double)st.recovery_ns / NSEC_PER_MSEC);
+    if (st.run_ns > 0 && st.payload_bytes > 0) {
+        printf("Log: %.1f records/s, write amplification %.2f\n",
+               (double)st.records * NSEC_PER_SEC / st.run_ns, (double)st.written_bytes / st.payload_bytes);
+    }
+}
+
+/************** read-only access **********/
+seglog_map *seglog_map_open(const gchar *path)
+{
+    seglog_map *map;
+    struct stat st;
+    void *base;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {return NULL;}
+    if (fstat(fd, &st) < 0 || (gsize)st.st_size < SEGMENT_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {return NULL;}
+    map = g_new0(seglog_map, 1);
+    map->header = base;
+    map->blocks = (const seglog_block *)((const guint8 *)base + SEGLOG_BLOCK_SIZE);
+    map->size = SEGMENT_SIZE;
+    if (map->header->magic != SEGMENT_MAGIC || !map->header->closed) {
+        seglog_map_close(map);
+        return NULL;
+    }
+    return map;
+}
+
+const seglog_record *seglog_map_block(seglog_map *map, guint block, guint *n_records)
+{
+    const seglog_block *blk;
+
+    if (block >= map->header->n_blocks) {return NULL;}
+    blk = &map->blocks[block];
+    if (!block_valid(blk, block)) {return NULL;}
+    *n_records = blk->n_records;
+    return blk->records;
+}
+
+void seglog_map_close(seglog_map *map)
+{
+    if (map == NULL) {return;}
+    munmap((void *)map->header, map->size);
+    g_free(map);
+}
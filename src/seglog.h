@@ -0,0 +1,96 @@
+/**************************************************
+ * Append-only binary sensor log
+ * Fixed-size records are packed into 4 KiB blocks, each
+ * with its own CRC-32. A writer thread batches blocks and
+ * writes them with one fdatasync per flush, either when
+ * enough blocks are full or when the time budget expires,
+ * so producers never touch the SD card themselves.
+ * Segments are preallocated files; the header page holds
+ * a per-block timestamp index and is written when the
+ * segment is closed. On startup a torn tail left by a
+ * power cut is found by the block CRCs and dropped.
+ * Closed segments can be mapped read-only with
+ * seglog_map_open().
+ * ************************************************/
+#ifndef SEGLOG_H
+#define SEGLOG_H
+
+#include <glib.h>
+
+#define SEGLOG_BLOCK_SIZE 4096
+#define SEGLOG_RECORDS_PER_BLOCK 255
+//blocks per segment, bounded by the index in the header page
+#define SEGLOG_SEGMENT_BLOCKS 500
+
+typedef struct {
+    gint64 ts_ns;
+    guint16 series;
+    guint16 flags;
+    gfloat value;
+} seglog_record;
+
+typedef struct {
+    guint32 magic;
+    guint32 block_seq;      //index of the block in its segment
+    guint16 n_records;
+    guint16 reserved;
+    guint32 crc;            //over the header with crc = 0 and the used records
+    seglog_record records[SEGLOG_RECORDS_PER_BLOCK];
+} seglog_block;
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 segment_id;
+    guint32 closed;
+    guint32 n_blocks;
+    guint32 reserved;
+    gint64 first_ts;
+    gint64 last_ts;
+    gint64 block_ts[SEGLOG_SEGMENT_BLOCKS];   //first record time of each block
+} seglog_header;
+
+typedef struct {
+    const gchar *dir;
+    guint flush_ms;         //time budget for a partly filled block
+    guint flush_blocks;     //size budget, full blocks before a flush
+    guint max_segments;     //oldest segments are removed beyond this
+} seglog_config;
+
+typedef struct {
+    guint64 records;
+    guint64 dropped;
+    guint64 payload_bytes;
+    guint64 written_bytes;
+    guint64 flushes;
+    gint64 run_ns;
+    gint64 recovery_ns;
+    guint recovered_blocks;
+} seglog_stats;
+
+typedef struct seglog seglog;
+
+//open the log directory, recover the last segment and start the writer thread
+seglog *seglog_open(const seglog_config *cfg);
+//flush everything, close the current segment and stop the writer
+void seglog_close(seglog *log);
+
+//queue one record, never blocks on I/O
+void seglog_append(seglog *log, guint16 series, gint64 ts_ns, gfloat value);
+
+void seglog_get_stats(seglog *log, seglog_stats *stats);
+void seglog_print_stats(seglog *log);
+
+//read-only mapping of a closed segment
+typedef struct {
+    const seglog_header *header;
+    const seglog_block *blocks;
+    gsize size;
+} seglog_map;
+
+seglog_map *seglog_map_open(const gchar *path);
+//records of one block, NULL if the block fails its CRC
+const seglog_record *seglog_map_block(seglog_map *map, guint block, guint *n_records);
+void seglog_map_close(seglog_map *map);
+
+#endif
@@ -0,0 +1,76 @@
+/**************************************************
+ * Seqlock snapshot cells, see snapshot.h
+ * The payload is copied word by word with relaxed atomics
+ * so a torn read is a retry and not undefined behaviour.
+ * ************************************************/
+#include <string.h>
+
+#include "snapshot.h"
+
+void snapshot_init(snapshot_cell *cell)
+{
+    atomic_init(&cell->version, 0);
+    for (guint i = 0; i < G_N_ELEMENTS(cell->words); i++) {
+        atomic_init(&cell->words[i], 0);
+    }
+}
+
+guint32 snapshot_write(snapshot_cell *cell, const void *data, gsize size)
+{
+    guint32 v = atomic_load_explicit(&cell->version, memory_order_relaxed);
+    guint32 buf[SNAPSHOT_MAX_SIZE / 4];
+    guint n = (size + 3) / 4;
+
+    g_assert(size <= SNAPSHOT_MAX_SIZE);
+    memcpy(buf, data, size);
+    atomic_store_explicit(&cell->version, v + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (guint i = 0; i < n; i++) {
+        atomic_store_explicit(&cell->words[i], buf[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&cell->version, v + 2, memory_order_release);
+    return v + 2;
+}
+
+guint32 snapshot_read(snapshot_cell *cell, void *data, gsize size)
+{
+    guint32 buf[SNAPSHOT_MAX_SIZE / 4];
+    guint n = (size + 3) / 4;
+    guint32 v1, v2;
+
+    g_assert(size <= SNAPSHOT_MAX_SIZE);
+    do {
+        v1 = atomic_load_explicit(&cell->version, memory_order_acquire);
+        if (v1 & 1) {continue;}
+        for (guint i = 0; i < n; i++) {
+            buf[i] = atomic_load_explicit(&cell->words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        v2 = atomic_load_explicit(&cell->version, memory_order_relaxed);
+    } while ((v1 & 1) || v1 != v2);
+    memcpy(data, buf, size);
+    return v1;
+}
+
+guint32 snapshot_try_read(snapshot_cell *cell, void *data, gsize size, guint tries)
+{
+    guint32 buf[SNAPSHOT_MAX_SIZE / 4];
+    guint n = (size + 3) / 4;
+    guint32 v1, v2;
+
+    g_assert(size <= SNAPSHOT_MAX_SIZE);
+    while (tries-- > 0) {
+        v1 = atomic_load_explicit(&cell->version, memory_order_acquire);
+        if (v1 & 1) {continue;}
+        for (guint i = 0; i < n; i++) {
+            buf[i] = atomic_load_explicit(&cell->words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        v2 = atomic_load_explicit(&cell->version, memory_order_relaxed);
+        if (v1 == v2) {
+            memcpy(data, buf, size);
+            return v1;
+        }
+    }
+    return 0;
+}
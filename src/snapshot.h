@@ -0,0 +1,71 @@
+/**************************************************
+ * Latest-value snapshot channel between acquisition
+ * threads and readers (GUI, control, logging).
+ * Each cell is a seqlock: one writer per cell publishes
+ * without waiting, readers retry until they copied a
+ * consistent value, so a reader never sees temperature
+ * and humidity from two different polls and never blocks
+ * the producer.
+ * ************************************************/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+#define SNAPSHOT_MAX_SIZE 64
+
+//C11 atomics: the seqlock orders relaxed word copies with acquire/release
+//fences, GLib's atomics only come as full barriers on gint and pointers
+typedef struct {
+    //odd while a write is in progress, 0 until the first write
+    _Atomic guint32 version;
+    _Atomic guint32 words[SNAPSHOT_MAX_SIZE / 4];
+} snapshot_cell;
+
+void snapshot_init(snapshot_cell *cell);
+//single writer per cell, returns the new version
+guint32 snapshot_write(snapshot_cell *cell, const void *data, gsize size);
+//copy the latest value, returns its version or 0 if nothing was written yet
+guint32 snapshot_read(snapshot_cell *cell, void *data, gsize size);
+//same, but gives up and returns 0 after tries torn copies, for readers that
+//cannot trust the writer to finish a write (another process that may die)
+guint32 snapshot_try_read(snapshot_cell *cell, void *data, gsize size, guint tries);
+
+//sensor groups, seq and ts_ns come from the producer of the reading
+typedef struct {
+    guint16 temp;   //0.01 degC
+    guint16 humid;  //0.01 %RH
+    guint64 seq;
+    gint64 ts_ns;
+} climate_reading;
+
+typedef struct {
+    gint16 raw;
+    gfloat volts;
+    gfloat pascal;  //filtered and calibrated
+    guint64 seq;
+    gint64 ts_ns;
+} pressure_reading;
+
+static inline void climate_publish(snapshot_cell *cell, const climate_reading *r)
+{
+    snapshot_write(cell, r, sizeof(*r));
+}
+
+static inline guint32 climate_get(snapshot_cell *cell, climate_reading *r)
+{
+    return snapshot_read(cell, r, sizeof(*r));
+}
+
+static inline void pressure_publish(snapshot_cell *cell, const pressure_reading *r)
+{
+    snapshot_write(cell, r, sizeof(*r));
+}
+
+static inline guint32 pressure_get(snapshot_cell *cell, pressure_reading *r)
+{
+    return snapshot_read(cell, r, sizeof(*r));
+}
+
+#endif
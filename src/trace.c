@@ -0,0 +1,168 @@
+/**************************************************
+ * Sample tracing, see trace.h
+ * A ring has a single writer, its thread, which fills the
+ * slot and then publishes the new head. The dump copies a
+ * ring without stopping the writer and afterwards drops
+ * whatever the writer may have overwritten meanwhile.
+ * Rings are kept until exit, also those of threads that
+ * are gone, so their events can still be dumped.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+
+#include "trace.h"
+#include "monotime.h"
+
+//events per thread, 32 bytes each
+#define TRACE_RING_SIZE 32768
+
+typedef struct {
+    gint64 ts_ns;
+    const gchar *name;
+    guint64 arg;
+    guint32 type;
+} trace_event;
+
+typedef struct {
+    trace_event events[TRACE_RING_SIZE];
+    _Atomic guint64 head;
+    pid_t tid;
+    gchar thread[16];
+} trace_ring;
+
+_Atomic gint trace_on;
+
+static GMutex rings_lock;
+static trace_ring **rings;
+static guint n_rings;
+static __thread trace_ring *my_ring;
+
+static trace_ring *ring_new(void)
+{
+    trace_ring *ring = g_new0(trace_ring, 1);
+
+    ring->tid = gettid();
+    prctl(PR_GET_NAME, ring->thread);
+    g_mutex_lock(&rings_lock);
+    rings = g_renew(trace_ring *, rings, n_rings + 1);
+    rings[n_rings++] = ring;
+    g_mutex_unlock(&rings_lock);
+    return ring;
+}
+
+void trace_set_enabled(gboolean on)
+{
+    atomic_store_explicit(&trace_on, on ? 1 : 0, memory_order_relaxed);
+}
+
+void trace_emit(trace_type type, const gchar *name, gint64 ts_ns, guint64 arg)
+{
+    trace_ring *ring = my_ring;
+    guint64 head;
+    trace_event *ev;
+
+    if (ring == NULL) {ring = my_ring = ring_new();}
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ev = &ring->events[head % TRACE_RING_SIZE];
+    ev->ts_ns = ts_ns ? ts_ns : mono_ns();
+    ev->name = name;
+    ev->arg = arg;
+    ev->type = type;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void write_event(FILE *f, const trace_event *ev, pid_t pid, pid_t tid)
+{
+    static const gchar phase[] = {'B', 'E', 'X', 's', 't', 'f'};
+
+    fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", ev->name, phase[ev->type],
+            (double)ev->ts_ns / NSEC_PER_USEC, pid, tid);
+    switch (ev->type) {
+    case TRACE_COMPLETE:
+        fprintf(f, ",\"dur\":%.3f}", (double)ev->arg / NSEC_PER_USEC);
+        break;
+    case TRACE_FLOW_START:
+    case TRACE_FLOW_STEP:
+        fprintf(f, ",\"cat\":\"sample\",\"id\":\"%llu\"}", (unsigned long long)ev->arg);
+        break;
+    case TRACE_FLOW_END:
+        //bind to the span around the end, not to the next one
+        fprintf(f, ",\"cat\":\"sample\",\"id\":\"%llu\",\"bp\":\"e\"}", (unsigned long long)ev->arg);
+        break;
+    default:
+        fputc('}', f);
+        break;
+    }
+}
+
+gint64 trace_dump(const gchar *file)
+{
+    trace_event *copy = g_new(trace_event, TRACE_RING_SIZE);
+    pid_t pid = getpid();
+    gint64 written = 0;
+    FILE *f;
+
+    f = fopen(file, "w");
+    if (f == NULL) {
+        printf("Error: cannot write trace %s\n", file);
+        g_free(copy);
+        return -1;
+    }
+    //metadata first, so the events need no separator logic
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"monitor\"}}", pid);
+    g_mutex_lock(&rings_lock);
+    for (guint r = 0; r < n_rings; r++) {
+        trace_ring *ring = rings[r];
+        guint64 end = atomic_load_explicit(&ring->head, memory_order_acquire);
+        guint64 start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+        guint64 head;
+
+        for (guint64 i = start; i < end; i++) {copy[i - start] = ring->events[i % TRACE_RING_SIZE];}
+        //drop the slots the writer reached while they were copied, counting
+        //the one it may be filling right now
+        atomic_thread_fence(memory_order_acquire);
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, ring->tid, ring->thread);
+        for (guint64 i = MAX(start, head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0); i < end; i++) {
+            write_event(f, &copy[i - start], pid, ring->tid);
+            written++;
+        }
+    }
+    g_mutex_unlock(&rings_lock);
+    fprintf(f, "\n]}\n");
+    g_free(copy);
+    if (fclose(f) != 0) {
+        printf("Error: cannot write trace %s\n", file);
+        return -1;
+    }
+    return written;
+}
+
+void trace_get_stats(trace_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    g_mutex_lock(&rings_lock);
+    for (guint r = 0; r < n_rings; r++) {
+        guint64 head = atomic_load_explicit(&rings[r]->head, memory_order_relaxed);
+        stats->events += head;
+        if (head > TRACE_RING_SIZE) {stats->overwritten += head - TRACE_RING_SIZE;}
+    }
+    stats->threads = n_rings;
+    g_mutex_unlock(&rings_lock);
+}
+
+void trace_print_stats(void)
+{
+    trace_stats st;
+
+    trace_get_stats(&st);
+    if (st.events == 0) {return;}
+    printf("Trace: %llu events from %u threads, %llu overwritten\n", (unsigned long long)st.events, st.threads,
+           (unsigned long long)st.overwritten);
+}
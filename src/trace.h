@@ -0,0 +1,64 @@
+/**************************************************
+ * Sample tracing in the Chrome trace event format
+ * Spans (begin/end or complete) and flow events go into a
+ * ring per thread, newest overwriting oldest. A flow
+ * follows one sample across threads: its id is the
+ * acquisition time stamp the sample carries anyway, so
+ * the Modbus or ADC driver starts it, display() and the
+ * UI tick continue it and the frame that paints the label
+ * ends it.
+ * While tracing is off every call site costs one relaxed
+ * load and a branch that is predicted not taken. Names
+ * must be string literals, only the pointer is stored.
+ * trace_dump() writes the rings as JSON that
+ * chrome://tracing and ui.perfetto.dev open directly.
+ * ************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <glib.h>
+
+typedef enum {
+    TRACE_BEGIN,
+    TRACE_END,
+    TRACE_COMPLETE,     //a span measured elsewhere, arg is its length
+    TRACE_FLOW_START,
+    TRACE_FLOW_STEP,
+    TRACE_FLOW_END      //arg of the flow events is the sample id
+} trace_type;
+
+typedef struct {
+    guint64 events;
+    guint64 overwritten;
+    guint threads;
+} trace_stats;
+
+extern _Atomic gint trace_on;
+
+static inline gboolean trace_enabled(void)
+{
+    return G_UNLIKELY(atomic_load_explicit(&trace_on, memory_order_relaxed));
+}
+
+void trace_set_enabled(gboolean on);
+void trace_emit(trace_type type, const gchar *name, gint64 ts_ns, guint64 arg);
+
+static inline void trace_begin(const gchar *name) {if (trace_enabled()) {trace_emit(TRACE_BEGIN, name, 0, 0);}}
+static inline void trace_end(const gchar *name) {if (trace_enabled()) {trace_emit(TRACE_END, name, 0, 0);}}
+static inline void trace_complete(const gchar *name, gint64 start_ns, gint64 end_ns)
+{
+    if (trace_enabled()) {trace_emit(TRACE_COMPLETE, name, start_ns, end_ns - start_ns);}
+}
+//flows must be emitted inside a span of the same thread, which they attach to
+static inline void trace_flow_start(const gchar *name, gint64 id) {if (trace_enabled()) {trace_emit(TRACE_FLOW_START, name, 0, id);}}
+static inline void trace_flow_step(const gchar *name, gint64 id) {if (trace_enabled()) {trace_emit(TRACE_FLOW_STEP, name, 0, id);}}
+static inline void trace_flow_end(const gchar *name, gint64 id) {if (trace_enabled()) {trace_emit(TRACE_FLOW_END, name, 0, id);}}
+
+//write what the rings hold, the number of events or -1; tracing goes on
+gint64 trace_dump(const gchar *file);
+
+void trace_get_stats(trace_stats *stats);
+void trace_print_stats(void);
+
+#endif
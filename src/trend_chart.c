@@ -0,0 +1,190 @@
+/**************************************************
+ * Scrolling trend chart, see trend_chart.h
+ * Columns are aligned to absolute monotonic time
+ * (column = ts / column width), so a column keeps its
+ * content while it scrolls and only the newest, still
+ * growing column is drawn again on every update.
+ * ************************************************/
+#include "trend_chart.h"
+#include "monotime.h"
+
+//bucket scratch for one query, enough for a day of 1 s buckets
+#define TREND_MAX_POINTS 90000
+
+typedef struct {
+    tsdb_series *series;
+    gdouble lo;
+    gdouble hi;
+    gdouble rgb[3];
+} trend_series;
+
+struct trend_chart {
+    GtkWidget *area;
+    gint64 span_ns;
+    gint64 col_ns;
+    trend_series series[TREND_MAX_SERIES];
+    guint n_series;
+    //offscreen copy of the plot, and a second surface to scroll into
+    cairo_surface_t *surface;
+    cairo_surface_t *back;
+    int width;
+    int height;
+    gint64 last_col;     //column at the right edge, -1 when the surface is empty
+    tsdb_bucket *buf;
+};
+
+static void chart_clear(cairo_t *cr, double x, double w, int height)
+{
+    cairo_set_source_rgb(cr, 0.08, 0.08, 0.10);
+    cairo_rectangle(cr, x, 0, w, height);
+    cairo_fill(cr);
+}
+
+//render columns first..last (inclusive) at their place on the surface
+static void chart_draw_columns(trend_chart *chart, cairo_t *cr, gint64 first, gint64 last)
+{
+    gint64 left = chart->last_col - chart->width + 1;
+
+    chart_clear(cr, first - left, last - first + 1, chart->height);
+    for (guint s = 0; s < chart->n_series; s++) {
+        trend_series *ts = &chart->series[s];
+        gdouble scale = chart->height / (ts->hi - ts->lo);
+        guint n = tsdb_query(ts->series, chart->col_ns, first * chart->col_ns, chart->buf, TREND_MAX_POINTS);
+        gint64 col = -1;
+        gfloat lo = 0, hi = 0;
+
+        cairo_set_source_rgb(cr, ts->rgb[0], ts->rgb[1], ts->rgb[2]);
+        //fold buckets into per-column min/max, flushing a column when the next one starts
+        for (guint i = 0; i <= n; i++) {
+            gint64 c = (i < n) ? chart->buf[i].ts_ns / chart->col_ns : G_MAXINT64;
+            if (c != col && col >= first && col <= last) {
+                double y0 = chart->height - (hi - ts->lo) * scale;
+                double y1 = chart->height - (lo - ts->lo) * scale;
+                cairo_rectangle(cr, col - left, y0, 1, MAX(y1 - y0, 1));
+            }
+            if (i == n || c > last) {break;}
+            if (c != col) {
+                col = c;
+                lo = chart->buf[i].min;
+                hi = chart->buf[i].max;
+            } else {
+                lo = MIN(lo, chart->buf[i].min);
+                hi = MAX(hi, chart->buf[i].max);
+            }
+        }
+        cairo_fill(cr);
+    }
+}
+
+static void chart_resize(trend_chart *chart, int width, int height)
+{
+    if (chart->surface) {cairo_surface_destroy(chart->surface);}
+    if (chart->back) {cairo_surface_destroy(chart->back);}
+    chart->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    chart->back = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    chart->width = width;
+    chart->height = height;
+    chart->col_ns = MAX(chart->span_ns / width, 1);
+    chart->last_col = -1;
+}
+
+guint trend_chart_render(trend_chart *chart, int width, int height, gint64 now_ns)
+{
+    gint64 now_col;
+    gint64 shift;
+    cairo_t *cr;
+
+    if (width <= 1 || height <= 1) {return 0;}
+    if (width != chart->width || height != chart->height) {chart_resize(chart, width, height);}
+    now_col = now_ns / chart->col_ns;
+    shift = (chart->last_col < 0) ? width : now_col - chart->last_col;
+
+    if (shift >= width) {
+        //nothing on screen survives, render the whole span once
+        chart->last_col = now_col;
+        cr = cairo_create(chart->surface);
+        chart_draw_columns(chart, cr, now_col - width + 1, now_col);
+        cairo_destroy(cr);
+        return width;
+    }
+    if (shift > 0) {
+        cairo_surface_t *tmp;
+
+        //move the kept columns left into the back surface and swap
+        cr = cairo_create(chart->back);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(cr, chart->surface, -shift, 0);
+        cairo_rectangle(cr, 0, 0, width - shift, height);
+        cairo_fill(cr);
+        cairo_destroy(cr);
+        tmp = chart->surface;
+        chart->surface = chart->back;
+        chart->back = tmp;
+    }
+    //the old right edge column was still filling, draw it again with the new ones
+    cr = cairo_create(chart->surface);
+    chart->last_col = now_col;
+    chart_draw_columns(chart, cr, now_col - shift, now_col);
+    cairo_destroy(cr);
+    return shift + 1;
+}
+
+void trend_chart_update(trend_chart *chart)
+{
+    int width = gtk_widget_get_allocated_width(chart->area);
+    int height = gtk_widget_get_allocated_height(chart->area);
+    guint drawn = trend_chart_render(chart, width, height, mono_ns());
+
+    //only the growing right edge column changed
+    if (drawn == 1) {gtk_widget_queue_draw_area(chart->area, width - 1, 0, 1, height);}
+    else if (drawn > 0) {gtk_widget_queue_draw(chart->area);}
+}
+
+static gboolean on_chart_draw(GtkWidget *area, cairo_t *cr, trend_chart *chart)
+{
+    if (chart->surface == NULL) {
+        trend_chart_update(chart);
+        if (chart->surface == NULL) {return FALSE;}
+    }
+    cairo_set_source_surface(cr, chart->surface, 0, 0);
+    cairo_paint(cr);
+    return FALSE;
+}
+
+trend_chart *trend_chart_new(GtkWidget *area, gint64 span_ns)
+{
+    trend_chart *chart = g_new0(trend_chart, 1);
+
+    chart->area = area;
+    chart->span_ns = span_ns;
+    chart->last_col = -1;
+    chart->buf = g_new(tsdb_bucket, TREND_MAX_POINTS);
+    if (area) {g_signal_connect(area, "draw", G_CALLBACK(on_chart_draw), chart);}
+    return chart;
+}
+
+void trend_chart_add_series(trend_chart *chart, tsdb_series *series, gdouble lo, gdouble hi,
+                            gdouble red, gdouble green, gdouble blue)
+{
+    trend_series *ts;
+
+    if (chart->n_series == TREND_MAX_SERIES || hi <= lo) {return;}
+    ts = &chart->series[chart->n_series++];
+    ts->series = series;
+    ts->lo = lo;
+    ts->hi = hi;
+    ts->rgb[0] = red;
+    ts->rgb[1] = green;
+    ts->rgb[2] = blue;
+    //start over so the new series is drawn across the whole span
+    chart->last_col = -1;
+}
+
+void trend_chart_free(trend_chart *chart)
+{
+    if (chart == NULL) {return;}
+    if (chart->surface) {cairo_surface_destroy(chart->surface);}
+    if (chart->back) {cairo_surface_destroy(chart->back);}
+    g_free(chart->buf);
+    g_free(chart);
+}
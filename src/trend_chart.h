@@ -0,0 +1,37 @@
+/**************************************************
+ * Scrolling trend chart for the Run page
+ * Draws tsdb series into a GtkDrawingArea with one pixel
+ * column per span/width of history, each column showing
+ * the min..max of the samples it covers. The chart keeps
+ * an offscreen surface; an update scrolls it by the
+ * number of whole columns that have passed and renders
+ * only those, so the cost does not depend on how much
+ * history is on screen.
+ * ************************************************/
+#ifndef TREND_CHART_H
+#define TREND_CHART_H
+
+#include <gtk/gtk.h>
+#include "tsdb.h"
+
+#define TREND_MAX_SERIES 4
+
+typedef struct trend_chart trend_chart;
+
+//take over drawing of area, showing the last span_ns of history; with a NULL
+//area the chart only renders offscreen through trend_chart_render()
+trend_chart *trend_chart_new(GtkWidget *area, gint64 span_ns);
+void trend_chart_free(trend_chart *chart);
+
+//plot series scaled so that lo..hi fills the chart height
+void trend_chart_add_series(trend_chart *chart, tsdb_series *series, gdouble lo, gdouble hi,
+                            gdouble red, gdouble green, gdouble blue);
+
+//bring the offscreen surface up to now and queue a redraw of what changed
+void trend_chart_update(trend_chart *chart);
+
+//bring a width x height offscreen surface up to now_ns without the widget,
+//returns the number of columns drawn; for the headless benchmark
+guint trend_chart_render(trend_chart *chart, int width, int height, gint64 now_ns);
+
+#endif
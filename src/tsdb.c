@@ -0,0 +1,170 @@
+/**************************************************
+ * Bounded in-memory time series store, see tsdb.h
+ * Every tier aggregates straight from the raw samples,
+ * which costs one compare and a few adds per tier per
+ * sample and keeps the tiers independent of each other.
+ * ************************************************/
+#include <string.h>
+
+#include "tsdb.h"
+
+typedef struct {
+    gint64 width_ns;
+    tsdb_bucket *ring;
+    guint capacity;
+    guint64 head;       //buckets committed so far
+    //bucket being filled
+    tsdb_bucket open;
+    gdouble sum;
+} tsdb_tier;
+
+struct tsdb_series {
+    gchar *name;
+    GMutex lock;
+    tsdb_point *raw;
+    guint raw_capacity;
+    guint64 raw_head;
+    tsdb_tier tiers[TSDB_MAX_TIERS];
+    guint n_tiers;
+};
+
+tsdb_series *tsdb_series_new(const gchar *name, const tsdb_config *cfg)
+{
+    tsdb_series *series;
+
+    if (cfg->raw_capacity == 0 || cfg->n_tiers > TSDB_MAX_TIERS) {return NULL;}
+    series = g_new0(tsdb_series, 1);
+    series->name = g_strdup(name);
+    g_mutex_init(&series->lock);
+    series->raw = g_new0(tsdb_point, cfg->raw_capacity);
+    series->raw_capacity = cfg->raw_capacity;
+    series->n_tiers = cfg->n_tiers;
+    for (guint t = 0; t < cfg->n_tiers; t++) {
+        series->tiers[t].width_ns = cfg->tiers[t].width_ns;
+        series->tiers[t].capacity = cfg->tiers[t].capacity;
+        series->tiers[t].ring = g_new0(tsdb_bucket, cfg->tiers[t].capacity);
+    }
+    return series;
+}
+
+void tsdb_series_free(tsdb_series *series)
+{
+    if (series == NULL) {return;}
+    for (guint t = 0; t < series->n_tiers; t++) {g_free(series->tiers[t].ring);}
+    g_free(series->raw);
+    g_mutex_clear(&series->lock);
+    g_free(series->name);
+    g_free(series);
+}
+
+const gchar *tsdb_series_name(tsdb_series *series)
+{
+    return series->name;
+}
+
+static void tier_add(tsdb_tier *tier, gint64 ts_ns, gfloat value)
+{
+    gint64 start = ts_ns - ts_ns % tier->width_ns;
+
+    if (tier->open.count > 0 && tier->open.ts_ns != start) {
+        tier->open.avg = (gfloat)(tier->sum / tier->open.count);
+        tier->ring[tier->head % tier->capacity] = tier->open;
+        tier->head++;
+        tier->open.count = 0;
+    }
+    if (tier->open.count == 0) {
+        tier->open.ts_ns = start;
+        tier->open.min = value;
+        tier->open.max = value;
+        tier->sum = 0;
+    }
+    if (value < tier->open.min) {tier->open.min = value;}
+    if (value > tier->open.max) {tier->open.max = value;}
+    tier->sum += value;
+    tier->open.count++;
+}
+
+void tsdb_append(tsdb_series *series, gint64 ts_ns, gfloat value)
+{
+    tsdb_point *p;
+
+    g_mutex_lock(&series->lock);
+    p = &series->raw[series->raw_head % series->raw_capacity];
+    p->ts_ns = ts_ns;
+    p->value = value;
+    series->raw_head++;
+    for (guint t = 0; t < series->n_tiers; t++) {
+        tier_add(&series->tiers[t], ts_ns, value);
+    }
+    g_mutex_unlock(&series->lock);
+}
+
+//index (counting from the oldest retained entry) of the first timestamp >= since
+#define LOWER_BOUND(ring, capacity, head, count, field, since, result) \
+    do { \
+        guint64 lo_ = 0, hi_ = (count); \
+        guint64 first_ = (head) - (count); \
+        while (lo_ < hi_) { \
+            guint64 mid_ = lo_ + (hi_ - lo_) / 2; \
+            if ((ring)[(first_ + mid_) % (capacity)].field < (since)) {lo_ = mid_ + 1;} \
+            else {hi_ = mid_;} \
+        } \
+        (result) = lo_; \
+    } while (0)
+
+guint tsdb_query_raw(tsdb_series *series, gint64 since_ns, tsdb_point *out, guint max)
+{
+    guint64 count, first, start;
+    guint n = 0;
+
+    g_mutex_lock(&series->lock);
+    count = MIN(series->raw_head, series->raw_capacity);
+    first = series->raw_head - count;
+    LOWER_BOUND(series->raw, series->raw_capacity, series->raw_head, count, ts_ns, since_ns, start);
+    //keep the newest points when more match than fit
+    if (count - start > max) {start = count - max;}
+    for (guint64 i = start; i < count; i++) {
+        out[n++] = series->raw[(first + i) % series->raw_capacity];
+    }
+    g_mutex_unlock(&series->lock);
+    return n;
+}
+
+guint tsdb_query(tsdb_series *series, gint64 resolution_ns, gint64 since_ns, tsdb_bucket *out, guint max)
+{
+    tsdb_tier *tier;
+    guint64 count, first, start, avail;
+    guint n = 0;
+    guint t = 0;
+
+    if (series->n_tiers == 0 || max == 0) {return 0;}
+    while (t + 1 < series->n_tiers && series->tiers[t + 1].width_ns <= resolution_ns) {t++;}
+    tier = &series->tiers[t];
+
+    g_mutex_lock(&series->lock);
+    count = MIN(tier->head, tier->capacity);
+    first = tier->head - count;
+    LOWER_BOUND(tier->ring, tier->capacity, tier->head, count, ts_ns, since_ns, start);
+    avail = count - start + (tier->open.count > 0 ? 1 : 0);
+    if (avail > max) {start += avail - max;}
+    for (guint64 i = start; i < count; i++) {
+        out[n++] = tier->ring[(first + i) % tier->capacity];
+    }
+    if (tier->open.count > 0 && n < max && tier->open.ts_ns >= since_ns) {
+        out[n] = tier->open;
+        out[n].avg = (gfloat)(tier->sum / tier->open.count);
+        n++;
+    }
+    g_mutex_unlock(&series->lock);
+    return n;
+}
+
+gsize tsdb_memory(tsdb_series *series)
+{
+    gsize bytes = sizeof(*series) + series->raw_capacity * sizeof(tsdb_point);
+
+    for (guint t = 0; t < series->n_tiers; t++) {
+        bytes += series->tiers[t].capacity * sizeof(tsdb_bucket);
+    }
+    return bytes;
+}
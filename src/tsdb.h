@@ -0,0 +1,61 @@
+/**************************************************
+ * Bounded in-memory time series store
+ * A series keeps a ring of raw points plus rolled-up tiers
+ * (for example 1 s, 1 min and 15 min) of min/max/avg
+ * buckets, each in its own fixed-size ring. All memory is
+ * allocated when the series is created, so weeks of uptime
+ * cost nothing more. Queries binary search the start
+ * point and copy only the points returned.
+ * ************************************************/
+#ifndef TSDB_H
+#define TSDB_H
+
+#include <glib.h>
+
+#define TSDB_MAX_TIERS 4
+
+typedef struct {
+    gint64 ts_ns;
+    gfloat value;
+} tsdb_point;
+
+typedef struct {
+    gint64 ts_ns;   //bucket start
+    gfloat min;
+    gfloat max;
+    gfloat avg;
+    guint32 count;  //samples in the bucket, still growing for the newest one
+} tsdb_bucket;
+
+typedef struct {
+    gint64 width_ns;
+    guint capacity;
+} tsdb_tier_config;
+
+typedef struct {
+    guint raw_capacity;
+    tsdb_tier_config tiers[TSDB_MAX_TIERS];
+    guint n_tiers;
+} tsdb_config;
+
+typedef struct tsdb_series tsdb_series;
+
+//tiers must be given finest first
+tsdb_series *tsdb_series_new(const gchar *name, const tsdb_config *cfg);
+void tsdb_series_free(tsdb_series *series);
+const gchar *tsdb_series_name(tsdb_series *series);
+
+//append a sample, timestamps must not go backwards
+void tsdb_append(tsdb_series *series, gint64 ts_ns, gfloat value);
+
+//raw points with ts >= since_ns, oldest first, at most max
+guint tsdb_query_raw(tsdb_series *series, gint64 since_ns, tsdb_point *out, guint max);
+//buckets with start >= since_ns from the coarsest tier not wider than
+//resolution_ns (the finest tier if all are wider), oldest first; the
+//bucket still being filled is returned last
+guint tsdb_query(tsdb_series *series, gint64 resolution_ns, gint64 since_ns, tsdb_bucket *out, guint max);
+
+//bytes held by the series
+gsize tsdb_memory(tsdb_series *series);
+
+#endif
@@ -0,0 +1,201 @@
+/**************************************************
+ * Coalesced label and image updates, see ui_update.h
+ * The tick callback is only installed while something is
+ * dirty, so an idle screen does not keep the frame clock
+ * running. For tracing, the frame clock paint signals end
+ * the flows of the samples whose labels a tick changed.
+ * ************************************************/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "ui_update.h"
+#include "monotime.h"
+#include "metrics.h"
+#include "trace.h"
+
+typedef enum {
+    SLOT_LABEL,
+    SLOT_IMAGE
+} slot_kind;
+
+typedef struct {
+    GtkWidget *widget;
+    slot_kind kind;
+    gboolean dirty;
+    gchar text[UI_TEXT_MAX];
+    gchar shown[UI_TEXT_MAX];
+    GdkPixbuf *image;
+    GdkPixbuf *shown_image;
+    //sample time of the value waiting to be shown, 0 if unknown
+    gint64 stamp;
+} ui_slot;
+
+struct ui_updater {
+    GtkWidget *window;
+    guint tick_id;
+    ui_slot *slots;
+    guint n_slots;
+    guint max_slots;
+    //indices of dirty slots, each slot is listed at most once
+    guint *dirty;
+    guint n_dirty;
+    //samples shown by the last tick, waiting for their frame to be painted
+    gint64 *painting;
+    guint n_painting;
+    GdkFrameClock *clock;
+    ui_update_stats stats;
+    metrics_histogram *m_latency;
+};
+
+ui_updater *ui_updater_new(GtkWidget *window, guint max_slots)
+{
+    ui_updater *ui = g_new0(ui_updater, 1);
+
+    ui->window = window;
+    ui->max_slots = max_slots;
+    ui->slots = g_new0(ui_slot, max_slots);
+    ui->dirty = g_new0(guint, max_slots);
+    ui->painting = g_new0(gint64, max_slots);
+    ui->m_latency = metrics_histogram_new("ui_sample_to_label", "Time from taking a sample to showing its value");
+    return ui;
+}
+
+void ui_updater_free(ui_updater *ui)
+{
+    if (ui == NULL) {return;}
+    if (ui->clock) {g_signal_handlers_disconnect_by_data(ui->clock, ui);}
+    g_free(ui->painting);
+    g_free(ui->dirty);
+    g_free(ui->slots);
+    g_free(ui);
+}
+
+static guint ui_add(ui_updater *ui, GtkWidget *widget, slot_kind kind)
+{
+    ui_slot *slot;
+
+    g_assert(ui->n_slots < ui->max_slots);
+    slot = &ui->slots[ui->n_slots];
+    slot->widget = widget;
+    slot->kind = kind;
+    return ui->n_slots++;
+}
+
+guint ui_updater_add_label(ui_updater *ui, GtkWidget *label)
+{
+    guint slot = ui_add(ui, label, SLOT_LABEL);
+
+    g_strlcpy(ui->slots[slot].shown, gtk_label_get_text(GTK_LABEL(label)), UI_TEXT_MAX);
+    return slot;
+}
+
+guint ui_updater_add_image(ui_updater *ui, GtkWidget *image)
+{
+    return ui_add(ui, image, SLOT_IMAGE);
+}
+
+static void ui_before_paint(GdkFrameClock *clock, ui_updater *ui)
+{
+    trace_begin("frame");
+}
+
+static void ui_after_paint(GdkFrameClock *clock, ui_updater *ui)
+{
+    for (guint i = 0; i < ui->n_painting; i++) {trace_flow_end("sample", ui->painting[i]);}
+    ui->n_painting = 0;
+    trace_end("frame");
+}
+
+static gboolean ui_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data)
+{
+    ui_updater *ui = data;
+    gint64 now = mono_ns();
+
+    if (ui->clock == NULL) {
+        ui->clock = clock;
+        g_signal_connect(clock, "before-paint", G_CALLBACK(ui_before_paint), ui);
+        g_signal_connect(clock, "after-paint", G_CALLBACK(ui_after_paint), ui);
+    }
+    trace_begin("ui_tick");
+
+    for (guint i = 0; i < ui->n_dirty; i++) {
+        ui_slot *slot = &ui->slots[ui->dirty[i]];
+        gint64 stamp = slot->stamp;
+
+        slot->dirty = FALSE;
+        slot->stamp = 0;
+        if (slot->kind == SLOT_LABEL) {
+            //it may have been set back to what is shown since it was marked
+            if (strcmp(slot->text, slot->shown) == 0) {continue;}
+            memcpy(slot->shown, slot->text, UI_TEXT_MAX);
+            gtk_label_set_text(GTK_LABEL(slot->widget), slot->shown);
+        } else {
+            if (slot->image == slot->shown_image) {continue;}
+            slot->shown_image = slot->image;
+            gtk_image_set_from_pixbuf(GTK_IMAGE(slot->widget), slot->image);
+        }
+        if (stamp != 0) {
+            metrics_observe(ui->m_latency, now - stamp);
+            if (trace_enabled() && ui->n_painting < ui->max_slots) {
+                trace_flow_step("sample", stamp);
+                ui->painting[ui->n_painting++] = stamp;
+            }
+        }
+        ui->stats.applied++;
+    }
+    trace_end("ui_tick");
+    ui->n_dirty = 0;
+    ui->stats.ticks++;
+    ui->tick_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void ui_mark(ui_updater *ui, guint slot)
+{
+    if (ui->slots[slot].dirty) {return;}
+    ui->slots[slot].dirty = TRUE;
+    ui->dirty[ui->n_dirty++] = slot;
+    if (ui->tick_id == 0) {
+        ui->tick_id = gtk_widget_add_tick_callback(ui->window, ui_tick, ui, NULL);
+    }
+}
+
+void ui_set_text(ui_updater *ui, guint slot, const gchar *format, ...)
+{
+    ui_slot *s = &ui->slots[slot];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(s->text, UI_TEXT_MAX, format, args);
+    va_end(args);
+    if (strcmp(s->text, s->shown) == 0) {
+        ui->stats.unchanged++;
+        s->stamp = 0;
+        return;
+    }
+    ui_mark(ui, slot);
+}
+
+void ui_set_image(ui_updater *ui, guint slot, GdkPixbuf *pixbuf)
+{
+    ui_slot *s = &ui->slots[slot];
+
+    s->image = pixbuf;
+    if (s->image == s->shown_image) {
+        ui->stats.unchanged++;
+        s->stamp = 0;
+        return;
+    }
+    ui_mark(ui, slot);
+}
+
+void ui_set_stamp(ui_updater *ui, guint slot, gint64 ts_ns)
+{
+    ui->slots[slot].stamp = ts_ns;
+}
+
+void ui_updater_get_stats(ui_updater *ui, ui_update_stats *stats)
+{
+    *stats = ui->stats;
+}
@@ -0,0 +1,43 @@
+/**************************************************
+ * Coalesced label and image updates
+ * Periodic callbacks format their values into slots
+ * instead of calling gtk_label_set_text() directly. Text
+ * goes into a fixed buffer in the slot, and a slot is only
+ * marked dirty when the text differs from what is on
+ * screen. Dirty slots are applied together in one frame
+ * clock tick, so an unchanged value costs no relayout
+ * and the steady state does no heap allocation.
+ * All functions must be called from the GTK main thread.
+ * ************************************************/
+#ifndef UI_UPDATE_H
+#define UI_UPDATE_H
+
+#include <gtk/gtk.h>
+
+#define UI_TEXT_MAX 32
+
+typedef struct ui_updater ui_updater;
+
+typedef struct {
+    guint64 ticks;
+    guint64 applied;
+    guint64 unchanged;
+} ui_update_stats;
+
+//window provides the frame clock
+ui_updater *ui_updater_new(GtkWidget *window, guint max_slots);
+void ui_updater_free(ui_updater *ui);
+
+guint ui_updater_add_label(ui_updater *ui, GtkWidget *label);
+guint ui_updater_add_image(ui_updater *ui, GtkWidget *image);
+
+void ui_set_text(ui_updater *ui, guint slot, const gchar *format, ...) G_GNUC_PRINTF(3, 4);
+//pixbufs are compared by pointer, pass the shared ones from image_cache
+void ui_set_image(ui_updater *ui, guint slot, GdkPixbuf *pixbuf);
+//the next value set in slot comes from a sample taken at ts_ns (mono_ns()),
+//the time until it is on screen goes into the ui_sample_to_label histogram
+void ui_set_stamp(ui_updater *ui, guint slot, gint64 ts_ns);
+
+void ui_updater_get_stats(ui_updater *ui, ui_update_stats *stats);
+
+#endif
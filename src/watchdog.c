@@ -0,0 +1,182 @@
+/**************************************************
+ * Acquisition watchdog, see watchdog.h
+ * The only state shared with the producers is the newest
+ * time stamp of each signal, an atomic that only moves
+ * forward. Everything else belongs to the checking thread,
+ * the stats are copied out under the lock.
+ * ************************************************/
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "watchdog.h"
+#include "monotime.h"
+#include "metrics.h"
+
+typedef struct {
+    watchdog *wd;
+    gint id;
+    gchar name[32];
+    gint64 max_age;
+    //C11 atomic: GLib has no 64-bit atomic integers and the time stamps are gint64
+    _Atomic gint64 last;
+    //heartbeat timer, NULL for fed signals
+    reactor_source *timer;
+    gint64 period;
+    gint64 due;
+    //checking thread
+    gboolean stale;
+    gint64 stale_last;      //newest value when it went stale
+} wd_signal;
+
+struct watchdog {
+    wd_signal signals[WATCHDOG_MAX_SIGNALS];
+    guint n_signals;
+    metrics_counter *m_stale;
+    metrics_histogram *m_outage;
+    GMutex lock;
+    watchdog_stats stats[WATCHDOG_MAX_SIGNALS];
+};
+
+watchdog *watchdog_new(void)
+{
+    watchdog *wd = g_new0(watchdog, 1);
+
+    wd->m_stale = metrics_counter_new("watchdog_stale", "Times a watched signal missed its freshness deadline");
+    wd->m_outage = metrics_histogram_new("watchdog_outage", "Gap in a watched signal from its last value to the first after recovery");
+    g_mutex_init(&wd->lock);
+    return wd;
+}
+
+void watchdog_stop(watchdog *wd)
+{
+    for (guint i = 0; i < wd->n_signals; i++) {
+        if (wd->signals[i].timer == NULL) {continue;}
+        reactor_remove(wd->signals[i].timer);
+        wd->signals[i].timer = NULL;
+    }
+}
+
+void watchdog_free(watchdog *wd)
+{
+    if (wd == NULL) {return;}
+    watchdog_stop(wd);
+    g_mutex_clear(&wd->lock);
+    g_free(wd);
+}
+
+gint watchdog_add(watchdog *wd, const gchar *name, guint max_age_ms)
+{
+    wd_signal *sig;
+
+    if (wd->n_signals == WATCHDOG_MAX_SIGNALS || max_age_ms == 0) {return -1;}
+    sig = &wd->signals[wd->n_signals];
+    sig->wd = wd;
+    sig->id = wd->n_signals;
+    g_strlcpy(sig->name, name, sizeof(sig->name));
+    sig->max_age = (gint64)max_age_ms * NSEC_PER_MSEC;
+    atomic_init(&sig->last, mono_ns());
+    return wd->n_signals++;
+}
+
+static void watchdog_on_beat(reactor_source *src, guint32 events, gpointer data)
+{
+    wd_signal *sig = data;
+    gint64 now = mono_ns();
+
+    watchdog_feed(sig->wd, sig->id, now);
+    sig->due += sig->period;
+    if (sig->due < now) {sig->due = now + sig->period;}
+    reactor_timer_arm(sig->timer, sig->due);
+}
+
+gint watchdog_add_heartbeat(watchdog *wd, const gchar *name, reactor *r, guint period_ms, guint max_age_ms)
+{
+    gint id;
+    wd_signal *sig;
+
+    if (period_ms == 0 || period_ms >= max_age_ms) {return -1;}
+    id = watchdog_add(wd, name, max_age_ms);
+    if (id < 0) {return -1;}
+    sig = &wd->signals[id];
+    sig->timer = reactor_add_timer(r, watchdog_on_beat, sig);
+    if (sig->timer == NULL) {
+        wd->n_signals--;
+        return -1;
+    }
+    sig->period = (gint64)period_ms * NSEC_PER_MSEC;
+    sig->due = mono_ns() + sig->period;
+    reactor_timer_arm(sig->timer, sig->due);
+    return id;
+}
+
+void watchdog_feed(watchdog *wd, gint id, gint64 ts_ns)
+{
+    wd_signal *sig;
+    gint64 last;
+
+    if (id < 0 || (guint)id >= wd->n_signals) {return;}
+    sig = &wd->signals[id];
+    //a late producer must not make the signal look older
+    last = atomic_load_explicit(&sig->last, memory_order_relaxed);
+    while (ts_ns > last &&
+           !atomic_compare_exchange_weak_explicit(&sig->last, &last, ts_ns, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+guint watchdog_check(watchdog *wd, gint64 now, watchdog_func func, gpointer user_data)
+{
+    guint stale = 0;
+
+    for (guint i = 0; i < wd->n_signals; i++) {
+        wd_signal *sig = &wd->signals[i];
+        gint64 last = atomic_load_explicit(&sig->last, memory_order_relaxed);
+        gint64 age = now - last;
+        gboolean on = age > sig->max_age;
+
+        if (on) {stale++;}
+        if (on == sig->stale) {continue;}
+        sig->stale = on;
+        g_mutex_lock(&wd->lock);
+        if (on) {
+            sig->stale_last = last;
+            wd->stats[i].stale++;
+        }
+        else {
+            gint64 outage = last - sig->stale_last;
+            wd->stats[i].outage_ns += outage;
+            wd->stats[i].outage_max_ns = MAX(wd->stats[i].outage_max_ns, outage);
+            metrics_observe(wd->m_outage, outage);
+        }
+        g_mutex_unlock(&wd->lock);
+        if (on) {metrics_inc(wd->m_stale);}
+        if (func) {func(i, sig->name, on, age, user_data);}
+    }
+    return stale;
+}
+
+gboolean watchdog_is_stale(watchdog *wd, gint id)
+{
+    if (id < 0 || (guint)id >= wd->n_signals) {return FALSE;}
+    return wd->signals[id].stale;
+}
+
+void watchdog_get_stats(watchdog *wd, gint id, watchdog_stats *stats)
+{
+    g_mutex_lock(&wd->lock);
+    *stats = wd->stats[id];
+    g_mutex_unlock(&wd->lock);
+}
+
+void watchdog_print_stats(watchdog *wd)
+{
+    watchdog_stats st;
+
+    for (guint i = 0; i < wd->n_signals; i++) {
+        watchdog_get_stats(wd, i, &st);
+        printf("Watchdog: %s stale %llu times", wd->signals[i].name, (unsigned long long)st.stale);
+        if (st.stale > 0 && st.outage_ns > 0) {
+            printf(", longest outage %.1f s, %.1f s in total", (double)st.outage_max_ns / NSEC_PER_SEC,
+                   (double)st.outage_ns / NSEC_PER_SEC);
+        }
+        printf("%s\n", wd->signals[i].stale ? ", stale now" : "");
+    }
+}
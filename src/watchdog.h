@@ -0,0 +1,57 @@
+/**************************************************
+ * Acquisition watchdog
+ * Every watched signal has a freshness deadline: producers
+ * feed it the time stamp of each value they deliver, from
+ * whatever thread they run on, and a signal whose newest
+ * value is older than its deadline is stale. A heartbeat
+ * is a signal fed by a timer on a reactor, so it goes
+ * stale when that reactor thread stops running callbacks
+ * even though its devices are fine.
+ * watchdog_check() runs on the GUI thread, reports every
+ * change between fresh and stale and measures how long
+ * each outage lasted.
+ * ************************************************/
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <glib.h>
+#include "reactor.h"
+
+#define WATCHDOG_MAX_SIGNALS 16
+
+typedef struct watchdog watchdog;
+
+typedef struct {
+    guint64 stale;          //times the signal went stale
+    gint64 outage_ns;       //total time between the last value before and the first after
+    gint64 outage_max_ns;
+} watchdog_stats;
+
+//a signal went stale or recovered, age is that of its newest value
+typedef void (*watchdog_func)(gint id, const gchar *name, gboolean stale, gint64 age_ns, gpointer user_data);
+
+watchdog *watchdog_new(void);
+//remove the heartbeats, while their reactors are stopped and before they are
+//freed; the signals can still be fed and checked
+void watchdog_stop(watchdog *wd);
+void watchdog_free(watchdog *wd);
+
+//signals are added before any producer starts; returns the id, -1 when full.
+//A signal counts as fed when it is added
+gint watchdog_add(watchdog *wd, const gchar *name, guint max_age_ms);
+//signal fed every period_ms from the thread of r
+gint watchdog_add_heartbeat(watchdog *wd, const gchar *name, reactor *r, guint period_ms, guint max_age_ms);
+
+//a value taken at ts_ns was delivered, safe to call from any thread
+void watchdog_feed(watchdog *wd, gint id, gint64 ts_ns);
+
+//compare every signal with its deadline, returns the number of stale signals;
+//func may be NULL. Called from one thread only
+guint watchdog_check(watchdog *wd, gint64 now, watchdog_func func, gpointer user_data);
+//state found by the last check
+gboolean watchdog_is_stale(watchdog *wd, gint id);
+
+void watchdog_get_stats(watchdog *wd, gint id, watchdog_stats *stats);
+void watchdog_print_stats(watchdog *wd);
+
+#endif
@@ -0,0 +1,116 @@
+/**************************************************
+ * Benchmark of the actuator worker on the simulated bank.
+ * Single commands: one producer toggles a relay every
+ * millisecond and the worker's latency sum tells what each
+ * command took from enqueue to pin written; reported are
+ * the median, p99 and max. Contention: three producers
+ * post as fast as they can, reported are the mean and max
+ * latency and the commands dropped on a full queue.
+ * Timed edges: four channels run software PWM, reported
+ * is how late the scheduled edges were written.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "actuator.h"
+#include "monotime.h"
+
+#define TOGGLES 2000
+#define PRODUCERS 3
+#define PRODUCER_COMMANDS 20000
+#define PWM_CHANNELS 4
+#define PWM_PERIOD_NS (10 * NSEC_PER_MSEC)
+#define PWM_RUN_US 2000000
+
+static int cmp_gint64(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static actuator *open_sim(guint channels)
+{
+    actuator *act = actuator_open_sim();
+
+    for (guint ch = 0; ch < channels; ch++) {actuator_add_channel(act, 17 + ch, FALSE);}
+    actuator_start(act);
+    return act;
+}
+
+static void bench_single(void)
+{
+    actuator *act = open_sim(1);
+    static gint64 lat[TOGGLES];
+    actuator_stats st;
+    gint64 sum = 0;
+
+    for (guint i = 0; i < TOGGLES; i++) {
+        actuator_set(act, 0, i & 1);
+        do {
+            g_usleep(100);
+            actuator_get_stats(act, &st);
+        } while (st.commands == i);
+        lat[i] = st.latency_sum_ns - sum;
+        sum = st.latency_sum_ns;
+        g_usleep(900);
+    }
+    actuator_stop(act);
+    actuator_free(act);
+    qsort(lat, TOGGLES, sizeof(lat[0]), cmp_gint64);
+    printf("Enqueue to pin, %u single commands 1 ms apart:\n", TOGGLES);
+    printf("  median %6.1f us  p99 %6.1f us  max %7.1f us\n", (double)lat[TOGGLES / 2] / NSEC_PER_USEC,
+           (double)lat[TOGGLES * 99 / 100] / NSEC_PER_USEC, (double)lat[TOGGLES - 1] / NSEC_PER_USEC);
+}
+
+static gpointer producer(gpointer data)
+{
+    actuator *act = data;
+
+    for (guint i = 0; i < PRODUCER_COMMANDS; i++) {actuator_set(act, i % 4, (i / 4) & 1);}
+    return NULL;
+}
+
+static void bench_contention(void)
+{
+    actuator *act = open_sim(4);
+    GThread *th[PRODUCERS];
+    actuator_stats st;
+    gint64 start = mono_ns(), ns;
+
+    for (guint p = 0; p < PRODUCERS; p++) {th[p] = g_thread_new("producer", producer, act);}
+    for (guint p = 0; p < PRODUCERS; p++) {g_thread_join(th[p]);}
+    ns = mono_ns() - start;
+    actuator_stop(act);
+    actuator_get_stats(act, &st);
+    actuator_free(act);
+    printf("%u producers, %u commands each:\n", PRODUCERS, PRODUCER_COMMANDS);
+    printf("  %.0f commands/s  mean %6.1f us  max %7.1f us  %llu dropped  %.1f commands per bank write\n",
+           (double)st.commands * NSEC_PER_SEC / ns, (double)st.latency_sum_ns / MAX(st.commands, 1) / NSEC_PER_USEC,
+           (double)st.latency_max_ns / NSEC_PER_USEC, (unsigned long long)st.dropped,
+           (double)st.commands / MAX(st.writes, 1));
+}
+
+static void bench_pwm(void)
+{
+    actuator *act = open_sim(PWM_CHANNELS);
+    actuator_stats st;
+
+    for (guint ch = 0; ch < PWM_CHANNELS; ch++) {actuator_pwm(act, ch, PWM_PERIOD_NS, 250 * (ch + 1) - 100);}
+    g_usleep(PWM_RUN_US);
+    actuator_get_stats(act, &st);
+    actuator_stop(act);
+    actuator_free(act);
+    printf("Software PWM, %u channels at %lld ms for %d s:\n", PWM_CHANNELS,
+           (long long)(PWM_PERIOD_NS / NSEC_PER_MSEC), PWM_RUN_US / 1000000);
+    printf("  %llu edges  late mean %6.1f us  max %7.1f us  %llu bank writes\n", (unsigned long long)st.edges,
+           (double)st.late_sum_ns / MAX(st.edges, 1) / NSEC_PER_USEC, (double)st.late_max_ns / NSEC_PER_USEC,
+           (unsigned long long)st.writes);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_single();
+    bench_contention();
+    bench_pwm();
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**************************************************
+ * Benchmark of ADS1115 continuous acquisition on the fake
+ * converter. For a range of data rates, with one channel
+ * and with a scan of four, the converter runs from the
+ * reactor for a second while a consumer drains the ring
+ * every 10 ms the way display() does; reported are the
+ * samples/s reached against the data rate, the CPU the
+ * reactor thread needed for it and the samples dropped.
+ * A last run drains a small ring only every 200 ms at the
+ * highest rate to show the drop counting.
+ * ************************************************/
+#include <stdio.h>
+
+#include "ads1115.h"
+#include "sample_ring.h"
+#include "reactor.h"
+#include "monotime.h"
+
+#define RUN_NS NSEC_PER_SEC
+
+static void run(guint8 data_rate, guint channels, guint ring_size, guint drain_ms)
+{
+    ads1115_config cfg = {{ADS1115_MUX_AIN0, ADS1115_MUX_AIN1, ADS1115_MUX_AIN2, ADS1115_MUX_AIN3}, channels, data_rate};
+    reactor *r = reactor_new();
+    ads1115 *adc = ads1115_open_fake();
+    sample_ring *ring = sample_ring_new(ring_size);
+    adc_sample batch[64];
+    guint64 drained = 0;
+    gint64 end;
+    ads1115_stats as;
+    reactor_stats rs;
+    guint n;
+
+    ads1115_start(adc, &cfg, r, ring);
+    reactor_start(r, -1);
+    end = mono_ns() + RUN_NS;
+    while (mono_ns() < end) {
+        g_usleep(drain_ms * 1000);
+        while ((n = sample_ring_drain(ring, batch, G_N_ELEMENTS(batch))) > 0) {drained += n;}
+    }
+    reactor_stop(r);
+    ads1115_get_stats(adc, &as);
+    reactor_get_stats(r, &rs);
+    printf("  %3u SPS  %u ch  ring %4u/%3u ms  %7.1f samples/s  %5.3f%% CPU  %5.1f us/sample  %6llu dropped\n",
+           ads1115_rate_sps(data_rate), channels, ring_size, drain_ms, (double)as.samples * NSEC_PER_SEC / as.run_ns,
+           100.0 * rs.cpu_ns / rs.run_ns, (double)rs.cpu_ns / NSEC_PER_USEC / MAX(as.samples, 1),
+           (unsigned long long)as.dropped);
+    ads1115_free(adc);
+    sample_ring_free(ring);
+    reactor_free(r);
+}
+
+int main(int argc, char *argv[])
+{
+    const guint8 rates[] = {ADS1115_DR_8, ADS1115_DR_128, ADS1115_DR_475, ADS1115_DR_860};
+
+    printf("Fake converter, drained every 10 ms:\n");
+    for (guint i = 0; i < G_N_ELEMENTS(rates); i++) {
+        run(rates[i], 1, 1024, 10);
+        run(rates[i], 4, 1024, 10);
+    }
+    printf("Slow consumer:\n");
+    run(ADS1115_DR_860, 1, 64, 200);
+    return 0;
+}
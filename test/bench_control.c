@@ -0,0 +1,114 @@
+/**************************************************
+ * Benchmark of the control thread's wakeup jitter. The
+ * loop runs main.c's climate control against the
+ * simulated plant, at a 10 ms period for more wakeups per
+ * run, once on an idle machine and once under a synthetic
+ * GUI load: one thread per CPU plus one, each repainting a
+ * 1920x1080 frame buffer and churning small allocations
+ * for most of every 60 fps frame. Under load the loop runs
+ * once with main.c's SCHED_FIFO priority and once on the
+ * normal scheduler; SCHED_FIFO needs root or CAP_SYS_NICE,
+ * without it both loaded runs are the same. Reported are
+ * the deadline misses and the lateness histogram.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "control.h"
+#include "actuator.h"
+#include "snapshot.h"
+#include "monotime.h"
+
+#define PERIOD_MS 10
+#define RUN_US 3000000
+#define FRAME_NS (NSEC_PER_SEC / 60)
+#define FRAME_BUSY_NS (12 * NSEC_PER_MSEC)
+#define FRAME_BYTES (1920 * 1080 * 4)
+
+typedef struct {
+    volatile gint stop;
+    guint64 frames;
+} gui_load;
+
+static gpointer gui_thread(gpointer data)
+{
+    gui_load *load = data;
+    guint8 *front = g_malloc0(FRAME_BYTES), *back = g_malloc0(FRAME_BYTES);
+    gint64 frame = mono_ns();
+    guint8 shade = 0;
+
+    while (!g_atomic_int_get(&load->stop)) {
+        gint64 busy_until = frame + FRAME_BUSY_NS;
+
+        while (mono_ns() < busy_until) {
+            gpointer junk[64];
+            memset(back, shade++, FRAME_BYTES / 16);
+            memcpy(front, back, FRAME_BYTES / 16);
+            for (guint i = 0; i < G_N_ELEMENTS(junk); i++) {junk[i] = g_malloc(64 + i * 16);}
+            for (guint i = 0; i < G_N_ELEMENTS(junk); i++) {g_free(junk[i]);}
+        }
+        load->frames++;
+        frame += FRAME_NS;
+        sleep_until_ns(frame);
+    }
+    g_free(front);
+    g_free(back);
+    return NULL;
+}
+
+static void on_reading(const climate_reading *reading, gpointer user_data)
+{
+    climate_publish(user_data, reading);
+}
+
+static void run(const gchar *what, int priority, guint load_threads)
+{
+    control_config cfg = {
+        PERIOD_MS, priority, 2000, 5000,
+        {0.5, 0.005, 20.0, 0.0, 1.0, 0.02},
+        10000, 1.0, 5.0, 30000
+    };
+    actuator *act = actuator_open_sim();
+    snapshot_cell climate;
+    control_outputs out;
+    gui_load load = {0};
+    GThread *th[16];
+    control *ctl;
+    control_stats st;
+
+    out.heater = actuator_add_channel(act, 17, FALSE);
+    out.fan = actuator_add_channel(act, 18, FALSE);
+    out.humidifier = actuator_add_channel(act, 27, FALSE);
+    actuator_start(act);
+    snapshot_init(&climate);
+    load_threads = MIN(load_threads, G_N_ELEMENTS(th));
+    for (guint i = 0; i < load_threads; i++) {th[i] = g_thread_new("gui", gui_thread, &load);}
+    ctl = control_start_sim(&cfg, &climate, act, &out, on_reading, &climate);
+    control_set_target(ctl, 25.0, 50.0);
+    g_usleep(RUN_US);
+    control_get_stats(ctl, &st);
+    control_stop(ctl);
+    g_atomic_int_set(&load.stop, 1);
+    for (guint i = 0; i < load_threads; i++) {g_thread_join(th[i]);}
+    actuator_stop(act);
+    actuator_free(act);
+
+    printf("%s:\n", what);
+    printf("  %llu periods, %llu misses (> %u us late), worst %.1f us late\n", (unsigned long long)st.periods,
+           (unsigned long long)st.misses, cfg.max_late_us, (double)st.late_max_ns / NSEC_PER_USEC);
+    for (guint b = 0; b < CONTROL_HIST_BUCKETS; b++) {
+        if (st.hist[b] == 0) {continue;}
+        printf("    < %8u us late: %llu\n", 1u << b, (unsigned long long)st.hist[b]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    guint load = g_get_num_processors() + 1;
+
+    printf("Control loop at %d ms for %d s, GUI load %u threads:\n", PERIOD_MS, RUN_US / 1000000, load);
+    run("idle, SCHED_FIFO 30", 30, 0);
+    run("GUI load, SCHED_FIFO 30", 30, load);
+    run("GUI load, normal scheduler", 0, load);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/**************************************************
+ * Benchmark of the pressure filter pipeline per stage.
+ * A noisy raw stream with spikes is filtered in batches
+ * of the size display() drains and of a large backlog,
+ * with main.c's pressure filter and with variations of
+ * the median window and the low-pass; reported are the
+ * samples/s each stage sustained from the filter's own
+ * per-stage timing and the samples/s of the whole run.
+ * Run it on x86 and on the Pi, the header line says which
+ * machine it ran on.
+ * ************************************************/
+#include <stdio.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+#include "dsp.h"
+#include "monotime.h"
+
+#define SAMPLES (16 * 1024 * 1024)
+
+static const dsp_config pressure_filter = {
+    8, 5, DSP_LOWPASS_BIQUAD, 128.0, 0.5,
+    {{4000, -50.0}, {28000, 50.0}}, 2
+};
+
+static gint16 in[SAMPLES];
+static gfloat out[SAMPLES];
+
+static void run(const gchar *what, guint decimate, guint median, dsp_lowpass lowpass, guint batch)
+{
+    dsp_config cfg = pressure_filter;
+    const gchar *names[DSP_STAGES] = {"decimate", "median", "low-pass", "calibrate"};
+    dsp_filter *f;
+    dsp_stats st;
+    gint64 start, ns;
+
+    cfg.decimate = decimate;
+    cfg.median = median;
+    cfg.lowpass = lowpass;
+    f = dsp_filter_new(&cfg);
+    start = mono_ns();
+    for (guint i = 0; i < SAMPLES; i += batch) {dsp_filter_run(f, in + i, MIN(batch, SAMPLES - i), out, NULL);}
+    ns = mono_ns() - start;
+    dsp_get_stats(f, &st);
+    printf("  %-20s batch %4u  overall %6.1f ", what, batch, (double)SAMPLES * 1e3 / ns);
+    for (guint s = 0; s < DSP_STAGES; s++) {
+        if (st.stage_samples[s] == 0 || st.stage_ns[s] == 0) {continue;}
+        printf(" %s %.1f", names[s], (double)st.stage_samples[s] * 1e3 / st.stage_ns[s]);
+    }
+    printf("\n");
+    dsp_filter_free(f);
+}
+
+int main(int argc, char *argv[])
+{
+    guint32 rng = 2463534242u;
+    const guint batches[] = {64, 4096};
+    struct utsname machine;
+
+    for (guint i = 0; i < SAMPLES; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        in[i] = 16000 + 4000 * sinf(i * 1e-4f) + (gint)(rng & 0xFF) - 128;
+        if ((rng >> 8) % 1000 == 0) {in[i] = 32767;}
+    }
+    uname(&machine);
+    printf("Filter stages in M samples/s, %d M raw samples on %s:\n", SAMPLES >> 20, machine.machine);
+    for (guint b = 0; b < G_N_ELEMENTS(batches); b++) {
+        run("main.c (8, median 5)", 8, 5, DSP_LOWPASS_BIQUAD, batches[b]);
+        run("median 3", 8, 3, DSP_LOWPASS_BIQUAD, batches[b]);
+        run("median 9", 8, 9, DSP_LOWPASS_BIQUAD, batches[b]);
+        run("EMA", 8, 5, DSP_LOWPASS_EMA, batches[b]);
+        run("no decimation", 1, 5, DSP_LOWPASS_BIQUAD, batches[b]);
+    }
+    return 0;
+}
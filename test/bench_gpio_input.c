@@ -0,0 +1,181 @@
+/**************************************************
+ * Benchmark of the edge-triggered dry contact input on
+ * simulated lines. A stand-in GUI thread takes the place
+ * of the main loop: the change callback queues at most one
+ * message for it the way on_dry_contact_changed() queues
+ * one idle callback, and the GUI side reads the levels.
+ * Edge to screen: clean edges on one line with main.c's
+ * 20 ms debounce, reporting the time from the edge to the
+ * GUI reading the new level, beyond the debounce window.
+ * Bounce storm: every line bounces with an edge about
+ * every 50 us and then settles, over and over; each storm
+ * has to end in exactly one transition per line and at
+ * most that many GUI messages. Reported are the edge rate
+ * reached and the CPU the reactor thread needed per edge.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio_input.h"
+#include "reactor.h"
+#include "monotime.h"
+
+#define DEBOUNCE_US 20000
+#define EDGES 100
+#define STORM_LINES 8
+#define STORMS 20
+#define STORM_EDGES 41      //odd, so every storm ends at the other level
+#define BOUNCE_US 50
+
+typedef struct {
+    gpio_input *in;
+    guint lines;
+    GMutex lock;
+    GCond cond;
+    volatile gint pending;
+    gboolean quit;
+    guint posted;           //messages queued to the GUI
+    guint shown;            //messages the GUI has handled
+    guint32 levels;         //levels the GUI read last
+    gint64 shown_ns;
+} screen;
+
+//reactor thread, one message until the GUI has handled the last one
+static void on_changed(guint line, gint level, gint64 ts_ns, gpointer user_data)
+{
+    screen *s = user_data;
+
+    if (!g_atomic_int_compare_and_exchange(&s->pending, 0, 1)) {return;}
+    g_mutex_lock(&s->lock);
+    s->posted++;
+    g_cond_broadcast(&s->cond);
+    g_mutex_unlock(&s->lock);
+}
+
+static gpointer gui_thread(gpointer data)
+{
+    screen *s = data;
+
+    g_mutex_lock(&s->lock);
+    while (!s->quit) {
+        if (s->posted == s->shown) {
+            g_cond_wait(&s->cond, &s->lock);
+            continue;
+        }
+        g_atomic_int_set(&s->pending, 0);
+        s->levels = 0;
+        for (guint l = 0; l < s->lines; l++) {
+            if (gpio_input_get_level(s->in, l) == 1) {s->levels |= 1u << l;}
+        }
+        s->shown_ns = mono_ns();
+        s->shown++;
+        g_cond_broadcast(&s->cond);
+    }
+    g_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static GThread *screen_start(screen *s, gpio_input *in, guint lines, reactor *r)
+{
+    memset(s, 0, sizeof(*s));
+    g_mutex_init(&s->lock);
+    g_cond_init(&s->cond);
+    s->in = in;
+    s->lines = lines;
+    s->levels = (1u << lines) - 1;
+    gpio_input_start(in, r, on_changed, s);
+    reactor_start(r, -1);
+    return g_thread_new("gui", gui_thread, s);
+}
+
+static void screen_stop(screen *s, GThread *gui, reactor *r)
+{
+    reactor_stop(r);
+    g_mutex_lock(&s->lock);
+    s->quit = TRUE;
+    g_cond_broadcast(&s->cond);
+    g_mutex_unlock(&s->lock);
+    g_thread_join(gui);
+    g_cond_clear(&s->cond);
+    g_mutex_clear(&s->lock);
+}
+
+static int cmp_gint64(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_latency(void)
+{
+    reactor *r = reactor_new();
+    gpio_input *in = gpio_input_open_sim(1, DEBOUNCE_US);
+    screen s;
+    GThread *gui = screen_start(&s, in, 1, r);
+    gint64 lat[EDGES];
+
+    for (guint i = 0; i < EDGES; i++) {
+        guint32 want = (i & 1) ? 1 : 0;
+        gint64 edge = mono_ns();
+
+        gpio_input_sim_set(in, 0, want);
+        g_mutex_lock(&s.lock);
+        while (s.levels != want) {g_cond_wait(&s.cond, &s.lock);}
+        lat[i] = s.shown_ns - edge - DEBOUNCE_US * NSEC_PER_USEC;
+        g_mutex_unlock(&s.lock);
+    }
+    screen_stop(&s, gui, r);
+    qsort(lat, EDGES, sizeof(lat[0]), cmp_gint64);
+    printf("Edge to screen, %u edges, beyond the %u ms debounce:\n", EDGES, DEBOUNCE_US / 1000);
+    printf("  median %7.1f us, p90 %7.1f us, max %7.1f us\n", (double)lat[EDGES / 2] / NSEC_PER_USEC,
+           (double)lat[EDGES * 9 / 10] / NSEC_PER_USEC, (double)lat[EDGES - 1] / NSEC_PER_USEC);
+    gpio_input_free(in);
+    reactor_free(r);
+}
+
+static void bench_storm(void)
+{
+    reactor *r = reactor_new();
+    gpio_input *in = gpio_input_open_sim(STORM_LINES, DEBOUNCE_US);
+    screen s;
+    GThread *gui = screen_start(&s, in, STORM_LINES, r);
+    guint64 edges, transitions;
+    guint32 levels = (1u << STORM_LINES) - 1;
+    gint64 storm_ns = 0;
+    guint wrong = 0;
+    reactor_stats rs;
+
+    for (guint n = 0; n < STORMS; n++) {
+        gint64 start = mono_ns();
+
+        for (guint e = 0; e < STORM_EDGES; e++) {
+            for (guint l = 0; l < STORM_LINES; l++) {gpio_input_sim_set(in, l, !((levels >> l) & 1) ^ (e & 1));}
+            g_usleep(BOUNCE_US);
+        }
+        storm_ns += mono_ns() - start;
+        levels ^= (1u << STORM_LINES) - 1;
+        g_usleep(DEBOUNCE_US + 10000);
+        g_mutex_lock(&s.lock);
+        if (s.levels != levels) {wrong++;}
+        g_mutex_unlock(&s.lock);
+    }
+    reactor_get_stats(r, &rs);
+    screen_stop(&s, gui, r);
+    gpio_input_get_counts(in, &edges, &transitions);
+    printf("Bounce storm, %u lines, %u storms of %u edges per line:\n", STORM_LINES, STORMS, STORM_EDGES);
+    printf("  %llu edges at %.0f edges/s, %llu transitions (expected %u), %u GUI messages, %u wrong levels\n",
+           (unsigned long long)edges, (double)edges * NSEC_PER_SEC / storm_ns, (unsigned long long)transitions,
+           STORMS * STORM_LINES, s.posted, wrong);
+    printf("  reactor %llu wakeups, %.2f%% CPU, %.0f ns CPU per edge\n", (unsigned long long)rs.wakeups,
+           100.0 * rs.cpu_ns / rs.run_ns, (double)rs.cpu_ns / edges);
+    gpio_input_free(in);
+    reactor_free(r);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_latency();
+    bench_storm();
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**************************************************
+ * Benchmark of the status input scanner on the simulated
+ * bank. First the cost of one scan, debounce and report
+ * included, for the 6 status lines of the monitor and for
+ * a full bank of 32; then the scanner runs from the reactor
+ * at 1, 5 and 10 kHz for a second each while lines change,
+ * reporting the scan rate reached, the worst late scan and
+ * the CPU the reactor thread needed.
+ * ************************************************/
+#include <stdio.h>
+
+#include "gpio_scan.h"
+#include "reactor.h"
+#include "monotime.h"
+
+#define MIN_RUN_NS (200 * NSEC_PER_MSEC)
+#define RUN_NS NSEC_PER_SEC
+
+static guint64 reports;
+
+static void on_changed(guint32 changed, guint32 levels, gint64 ts_ns, gpointer user_data)
+{
+    reports++;
+}
+
+static gpio_scan *open_lines(reactor *r, guint lines, guint period_us)
+{
+    gpio_scan *scan = gpio_scan_open_sim();
+
+    for (guint l = 0; l < lines; l++) {gpio_scan_add_line(scan, l, TRUE);}
+    gpio_scan_start(scan, r, period_us, 10, on_changed, NULL);
+    return scan;
+}
+
+//ns per gpio_scan_poll(), a line changes every 64 scans
+static gdouble bench_poll(guint lines)
+{
+    reactor *r = reactor_new();
+    gpio_scan *scan = open_lines(r, lines, 1000);
+    guint64 scans = 0;
+    gint64 start = mono_ns(), now;
+
+    do {
+        for (guint i = 0; i < 10000; i++) {
+            if ((i & 63) == 0) {gpio_scan_sim_set(scan, i / 64 % lines, (i / 64 / lines) & 1);}
+            gpio_scan_poll(scan);
+        }
+        scans += 10000;
+        now = mono_ns();
+    } while (now - start < MIN_RUN_NS);
+    gpio_scan_free(scan);
+    reactor_free(r);
+    return (gdouble)(now - start) / scans;
+}
+
+static void bench_rate(guint hz)
+{
+    reactor *r = reactor_new();
+    gpio_scan *scan = open_lines(r, 6, 1000000 / hz);
+    gpio_scan_stats st;
+    reactor_stats rs;
+
+    reports = 0;
+    reactor_start(r, -1);
+    //a switch changes every 50 ms
+    for (guint i = 0; i < RUN_NS / (50 * NSEC_PER_MSEC); i++) {
+        gpio_scan_sim_set(scan, i % 6, (i / 6) & 1);
+        g_usleep(50000);
+    }
+    reactor_stop(r);
+    gpio_scan_get_stats(scan, &st);
+    reactor_get_stats(r, &rs);
+    printf("  %5u Hz: %7.0f scans/s, worst %7.1f us late, %llu reports, %5.2f%% CPU, %5.2f us CPU per scan\n", hz,
+           (double)st.scans * NSEC_PER_SEC / st.run_ns, (double)st.late_max_ns / NSEC_PER_USEC,
+           (unsigned long long)reports, 100.0 * rs.cpu_ns / rs.run_ns, (double)rs.cpu_ns / NSEC_PER_USEC / st.scans);
+    gpio_scan_free(scan);
+    reactor_free(r);
+}
+
+int main(int argc, char *argv[])
+{
+    const guint rates[] = {1000, 5000, 10000};
+
+    printf("One scan:\n");
+    printf("   6 lines  %6.1f ns\n", bench_poll(6));
+    printf("  32 lines  %6.1f ns\n", bench_poll(32));
+    printf("Scanning from the reactor, 6 lines:\n");
+    for (guint i = 0; i < G_N_ELEMENTS(rates); i++) {bench_rate(rates[i]);}
+    return 0;
+}
@@ -0,0 +1,124 @@
+/**************************************************
+ * Reader/writer benchmark of the live data segment. The
+ * writer publishes 16 channels round robin as fast as it
+ * can for one second per case while 0 to 64 reader
+ * processes, each with its own live_client mapping, read
+ * the channels in a loop. Every write stores its sequence
+ * number as value and time stamp, so a reader can tell a
+ * torn copy or one going backwards. Reported are writes/s
+ * and the worst write, reads/s over all readers, reads
+ * that gave up retrying and inconsistent copies, which
+ * must be none.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "live_pub.h"
+#include "live_client.h"
+#include "monotime.h"
+
+#define CHANNELS 16
+#define MAX_READERS 64
+#define RUN_NS NSEC_PER_SEC
+
+typedef struct {
+    guint64 reads;
+    guint64 failed;
+    guint64 bad;
+} reader_result;
+
+//shared with the reader processes
+typedef struct {
+    volatile gint ready;
+    volatile gint stop;
+    reader_result result[MAX_READERS];
+} bench_shared;
+
+static void reader(const gchar *name, bench_shared *sh, guint id)
+{
+    live_client *c = live_client_open(name);
+    reader_result *res = &sh->result[id];
+    guint64 last[CHANNELS] = {0};
+    live_value v;
+
+    if (c == NULL) {_exit(1);}
+    g_atomic_int_inc(&sh->ready);
+    while (!g_atomic_int_get(&sh->stop)) {
+        for (guint ch = 0; ch < CHANNELS; ch++) {
+            if (!live_client_read(c, ch, &v)) {
+                res->failed++;
+                continue;
+            }
+            if (v.value != (gdouble)v.seq || v.ts_ns != (gint64)v.seq || v.seq < last[ch]) {res->bad++;}
+            last[ch] = v.seq;
+            res->reads++;
+        }
+    }
+    live_client_close(c);
+    _exit(0);
+}
+
+static void run(const gchar *name, guint readers)
+{
+    live_pub *pub = live_pub_open(name);
+    bench_shared *sh = mmap(NULL, sizeof(bench_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    guint64 count[CHANNELS] = {0}, writes = 0, reads = 0, failed = 0, bad = 0;
+    gint channels[CHANNELS];
+    gint64 start, now, worst = 0;
+
+    if (pub == NULL || sh == MAP_FAILED) {
+        printf("Error: cannot set up the segment\n");
+        exit(1);
+    }
+    for (guint ch = 0; ch < CHANNELS; ch++) {
+        gchar chname[LIVE_NAME_MAX];
+        g_snprintf(chname, sizeof(chname), "channel%u", ch);
+        channels[ch] = live_pub_add(pub, chname, "V");
+        count[ch]++;
+        live_pub_set(pub, channels[ch], count[ch], count[ch]);
+    }
+    for (guint r = 0; r < readers; r++) {
+        if (fork() == 0) {reader(name, sh, r);}
+    }
+    while (g_atomic_int_get(&sh->ready) < (gint)readers) {g_usleep(1000);}
+
+    start = now = mono_ns();
+    while (now - start < RUN_NS) {
+        guint ch = writes % CHANNELS;
+        gint64 t;
+
+        count[ch]++;
+        live_pub_set(pub, channels[ch], count[ch], count[ch]);
+        writes++;
+        t = mono_ns();
+        worst = MAX(worst, t - now);
+        now = t;
+    }
+    g_atomic_int_set(&sh->stop, 1);
+    for (guint r = 0; r < readers; r++) {wait(NULL);}
+    for (guint r = 0; r < readers; r++) {
+        reads += sh->result[r].reads;
+        failed += sh->result[r].failed;
+        bad += sh->result[r].bad;
+    }
+    printf("  %2u readers  %6.2f M writes/s  worst %7.1f us  %7.2f M reads/s  %llu failed  %llu inconsistent\n",
+           readers, (double)writes * 1e3 / (now - start), (double)worst / NSEC_PER_USEC,
+           (double)reads * 1e3 / (now - start), (unsigned long long)failed, (unsigned long long)bad);
+    munmap(sh, sizeof(bench_shared));
+    live_pub_close(pub);
+}
+
+int main(int argc, char *argv[])
+{
+    const guint readers[] = {0, 1, 4, 16, 64};
+    gchar *name = g_strdup_printf("/bench_live_shm.%d", (int)getpid());
+
+    printf("Live segment, %d channels, %.0f s per case, %u CPUs:\n", CHANNELS, (double)RUN_NS / NSEC_PER_SEC,
+           g_get_num_processors());
+    for (guint i = 0; i < G_N_ELEMENTS(readers); i++) {run(name, readers[i]);}
+    g_free(name);
+    return 0;
+}
@@ -0,0 +1,247 @@
+/**************************************************
+ * Localhost load test of the Modbus TCP server. The
+ * server runs main.c's BMS register map on its own
+ * reactor over a live data segment that a writer thread
+ * keeps updating at 1 kHz. 1 to 500 client connections
+ * each keep one request outstanding for two seconds per
+ * case: a read of the 15 int16 registers, every fourth one
+ * a read of the float registers, alternating function 03
+ * and 04. Every response is checked against its request.
+ * Reported are requests/s, the median, p99 and max round
+ * trip seen by the clients and the server's own mean
+ * service time.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "modbus_tcp.h"
+#include "live_pub.h"
+#include "monotime.h"
+
+#define PORT 15502
+#define MAX_CONNS 500
+#define RUN_NS (2 * NSEC_PER_SEC)
+#define MAX_LATENCIES (4 * 1024 * 1024)
+
+//main.c's BMS map
+static const mbtcp_reg registers[] = {
+    {0, "temperature", 100, MBTCP_INT16},
+    {1, "humidity", 100, MBTCP_INT16},
+    {2, "pressure", 10, MBTCP_INT16},
+    {3, "o2", 1, MBTCP_INT16},
+    {4, "n2o", 1, MBTCP_INT16},
+    {5, "co2", 1, MBTCP_INT16},
+    {6, "vacuum", 1, MBTCP_INT16},
+    {7, "agss", 1, MBTCP_INT16},
+    {8, "contact", 1, MBTCP_UINT16},
+    {9, "heater", 1000, MBTCP_UINT16},
+    {10, "fan", 1, MBTCP_UINT16},
+    {11, "humidifier", 1, MBTCP_UINT16},
+    {12, "alarms", 1, MBTCP_UINT16},
+    {13, "operation_timer", 1, MBTCP_UINT16},
+    {14, "anesthesia_timer", 1, MBTCP_UINT16},
+    {100, "temperature", 1, MBTCP_FLOAT32},
+    {102, "humidity", 1, MBTCP_FLOAT32},
+    {104, "pressure", 1, MBTCP_FLOAT32},
+};
+static const gchar *channels[] = {
+    "temperature", "humidity", "pressure", "o2", "n2o", "co2", "vacuum", "agss",
+    "contact", "heater", "fan", "humidifier", "alarms", "operation_timer", "anesthesia_timer"
+};
+
+typedef struct {
+    int fd;
+    guint16 tid;
+    guint16 count;
+    gint64 sent_ns;
+    guint8 rx[64];
+    size_t rx_len;
+} conn;
+
+typedef struct {
+    live_pub *pub;
+    gint ids[G_N_ELEMENTS(channels)];
+    volatile gint stop;
+} writer;
+
+static gint64 lat[MAX_LATENCIES];
+
+static int cmp_gint64(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static gpointer writer_thread(gpointer data)
+{
+    writer *w = data;
+    gint64 next = mono_ns();
+
+    for (guint n = 0; !g_atomic_int_get(&w->stop); n++) {
+        for (guint i = 0; i < G_N_ELEMENTS(channels); i++) {live_pub_set(w->pub, w->ids[i], 20.0 + (n + i) % 100 / 10.0, next);}
+        live_pub_heartbeat(w->pub, next);
+        next += NSEC_PER_MSEC;
+        sleep_until_ns(next);
+    }
+    return NULL;
+}
+
+static void send_request(conn *c)
+{
+    guint8 req[12];
+    guint16 address;
+
+    c->tid++;
+    //every fourth request reads the three floats
+    c->count = c->tid % 4 == 1 ? 6 : 15;
+    address = c->count == 6 ? 100 : 0;
+    req[0] = c->tid >> 8;
+    req[1] = c->tid;
+    req[2] = req[3] = 0;
+    req[4] = 0;
+    req[5] = 6;
+    req[6] = 1;
+    req[7] = c->tid % 2 ? 0x04 : 0x03;
+    req[8] = address >> 8;
+    req[9] = address;
+    req[10] = c->count >> 8;
+    req[11] = c->count;
+    c->sent_ns = mono_ns();
+    if (write(c->fd, req, sizeof(req)) != sizeof(req)) {
+        printf("Error: request write: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+//TRUE once a whole response is in, which must answer the last request
+static gboolean check_response(conn *c)
+{
+    size_t want = 9 + 2 * c->count;
+
+    if (c->rx_len < want) {return FALSE;}
+    if (c->rx_len > want || ((c->rx[0] << 8) | c->rx[1]) != c->tid || c->rx[7] != (c->tid % 2 ? 0x04 : 0x03) ||
+        c->rx[8] != 2 * c->count) {
+        printf("Error: bad response to transaction %u\n", c->tid);
+        exit(1);
+    }
+    c->rx_len = 0;
+    return TRUE;
+}
+
+static void run(mbtcp_server *srv, guint n_conns)
+{
+    static conn conns[MAX_CONNS];
+    static struct pollfd pfd[MAX_CONNS];
+    struct sockaddr_in addr;
+    mbtcp_stats before, after;
+    guint64 requests = 0;
+    gint64 start, now;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (guint i = 0; i < n_conns; i++) {
+        memset(&conns[i], 0, sizeof(conns[i]));
+        conns[i].fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (conns[i].fd < 0 || connect(conns[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            printf("Error: connect: %s\n", strerror(errno));
+            exit(1);
+        }
+        setsockopt(conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pfd[i].fd = conns[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    mbtcp_get_stats(srv, &before);
+    start = now = mono_ns();
+    for (guint i = 0; i < n_conns; i++) {send_request(&conns[i]);}
+    while (now - start < RUN_NS) {
+        if (poll(pfd, n_conns, 100) < 0) {
+            printf("Error: poll: %s\n", strerror(errno));
+            exit(1);
+        }
+        for (guint i = 0; i < n_conns; i++) {
+            conn *c = &conns[i];
+            ssize_t n;
+
+            if (!(pfd[i].revents & POLLIN)) {continue;}
+            n = read(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len);
+            if (n <= 0) {
+                printf("Error: connection %u closed by the server\n", i);
+                exit(1);
+            }
+            c->rx_len += n;
+            if (!check_response(c)) {continue;}
+            now = mono_ns();
+            if (requests < MAX_LATENCIES) {lat[requests] = now - c->sent_ns;}
+            requests++;
+            send_request(c);
+        }
+        now = mono_ns();
+    }
+    mbtcp_get_stats(srv, &after);
+    for (guint i = 0; i < n_conns; i++) {close(conns[i].fd);}
+
+    qsort(lat, MIN(requests, MAX_LATENCIES), sizeof(lat[0]), cmp_gint64);
+    requests = MAX(requests, 1);
+    printf("  %3u connections  %7.0f requests/s  median %7.1f us  p99 %7.1f us  max %8.1f us  server %5.1f us/request\n",
+           n_conns, (double)requests * NSEC_PER_SEC / (now - start),
+           (double)lat[MIN(requests, MAX_LATENCIES) / 2] / NSEC_PER_USEC,
+           (double)lat[MIN(requests, MAX_LATENCIES) * 99 / 100] / NSEC_PER_USEC,
+           (double)lat[MIN(requests, MAX_LATENCIES) - 1] / NSEC_PER_USEC,
+           (double)(after.service_ns - before.service_ns) / MAX(after.requests - before.requests, 1) / NSEC_PER_USEC);
+    //let the server see the closes before the next case
+    g_usleep(200000);
+}
+
+int main(int argc, char *argv[])
+{
+    const guint counts[] = {1, 10, 100, 500};
+    gchar *name = g_strdup_printf("/bench_modbus_tcp.%d", (int)getpid());
+    mbtcp_config cfg = {PORT, MAX_CONNS + 10, 0, registers, G_N_ELEMENTS(registers)};
+    writer w = {0};
+    live_client *live;
+    reactor *r = reactor_new();
+    mbtcp_server *srv;
+    GThread *th;
+    mbtcp_stats st;
+
+    w.pub = live_pub_open(name);
+    if (w.pub == NULL) {return 1;}
+    for (guint i = 0; i < G_N_ELEMENTS(channels); i++) {w.ids[i] = live_pub_add(w.pub, channels[i], NULL);}
+    live = live_client_open(name);
+    srv = mbtcp_start(&cfg, r, live);
+    if (live == NULL || srv == NULL) {
+        printf("Error: cannot start the server on port %d\n", PORT);
+        return 1;
+    }
+    th = g_thread_new("writer", writer_thread, &w);
+    reactor_start(r, -1);
+
+    printf("Modbus TCP on localhost, %.0f s per case, %u CPUs:\n", (double)RUN_NS / NSEC_PER_SEC, g_get_num_processors());
+    for (guint i = 0; i < G_N_ELEMENTS(counts); i++) {run(srv, counts[i]);}
+
+    reactor_stop(r);
+    mbtcp_get_stats(srv, &st);
+    printf("  %llu accepted, %llu rejected, %llu exceptions, %llu bad frames, server worst %.1f us\n",
+           (unsigned long long)st.accepted, (unsigned long long)st.rejected, (unsigned long long)st.exceptions,
+           (unsigned long long)st.bad_frames, (double)st.service_max_ns / NSEC_PER_USEC);
+    mbtcp_stop(srv);
+    reactor_free(r);
+    g_atomic_int_set(&w.stop, 1);
+    g_thread_join(th);
+    live_client_close(live);
+    live_pub_close(w.pub);
+    g_free(name);
+    return 0;
+}
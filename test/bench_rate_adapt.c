@@ -0,0 +1,384 @@
+/**************************************************
+ * Replayed-trace benchmark of adaptive sampling.
+ * A synthetic six hour trace of the theatre is generated:
+ * climate drifting slowly, a temperature and a humidity
+ * excursion past their limits, a slow O2 supply loss and
+ * twenty sudden ones, and a room pressure dip every 20
+ * minutes. It is replayed on a simulated clock through
+ * the real Modbus poll (replay mode), alarm engine,
+ * pressure filter and rate_adapt with main.c's settings,
+ * at the configured fixed periods and adapting them the
+ * way main.c does. Reported are the RS-485 and I2C bus
+ * occupancy, the time spent in the pipeline (the best of
+ * a few replays, fixed and adaptive taking turns, as it is
+ * the only figure that varies), and
+ * for every limit crossing of the clean signal the delay
+ * until the first sample past it (the filtered value for
+ * pressure, which is only looked at once a second).
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "modbus_poll.h"
+#include "modbus_frame.h"
+#include "alarm.h"
+#include "rate_adapt.h"
+#include "dsp.h"
+#include "ads1115.h"
+#include "monotime.h"
+
+#define HOURS 6
+#define TRACE_NS ((gint64)HOURS * 3600 * NSEC_PER_SEC)
+#define GAS_REGS 5
+#define PRESSURE_LOW 2.5
+//the pipeline time is the best of this many replays, the rest is the same every time
+#define REPEATS 5
+
+/************** settings of main.c **********/
+static const alarm_rule rules[] = {
+    {"temperature high", "temperature", ALARM_ABOVE, 28.0, 0.5, 60000, FALSE, 2},
+    {"temperature low", "temperature", ALARM_BELOW, 16.0, 0.5, 60000, FALSE, 2},
+    {"temperature rising fast", "temperature", ALARM_RISING, 2.0, 0.5, 0, FALSE, 1},
+    {"humidity high", "humidity", ALARM_ABOVE, 70.0, 2.0, 60000, FALSE, 1},
+    {"humidity low", "humidity", ALARM_BELOW, 30.0, 2.0, 60000, FALSE, 1},
+    {"room pressure low", "pressure", ALARM_BELOW, PRESSURE_LOW, 1.0, 30000, TRUE, 3},
+    {"O2 supply low", "o2", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 3},
+    {"O2 supply high", "o2", ALARM_ABOVE, 480.0, 10.0, 5000, TRUE, 3},
+    {"N2O supply low", "n2o", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 3},
+    {"CO2 supply low", "co2", ALARM_BELOW, 320.0, 10.0, 5000, TRUE, 2},
+    {"vacuum weak", "vacuum", ALARM_ABOVE, -40.0, 5.0, 5000, TRUE, 3},
+    {"AGSS flow low", "agss", ALARM_BELOW, 1.0, 0.2, 10000, TRUE, 2},
+};
+static const gchar *gas_signals[GAS_REGS] = {"o2", "n2o", "co2", "vacuum", "agss"};
+static const mb_block climate_blocks[] = {{0x04, 0x0000, 2, 1000}};
+static const mb_block gas_blocks[] = {{0x04, 0x0000, GAS_REGS, 1000}};
+static const mb_device devices[] = {
+    {"climate", 1, climate_blocks, G_N_ELEMENTS(climate_blocks)},
+    {"gas", 2, gas_blocks, G_N_ELEMENTS(gas_blocks)},
+};
+static const mb_poll_config bus = {
+    "/dev/null", 9600, 'N', 8, 1,
+    500, 100, 10000,
+    devices, G_N_ELEMENTS(devices), 50
+};
+static const rate_adapt_config temp_rate = {100, 3000, 0.05, 0.05, 0.5};
+static const rate_adapt_config humid_rate = {250, 3000, 0.2, 0.2, 1.0};
+static const rate_adapt_config gas_rate = {200, 1000, 2.0, 5.0, 10.0};
+static const rate_adapt_config pressure_rate = {4, 32, 0.05, 2.0, 2.0};
+static const dsp_config pressure_filter = {
+    8, 5, DSP_LOWPASS_BIQUAD, 128.0, 0.5,
+    {{4000, -50.0}, {28000, 50.0}}, 2
+};
+
+/************** the trace **********/
+static guint32 rng;
+
+//uniform in -0.5..0.5, the same sequence on both runs
+static gdouble noise(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng / 4294967296.0 - 0.5;
+}
+
+//0 before t0, up to h over up seconds, held, back to 0 over down seconds
+static gdouble ramp(gdouble t, gdouble t0, gdouble up, gdouble hold, gdouble down, gdouble h)
+{
+    if (t < t0) {return 0;}
+    t -= t0;
+    if (t < up) {return h * t / up;}
+    t -= up;
+    if (t < hold) {return h;}
+    t -= hold;
+    if (t < down) {return h * (1 - t / down);}
+    return 0;
+}
+
+static gdouble temp_clean(gdouble t) {return 22 + 0.3 * sin(t / 3600 * G_PI) + ramp(t, 7200, 150, 300, 300, 7.0);}
+static gdouble humid_clean(gdouble t) {return 50 + 2 * sin(t / 5400 * G_PI) + ramp(t, 10800, 110, 300, 300, 22.0);}
+
+//a slow supply loss, then twenty sudden ones (a regulator failing, 1 s to empty)
+//at odd phases to the polls
+static gdouble o2_clean(gdouble t)
+{
+    gdouble v = 400 + ramp(t, 14400, 20, 60, 30, -100);
+
+    for (guint k = 0; k < 20; k++) {v += ramp(t, 18000 + 150 * k + 0.37 * k, 1, 60, 30, -100);}
+    return v;
+}
+
+//the door opens every 20 minutes from the tenth
+static gdouble pressure_clean(gdouble t)
+{
+    return t > 300 ? 8 + ramp(fmod(t, 1200), 600, 3.5, 10, 3.5, -7.0) : 8;
+}
+
+/************** detection delay **********/
+typedef struct {
+    const gchar *name;
+    gdouble (*clean)(gdouble t);
+    gdouble limit;
+    gboolean below;
+    gdouble from, to;       //part of the trace this watch covers, s
+    gboolean past;          //the last sample was past the limit
+    gdouble worst;
+    guint crossings;
+} watch;
+
+static gboolean is_past(const watch *w, gdouble v) {return w->below ? v < w->limit : v > w->limit;}
+
+//a sample was taken at t; on the first one past the limit, step back to the crossing
+static void watch_sample(watch *w, gdouble t)
+{
+    gboolean past = is_past(w, w->clean(t));
+    gdouble c = t;
+
+    if (t < w->from || t >= w->to) {return;}
+    if (past && !w->past) {
+        while (is_past(w, w->clean(c - 0.001))) {c -= 0.001;}
+        w->worst = MAX(w->worst, t - c);
+        w->crossings++;
+    }
+    w->past = past;
+}
+
+enum {W_TEMP, W_HUMID, W_O2_RAMP, W_O2_STEP, WATCHES};
+
+static const watch watches[WATCHES] = {
+    {"temperature", temp_clean, 28.0, FALSE, 0, HOURS * 3600},
+    {"humidity", humid_clean, 70.0, FALSE, 0, HOURS * 3600},
+    {"O2 ramp", o2_clean, 320.0, TRUE, 0, 18000},
+    {"O2 steps", o2_clean, 320.0, TRUE, 18000, HOURS * 3600},
+};
+
+/************** replay **********/
+typedef struct {
+    gboolean adaptive;
+    gboolean print_rates;
+    alarm_engine *eng;
+    gint sig_temp, sig_humid, sig_pressure, sig_gas[GAS_REGS];
+    rate_adapt *temp, *humid, *gas[GAS_REGS], *pressure;
+    mb_poll *poll;
+    gint64 climate_period, gas_period;
+    watch w[WATCHES];
+    //results
+    guint64 polls, conversions;
+    gdouble rs485_s, i2c_s;
+    gint64 pipeline_ns;
+    gdouble pressure_worst;
+    guint pressure_crossings;
+} run;
+
+static gint64 adapt(run *r, rate_adapt *ra, gint signal, gdouble value, gint64 ts_ns)
+{
+    gint direction;
+    gdouble margin = alarm_engine_signal_margin(r->eng, signal, value, &direction);
+
+    return rate_adapt_update(ra, value, margin, direction, ts_ns);
+}
+
+static void on_sample(const mb_sample *s, gpointer user_data)
+{
+    run *r = user_data;
+    gdouble ts = (gdouble)s->ts_ns / NSEC_PER_SEC;
+    gint64 period = G_MAXINT64;
+
+    if (s->device == 1) {
+        watch_sample(&r->w[W_O2_RAMP], ts);
+        watch_sample(&r->w[W_O2_STEP], ts);
+        for (guint i = 0; i < s->count; i++) {
+            alarm_engine_update(r->eng, r->sig_gas[i], (gint16)s->regs[i], s->ts_ns);
+            if (r->adaptive) {
+                gint64 p = adapt(r, r->gas[i], r->sig_gas[i], (gint16)s->regs[i], s->ts_ns);
+                period = MIN(period, p);
+            }
+        }
+        if (r->adaptive) {r->gas_period = (gint64)mb_poll_set_period(r->poll, 1, 0, period / NSEC_PER_MSEC) * NSEC_PER_MSEC;}
+        return;
+    }
+    watch_sample(&r->w[W_TEMP], ts);
+    watch_sample(&r->w[W_HUMID], ts);
+    alarm_engine_update(r->eng, r->sig_temp, s->regs[0] / 100.0, s->ts_ns);
+    alarm_engine_update(r->eng, r->sig_humid, s->regs[1] / 100.0, s->ts_ns);
+    if (r->adaptive) {
+        gint64 p = adapt(r, r->humid, r->sig_humid, s->regs[1] / 100.0, s->ts_ns);
+
+        period = adapt(r, r->temp, r->sig_temp, s->regs[0] / 100.0, s->ts_ns);
+        period = MIN(period, p);
+        r->climate_period = (gint64)mb_poll_set_period(r->poll, 0, 0, period / NSEC_PER_MSEC) * NSEC_PER_MSEC;
+    }
+}
+
+//one transaction at 9600 baud, 10 bits a character: request, response,
+//a 3.5 character gap after each and 5 ms for the sensor to answer
+static gdouble rtu_seconds(guint regs)
+{
+    return (8 + 5 + 2 * regs + 2 * 3.5) * 10 / 9600.0 + 0.005;
+}
+
+//replay one poll of a device through mb_poll_replay()
+static void poll_device(run *r, guint8 unit, const guint16 *regs, guint16 count, gint64 t)
+{
+    uint8_t req[MB_RTU_MAX_ADU], rsp[MB_RTU_MAX_ADU];
+    size_t req_len = mb_frame_read_request(req, sizeof(req), unit, MB_FC_READ_INPUT, 0, count);
+    size_t rsp_len = mb_frame_read_response(rsp, sizeof(rsp), unit, MB_FC_READ_INPUT, regs, count);
+    gint64 start = mono_ns();
+
+    mb_poll_replay(r->poll, req, req_len, rsp, rsp_len, t);
+    r->pipeline_ns += mono_ns() - start;
+    r->polls++;
+    r->rs485_s += rtu_seconds(count);
+}
+
+//set_adc_rate() of main.c: the slowest data rate that samples every period and
+//that the filter can follow
+static guint8 adc_rate(dsp_filter *dsp, gint64 period, guint8 current)
+{
+    guint8 rate = ADS1115_DR_860;
+
+    for (guint8 dr = ADS1115_DR_8; dr < ADS1115_DR_860; dr++) {
+        if (NSEC_PER_SEC / ads1115_rate_sps(dr) <= period) {rate = dr; break;}
+    }
+    if (rate == current) {return current;}
+    while (dsp_filter_set_rate(dsp, ads1115_rate_sps(rate)) != 0) {
+        if (rate == ADS1115_DR_860) {return current;}
+        rate++;
+    }
+    return rate;
+}
+
+static void replay(run *r)
+{
+    gint64 next_climate = 0, next_gas = 0, next_adc = 0, next_tick = NSEC_PER_SEC;
+    dsp_filter *dsp = dsp_filter_new(&pressure_filter);
+    gint16 raw[1024];
+    gfloat out[G_N_ELEMENTS(raw)];
+    guint n_raw = 0;
+    guint8 dr = ADS1115_DR_128;
+    gdouble p_cross = -1;
+    gboolean p_past = FALSE;
+
+    rng = 2463534242u;
+    memcpy(r->w, watches, sizeof(r->w));
+    r->eng = alarm_engine_new(10000);
+    alarm_engine_add_rules(r->eng, rules, G_N_ELEMENTS(rules));
+    alarm_engine_compile(r->eng);
+    r->sig_temp = alarm_engine_find_signal(r->eng, "temperature");
+    r->sig_humid = alarm_engine_find_signal(r->eng, "humidity");
+    r->sig_pressure = alarm_engine_find_signal(r->eng, "pressure");
+    r->temp = rate_adapt_new(&temp_rate);
+    r->humid = rate_adapt_new(&humid_rate);
+    r->pressure = rate_adapt_new(&pressure_rate);
+    for (guint i = 0; i < GAS_REGS; i++) {
+        r->sig_gas[i] = alarm_engine_find_signal(r->eng, gas_signals[i]);
+        r->gas[i] = rate_adapt_new(&gas_rate);
+    }
+    r->poll = mb_poll_start_replay(&bus, on_sample, r);
+    r->climate_period = r->gas_period = NSEC_PER_SEC;
+
+    for (;;) {
+        gint64 t = MIN(MIN(next_climate, next_gas), MIN(next_adc, next_tick));
+        gdouble ts = (gdouble)t / NSEC_PER_SEC;
+        guint16 regs[GAS_REGS];
+
+        if (t >= TRACE_NS) {break;}
+        if (t == next_climate) {
+            regs[0] = (guint16)lround((temp_clean(ts) + 0.02 * noise()) * 100);
+            regs[1] = (guint16)lround((humid_clean(ts) + 0.3 * noise()) * 100);
+            poll_device(r, 1, regs, 2, t);
+            next_climate = t + r->climate_period;
+        }
+        else if (t == next_gas) {
+            regs[0] = (guint16)(gint16)lround(o2_clean(ts) + noise());
+            regs[1] = (guint16)(gint16)lround(400 + noise());
+            regs[2] = (guint16)(gint16)lround(400 + noise());
+            regs[3] = (guint16)(gint16)lround(-90 + noise());
+            regs[4] = (guint16)(gint16)lround(50 + noise());
+            poll_device(r, 2, regs, GAS_REGS, t);
+            next_gas = t + r->gas_period;
+        }
+        else if (t == next_adc) {
+            gdouble p = pressure_clean(ts);
+
+            if (n_raw < G_N_ELEMENTS(raw)) {raw[n_raw++] = (gint16)lround(4000 + (p + 0.05 * noise() + 50) * 240);}
+            //step back to where the clean signal crossed, as for the other watches
+            if (p < PRESSURE_LOW && !p_past) {
+                for (p_cross = ts; pressure_clean(p_cross - 0.001) < PRESSURE_LOW; p_cross -= 0.001) {}
+            }
+            p_past = p < PRESSURE_LOW;
+            r->conversions++;
+            //two byte read with address and acks at 100 kHz
+            r->i2c_s += 27 / 100e3;
+            next_adc = t + NSEC_PER_SEC / ads1115_rate_sps(dr);
+        }
+        else {
+            //the 1 Hz display tick filters what was converted and sets the data rate
+            gint64 start = mono_ns();
+            guint m = dsp_filter_run(dsp, raw, n_raw, out, NULL);
+
+            n_raw = 0;
+            if (m > 0) {
+                alarm_engine_update(r->eng, r->sig_pressure, out[m - 1], t);
+                if (p_cross >= 0 && out[m - 1] < PRESSURE_LOW) {
+                    r->pressure_worst = MAX(r->pressure_worst, ts - p_cross);
+                    r->pressure_crossings++;
+                    p_cross = -1;
+                }
+                if (r->adaptive) {dr = adc_rate(dsp, adapt(r, r->pressure, r->sig_pressure, out[m - 1], t), dr);}
+            }
+            r->pipeline_ns += mono_ns() - start;
+            next_tick = t + NSEC_PER_SEC;
+        }
+    }
+
+    if (r->adaptive && r->print_rates) {
+        rate_adapt_print_stats(r->temp, "temperature");
+        rate_adapt_print_stats(r->humid, "humidity");
+        rate_adapt_print_stats(r->gas[0], "o2");
+        rate_adapt_print_stats(r->pressure, "pressure");
+    }
+    mb_poll_stop(r->poll);
+    alarm_engine_free(r->eng);
+    rate_adapt_free(r->temp);
+    rate_adapt_free(r->humid);
+    rate_adapt_free(r->pressure);
+    for (guint i = 0; i < GAS_REGS; i++) {rate_adapt_free(r->gas[i]);}
+    dsp_filter_free(dsp);
+}
+
+int main(int argc, char *argv[])
+{
+    static run runs[2], again;
+    const gdouble trace_s = (gdouble)TRACE_NS / NSEC_PER_SEC;
+
+    runs[1].adaptive = TRUE;
+    runs[1].print_rates = TRUE;
+    for (guint i = 0; i < 2; i++) {replay(&runs[i]);}
+    //alternate the two, so a busy spell of the machine hits both alike
+    for (guint k = 1; k < REPEATS; k++) {
+        for (guint i = 0; i < 2; i++) {
+            memset(&again, 0, sizeof(again));
+            again.adaptive = runs[i].adaptive;
+            replay(&again);
+            runs[i].pipeline_ns = MIN(runs[i].pipeline_ns, again.pipeline_ns);
+        }
+    }
+    printf("%d h trace                   fixed   adaptive\n", HOURS);
+    printf("RS-485 polls            %9llu  %9llu\n", (unsigned long long)runs[0].polls, (unsigned long long)runs[1].polls);
+    printf("RS-485 busy             %8.2f%%  %8.2f%%\n", 100 * runs[0].rs485_s / trace_s, 100 * runs[1].rs485_s / trace_s);
+    printf("ADC conversions         %9llu  %9llu\n", (unsigned long long)runs[0].conversions,
+           (unsigned long long)runs[1].conversions);
+    printf("I2C busy                %8.2f%%  %8.2f%%\n", 100 * runs[0].i2c_s / trace_s, 100 * runs[1].i2c_s / trace_s);
+    printf("pipeline, best of %d     %8.3fs  %8.3fs\n", REPEATS, (double)runs[0].pipeline_ns / NSEC_PER_SEC,
+           (double)runs[1].pipeline_ns / NSEC_PER_SEC);
+    printf("worst detection delay:\n");
+    for (guint w = 0; w < WATCHES; w++) {
+        printf("  %-11s (%2u crossings) %7.3fs  %8.3fs\n", runs[0].w[w].name, runs[0].w[w].crossings,
+               runs[0].w[w].worst, runs[1].w[w].worst);
+    }
+    printf("  %-11s (%2u crossings) %7.3fs  %8.3fs\n", "pressure", runs[0].pressure_crossings,
+           runs[0].pressure_worst, runs[1].pressure_worst);
+    return 0;
+}
@@ -0,0 +1,341 @@
+/**************************************************
+ * Benchmark of the acquisition reactor against the thread
+ * per device model it replaced, on the same stand-ins:
+ * the fake ADS1115 at main.c's 128 samples/s, one
+ * simulated dry contact that never changes and a Modbus
+ * slave on a pseudo terminal that answers after the wire
+ * time of a 9600 baud transaction.
+ * Threads: the loops of the original main.c. The ADC
+ * thread starts a conversion and reads the status
+ * register until it is done, each read a 300 us i2c
+ * transfer; the contact thread reads the level every
+ * 500 ms; the Modbus thread sends the next request as
+ * soon as the last answer is in. Reactor: ads1115,
+ * gpio_input and modbus_poll with main.c's 1 s poll, all
+ * on one reactor thread.
+ * Reported are the CPU and the wakeups (context switches)
+ * per second of the acquisition threads, the slave stand-in
+ * and the idle main thread left out, and the samples and
+ * polls they got for it.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "reactor.h"
+#include "ads1115.h"
+#include "gpio_input.h"
+#include "modbus_poll.h"
+#include "modbus_frame.h"
+#include "sample_ring.h"
+#include "monotime.h"
+
+#define RUN_NS (5 * NSEC_PER_SEC)
+#define ADC_SPS 128
+#define I2C_READ_US 300
+#define CONTACT_MS 500
+//8 byte request and 9 byte answer at 10 bits per byte and 9600 baud
+#define WIRE_US (17 * 10 * 1000000 / 9600)
+
+static const mb_block climate_blocks[] = {{MB_FC_READ_INPUT, 0x0000, 2, 1000}};
+static const mb_device sensor_devices[] = {{"climate", 1, climate_blocks, G_N_ELEMENTS(climate_blocks)}};
+
+//the master side of the pty, answering for slave 1
+typedef struct {
+    gchar link[64];
+    int master;
+    int keep;
+    GThread *thread;
+    pthread_t self;
+    volatile gint tid;
+    volatile gint quit;
+} slave_sim;
+
+static gpointer slave_thread(gpointer data)
+{
+    slave_sim *sim = data;
+    uint8_t buf[64], rsp[MB_RTU_MAX_ADU];
+    const guint16 regs[2] = {2150, 4500};
+    size_t len = 0;
+
+    sim->self = pthread_self();
+    g_atomic_int_set(&sim->tid, syscall(SYS_gettid));
+    while (!g_atomic_int_get(&sim->quit)) {
+        struct pollfd pfd = {sim->master, POLLIN, 0};
+        mb_frame req;
+        ssize_t n;
+
+        if (poll(&pfd, 1, 100) <= 0 || !(pfd.revents & POLLIN)) {continue;}
+        n = read(sim->master, buf + len, sizeof(buf) - len);
+        if (n <= 0) {continue;}
+        len += n;
+        while (len >= 8) {
+            if (mb_frame_parse_request(buf, 8, &req) == MB_FRAME_OK && req.slave == 1) {
+                size_t r = mb_frame_read_response(rsp, sizeof(rsp), 1, req.function, regs, MIN(req.count, 2));
+                g_usleep(WIRE_US);
+                if (write(sim->master, rsp, r) != (ssize_t)r) {printf("Error: slave write: %s\n", strerror(errno));}
+            }
+            len -= 8;
+            memmove(buf, buf + 8, len);
+        }
+    }
+    return NULL;
+}
+
+static void slave_open(slave_sim *sim)
+{
+    struct termios tio;
+
+    memset(sim, 0, sizeof(*sim));
+    g_snprintf(sim->link, sizeof(sim->link), "/tmp/bench_reactor.%d", (int)getpid());
+    sim->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    grantpt(sim->master);
+    unlockpt(sim->master);
+    sim->keep = open(ptsname(sim->master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    tcgetattr(sim->keep, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(sim->keep, TCSANOW, &tio);
+    unlink(sim->link);
+    if (symlink(ptsname(sim->master), sim->link) != 0) {printf("Error: no pty link %s\n", sim->link);}
+    sim->thread = g_thread_new("slave", slave_thread, sim);
+    while (g_atomic_int_get(&sim->tid) == 0) {g_usleep(1000);}
+}
+
+static void slave_close(slave_sim *sim)
+{
+    g_atomic_int_set(&sim->quit, 1);
+    g_thread_join(sim->thread);
+    close(sim->keep);
+    close(sim->master);
+    unlink(sim->link);
+}
+
+//context switches of every thread of the process but two
+static guint64 wakeups(int skip1, int skip2)
+{
+    DIR *d = opendir("/proc/self/task");
+    struct dirent *ent;
+    guint64 total = 0;
+
+    while ((ent = readdir(d)) != NULL) {
+        gchar path[64], line[128];
+        int tid = atoi(ent->d_name);
+        unsigned long long n;
+        FILE *f;
+
+        if (tid <= 0 || tid == skip1 || tid == skip2) {continue;}
+        g_snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+        if ((f = fopen(path, "r")) == NULL) {continue;}
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &n) == 1) {total += n;}
+            else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &n) == 1) {total += n;}
+        }
+        fclose(f);
+    }
+    closedir(d);
+    return total;
+}
+
+static gint64 clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (gint64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+typedef struct {
+    guint64 wakeups;
+    gint64 cpu_ns;
+    gint64 slave_cpu_ns;
+    gint64 main_cpu_ns;
+} usage;
+
+static void usage_take(usage *u, slave_sim *sim)
+{
+    clockid_t slave_clock;
+
+    pthread_getcpuclockid(sim->self, &slave_clock);
+    u->wakeups = wakeups(getpid(), g_atomic_int_get(&sim->tid));
+    u->cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    u->slave_cpu_ns = clock_ns(slave_clock);
+    u->main_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void report(const gchar *what, const usage *a, const usage *b, gint64 ns, guint64 samples, guint64 polls)
+{
+    gint64 cpu = (b->cpu_ns - a->cpu_ns) - (b->slave_cpu_ns - a->slave_cpu_ns) - (b->main_cpu_ns - a->main_cpu_ns);
+
+    printf("  %-8s %6.2f%% CPU  %7.0f wakeups/s  %6.1f samples/s  %5.1f polls/s\n", what, 100.0 * cpu / ns,
+           (double)(b->wakeups - a->wakeups) * NSEC_PER_SEC / ns, (double)samples * NSEC_PER_SEC / ns,
+           (double)polls * NSEC_PER_SEC / ns);
+}
+
+/**********************************************
+ * the thread per device model
+ * ********************************************/
+typedef struct {
+    slave_sim *sim;
+    volatile gint stop;
+    volatile gint samples;
+    volatile gint polls;
+    volatile gint level;
+} threads;
+
+static gpointer adc_thread(gpointer data)
+{
+    threads *t = data;
+
+    while (!g_atomic_int_get(&t->stop)) {
+        gint64 done = mono_ns() + NSEC_PER_SEC / ADC_SPS;
+
+        //write the config register, then read it until the OS bit says done
+        g_usleep(I2C_READ_US);
+        do {g_usleep(I2C_READ_US);} while (mono_ns() < done);
+        //select and read the conversion register
+        g_usleep(I2C_READ_US);
+        g_usleep(I2C_READ_US);
+        g_atomic_int_inc(&t->samples);
+    }
+    return NULL;
+}
+
+static gpointer contact_thread(gpointer data)
+{
+    threads *t = data;
+
+    while (!g_atomic_int_get(&t->stop)) {
+        g_atomic_int_set(&t->level, 1);
+        g_usleep(CONTACT_MS * 1000);
+    }
+    return NULL;
+}
+
+static gpointer modbus_thread(gpointer data)
+{
+    threads *t = data;
+    uint8_t req[8], rsp[MB_RTU_MAX_ADU];
+    size_t req_len = mb_frame_read_request(req, sizeof(req), 1, MB_FC_READ_INPUT, 0, 2);
+    int fd = open(t->sim->link, O_RDWR | O_NOCTTY);
+    struct termios tio;
+
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    while (!g_atomic_int_get(&t->stop)) {
+        size_t len = 0;
+        mb_frame f;
+
+        if (write(fd, req, req_len) != (ssize_t)req_len) {break;}
+        //modbus_receive_confirmation(): select() with the 500 ms response timeout
+        while (len < 9) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            ssize_t n;
+
+            if (poll(&pfd, 1, 500) <= 0) {break;}
+            if ((n = read(fd, rsp + len, sizeof(rsp) - len)) <= 0) {break;}
+            len += n;
+        }
+        if (mb_frame_parse_response(rsp, len, MB_FC_READ_INPUT, &f) == MB_FRAME_OK) {g_atomic_int_inc(&t->polls);}
+    }
+    close(fd);
+    return NULL;
+}
+
+static void bench_threads(void)
+{
+    slave_sim sim;
+    threads t = {0};
+    GThread *th[3];
+    usage a, b;
+    gint64 start, ns;
+    guint samples, polls;
+
+    slave_open(&sim);
+    t.sim = &sim;
+    th[0] = g_thread_new("adc", adc_thread, &t);
+    th[1] = g_thread_new("contact", contact_thread, &t);
+    th[2] = g_thread_new("modbus", modbus_thread, &t);
+    g_usleep(200000);
+    samples = g_atomic_int_get(&t.samples);
+    polls = g_atomic_int_get(&t.polls);
+    usage_take(&a, &sim);
+    start = mono_ns();
+    g_usleep(RUN_NS / NSEC_PER_USEC);
+    usage_take(&b, &sim);
+    ns = mono_ns() - start;
+    samples = g_atomic_int_get(&t.samples) - samples;
+    polls = g_atomic_int_get(&t.polls) - polls;
+    g_atomic_int_set(&t.stop, 1);
+    for (guint i = 0; i < G_N_ELEMENTS(th); i++) {g_thread_join(th[i]);}
+    report("threads", &a, &b, ns, samples, polls);
+    slave_close(&sim);
+}
+
+/**********************************************
+ * the reactor
+ * ********************************************/
+static void on_contact(guint line, gint level, gint64 ts_ns, gpointer user_data) {}
+
+static void on_sample(const mb_sample *sample, gpointer user_data) {}
+
+static void bench_reactor(void)
+{
+    const ads1115_config adc_config = {{ADS1115_MUX_AIN0}, 1, ADS1115_DR_128};
+    mb_poll_config bus = {NULL, 9600, 'N', 8, 1, 500, 100, 10000,
+                          sensor_devices, G_N_ELEMENTS(sensor_devices), 50};
+    slave_sim sim;
+    reactor *r = reactor_new();
+    ads1115 *adc = ads1115_open_fake();
+    sample_ring *ring = sample_ring_new(4096);
+    gpio_input *contact = gpio_input_open_sim(1, 20000);
+    mb_poll *poll;
+    ads1115_stats as0, as1;
+    mb_poll_stats ps0, ps1;
+    usage a, b;
+    gint64 start, ns;
+
+    slave_open(&sim);
+    bus.device = sim.link;
+    ads1115_start(adc, &adc_config, r, ring);
+    gpio_input_start(contact, r, on_contact, NULL);
+    poll = mb_poll_start(&bus, r, on_sample, NULL);
+    reactor_start(r, -1);
+    g_usleep(200000);
+    ads1115_get_stats(adc, &as0);
+    mb_poll_get_stats(poll, &ps0);
+    usage_take(&a, &sim);
+    start = mono_ns();
+    //the ring is left to fill and drop, the consumer is not part of acquisition
+    g_usleep(RUN_NS / NSEC_PER_USEC);
+    usage_take(&b, &sim);
+    ns = mono_ns() - start;
+    ads1115_get_stats(adc, &as1);
+    mb_poll_get_stats(poll, &ps1);
+    reactor_stop(r);
+    report("reactor", &a, &b, ns, as1.samples - as0.samples, ps1.good - ps0.good);
+    mb_poll_stop(poll);
+    gpio_input_free(contact);
+    ads1115_free(adc);
+    sample_ring_free(ring);
+    reactor_free(r);
+    slave_close(&sim);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Acquisition for %lld s, ADC at %d samples/s, Modbus slave with %d us wire time:\n",
+           (long long)(RUN_NS / NSEC_PER_SEC), ADC_SPS, WIRE_US);
+    bench_threads();
+    bench_reactor();
+    return 0;
+}
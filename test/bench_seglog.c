@@ -0,0 +1,218 @@
+/**************************************************
+ * Benchmark of the append-only sensor log in a scratch
+ * directory under /tmp. Burst: records are appended as
+ * fast as one producer can with main.c's size budget, so
+ * the writer falls behind and the records it could keep
+ * per second are its sustained rate; trickle: 1000
+ * records/s flushed every 100 ms, where the partly filled
+ * block is rewritten on every flush. Both report the write
+ * amplification (bytes written to the file per payload
+ * byte) once the writer has flushed. Power cut: a child
+ * process logs until it is killed, the records of the
+ * last block it wrote are torn in half the way an
+ * interrupted sector write leaves them, and the log is
+ * opened again; reported are the recovery time and what
+ * survived, every surviving block has to pass its CRC and
+ * the records have to read back in order.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "seglog.h"
+#include "monotime.h"
+
+#define BURST_RECORDS 2000000
+
+static gchar dir[] = "/tmp/bench_seglog.XXXXXX";
+
+static void clear_dir(void)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+
+    if (d == NULL) {return;}
+    while ((ent = readdir(d)) != NULL) {
+        gchar *path;
+        if (ent->d_name[0] == '.') {continue;}
+        path = g_build_filename(dir, ent->d_name, NULL);
+        unlink(path);
+        g_free(path);
+    }
+    closedir(d);
+}
+
+static void report(const gchar *what, seglog *log, gint64 ns)
+{
+    seglog_stats st;
+
+    seglog_get_stats(log, &st);
+    printf("  %-8s %8llu kept  %8llu dropped  %9.0f records/s kept  %4llu flushes  write amplification %.2f\n", what,
+           (unsigned long long)st.records, (unsigned long long)st.dropped, (double)st.records * NSEC_PER_SEC / ns,
+           (unsigned long long)st.flushes, (double)st.written_bytes / MAX(st.payload_bytes, 1));
+}
+
+//append n records, at rate per second if rate > 0, then give the writer one
+//time budget to flush the rest; returns the time the appends took
+static gint64 run(seglog *log, const seglog_config *cfg, guint n, guint rate)
+{
+    gint64 start = mono_ns(), ns;
+
+    for (guint i = 0; i < n; i++) {
+        if (rate > 0) {sleep_until_ns(start + (gint64)i * NSEC_PER_SEC / rate);}
+        seglog_append(log, i & 3, start + i, i * 0.5f);
+    }
+    ns = mono_ns() - start;
+    g_usleep(cfg->flush_ms * 1000 + 100000);
+    return ns;
+}
+
+//the highest segment file and the last slot in it that holds a block
+static gchar *last_segment(guint *slot)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    gchar *path = NULL;
+    unsigned id, highest = 0;
+    seglog_block blk;
+    int fd;
+
+    while ((ent = readdir(d)) != NULL) {
+        if (sscanf(ent->d_name, "seg-%08u.log", &id) == 1 && (path == NULL || id > highest)) {
+            g_free(path);
+            path = g_build_filename(dir, ent->d_name, NULL);
+            highest = id;
+        }
+    }
+    closedir(d);
+    fd = open(path, O_RDONLY);
+    *slot = 0;
+    for (guint n = 0; n < SEGLOG_SEGMENT_BLOCKS; n++) {
+        if (pread(fd, &blk, sizeof(blk), (off_t)SEGLOG_BLOCK_SIZE * (1 + n)) != sizeof(blk)) {break;}
+        if (blk.n_records == 0 || blk.block_seq != n) {break;}
+        *slot = n;
+    }
+    close(fd);
+    return path;
+}
+
+static void bench_power_cut(void)
+{
+    seglog_config cfg = {dir, 50, 16, 64};
+    seglog_block blk;
+    guint8 junk[SEGLOG_BLOCK_SIZE];
+    seglog_stats st;
+    seglog *log;
+    gchar *path;
+    guint slot, blocks = 0, bad = 0, torn, segments = 0;
+    guint64 records = 0, gaps = 0, out_of_order = 0;
+    gint64 last = -1;
+    off_t tear;
+    pid_t child;
+    int fd;
+
+    clear_dir();
+    child = fork();
+    if (child == 0) {
+        log = seglog_open(&cfg);
+        for (gint64 i = 0;; i++) {
+            seglog_append(log, 0, i, 0);
+            if (i % 100 == 0) {g_usleep(200);}
+        }
+    }
+    g_usleep(700000);
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    //the second half of the records in the last block never reached the card
+    path = last_segment(&slot);
+    fd = open(path, O_RDWR);
+    if (pread(fd, &blk, sizeof(blk), (off_t)SEGLOG_BLOCK_SIZE * (1 + slot)) != sizeof(blk)) {blk.n_records = 0;}
+    torn = blk.n_records;
+    tear = G_STRUCT_OFFSET(seglog_block, records) + torn / 2 * sizeof(seglog_record);
+    memset(junk, 0xFF, sizeof(junk));
+    if (pwrite(fd, junk, SEGLOG_BLOCK_SIZE - tear, (off_t)SEGLOG_BLOCK_SIZE * (1 + slot) + tear) < 0) {torn = 0;}
+    close(fd);
+    g_free(path);
+
+    log = seglog_open(&cfg);
+    seglog_get_stats(log, &st);
+    seglog_close(log);
+
+    //everything left must read back in order through the CRC checked mapping
+    for (guint id = 0; id < 64; id++) {
+        gchar name[32];
+        seglog_map *map;
+
+        g_snprintf(name, sizeof(name), "seg-%08u.log", id);
+        path = g_build_filename(dir, name, NULL);
+        if (access(path, F_OK) != 0) {
+            g_free(path);
+            continue;
+        }
+        segments++;
+        map = seglog_map_open(path);
+        g_free(path);
+        if (map == NULL) {
+            bad++;
+            continue;
+        }
+        for (guint b = 0; b < map->header->n_blocks; b++) {
+            guint n;
+            const seglog_record *rec = seglog_map_block(map, b, &n);
+            if (rec == NULL) {
+                bad++;
+                continue;
+            }
+            blocks++;
+            records += n;
+            //the child numbers its records, gaps are records it dropped itself
+            for (guint i = 0; i < n; i++) {
+                if (rec[i].ts_ns <= last) {out_of_order++;}
+                else if (rec[i].ts_ns != last + 1) {gaps++;}
+                last = rec[i].ts_ns;
+            }
+        }
+        seglog_map_close(map);
+    }
+    printf("Power cut after 0.7 s, block %u of the last segment torn (%u records):\n", slot, torn);
+    printf("  recovered %u blocks of the open segment in %.3f ms\n", st.recovered_blocks,
+           (double)st.recovery_ns / NSEC_PER_MSEC);
+    printf("  %u segments, %u blocks, %llu records read back, %u failed blocks or segments, %llu out of order, %llu gaps\n",
+           segments, blocks, (unsigned long long)records, bad, (unsigned long long)out_of_order, (unsigned long long)gaps);
+}
+
+int main(int argc, char *argv[])
+{
+    //main.c's size budget; its 10 s time budget only matters at the trickle
+    seglog_config burst_cfg = {dir, 1000, 16, 64};
+    seglog_config trickle_cfg = {dir, 100, 16, 64};
+    seglog *log;
+    gint64 ns;
+
+    if (mkdtemp(dir) == NULL) {
+        printf("Error: no scratch directory\n");
+        return 1;
+    }
+    printf("Sustained logging:\n");
+    clear_dir();
+    log = seglog_open(&burst_cfg);
+    ns = run(log, &burst_cfg, BURST_RECORDS, 0);
+    report("burst", log, ns);
+    seglog_close(log);
+    clear_dir();
+    log = seglog_open(&trickle_cfg);
+    ns = run(log, &trickle_cfg, 3000, 1000);
+    report("trickle", log, ns);
+    seglog_close(log);
+    bench_power_cut();
+    clear_dir();
+    rmdir(dir);
+    return 0;
+}
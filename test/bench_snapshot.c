@@ -0,0 +1,218 @@
+/**************************************************
+ * Contention benchmark of the snapshot cell and the
+ * sample ring against the same hand-over done under a
+ * GMutex. A writer publishes as fast as it can while
+ * readers copy the latest value in a loop, for one second
+ * per case; the ring producer pushes while the consumer
+ * drains batches. Reports the throughput of both sides and
+ * the worst write seen, which for the lock-free versions
+ * must not grow with the number of readers.
+ * ************************************************/
+#include <stdio.h>
+
+#include "snapshot.h"
+#include "sample_ring.h"
+#include "monotime.h"
+
+#define RUN_NS NSEC_PER_SEC
+#define MAX_READERS 4
+
+//the GMutex versions, what the snapshot cell and the ring replace
+typedef struct {
+    GMutex lock;
+    guint32 version;
+    guint8 data[SNAPSHOT_MAX_SIZE];
+} mutex_cell;
+
+typedef struct {
+    GMutex lock;
+    adc_sample *buf;
+    guint mask;
+    guint head;
+    guint tail;
+    guint64 dropped;
+} mutex_ring;
+
+typedef struct {
+    gboolean locked;
+    snapshot_cell cell;
+    mutex_cell mcell;
+    gint done;
+    guint64 reads[MAX_READERS];
+} cell_bench;
+
+typedef struct {
+    cell_bench *b;
+    guint id;
+} cell_reader;
+
+static gpointer cell_read_loop(gpointer data)
+{
+    cell_reader *rd = data;
+    cell_bench *b = rd->b;
+    climate_reading r;
+    guint64 n = 0;
+
+    while (!g_atomic_int_get(&b->done)) {
+        if (b->locked) {
+            g_mutex_lock(&b->mcell.lock);
+            memcpy(&r, b->mcell.data, sizeof(r));
+            g_mutex_unlock(&b->mcell.lock);
+        }
+        else {
+            climate_get(&b->cell, &r);
+        }
+        n++;
+    }
+    b->reads[rd->id] = n;
+    return NULL;
+}
+
+static void bench_cell(gboolean locked, guint readers)
+{
+    cell_bench b;
+    cell_reader rd[MAX_READERS];
+    GThread *th[MAX_READERS];
+    climate_reading r = {2150, 4520, 0, 0};
+    guint64 writes = 0, reads = 0;
+    gint64 start, now, t, worst = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.locked = locked;
+    snapshot_init(&b.cell);
+    g_mutex_init(&b.mcell.lock);
+    for (guint i = 0; i < readers; i++) {
+        rd[i] = (cell_reader){&b, i};
+        th[i] = g_thread_new("reader", cell_read_loop, &rd[i]);
+    }
+    start = now = mono_ns();
+    while (now - start < RUN_NS) {
+        //time every 64th write, the clock costs more than a write
+        gboolean timed = (writes & 63) == 0;
+
+        r.seq = writes;
+        if (timed) {t = mono_ns();}
+        if (locked) {
+            g_mutex_lock(&b.mcell.lock);
+            memcpy(b.mcell.data, &r, sizeof(r));
+            b.mcell.version += 2;
+            g_mutex_unlock(&b.mcell.lock);
+        }
+        else {
+            climate_publish(&b.cell, &r);
+        }
+        if (timed) {
+            now = mono_ns();
+            worst = MAX(worst, now - t);
+        }
+        writes++;
+    }
+    g_atomic_int_set(&b.done, 1);
+    for (guint i = 0; i < readers; i++) {
+        g_thread_join(th[i]);
+        reads += b.reads[i];
+    }
+    printf("  %-9s %u readers: %6.1f M writes/s, %6.1f M reads/s, worst write %6.2f us\n",
+           locked ? "GMutex" : "seqlock", readers, writes * 1e3 / (now - start), reads * 1e3 / (now - start),
+           (double)worst / NSEC_PER_USEC);
+    g_mutex_clear(&b.mcell.lock);
+}
+
+typedef struct {
+    gboolean locked;
+    sample_ring *ring;
+    mutex_ring mring;
+    gint done;
+    guint64 drained;
+} ring_bench;
+
+static gboolean mutex_ring_push(mutex_ring *ring, const adc_sample *s)
+{
+    gboolean ok;
+
+    g_mutex_lock(&ring->lock);
+    ok = ring->head - ring->tail <= ring->mask;
+    if (ok) {ring->buf[ring->head++ & ring->mask] = *s;}
+    else {ring->dropped++;}
+    g_mutex_unlock(&ring->lock);
+    return ok;
+}
+
+static guint mutex_ring_drain(mutex_ring *ring, adc_sample *out, guint max)
+{
+    guint n;
+
+    g_mutex_lock(&ring->lock);
+    n = MIN(ring->head - ring->tail, max);
+    for (guint i = 0; i < n; i++) {out[i] = ring->buf[(ring->tail + i) & ring->mask];}
+    ring->tail += n;
+    g_mutex_unlock(&ring->lock);
+    return n;
+}
+
+static gpointer ring_drain_loop(gpointer data)
+{
+    ring_bench *b = data;
+    adc_sample out[64];
+    guint64 n = 0;
+
+    while (!g_atomic_int_get(&b->done)) {
+        n += b->locked ? mutex_ring_drain(&b->mring, out, G_N_ELEMENTS(out))
+                       : sample_ring_drain(b->ring, out, G_N_ELEMENTS(out));
+    }
+    b->drained = n;
+    return NULL;
+}
+
+static void bench_ring(gboolean locked)
+{
+    ring_bench b;
+    GThread *th;
+    adc_sample s = {0, 0, 0};
+    guint64 pushes = 0, dropped;
+    gint64 start, now, t, worst = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.locked = locked;
+    b.ring = sample_ring_new(1024);
+    g_mutex_init(&b.mring.lock);
+    b.mring.buf = g_new0(adc_sample, 1024);
+    b.mring.mask = 1023;
+    th = g_thread_new("consumer", ring_drain_loop, &b);
+    start = now = mono_ns();
+    while (now - start < RUN_NS) {
+        gboolean timed = (pushes & 63) == 0;
+
+        s.ts_ns = pushes;
+        if (timed) {t = mono_ns();}
+        if (locked) {mutex_ring_push(&b.mring, &s);}
+        else {sample_ring_push(b.ring, &s);}
+        if (timed) {
+            now = mono_ns();
+            worst = MAX(worst, now - t);
+        }
+        pushes++;
+    }
+    g_atomic_int_set(&b.done, 1);
+    g_thread_join(th);
+    dropped = locked ? b.mring.dropped : sample_ring_dropped(b.ring);
+    printf("  %-9s %6.1f M pushes/s, %6.1f M drained/s, %4.1f%% dropped, worst push %6.2f us\n",
+           locked ? "GMutex" : "SPSC ring", pushes * 1e3 / (now - start), b.drained * 1e3 / (now - start),
+           100.0 * dropped / pushes, (double)worst / NSEC_PER_USEC);
+    sample_ring_free(b.ring);
+    g_free(b.mring.buf);
+    g_mutex_clear(&b.mring.lock);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Snapshot cell, one writer against readers:\n");
+    for (guint readers = 1; readers <= MAX_READERS; readers++) {
+        bench_cell(FALSE, readers);
+        bench_cell(TRUE, readers);
+    }
+    printf("Sample ring, one producer and one consumer:\n");
+    bench_ring(FALSE);
+    bench_ring(TRUE);
+    return 0;
+}
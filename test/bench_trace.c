@@ -0,0 +1,85 @@
+/**************************************************
+ * Cost check of the trace call sites. A small step of
+ * work runs in a loop bare, and wrapped the way the
+ * drivers wrap a sample (begin, flow step, end) with
+ * tracing off and on. Reported are ns per step and the
+ * added cost per call site; with tracing off the calls
+ * must not record a single event, the run fails if they
+ * do. A dump of the full ring is timed at the end.
+ * The cost while off depends on the build: with the
+ * Makefile's -O0 every call site is a function call that
+ * loads the flag, with OPT=-O2 it is the load and the
+ * branch inlined.
+ * ************************************************/
+#include <stdio.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "monotime.h"
+
+#define STEPS 20000000
+#define TRACED_STEPS 2000000
+#define SITES 3
+
+static volatile guint64 sink;
+
+//about what decoding one register takes
+static inline void step(guint i) {sink += i * 2654435761u;}
+
+static gdouble run_bare(guint n)
+{
+    gint64 start = mono_ns();
+
+    for (guint i = 0; i < n; i++) {step(i);}
+    return (gdouble)(mono_ns() - start) / n;
+}
+
+static gdouble run_traced(guint n)
+{
+    gint64 start = mono_ns();
+
+    for (guint i = 0; i < n; i++) {
+        trace_begin("step");
+        step(i);
+        trace_flow_step("sample", i);
+        trace_end("step");
+    }
+    return (gdouble)(mono_ns() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+    gchar *file = g_strdup_printf("/tmp/bench_trace.%d.json", (int)getpid());
+    trace_stats before, after;
+    gdouble bare, off, on;
+    gint64 start, events;
+
+    //warm up, so the first loop does not pay for faulting in the code
+    run_bare(STEPS / 10);
+    bare = run_bare(STEPS);
+    trace_get_stats(&before);
+    off = run_traced(STEPS);
+    trace_get_stats(&after);
+    printf("Trace call sites, %d call sites per step:\n", SITES);
+    printf("  bare step            %6.2f ns\n", bare);
+    printf("  tracing off          %6.2f ns  %+6.2f ns per call site  %llu events\n", off, (off - bare) / SITES,
+           (unsigned long long)(after.events - before.events));
+    if (after.events != before.events) {
+        printf("Error: tracing off recorded events\n");
+        return 1;
+    }
+
+    trace_set_enabled(TRUE);
+    on = run_traced(TRACED_STEPS);
+    trace_set_enabled(FALSE);
+    trace_get_stats(&after);
+    printf("  tracing on           %6.2f ns  %+6.2f ns per call site  %llu events, %llu overwritten\n", on,
+           (on - bare) / SITES, (unsigned long long)after.events, (unsigned long long)after.overwritten);
+
+    start = mono_ns();
+    events = trace_dump(file);
+    printf("Dump of %lld events: %.1f ms\n", (long long)events, (double)(mono_ns() - start) / NSEC_PER_MSEC);
+    unlink(file);
+    g_free(file);
+    return 0;
+}
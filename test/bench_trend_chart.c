@@ -0,0 +1,108 @@
+/**************************************************
+ * Headless benchmark of the trend chart at the size of
+ * the Run page's trend area, with main.c's three series
+ * and history configs. Each series is filled with a
+ * 24 hour history of 10k to 10M points; reported are the
+ * ms of a full redraw (first frame or resize) and of the
+ * frames of the minute that follows at 60 fps while samples
+ * keep arriving at the same rate, where only the newest
+ * columns are drawn. A 60 fps frame has 16.7 ms for all
+ * of it.
+ * ************************************************/
+#include <stdio.h>
+#include <math.h>
+
+#include "trend_chart.h"
+#include "monotime.h"
+
+#define WIDTH 1920
+#define HEIGHT 200
+#define SPAN_NS (86400 * NSEC_PER_SEC)
+#define FULL_RUNS 10
+#define FRAMES 3600
+#define FRAME_NS (NSEC_PER_SEC / 60)
+
+static const tsdb_config climate_history = {
+    3600, {{NSEC_PER_SEC, 86400}, {60 * NSEC_PER_SEC, 10080}, {900 * NSEC_PER_SEC, 2880}}, 3
+};
+static const tsdb_config pressure_history = {
+    65536, {{NSEC_PER_SEC, 86400}, {60 * NSEC_PER_SEC, 10080}, {900 * NSEC_PER_SEC, 2880}}, 3
+};
+
+typedef struct {
+    tsdb_series *temp;
+    tsdb_series *humid;
+    tsdb_series *pressure;
+    gint64 ts;
+    gint64 step;
+} history;
+
+static void history_fill(history *h, gint64 until_ns)
+{
+    for (; h->ts <= until_ns; h->ts += h->step) {
+        gfloat t = h->ts * 1e-12f;
+        tsdb_append(h->temp, h->ts, 25.0f + 5.0f * sinf(t));
+        tsdb_append(h->humid, h->ts, 50.0f + 20.0f * cosf(t));
+        tsdb_append(h->pressure, h->ts, 10.0f * sinf(t * 7.0f));
+    }
+}
+
+static trend_chart *chart_new(history *h)
+{
+    trend_chart *chart = trend_chart_new(NULL, SPAN_NS);
+
+    trend_chart_add_series(chart, h->temp, 15.0, 35.0, 0.9, 0.3, 0.2);
+    trend_chart_add_series(chart, h->humid, 0.0, 100.0, 0.2, 0.6, 0.9);
+    trend_chart_add_series(chart, h->pressure, -50.0, 50.0, 0.3, 0.8, 0.3);
+    return chart;
+}
+
+static void run(guint64 points)
+{
+    history h;
+    trend_chart *chart;
+    gint64 now = SPAN_NS, start, ns, full_ns = 0, frame_ns = 0, frame_max = 0;
+    guint scrolls = 0;
+
+    h.temp = tsdb_series_new("temperature", &climate_history);
+    h.humid = tsdb_series_new("humidity", &climate_history);
+    h.pressure = tsdb_series_new("pressure", &pressure_history);
+    h.step = MAX(SPAN_NS / (gint64)points, 1);
+    h.ts = now - (gint64)points * h.step;
+    history_fill(&h, now);
+
+    for (guint i = 0; i < FULL_RUNS; i++) {
+        chart = chart_new(&h);
+        start = mono_ns();
+        trend_chart_render(chart, WIDTH, HEIGHT, now);
+        full_ns += mono_ns() - start;
+        trend_chart_free(chart);
+    }
+    chart = chart_new(&h);
+    trend_chart_render(chart, WIDTH, HEIGHT, now);
+    for (guint i = 0; i < FRAMES; i++) {
+        now += FRAME_NS;
+        history_fill(&h, now);
+        start = mono_ns();
+        if (trend_chart_render(chart, WIDTH, HEIGHT, now) > 1) {scrolls++;}
+        ns = mono_ns() - start;
+        frame_ns += ns;
+        frame_max = MAX(frame_max, ns);
+    }
+    printf("  %8llu points  full %7.2f ms  frame mean %6.3f ms  max %6.3f ms  %u scrolled\n",
+           (unsigned long long)points, (double)full_ns / FULL_RUNS / NSEC_PER_MSEC,
+           (double)frame_ns / FRAMES / NSEC_PER_MSEC, (double)frame_max / NSEC_PER_MSEC, scrolls);
+    trend_chart_free(chart);
+    tsdb_series_free(h.temp);
+    tsdb_series_free(h.humid);
+    tsdb_series_free(h.pressure);
+}
+
+int main(int argc, char *argv[])
+{
+    const guint64 points[] = {10000, 100000, 1000000, 10000000};
+
+    printf("Trend chart %dx%d, 3 series over 24 h, %d frames at 60 fps:\n", WIDTH, HEIGHT, FRAMES);
+    for (guint i = 0; i < G_N_ELEMENTS(points); i++) {run(points[i]);}
+    return 0;
+}
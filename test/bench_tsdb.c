@@ -0,0 +1,93 @@
+/**************************************************
+ * Benchmark of the time series store with main.c's
+ * pressure history: a simulated 100 Hz ADC stream is
+ * ingested for a simulated month, time stamps advancing
+ * 10 ms per sample without waiting. Reported are the ingest
+ * cost per sample, the memory of the series and the
+ * resident size of the process after every week, which
+ * must not grow once the rings have been touched, and
+ * the latency of range queries at each resolution against
+ * the number of points they return.
+ * ************************************************/
+#include <stdio.h>
+#include <math.h>
+
+#include "tsdb.h"
+#include "monotime.h"
+
+#define RATE_HZ 100
+#define DAYS 30
+#define QUERY_RUNS 200
+
+static const tsdb_config pressure_history = {
+    65536, {{NSEC_PER_SEC, 86400}, {60 * NSEC_PER_SEC, 10080}, {900 * NSEC_PER_SEC, 2880}}, 3
+};
+
+static tsdb_bucket buckets[86400];
+static tsdb_point points[65536];
+
+//resident set size in kB
+static long rss_kb(void)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    gchar line[128];
+    long kb = -1;
+
+    if (f == NULL) {return -1;}
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) {break;}
+    }
+    fclose(f);
+    return kb;
+}
+
+static void query(tsdb_series *s, const gchar *what, gint64 now, gint64 span_ns, gint64 resolution_ns)
+{
+    guint n = 0;
+    gint64 start = mono_ns(), ns;
+
+    for (guint i = 0; i < QUERY_RUNS; i++) {
+        if (resolution_ns == 0) {n = tsdb_query_raw(s, now - span_ns, points, G_N_ELEMENTS(points));}
+        else {n = tsdb_query(s, resolution_ns, now - span_ns, buckets, G_N_ELEMENTS(buckets));}
+    }
+    ns = (mono_ns() - start) / QUERY_RUNS;
+    printf("  %-24s %6u points  %9.1f us  %5.1f ns/point\n", what, n, (double)ns / NSEC_PER_USEC, (double)ns / MAX(n, 1));
+}
+
+int main(int argc, char *argv[])
+{
+    tsdb_series *s = tsdb_series_new("pressure", &pressure_history);
+    const gint64 step = NSEC_PER_SEC / RATE_HZ;
+    const guint64 per_day = (guint64)RATE_HZ * 86400;
+    gint64 ts = 0, start, ingest_ns = 0;
+    guint32 rng = 2463534242u;
+
+    printf("Ingest, %d Hz for %d days:\n", RATE_HZ, DAYS);
+    printf("  start      series %8.1f kB  RSS %6ld kB\n", tsdb_memory(s) / 1024.0, rss_kb());
+    for (guint day = 1; day <= DAYS; day++) {
+        start = mono_ns();
+        for (guint64 i = 0; i < per_day; i++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            ts += step;
+            tsdb_append(s, ts, 10.0f * sinf(ts * 1e-12f) + (rng & 0xFF) * 0.001f);
+        }
+        ingest_ns += mono_ns() - start;
+        if (day % 7 == 0 || day == DAYS) {
+            printf("  day %2u     series %8.1f kB  RSS %6ld kB\n", day, tsdb_memory(s) / 1024.0, rss_kb());
+        }
+    }
+    printf("  %.1f ns per sample, %.2f M samples/s\n", (double)ingest_ns / (per_day * DAYS),
+           (double)per_day * DAYS * 1e3 / ingest_ns);
+    printf("Queries, mean of %d:\n", QUERY_RUNS);
+    query(s, "last 1 min raw", ts, 60 * NSEC_PER_SEC, 0);
+    query(s, "last 10 min raw", ts, 600 * NSEC_PER_SEC, 0);
+    query(s, "last 10 min at 1 s", ts, 600 * NSEC_PER_SEC, NSEC_PER_SEC);
+    query(s, "last 24 h at 1 s", ts, 86400 * NSEC_PER_SEC, NSEC_PER_SEC);
+    query(s, "last 24 h at 1 min", ts, 86400 * NSEC_PER_SEC, 60 * NSEC_PER_SEC);
+    query(s, "last 7 days at 1 min", ts, 7 * 86400 * NSEC_PER_SEC, 60 * NSEC_PER_SEC);
+    query(s, "last 30 days at 15 min", ts, 30 * 86400 * NSEC_PER_SEC, 900 * NSEC_PER_SEC);
+    tsdb_series_free(s);
+    return 0;
+}
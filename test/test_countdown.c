@@ -0,0 +1,187 @@
+/**************************************************
+ * Drift test of the countdown engine on a simulated clock.
+ * The operation and anaesthesia countdowns of a 12 hour
+ * surgery run the way main.c runs them, started 0.4 s
+ * apart, while every wakeup comes late by a random 0 to
+ * 20 ms and every 97th by a quarter of a second, like a
+ * busy main loop. Every displayed second has to appear
+ * once, never before its instant, at most one wakeup
+ * delay after it, and without the delay growing over the
+ * twelve hours; the countdowns have to expire on time.
+ * ************************************************/
+#include <stdio.h>
+
+#include "countdown.h"
+#include "monotime.h"
+
+#define SURGERY_NS (12 * 3600 * NSEC_PER_SEC)
+#define JITTER_NS (20 * NSEC_PER_MSEC)
+#define LATE_NS (250 * NSEC_PER_MSEC)
+#define DRIFT_MAX_NS (10 * NSEC_PER_MSEC)
+
+typedef struct {
+    gint64 now;
+    gint64 deadline;        //G_MAXINT64 while nothing is armed
+} sim_clock;
+
+static gint64 sim_now(gpointer user)
+{
+    return ((sim_clock *)user)->now;
+}
+
+static void sim_arm(countdown_engine *eng, gint64 deadline, gpointer user)
+{
+    ((sim_clock *)user)->deadline = deadline;
+}
+
+static const countdown_clock sim_clock_funcs = {
+    sim_now, sim_arm
+};
+
+typedef struct {
+    sim_clock *clock;
+    gint64 deadline;        //of the running countdown
+    gint64 expected;        //next value that has to be shown
+    gint64 first_hour_ns;   //sum of how late the values were shown, first and last hour
+    gint64 last_hour_ns;
+    guint64 first_hour;
+    guint64 last_hour;
+    gint64 worst_ns;
+    gint64 expired_at;
+} watch;
+
+static void on_changed(countdown_engine *eng, guint id, gint64 seconds, countdown_state state, gpointer user)
+{
+    watch *w = &((watch *)user)[id];
+    gint64 now = w->clock->now;
+    gint64 late;
+
+    if (state == COUNTDOWN_EXPIRED) {
+        g_assert_cmpint(w->expired_at, ==, 0);
+        w->expired_at = now;
+        return;
+    }
+    if (state != COUNTDOWN_RUNNING) {return;}
+    //no second skipped or shown twice, none shown before its time
+    g_assert_cmpint(seconds, ==, w->expected);
+    w->expected--;
+    late = now - (w->deadline - seconds * NSEC_PER_SEC);
+    g_assert_cmpint(late, >=, 0);
+    w->worst_ns = MAX(w->worst_ns, late);
+    if (seconds > SURGERY_NS / NSEC_PER_SEC - 3600) {
+        w->first_hour_ns += late;
+        w->first_hour++;
+    }
+    else if (seconds <= 3600) {
+        w->last_hour_ns += late;
+        w->last_hour++;
+    }
+}
+
+static void test_surgery(void)
+{
+    sim_clock clock = {1000 * NSEC_PER_SEC, G_MAXINT64};
+    countdown_engine *eng = countdown_engine_new(NULL);
+    watch w[2];
+    guint op, an;
+    guint64 wakeups = 0;
+    gint64 start, drift;
+    countdown_stats st;
+
+    memset(w, 0, sizeof(w));
+    for (guint i = 0; i < 2; i++) {
+        w[i].clock = &clock;
+        w[i].expected = SURGERY_NS / NSEC_PER_SEC;
+    }
+    countdown_engine_set_clock(eng, &sim_clock_funcs, &clock);
+    op = countdown_add(eng, "operation", COUNTDOWN_DOWN, on_changed, w);
+    an = countdown_add(eng, "anaesthesia", COUNTDOWN_DOWN, on_changed, w);
+    countdown_set(eng, op, SURGERY_NS);
+    countdown_set(eng, an, SURGERY_NS);
+    start = clock.now;
+    w[op].deadline = start + SURGERY_NS;
+    countdown_start(eng, op);
+    clock.now += 400 * NSEC_PER_MSEC;
+    w[an].deadline = clock.now + SURGERY_NS;
+    countdown_start(eng, an);
+    //pressing start again changes nothing
+    countdown_start(eng, op);
+    countdown_resume(eng, an);
+
+    while (clock.deadline != G_MAXINT64) {
+        gint64 late = (++wakeups % 97 == 0) ? LATE_NS : g_test_rand_int_range(0, JITTER_NS);
+
+        g_assert_cmpint(clock.deadline, >, clock.now);
+        clock.now = clock.deadline + late;
+        countdown_wakeup(eng);
+    }
+
+    countdown_get_stats(eng, &st);
+    g_test_message("%llu wakeups, %llu label updates", (unsigned long long)st.wakeups, (unsigned long long)st.reports);
+    for (guint i = 0; i < 2; i++) {
+        //every second down to 00:00:01 was shown, then it expired at its deadline
+        g_assert_cmpint(w[i].expected, ==, 0);
+        g_assert_cmpint(w[i].expired_at, >=, w[i].deadline);
+        g_assert_cmpint(w[i].expired_at - w[i].deadline, <=, LATE_NS);
+        g_assert_cmpint(countdown_get_state(eng, i), ==, COUNTDOWN_EXPIRED);
+        g_assert_cmpint(w[i].worst_ns, <=, LATE_NS);
+        //the lateness is that of single wakeups, it does not add up over the hours
+        drift = w[i].last_hour_ns / (gint64)w[i].last_hour - w[i].first_hour_ns / (gint64)w[i].first_hour;
+        g_test_message("timer %u: shown %.2f ms late on average in the first hour, %.2f ms in the last, worst %.1f ms",
+                       i, (double)w[i].first_hour_ns / w[i].first_hour / NSEC_PER_MSEC,
+                       (double)w[i].last_hour_ns / w[i].last_hour / NSEC_PER_MSEC, (double)w[i].worst_ns / NSEC_PER_MSEC);
+        g_assert_cmpint(ABS(drift), <, DRIFT_MAX_NS);
+    }
+    //one wakeup per second and timer at most, the 0.4 s apart timers do not share them
+    g_assert_cmpuint(st.wakeups, <=, 2 * SURGERY_NS / NSEC_PER_SEC + 2);
+    countdown_engine_free(eng);
+}
+
+static void test_pause_resume(void)
+{
+    sim_clock clock = {5 * NSEC_PER_SEC, G_MAXINT64};
+    countdown_engine *eng = countdown_engine_new(NULL);
+    guint down, up;
+
+    countdown_engine_set_clock(eng, &sim_clock_funcs, &clock);
+    down = countdown_add(eng, "down", COUNTDOWN_DOWN, NULL, NULL);
+    up = countdown_add(eng, "up", COUNTDOWN_UP, NULL, NULL);
+    g_assert_cmpint(clock.deadline, ==, G_MAXINT64);
+    countdown_set(eng, down, 60 * NSEC_PER_SEC);
+    countdown_start(eng, down);
+    countdown_start(eng, up);
+    clock.now += 10 * NSEC_PER_SEC;
+    countdown_pause(eng, down);
+    countdown_pause(eng, up);
+    //paused twice is paused once, time spent paused does not count
+    clock.now += 7 * NSEC_PER_SEC;
+    countdown_pause(eng, down);
+    g_assert_cmpint(countdown_get_state(eng, down), ==, COUNTDOWN_PAUSED);
+    g_assert_cmpint(countdown_value_ns(eng, down, clock.now), ==, 50 * NSEC_PER_SEC);
+    g_assert_cmpint(countdown_value_ns(eng, up, clock.now), ==, 10 * NSEC_PER_SEC);
+    g_assert_cmpint(clock.deadline, ==, G_MAXINT64);
+    countdown_resume(eng, down);
+    countdown_resume(eng, up);
+    countdown_resume(eng, down);
+    clock.now += 20 * NSEC_PER_SEC;
+    g_assert_cmpint(countdown_value_ns(eng, down, clock.now), ==, 30 * NSEC_PER_SEC);
+    g_assert_cmpint(countdown_value_ns(eng, up, clock.now), ==, 30 * NSEC_PER_SEC);
+    //the countdown expires 30 s on, not counting the pause
+    clock.now += 30 * NSEC_PER_SEC;
+    countdown_wakeup(eng);
+    g_assert_cmpint(countdown_get_state(eng, down), ==, COUNTDOWN_EXPIRED);
+    g_assert_cmpint(countdown_value_ns(eng, down, clock.now), ==, 0);
+    countdown_reset(eng, up);
+    g_assert_cmpint(countdown_get_state(eng, up), ==, COUNTDOWN_IDLE);
+    g_assert_cmpint(countdown_value_ns(eng, up, clock.now), ==, 0);
+    g_assert_cmpint(clock.deadline, ==, G_MAXINT64);
+    countdown_engine_free(eng);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/countdown/surgery_drift", test_surgery);
+    g_test_add_func("/countdown/pause_resume", test_pause_resume);
+    return g_test_run();
+}
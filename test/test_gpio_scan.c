@@ -0,0 +1,240 @@
+/**************************************************
+ * Correctness test of the status input scanner.
+ * The vertical counter debounces all lines in a few word
+ * operations; here every line also runs through a plain
+ * per-line integrator (count the scans that differ from
+ * the debounced level, clear on a match, toggle at the
+ * debounce setting) and the two have to agree on every
+ * scan. The simulated bank carries clean changes, contact
+ * bounce, single-scan glitches and lines that only chatter,
+ * on scattered pins, some active low, next to unused pins
+ * that change all the time. The scanner is driven with
+ * gpio_scan_poll(), the reactor never runs.
+ * Run with -m=slow for ten times the scans.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio_scan.h"
+#include "reactor.h"
+
+#define SCANS 200000
+#define LINES 12
+
+//bank 0 pins in the order the lines are added, and which are active low
+static const guint pins[LINES] = {5, 6, 13, 19, 26, 21, 20, 16, 12, 7, 8, 25};
+static const gboolean active_low[LINES] = {TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, FALSE, FALSE, TRUE, FALSE, TRUE, TRUE};
+
+typedef struct {
+    gboolean level;
+    guint count;
+} ref_line;
+
+typedef struct {
+    guint32 changed;
+    guint32 levels;
+    guint calls;
+} reported;
+
+static guint iterations(guint n) {return g_test_slow() ? 10 * n : n;}
+
+static void on_changed(guint32 changed, guint32 levels, gint64 ts_ns, gpointer user_data)
+{
+    reported *rep = user_data;
+
+    rep->changed = changed;
+    rep->levels = levels;
+    rep->calls++;
+}
+
+//the reference: one counter per line, returns TRUE when the line toggles
+static gboolean ref_scan(ref_line *ref, gboolean active, guint debounce)
+{
+    if (active == ref->level) {
+        ref->count = 0;
+        return FALSE;
+    }
+    if (++ref->count < debounce) {return FALSE;}
+    ref->level = active;
+    ref->count = 0;
+    return TRUE;
+}
+
+static gpio_scan *open_lines(reactor *r, guint debounce, reported *rep)
+{
+    gpio_scan *scan = gpio_scan_open_sim();
+
+    for (guint l = 0; l < LINES; l++) {g_assert_cmpint(gpio_scan_add_line(scan, pins[l], active_low[l]), ==, l);}
+    g_assert_cmpint(gpio_scan_start(scan, r, 1000, debounce, on_changed, rep), ==, 0);
+    return scan;
+}
+
+static void set_line(gpio_scan *scan, guint l, gboolean active)
+{
+    g_assert_cmpint(gpio_scan_sim_set(scan, pins[l], active != active_low[l]), ==, 0);
+}
+
+static void test_edges(void)
+{
+    reactor *r = reactor_new();
+    reported rep = {0, 0, 0};
+    gpio_scan *scan = open_lines(r, 10, &rep);
+    guint32 used = 0;
+
+    //idle high: the active low lines start inactive, the others active
+    g_assert_cmpuint(gpio_scan_get_levels(scan), ==, (1u << 6) | (1u << 7) | (1u << 9));
+    //a bounce one scan short of the debounce setting does nothing
+    for (guint bounce = 0; bounce < 3; bounce++) {
+        set_line(scan, 0, TRUE);
+        for (guint i = 0; i < 9; i++) {gpio_scan_poll(scan);}
+        set_line(scan, 0, FALSE);
+        gpio_scan_poll(scan);
+    }
+    g_assert_cmpuint(rep.calls, ==, 0);
+    //holding for ten scans changes the line on the tenth
+    set_line(scan, 0, TRUE);
+    for (guint i = 0; i < 9; i++) {gpio_scan_poll(scan);}
+    g_assert_cmpuint(rep.calls, ==, 0);
+    gpio_scan_poll(scan);
+    g_assert_cmpuint(rep.calls, ==, 1);
+    g_assert_cmpuint(rep.changed, ==, 1);
+    g_assert_cmpuint(gpio_scan_get_levels(scan), ==, rep.levels);
+    g_assert_true(rep.levels & 1);
+    //lines that settle on the same scan are reported together
+    set_line(scan, 3, TRUE);
+    set_line(scan, 11, TRUE);
+    for (guint i = 0; i < 10; i++) {gpio_scan_poll(scan);}
+    g_assert_cmpuint(rep.calls, ==, 2);
+    g_assert_cmpuint(rep.changed, ==, (1u << 3) | (1u << 11));
+    //unused pins are never looked at
+    for (guint l = 0; l < LINES; l++) {used |= 1u << pins[l];}
+    for (guint pin = 0; pin < 32; pin++) {
+        if (!(used & (1u << pin))) {gpio_scan_sim_set(scan, pin, 0);}
+    }
+    for (guint i = 0; i < 20; i++) {gpio_scan_poll(scan);}
+    g_assert_cmpuint(rep.calls, ==, 2);
+    //no lines once started
+    g_assert_cmpint(gpio_scan_add_line(scan, 4, TRUE), ==, -1);
+    gpio_scan_free(scan);
+    reactor_free(r);
+}
+
+typedef enum {LINE_QUIET, LINE_BOUNCY, LINE_GLITCHY, LINE_CHATTER} line_kind;
+
+//random contact behaviour, driven by one xorshift generator so a failure can be replayed
+typedef struct {
+    line_kind kind;
+    gboolean contact;       //level the contact settles at
+    guint bounce;           //scans of bounce left after a change
+} contact;
+
+static guint32 rng = 2463534242u;
+
+static guint32 next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static gboolean contact_scan(contact *c, guint debounce)
+{
+    gboolean level;
+
+    switch (c->kind) {
+    case LINE_CHATTER:
+        return next_rand() & 1;
+    case LINE_GLITCHY:
+        if (next_rand() % 1000 == 0) {c->contact = !c->contact;}
+        //a single scan of the other level now and then
+        return next_rand() % 50 == 0 ? !c->contact : c->contact;
+    default:
+        if (c->bounce == 0 && next_rand() % (c->kind == LINE_QUIET ? 5000 : 300) == 0) {
+            c->contact = !c->contact;
+            c->bounce = c->kind == LINE_BOUNCY ? next_rand() % (3 * debounce) : 0;
+        }
+        level = c->contact;
+        if (c->bounce > 0) {
+            c->bounce--;
+            if (next_rand() % 3 == 0) {level = !level;}
+        }
+        return level;
+    }
+}
+
+static void test_reference(void)
+{
+    const guint debounces[] = {1, 2, 3, 7, 10, 15};
+    guint n = iterations(SCANS);
+    guint64 toggles = 0;
+
+    for (guint d = 0; d < G_N_ELEMENTS(debounces); d++) {
+        guint debounce = debounces[d];
+        reactor *r = reactor_new();
+        reported rep;
+        gpio_scan *scan;
+        contact c[LINES];
+        ref_line ref[LINES];
+        guint32 expect_levels = 0;
+        guint64 expect_changes = 0;
+        gpio_scan_stats st;
+
+        memset(&rep, 0, sizeof(rep));
+        memset(c, 0, sizeof(c));
+        scan = open_lines(r, debounce, &rep);
+        for (guint l = 0; l < LINES; l++) {
+            c[l].kind = l % 4;
+            c[l].contact = active_low[l] ? FALSE : TRUE;
+            ref[l].level = c[l].contact;
+            ref[l].count = 0;
+            if (ref[l].level) {expect_levels |= 1u << l;}
+        }
+        g_assert_cmpuint(gpio_scan_get_levels(scan), ==, expect_levels);
+
+        for (guint i = 0; i < n; i++) {
+            guint32 expect_changed = 0;
+            guint calls = rep.calls;
+
+            for (guint l = 0; l < LINES; l++) {
+                gboolean active = contact_scan(&c[l], debounce);
+
+                set_line(scan, l, active);
+                if (ref_scan(&ref[l], active, debounce)) {expect_changed |= 1u << l;}
+            }
+            //pins that are not lines
+            gpio_scan_sim_set(scan, 4, next_rand() & 1);
+            gpio_scan_sim_set(scan, 31, next_rand() & 1);
+            gpio_scan_poll(scan);
+            expect_levels ^= expect_changed;
+            expect_changes += __builtin_popcount(expect_changed);
+            if (expect_changed) {
+                g_assert_cmpuint(rep.calls, ==, calls + 1);
+                g_assert_cmphex(rep.changed, ==, expect_changed);
+                g_assert_cmphex(rep.levels, ==, expect_levels);
+            }
+            else {
+                g_assert_cmpuint(rep.calls, ==, calls);
+            }
+            g_assert_cmphex(gpio_scan_get_levels(scan), ==, expect_levels);
+        }
+        gpio_scan_get_stats(scan, &st);
+        g_assert_cmpuint(st.scans, ==, n);
+        g_assert_cmpuint(st.changes, ==, expect_changes);
+        g_test_message("debounce %2u: %llu line changes in %u scans, %u reports", debounce,
+                       (unsigned long long)expect_changes, n, rep.calls);
+        toggles += expect_changes;
+        gpio_scan_free(scan);
+        reactor_free(r);
+    }
+    //the contacts did change, the agreement above was not all idle lines
+    g_assert_cmpuint(toggles, >, 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/gpio_scan/edges", test_edges);
+    g_test_add_func("/gpio_scan/reference", test_reference);
+    return g_test_run();
+}
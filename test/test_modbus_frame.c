@@ -0,0 +1,228 @@
+/**************************************************
+ * Tests of the Modbus RTU frame codec and the checksums.
+ * The table-driven CRCs are checked against bit-at-a-time
+ * reference implementations on random buffers and on the
+ * published check values, the encoders against the
+ * parsers, and the parsers are fuzzed with valid frames
+ * that get bits flipped and lengths cut, and with plain
+ * noise. Every fuzzed frame is parsed from an exact-size
+ * heap copy, so running under valgrind or with
+ * -fsanitize=address catches any read past its end; the
+ * test itself checks that what a parser accepts is
+ * consistent with the bytes it was given.
+ * Run with -m=slow for ten times the fuzz iterations.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "modbus_frame.h"
+#include "crc.h"
+
+#define FUZZ_FRAMES 500000
+
+static guint16 regs[MB_MAX_READ_REGS];
+
+/************** reference checksums **********/
+static uint16_t crc16_bitwise(const uint8_t *buf, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (guint b = 0; b < 8; b++) {crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;}
+    }
+    return crc;
+}
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (guint b = 0; b < 8; b++) {crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;}
+    }
+    return ~crc;
+}
+
+static void random_bytes(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {buf[i] = g_test_rand_int();}
+}
+
+static void test_crc16(void)
+{
+    const uint8_t check[] = "123456789";
+    //the request the sensor thread used to send as a constant
+    const uint8_t request[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x02};
+    uint8_t buf[300];
+
+    g_assert_cmphex(crc16_modbus(check, 9), ==, 0x4B37);
+    g_assert_cmphex(crc16_modbus(request, sizeof(request)), ==, 0xCB71);
+    g_assert_cmphex(crc16_modbus(buf, 0), ==, 0xFFFF);
+    for (guint i = 0; i < 20000; i++) {
+        size_t len = g_test_rand_int_range(0, sizeof(buf));
+
+        random_bytes(buf, len);
+        g_assert_cmphex(crc16_modbus(buf, len), ==, crc16_bitwise(buf, len));
+    }
+    //every single byte value, so every table entry is used alone
+    for (guint v = 0; v < 256; v++) {
+        buf[0] = v;
+        g_assert_cmphex(crc16_modbus(buf, 1), ==, crc16_bitwise(buf, 1));
+    }
+}
+
+static void test_crc32(void)
+{
+    const uint8_t check[] = "123456789";
+    uint8_t buf[300];
+
+    g_assert_cmphex(crc32_ieee(0, check, 9), ==, 0xCBF43926);
+    for (guint i = 0; i < 20000; i++) {
+        size_t len = g_test_rand_int_range(0, sizeof(buf));
+        size_t split = g_test_rand_int_range(0, len + 1);
+
+        random_bytes(buf, len);
+        g_assert_cmphex(crc32_ieee(0, buf, len), ==, crc32_bitwise(0, buf, len));
+        //continued over two pieces
+        g_assert_cmphex(crc32_ieee(crc32_ieee(0, buf, split), buf + split, len - split), ==, crc32_bitwise(0, buf, len));
+    }
+}
+
+static void test_round_trip(void)
+{
+    uint8_t buf[MB_RTU_MAX_ADU];
+    mb_frame f;
+    size_t len;
+
+    //read request, as polled
+    len = mb_frame_read_request(buf, sizeof(buf), 1, MB_FC_READ_INPUT, 0, 2);
+    g_assert_cmpuint(len, ==, 8);
+    g_assert_cmphex(buf[6], ==, 0x71);
+    g_assert_cmphex(buf[7], ==, 0xCB);
+    g_assert_cmpint(mb_frame_parse_request(buf, len, &f), ==, MB_FRAME_OK);
+    g_assert_cmpuint(f.slave, ==, 1);
+    g_assert_cmpuint(f.function, ==, MB_FC_READ_INPUT);
+    g_assert_cmpuint(f.address, ==, 0);
+    g_assert_cmpuint(f.count, ==, 2);
+    g_assert_cmpuint(mb_frame_read_request(buf, sizeof(buf), 1, MB_FC_READ_INPUT, 0, MB_MAX_READ_REGS + 1), ==, 0);
+    g_assert_cmpuint(mb_frame_read_request(buf, 7, 1, MB_FC_READ_INPUT, 0, 2), ==, 0);
+
+    //read responses of every size
+    for (guint16 n = 1; n <= MB_MAX_READ_REGS; n++) {
+        len = mb_frame_read_response(buf, sizeof(buf), 9, MB_FC_READ_HOLDING, regs, n);
+        g_assert_cmpuint(len, ==, 5 + 2 * n);
+        g_assert_cmpuint(mb_frame_response_len(buf, 3, MB_FC_READ_HOLDING), ==, len);
+        g_assert_cmpint(mb_frame_parse_response(buf, len - 1, MB_FC_READ_HOLDING, &f), ==, MB_FRAME_SHORT);
+        g_assert_cmpint(mb_frame_parse_response(buf, len, MB_FC_READ_INPUT, &f), ==, MB_FRAME_BAD);
+        g_assert_cmpint(mb_frame_parse_response(buf, len, MB_FC_READ_HOLDING, &f), ==, MB_FRAME_OK);
+        g_assert_cmpuint(f.count, ==, n);
+        //zero copy, the registers are read in place
+        g_assert_true(f.data == buf + 3);
+        for (guint i = 0; i < n; i++) {g_assert_cmpuint(mb_frame_reg(&f, i), ==, regs[i]);}
+    }
+
+    //writes and their echoes
+    len = mb_frame_write_single(buf, sizeof(buf), 7, 0x1234, 0xBEEF);
+    g_assert_cmpint(mb_frame_parse_request(buf, len, &f), ==, MB_FRAME_OK);
+    g_assert_cmpuint(f.address, ==, 0x1234);
+    g_assert_cmpuint(mb_frame_reg(&f, 0), ==, 0xBEEF);
+    g_assert_cmpint(mb_frame_parse_response(buf, len, MB_FC_WRITE_SINGLE, &f), ==, MB_FRAME_OK);
+    g_assert_cmpuint(mb_frame_reg(&f, 0), ==, 0xBEEF);
+    len = mb_frame_write_multiple(buf, sizeof(buf), 7, 0x100, regs, MB_MAX_WRITE_REGS);
+    g_assert_cmpint(mb_frame_parse_request(buf, len, &f), ==, MB_FRAME_OK);
+    g_assert_cmpuint(f.count, ==, MB_MAX_WRITE_REGS);
+    for (guint i = 0; i < f.count; i++) {g_assert_cmpuint(mb_frame_reg(&f, i), ==, regs[i]);}
+    g_assert_cmpuint(mb_frame_write_multiple(buf, sizeof(buf), 7, 0x100, regs, MB_MAX_WRITE_REGS + 1), ==, 0);
+
+    //exceptions
+    len = mb_frame_exception(buf, sizeof(buf), 7, MB_FC_READ_HOLDING, MB_EX_ILLEGAL_ADDRESS);
+    g_assert_cmpuint(len, ==, 5);
+    g_assert_cmpint(mb_frame_parse_response(buf, len, MB_FC_READ_HOLDING, &f), ==, MB_FRAME_EXCEPTION);
+    g_assert_cmpuint(f.function, ==, MB_FC_READ_HOLDING);
+    g_assert_cmpuint(f.exception, ==, MB_EX_ILLEGAL_ADDRESS);
+    //requests that are answered with an exception
+    memcpy(buf, (const uint8_t[]){MB_FC_READ_HOLDING, 0x00, 0x00, 0x00, 0x00}, 5);
+    g_assert_cmpint(mb_pdu_parse_request(buf, 5, &f), ==, MB_FRAME_EXCEPTION);
+    g_assert_cmpuint(f.exception, ==, MB_EX_ILLEGAL_VALUE);
+    buf[0] = 0x2B;
+    g_assert_cmpint(mb_pdu_parse_request(buf, 5, &f), ==, MB_FRAME_EXCEPTION);
+    g_assert_cmpuint(f.exception, ==, MB_EX_ILLEGAL_FUNCTION);
+}
+
+/************** fuzz **********/
+//what a parser accepted has to agree with the bytes it was given
+static void check_frame(mb_frame_result rc, const mb_frame *f, const uint8_t *buf, size_t len)
+{
+    if (rc != MB_FRAME_OK && rc != MB_FRAME_EXCEPTION) {return;}
+    g_assert_cmpuint(f->len, ==, len);
+    if (rc == MB_FRAME_EXCEPTION || f->data == NULL) {return;}
+    g_assert_true(f->data >= buf);
+    g_assert_cmpuint(f->data - buf + 2 * (size_t)f->count, <=, len);
+}
+
+static size_t fuzz_frame(uint8_t *buf)
+{
+    size_t len;
+    guint16 n = g_test_rand_int_range(1, MB_MAX_READ_REGS + 1);
+
+    switch (g_test_rand_int_range(0, 6)) {
+    case 0: len = mb_frame_read_response(buf, MB_RTU_MAX_ADU, g_test_rand_int(), MB_FC_READ_HOLDING, regs, n); break;
+    case 1: len = mb_frame_exception(buf, MB_RTU_MAX_ADU, g_test_rand_int(), MB_FC_READ_INPUT, g_test_rand_int()); break;
+    case 2: len = mb_frame_write_multiple(buf, MB_RTU_MAX_ADU, g_test_rand_int(), g_test_rand_int(), regs, MIN(n, MB_MAX_WRITE_REGS)); break;
+    case 3: len = mb_frame_write_single(buf, MB_RTU_MAX_ADU, g_test_rand_int(), g_test_rand_int(), g_test_rand_int()); break;
+    case 4: len = mb_frame_read_request(buf, MB_RTU_MAX_ADU, g_test_rand_int(), MB_FC_READ_INPUT, g_test_rand_int(), n); break;
+    default:
+        len = g_test_rand_int_range(0, MB_RTU_MAX_ADU + 1);
+        random_bytes(buf, len);
+        return len;
+    }
+    //flip a few bits, sometimes cut it short
+    for (gint k = g_test_rand_int_range(0, 4); k > 0; k--) {
+        buf[g_test_rand_int_range(0, len)] ^= 1 << g_test_rand_int_range(0, 8);
+    }
+    if (g_test_rand_int_range(0, 3) == 0) {len = g_test_rand_int_range(0, len + 1);}
+    return len;
+}
+
+static void test_fuzz(void)
+{
+    const guint8 functions[] = {MB_FC_READ_HOLDING, MB_FC_READ_INPUT, MB_FC_WRITE_SINGLE, MB_FC_WRITE_MULTIPLE};
+    guint n = g_test_slow() ? 10 * FUZZ_FRAMES : FUZZ_FRAMES;
+    guint64 results[4] = {0};
+    uint8_t buf[MB_RTU_MAX_ADU];
+
+    for (guint it = 0; it < n; it++) {
+        size_t len = fuzz_frame(buf);
+        uint8_t *copy = g_malloc(len);
+        guint8 function = functions[g_test_rand_int_range(0, G_N_ELEMENTS(functions))];
+        mb_frame f;
+        mb_frame_result rc;
+
+        memcpy(copy, buf, len);
+        rc = mb_frame_parse_response(copy, len, function, &f);
+        check_frame(rc, &f, copy, len);
+        if (rc == MB_FRAME_OK) {g_assert_cmpuint(f.function, ==, function);}
+        results[rc]++;
+        check_frame(mb_frame_parse_request(copy, len, &f), &f, copy, len);
+        if (len > 3) {check_frame(mb_pdu_parse_request(copy + 1, len - 3, &f), &f, copy + 1, len - 3);}
+        mb_frame_response_len(copy, len, function);
+        g_free(copy);
+    }
+    g_test_message("responses: %llu ok, %llu short, %llu bad, %llu exceptions",
+                   (unsigned long long)results[MB_FRAME_OK], (unsigned long long)results[MB_FRAME_SHORT],
+                   (unsigned long long)results[MB_FRAME_BAD], (unsigned long long)results[MB_FRAME_EXCEPTION]);
+    //the mix has to reach every outcome
+    for (guint i = 0; i < G_N_ELEMENTS(results); i++) {g_assert_cmpuint(results[i], >, 0);}
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    for (guint i = 0; i < G_N_ELEMENTS(regs); i++) {regs[i] = i * 0x0101 + 7;}
+    g_test_add_func("/crc/crc16_modbus", test_crc16);
+    g_test_add_func("/crc/crc32_ieee", test_crc32);
+    g_test_add_func("/modbus_frame/round_trip", test_round_trip);
+    g_test_add_func("/modbus_frame/fuzz", test_fuzz);
+    return g_test_run();
+}
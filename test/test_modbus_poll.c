@@ -0,0 +1,344 @@
+/**************************************************
+ * Test of the Modbus RTU poll against a stand-in slave
+ * on a pseudo terminal. The poll opens the pty through a
+ * symlink the way it opens /dev/ttyUSB0; a thread on the
+ * master side answers as slaves 1 and 2, each of which
+ * can answer properly, stay silent, answer with a bad CRC
+ * or with a byte count larger than any frame. Checked are
+ * the samples and their time stamps, the timeout and bad
+ * frame counts, the backoff of a slave that stops
+ * answering while the other one keeps its rate, that a
+ * runaway byte count fails the frame instead of the link,
+ * and the reconnect with backoff after the pty goes away
+ * and comes back. Runs on the wall clock, about eight
+ * seconds.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "modbus_poll.h"
+#include "modbus_frame.h"
+#include "monotime.h"
+
+#define PERIOD_MS 50
+#define TIMEOUT_MS 30
+#define BACKOFF_MIN_MS 50
+#define BACKOFF_MAX_MS 400
+#define REGS 4
+//slack for a loaded machine
+#define SLACK_NS (100 * NSEC_PER_MSEC)
+
+typedef enum {SLAVE_OK, SLAVE_SILENT, SLAVE_BAD_CRC, SLAVE_LONG_COUNT} slave_mode;
+
+//the master side of the pty, answering for slaves 1 and 2
+typedef struct {
+    gchar link[64];
+    int master;
+    int keep;           //our own fd on the slave side, so the master never sees a hangup
+    GThread *thread;
+    volatile gint quit;
+    volatile gint mode[3];
+} slave_sim;
+
+typedef struct {
+    GMutex lock;
+    guint samples[2];
+    guint wrong;
+    gint64 last_ts[2];
+    gint64 backwards;
+} received;
+
+static const mb_block blocks[] = {{MB_FC_READ_INPUT, 0x10, REGS, PERIOD_MS}};
+static const mb_device devices[] = {
+    {"first", 1, blocks, G_N_ELEMENTS(blocks)},
+    {"second", 2, blocks, G_N_ELEMENTS(blocks)},
+};
+
+//register values a slave answers with, so the samples can be checked
+static guint16 reg_value(guint slave, guint16 address) {return slave * 1000 + address;}
+
+static void slave_answer(slave_sim *sim, const mb_frame *req)
+{
+    uint8_t rsp[MB_RTU_MAX_ADU + 8];
+    guint16 regs[MB_MAX_READ_REGS];
+    size_t len;
+
+    if (req->slave < 1 || req->slave > 2) {return;}
+    switch (g_atomic_int_get(&sim->mode[req->slave])) {
+    case SLAVE_SILENT:
+        return;
+    case SLAVE_LONG_COUNT:
+        //a byte count of 255 announces a 260 byte frame, more than any frame holds
+        memset(rsp, 0x55, sizeof(rsp));
+        rsp[0] = req->slave;
+        rsp[1] = req->function;
+        rsp[2] = 0xFF;
+        len = 5 + 0xFF;
+        break;
+    default:
+        for (guint r = 0; r < req->count; r++) {regs[r] = reg_value(req->slave, req->address + r);}
+        len = mb_frame_read_response(rsp, sizeof(rsp), req->slave, req->function, regs, req->count);
+        if (g_atomic_int_get(&sim->mode[req->slave]) == SLAVE_BAD_CRC) {rsp[len - 1] ^= 0x01;}
+        break;
+    }
+    if (write(sim->master, rsp, len) != (ssize_t)len) {g_test_message("slave write: %s", strerror(errno));}
+}
+
+static gpointer slave_thread(gpointer data)
+{
+    slave_sim *sim = data;
+    uint8_t buf[256];
+    size_t len = 0;
+
+    while (!g_atomic_int_get(&sim->quit)) {
+        struct pollfd pfd = {sim->master, POLLIN, 0};
+        mb_frame req;
+        ssize_t n;
+
+        if (poll(&pfd, 1, 20) <= 0 || !(pfd.revents & POLLIN)) {continue;}
+        n = read(sim->master, buf + len, sizeof(buf) - len);
+        if (n <= 0) {continue;}
+        len += n;
+        //requests are 8 bytes, anything that does not parse is dropped
+        while (len >= 8) {
+            if (mb_frame_parse_request(buf, 8, &req) == MB_FRAME_OK) {slave_answer(sim, &req);}
+            len -= 8;
+            memmove(buf, buf + 8, len);
+        }
+    }
+    return NULL;
+}
+
+//a new pty behind the link, the old one (if any) must be closed
+static void slave_open(slave_sim *sim)
+{
+    gchar tmp[80];
+    struct termios tio;
+
+    sim->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    g_assert_cmpint(sim->master, >=, 0);
+    g_assert_cmpint(grantpt(sim->master), ==, 0);
+    g_assert_cmpint(unlockpt(sim->master), ==, 0);
+    sim->keep = open(ptsname(sim->master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    g_assert_cmpint(sim->keep, >=, 0);
+    //raw from the start, an echo would hand our answers back to us as requests
+    tcgetattr(sim->keep, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(sim->keep, TCSANOW, &tio);
+    g_snprintf(tmp, sizeof(tmp), "%s.new", sim->link);
+    unlink(tmp);
+    g_assert_cmpint(symlink(ptsname(sim->master), tmp), ==, 0);
+    g_assert_cmpint(rename(tmp, sim->link), ==, 0);
+    g_atomic_int_set(&sim->quit, 0);
+    sim->thread = g_thread_new("slave", slave_thread, sim);
+}
+
+static void slave_close(slave_sim *sim)
+{
+    g_atomic_int_set(&sim->quit, 1);
+    g_thread_join(sim->thread);
+    close(sim->keep);
+    close(sim->master);
+}
+
+static void on_sample(const mb_sample *s, gpointer user_data)
+{
+    received *rx = user_data;
+    guint slave = devices[s->device].slave;
+
+    g_mutex_lock(&rx->lock);
+    for (guint r = 0; r < s->count; r++) {
+        if (s->regs[r] != reg_value(slave, blocks[0].address + r)) {rx->wrong++;}
+    }
+    if (s->ts_ns <= rx->last_ts[0] || s->ts_ns <= rx->last_ts[1]) {rx->backwards++;}
+    rx->last_ts[s->device] = s->ts_ns;
+    rx->samples[s->device]++;
+    g_mutex_unlock(&rx->lock);
+}
+
+typedef struct {
+    slave_sim sim;
+    received rx;
+    reactor *r;
+    mb_poll *poll;
+} rig;
+
+static void rig_start(rig *g)
+{
+    mb_poll_config cfg = {NULL, 9600, 'N', 8, 1, TIMEOUT_MS, BACKOFF_MIN_MS, BACKOFF_MAX_MS,
+                          devices, G_N_ELEMENTS(devices), 0};
+
+    memset(g, 0, sizeof(*g));
+    g_snprintf(g->sim.link, sizeof(g->sim.link), "/tmp/test_modbus_poll.%d", (int)getpid());
+    slave_open(&g->sim);
+    g_mutex_init(&g->rx.lock);
+    cfg.device = g->sim.link;
+    g->r = reactor_new();
+    g->poll = mb_poll_start(&cfg, g->r, on_sample, &g->rx);
+    g_assert_nonnull(g->poll);
+    g_assert_cmpint(reactor_start(g->r, -1), ==, 0);
+}
+
+static void rig_free(rig *g)
+{
+    reactor_stop(g->r);
+    mb_poll_stop(g->poll);
+    reactor_free(g->r);
+    slave_close(&g->sim);
+    unlink(g->sim.link);
+    g_mutex_clear(&g->rx.lock);
+}
+
+static guint samples(rig *g, guint dev)
+{
+    guint n;
+
+    g_mutex_lock(&g->rx.lock);
+    n = g->rx.samples[dev];
+    g_mutex_unlock(&g->rx.lock);
+    return n;
+}
+
+//wait until device dev has delivered another sample, returns how long it took
+static gint64 wait_sample(rig *g, guint dev, gint64 limit_ns)
+{
+    gint64 start = mono_ns();
+    guint n = samples(g, dev);
+
+    while (samples(g, dev) == n && mono_ns() - start < limit_ns) {g_usleep(1000);}
+    return mono_ns() - start;
+}
+
+static void test_poll(void)
+{
+    rig g;
+    mb_poll_stats st;
+
+    rig_start(&g);
+    g_usleep(G_USEC_PER_SEC);
+    mb_poll_get_stats(g.poll, &st);
+    g_test_message("%.1f polls/s, %.1f us CPU per poll", (double)st.polls * NSEC_PER_SEC / st.run_ns,
+                   (double)st.cpu_ns / st.polls / NSEC_PER_USEC);
+    //both slaves at their period, with the right registers, time stamps in order
+    g_assert_cmpuint(samples(&g, 0), >=, 16);
+    g_assert_cmpuint(samples(&g, 1), >=, 16);
+    g_assert_cmpuint(samples(&g, 0), <=, 21);
+    g_assert_cmpuint(g.rx.wrong, ==, 0);
+    g_assert_cmpuint(g.rx.backwards, ==, 0);
+    g_assert_cmpuint(st.timeouts + st.bad_frames + st.exceptions + st.reconnects, ==, 0);
+    g_assert_cmpuint(st.good, ==, samples(&g, 0) + samples(&g, 1));
+    g_assert_cmpint(st.cpu_ns, >, 0);
+    rig_free(&g);
+}
+
+static void test_timeout_backoff(void)
+{
+    rig g;
+    mb_poll_stats st;
+    mb_device_stats ds;
+    guint first;
+    guint64 polls;
+    gint64 back;
+
+    rig_start(&g);
+    g_usleep(200000);
+    first = samples(&g, 0);
+    mb_poll_get_device_stats(g.poll, 1, &ds);
+    polls = ds.polls;
+    g_atomic_int_set(&g.sim.mode[2], SLAVE_SILENT);
+    g_usleep(2 * G_USEC_PER_SEC);
+    //the silent slave is backed off and does not slow down the other one
+    mb_poll_get_stats(g.poll, &st);
+    mb_poll_get_device_stats(g.poll, 1, &ds);
+    g_test_message("silent slave: %llu polls in 2 s, %llu timeouts", (unsigned long long)(ds.polls - polls),
+                   (unsigned long long)st.timeouts);
+    g_assert_true(ds.backed_off);
+    g_assert_cmpuint(st.timeouts, >=, 3);
+    g_assert_cmpuint(st.timeouts, <=, 12);
+    g_assert_cmpuint(samples(&g, 0) - first, >=, 35);
+    g_assert_cmpint(ds.stale_max_ns, >=, 2 * NSEC_PER_SEC - SLACK_NS);
+    //and answers again within the longest backoff
+    g_atomic_int_set(&g.sim.mode[2], SLAVE_OK);
+    back = wait_sample(&g, 1, 2 * NSEC_PER_SEC);
+    g_test_message("answering again after %.0f ms", (double)back / NSEC_PER_MSEC);
+    g_assert_cmpint(back, <=, BACKOFF_MAX_MS * NSEC_PER_MSEC + SLACK_NS);
+    g_usleep(50000);
+    mb_poll_get_device_stats(g.poll, 1, &ds);
+    g_assert_false(ds.backed_off);
+    rig_free(&g);
+}
+
+static void test_bad_frames(void)
+{
+    rig g;
+    mb_poll_stats st;
+    guint before;
+
+    rig_start(&g);
+    g_usleep(200000);
+    g_atomic_int_set(&g.sim.mode[2], SLAVE_BAD_CRC);
+    g_usleep(50000);
+    before = samples(&g, 1);
+    g_usleep(500000);
+    mb_poll_get_stats(g.poll, &st);
+    g_assert_cmpuint(samples(&g, 1), ==, before);
+    g_assert_cmpuint(st.bad_frames, >=, 3);
+    //a byte count past the buffer is a bad frame, not a lost link
+    g_atomic_int_set(&g.sim.mode[2], SLAVE_LONG_COUNT);
+    g_usleep(BACKOFF_MAX_MS * 1000 + 200000);
+    before = st.bad_frames;
+    mb_poll_get_stats(g.poll, &st);
+    g_test_message("%llu bad frames, %llu timeouts, %llu reconnects", (unsigned long long)st.bad_frames,
+                   (unsigned long long)st.timeouts, (unsigned long long)st.reconnects);
+    g_assert_cmpuint(st.bad_frames, >, before);
+    g_assert_cmpuint(st.reconnects, ==, 0);
+    g_assert_cmpuint(g.rx.wrong, ==, 0);
+    g_atomic_int_set(&g.sim.mode[2], SLAVE_OK);
+    g_assert_cmpint(wait_sample(&g, 1, 2 * NSEC_PER_SEC), <=, BACKOFF_MAX_MS * NSEC_PER_MSEC + SLACK_NS);
+    rig_free(&g);
+}
+
+static void test_reconnect(void)
+{
+    rig g;
+    mb_poll_stats st;
+    reactor_stats before, after;
+    gint64 back;
+
+    rig_start(&g);
+    g_usleep(200000);
+    //the adapter goes away for 1.5 s
+    slave_close(&g.sim);
+    reactor_get_stats(g.r, &before);
+    g_usleep(1500000);
+    reactor_get_stats(g.r, &after);
+    //reopening backs off, 50 100 200 400 400 ms, it does not spin
+    g_test_message("%llu reactor wakeups while the port was gone", (unsigned long long)(after.wakeups - before.wakeups));
+    g_assert_cmpuint(after.wakeups - before.wakeups, <=, 15);
+    slave_open(&g.sim);
+    back = wait_sample(&g, 0, 2 * NSEC_PER_SEC);
+    g_test_message("samples again %.0f ms after the port came back", (double)back / NSEC_PER_MSEC);
+    g_assert_cmpint(back, <=, BACKOFF_MAX_MS * NSEC_PER_MSEC + SLACK_NS);
+    g_assert_cmpint(wait_sample(&g, 1, 2 * NSEC_PER_SEC), <=, PERIOD_MS * NSEC_PER_MSEC + SLACK_NS);
+    mb_poll_get_stats(g.poll, &st);
+    g_assert_cmpuint(st.reconnects, ==, 1);
+    g_assert_cmpuint(g.rx.wrong, ==, 0);
+    rig_free(&g);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/modbus_poll/poll", test_poll);
+    g_test_add_func("/modbus_poll/timeout_backoff", test_timeout_backoff);
+    g_test_add_func("/modbus_poll/bad_frames", test_bad_frames);
+    g_test_add_func("/modbus_poll/reconnect", test_reconnect);
+    return g_test_run();
+}
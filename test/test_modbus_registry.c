@@ -0,0 +1,275 @@
+/**************************************************
+ * Test of the sensor registry with two buses of three
+ * slaves each, every bus a pseudo terminal with a thread
+ * on the master side answering for its slaves. Bus a is
+ * healthy; on bus b one slave answers, one never does and
+ * one takes 30 ms to answer. Checked are the device ids
+ * over both buses, also when the fleet is loaded from a
+ * key file the way main.c loads sensors.ini, that every
+ * sample carries the id and registers of the slave it
+ * came from, that the healthy and the slow slaves hold
+ * their periods and staleness while the dead one is
+ * backed off, and that bus b's trouble does not show on
+ * bus a. Aggregate samples/s and the worst staleness per
+ * device are reported.
+ * Runs on the wall clock, about three seconds.
+ * ************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "modbus_registry.h"
+#include "modbus_frame.h"
+#include "monotime.h"
+
+#define BUSES 2
+#define SLAVES 3
+#define TIMEOUT_MS 60
+#define SLOW_MS 30
+#define RUN_US 3000000
+//slack for a loaded machine
+#define SLACK_NS (100 * NSEC_PER_MSEC)
+
+typedef enum {SLAVE_OK, SLAVE_SILENT, SLAVE_SLOW} slave_mode;
+
+//the master side of one bus, answering for slaves 1 to SLAVES
+typedef struct {
+    guint bus;
+    gchar link[64];
+    int master;
+    int keep;
+    GThread *thread;
+    volatile gint quit;
+    slave_mode mode[SLAVES + 1];
+} bus_sim;
+
+typedef struct {
+    GMutex lock;
+    guint samples[BUSES * SLAVES];
+    guint wrong;
+} received;
+
+static const mb_block fast_blocks[] = {{MB_FC_READ_INPUT, 0x10, 4, 50}};
+static const mb_block mid_blocks[] = {{MB_FC_READ_INPUT, 0x10, 4, 100}};
+static const mb_block slow_blocks[] = {{MB_FC_READ_HOLDING, 0x20, 2, 200}};
+static const mb_device bus_a[] = {
+    {"a1", 1, fast_blocks, 1},
+    {"a2", 2, mid_blocks, 1},
+    {"a3", 3, slow_blocks, 1},
+};
+static const mb_device bus_b[] = {
+    {"b1", 1, fast_blocks, 1},
+    {"b2", 2, mid_blocks, 1},
+    {"b3", 3, mid_blocks, 1},
+};
+static const slave_mode modes[BUSES][SLAVES + 1] = {
+    {SLAVE_OK, SLAVE_OK, SLAVE_OK, SLAVE_OK},
+    {SLAVE_OK, SLAVE_OK, SLAVE_SILENT, SLAVE_SLOW},
+};
+static const mb_device *bus_devices[BUSES] = {bus_a, bus_b};
+
+//register values tell the bus and the slave that answered
+static guint16 reg_value(guint bus, guint slave, guint16 address) {return (bus + 1) * 10000 + slave * 100 + address;}
+
+static gpointer slave_thread(gpointer data)
+{
+    bus_sim *sim = data;
+    uint8_t buf[256], rsp[MB_RTU_MAX_ADU];
+    guint16 regs[MB_MAX_READ_REGS];
+    size_t len = 0;
+
+    while (!g_atomic_int_get(&sim->quit)) {
+        struct pollfd pfd = {sim->master, POLLIN, 0};
+        mb_frame req;
+        ssize_t n;
+
+        if (poll(&pfd, 1, 20) <= 0 || !(pfd.revents & POLLIN)) {continue;}
+        n = read(sim->master, buf + len, sizeof(buf) - len);
+        if (n <= 0) {continue;}
+        len += n;
+        while (len >= 8) {
+            if (mb_frame_parse_request(buf, 8, &req) == MB_FRAME_OK && req.slave >= 1 && req.slave <= SLAVES &&
+                sim->mode[req.slave] != SLAVE_SILENT) {
+                size_t r;
+                for (guint i = 0; i < req.count; i++) {regs[i] = reg_value(sim->bus, req.slave, req.address + i);}
+                r = mb_frame_read_response(rsp, sizeof(rsp), req.slave, req.function, regs, req.count);
+                if (sim->mode[req.slave] == SLAVE_SLOW) {g_usleep(SLOW_MS * 1000);}
+                if (write(sim->master, rsp, r) != (ssize_t)r) {g_test_message("slave write: %s", strerror(errno));}
+            }
+            len -= 8;
+            memmove(buf, buf + 8, len);
+        }
+    }
+    return NULL;
+}
+
+static void bus_open(bus_sim *sim, guint bus)
+{
+    struct termios tio;
+
+    memset(sim, 0, sizeof(*sim));
+    sim->bus = bus;
+    memcpy(sim->mode, modes[bus], sizeof(sim->mode));
+    g_snprintf(sim->link, sizeof(sim->link), "/tmp/test_modbus_registry.%d.%u", (int)getpid(), bus);
+    sim->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    g_assert_cmpint(sim->master, >=, 0);
+    g_assert_cmpint(grantpt(sim->master), ==, 0);
+    g_assert_cmpint(unlockpt(sim->master), ==, 0);
+    sim->keep = open(ptsname(sim->master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    g_assert_cmpint(sim->keep, >=, 0);
+    tcgetattr(sim->keep, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(sim->keep, TCSANOW, &tio);
+    unlink(sim->link);
+    g_assert_cmpint(symlink(ptsname(sim->master), sim->link), ==, 0);
+    sim->thread = g_thread_new("slave", slave_thread, sim);
+}
+
+static void bus_close(bus_sim *sim)
+{
+    g_atomic_int_set(&sim->quit, 1);
+    g_thread_join(sim->thread);
+    close(sim->keep);
+    close(sim->master);
+    unlink(sim->link);
+}
+
+static mb_registry *registry_new(bus_sim *sims)
+{
+    mb_registry *reg = mb_registry_new();
+
+    for (guint b = 0; b < BUSES; b++) {
+        mb_poll_config cfg = {sims[b].link, 9600, 'N', 8, 1, TIMEOUT_MS, 50, 400, bus_devices[b], SLAVES, 0};
+        g_assert_cmpint(mb_registry_add_bus(reg, &cfg), ==, 0);
+    }
+    return reg;
+}
+
+//the same fleet as a key file, see modbus_registry.h
+static void write_config(bus_sim *sims, const gchar *path)
+{
+    GString *text = g_string_new(NULL);
+
+    for (guint b = 0; b < BUSES; b++) {
+        g_string_append_printf(text, "[bus %c]\nport=%s\ntimeout_ms=%d\nbackoff_min_ms=50\nbackoff_max_ms=400\n\n",
+                               'a' + b, sims[b].link, TIMEOUT_MS);
+    }
+    for (guint b = 0; b < BUSES; b++) {
+        for (guint d = 0; d < SLAVES; d++) {
+            const mb_block *blk = &bus_devices[b][d].blocks[0];
+            g_string_append_printf(text, "[device %s]\nbus=%c\nslave=%d\nblocks=%s:0x%x:%u:%u\n\n",
+                                   bus_devices[b][d].name, 'a' + b, bus_devices[b][d].slave,
+                                   blk->function == MB_FC_READ_HOLDING ? "holding" : "input",
+                                   blk->address, blk->count, blk->period_ms);
+        }
+    }
+    g_assert_true(g_file_set_contents(path, text->str, -1, NULL));
+    g_string_free(text, TRUE);
+}
+
+static void on_sample(const mb_sample *s, gpointer user_data)
+{
+    received *rx = user_data;
+    guint bus = s->device / SLAVES;
+    const mb_device *d = &bus_devices[bus][s->device % SLAVES];
+
+    g_mutex_lock(&rx->lock);
+    for (guint r = 0; r < s->count; r++) {
+        if (s->regs[r] != reg_value(bus, d->slave, d->blocks[0].address + r)) {rx->wrong++;}
+    }
+    if (s->count != d->blocks[0].count) {rx->wrong++;}
+    rx->samples[s->device]++;
+    g_mutex_unlock(&rx->lock);
+}
+
+static void test_ids(void)
+{
+    bus_sim sims[BUSES];
+    mb_registry *reg;
+    mb_device_stats ds;
+
+    for (guint b = 0; b < BUSES; b++) {g_snprintf(sims[b].link, sizeof(sims[b].link), "/dev/null");}
+    reg = registry_new(sims);
+    g_assert_cmpuint(mb_registry_n_devices(reg), ==, BUSES * SLAVES);
+    for (guint b = 0; b < BUSES; b++) {
+        for (guint d = 0; d < SLAVES; d++) {g_assert_cmpint(mb_registry_find(reg, bus_devices[b][d].name), ==, b * SLAVES + d);}
+    }
+    g_assert_cmpint(mb_registry_find(reg, "c1"), ==, -1);
+    //nothing is polled yet
+    g_assert_cmpint(mb_registry_get_device_stats(reg, 0, &ds), ==, -1);
+    mb_registry_free(reg);
+}
+
+static void test_fleet(void)
+{
+    bus_sim sims[BUSES];
+    received rx;
+    reactor *r = reactor_new();
+    mb_registry *reg;
+    gint64 start, run_ns;
+    guint total = 0;
+    gchar *path = g_strdup_printf("/tmp/test_modbus_registry.%d.ini", (int)getpid());
+
+    memset(&rx, 0, sizeof(rx));
+    g_mutex_init(&rx.lock);
+    for (guint b = 0; b < BUSES; b++) {bus_open(&sims[b], b);}
+    write_config(sims, path);
+    reg = mb_registry_new();
+    g_assert_cmpint(mb_registry_load(reg, path), ==, BUSES);
+    unlink(path);
+    g_free(path);
+    for (guint id = 0; id < BUSES * SLAVES; id++) {
+        g_assert_cmpint(mb_registry_find(reg, bus_devices[id / SLAVES][id % SLAVES].name), ==, id);
+    }
+    g_assert_cmpint(mb_registry_start(reg, r, on_sample, &rx), ==, 0);
+    start = mono_ns();
+    g_assert_cmpint(reactor_start(r, -1), ==, 0);
+    g_usleep(RUN_US);
+    run_ns = mono_ns() - start;
+    for (guint id = 0; id < BUSES * SLAVES; id++) {
+        guint bus = id / SLAVES;
+        const mb_device *d = &bus_devices[bus][id % SLAVES];
+        gint64 period_ns = d->blocks[0].period_ms * NSEC_PER_MSEC;
+        guint expected = run_ns / period_ns;
+        mb_device_stats ds;
+
+        g_assert_cmpint(mb_registry_get_device_stats(reg, id, &ds), ==, 0);
+        g_test_message("%s: %u samples, %.1f/s, worst staleness %.0f ms%s", d->name, rx.samples[id],
+                       (double)rx.samples[id] * NSEC_PER_SEC / run_ns, (double)ds.stale_max_ns / NSEC_PER_MSEC,
+                       ds.backed_off ? ", backed off" : "");
+        total += rx.samples[id];
+        if (modes[bus][d->slave] == SLAVE_SILENT) {
+            g_assert_cmpuint(rx.samples[id], ==, 0);
+            g_assert_true(ds.backed_off);
+            continue;
+        }
+        g_assert_cmpuint(rx.samples[id], >=, expected * 8 / 10);
+        g_assert_cmpuint(rx.samples[id], <=, expected + 1);
+        g_assert_false(ds.backed_off);
+        //bus a only ever waits for its own frames, bus b also for a timeout and the slow answer
+        if (bus == 0) {g_assert_cmpint(ds.stale_max_ns, <=, period_ns + SLACK_NS);}
+        else {g_assert_cmpint(ds.stale_max_ns, <=, period_ns + (TIMEOUT_MS + SLOW_MS) * NSEC_PER_MSEC + SLACK_NS);}
+    }
+    g_test_message("%u devices on %u buses, %.1f samples/s", BUSES * SLAVES, BUSES, (double)total * NSEC_PER_SEC / run_ns);
+    g_assert_cmpuint(rx.wrong, ==, 0);
+    reactor_stop(r);
+    mb_registry_stop(reg);
+    mb_registry_free(reg);
+    reactor_free(r);
+    for (guint b = 0; b < BUSES; b++) {bus_close(&sims[b]);}
+    g_mutex_clear(&rx.lock);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/modbus_registry/ids", test_ids);
+    g_test_add_func("/modbus_registry/fleet", test_fleet);
+    return g_test_run();
+}
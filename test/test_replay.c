@@ -0,0 +1,277 @@
+/**************************************************
+ * Regression test of the replay harness. A ten second
+ * capture is made up the way the drivers record one:
+ * Modbus transactions of a temperature/humidity slave at
+ * 1 s (one timeout, one bad CRC and one request of a slave
+ * not in the map), ADS1115 words at 128 SPS and a dry
+ * contact press that bounces. It is replayed through the
+ * registry, the replay converter and the simulated
+ * contact into main.c's pressure filter.
+ * As fast as possible, two runs must deliver the same
+ * samples and filter output in the same order, with every
+ * record accounted for, and must not fall below a floor
+ * of records/s. At 20x the same output must come out in
+ * a twentieth of the captured time, and the bouncing
+ * press must debounce to one press and one release.
+ * Runs on the wall clock, under a second.
+ * ************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "replay.h"
+#include "modbus_frame.h"
+#include "dsp.h"
+#include "monotime.h"
+
+#define SPAN_NS (10 * NSEC_PER_SEC)
+#define ADC_SPS 128
+#define ADC_WORDS (SPAN_NS / NSEC_PER_SEC * ADC_SPS)
+#define POLLS 10
+#define TIMEOUT_POLL 3
+#define BAD_CRC_POLL 6
+#define EDGES 4
+#define RECORDS (ADC_WORDS + POLLS + 1 + EDGES)
+#define DEBOUNCE_US 20000
+#define SPEED 20.0
+//slack for a loaded machine
+#define SLACK_NS (100 * NSEC_PER_MSEC)
+//as fast as possible must stay well above this; a regression guard, not a target
+#define MIN_RECORDS_PER_S 20000
+
+static const mb_block th_blocks[] = {{MB_FC_READ_INPUT, 0x00, 2, 1000}};
+static const mb_device th_devices[] = {{"th", 1, th_blocks, 1}};
+//main.c's pressure filter
+static const dsp_config pressure_filter = {
+    8, 5, DSP_LOWPASS_BIQUAD, 128.0, 0.5,
+    {{4000, -50.0}, {28000, 50.0}}, 2
+};
+
+typedef struct {
+    gint64 ts;
+    guint kind;
+    guint index;
+} event;
+
+typedef struct {
+    guint64 hash;
+    guint mb_samples;
+    gint16 raw[ADC_WORDS];
+    guint n_raw;
+    guint transitions;
+    volatile gint done;
+} output;
+
+static void hash_bytes(guint64 *hash, const void *data, gsize len)
+{
+    const guint8 *p = data;
+
+    for (gsize i = 0; i < len; i++) {*hash = (*hash ^ p[i]) * 1099511628211ull;}
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+    const event *x = a, *y = b;
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+static void write_capture(const gchar *path)
+{
+    capture *cap = capture_create(path);
+    event ev[RECORDS];
+    guint n = 0;
+    gint64 base;
+    const gint64 edge_ts[EDGES] = {2000000000, 2000500000, 2001000000, 6000000000};
+
+    g_assert_nonnull(cap);
+    base = mono_ns();
+    for (guint i = 0; i < ADC_WORDS; i++) {ev[n++] = (event){(gint64)i * NSEC_PER_SEC / ADC_SPS, CAPTURE_ADC, i};}
+    for (guint i = 0; i < POLLS; i++) {ev[n++] = (event){i * NSEC_PER_SEC + 5 * NSEC_PER_MSEC, CAPTURE_MODBUS, i};}
+    ev[n++] = (event){4500 * NSEC_PER_MSEC, CAPTURE_MODBUS, POLLS};
+    for (guint i = 0; i < EDGES; i++) {ev[n++] = (event){edge_ts[i], CAPTURE_GPIO, i};}
+    qsort(ev, n, sizeof(ev[0]), cmp_event);
+
+    for (guint i = 0; i < n; i++) {
+        guint8 req[16], rsp[16], data[3];
+        guint16 regs[2];
+        size_t req_len, rsp_len;
+
+        switch (ev[i].kind) {
+        case CAPTURE_ADC:
+            //a slow ramp with a little ripple around mid scale
+            regs[0] = 16000 + ev[i].index * 4 + (ev[i].index % 7) * 30;
+            data[0] = ADS1115_MUX_AIN0;
+            data[1] = regs[0] >> 8;
+            data[2] = regs[0] & 0xFF;
+            capture_write(cap, CAPTURE_ADC, 0, base + ev[i].ts, data, 3);
+            break;
+        case CAPTURE_MODBUS:
+            regs[0] = 2150 + ev[i].index;
+            regs[1] = 4500 + ev[i].index;
+            //the last one is a slave this configuration does not poll
+            req_len = mb_frame_read_request(req, sizeof(req), ev[i].index == POLLS ? 9 : 1, MB_FC_READ_INPUT, 0x00, 2);
+            rsp_len = mb_frame_read_response(rsp, sizeof(rsp), 1, MB_FC_READ_INPUT, regs, 2);
+            if (ev[i].index == TIMEOUT_POLL) {rsp_len = 0;}
+            if (ev[i].index == BAD_CRC_POLL) {rsp[rsp_len - 1] ^= 0xFF;}
+            capture_write_frames(cap, 0, base + ev[i].ts, req, req_len, rsp, rsp_len);
+            break;
+        case CAPTURE_GPIO:
+            //pressed with two bounces, released clean
+            data[0] = ev[i].index % 2;
+            capture_write(cap, CAPTURE_GPIO, 0, base + ev[i].ts, data, 1);
+            break;
+        }
+    }
+    capture_close(cap);
+}
+
+static void on_sample(const mb_sample *s, gpointer user_data)
+{
+    output *out = user_data;
+
+    hash_bytes(&out->hash, &s->device, sizeof(s->device));
+    hash_bytes(&out->hash, s->regs, s->count * sizeof(s->regs[0]));
+    out->mb_samples++;
+}
+
+static void on_contact(guint line, gint level, gint64 ts_ns, gpointer user_data)
+{
+    output *out = user_data;
+
+    out->transitions++;
+}
+
+static void on_done(gpointer user_data)
+{
+    output *out = user_data;
+
+    g_atomic_int_set(&out->done, 1);
+}
+
+//replay the capture into the pipeline, filter output and counts go to out
+static void run(const gchar *path, gdouble speed, output *out, replay_stats *st)
+{
+    ads1115_config adc_cfg = {{ADS1115_MUX_AIN0}, 1, ADS1115_DR_128};
+    mb_poll_config bus = {"/dev/null", 9600, 'N', 8, 1, 100, 100, 1000, th_devices, 1, 0};
+    replay *rp = replay_open(path, speed);
+    reactor *r = reactor_new();
+    sample_ring *ring = sample_ring_new(256);
+    mb_registry *reg = mb_registry_new();
+    ads1115 *adc = ads1115_open_replay();
+    gpio_input *contacts = gpio_input_open_sim(1, DEBOUNCE_US);
+    replay_targets targets = {reg, adc, contacts};
+    dsp_filter *f = dsp_filter_new(&pressure_filter);
+    gfloat filtered[ADC_WORDS];
+    adc_sample batch[64];
+    guint n;
+
+    g_assert_nonnull(rp);
+    memset(out, 0, sizeof(*out));
+    out->hash = 14695981039346656037ull;
+    g_assert_cmpint(mb_registry_add_bus(reg, &bus), ==, 0);
+    g_assert_cmpint(mb_registry_start_replay(reg, on_sample, out), ==, 0);
+    g_assert_cmpint(ads1115_start(adc, &adc_cfg, r, ring), ==, 0);
+    g_assert_cmpint(gpio_input_start(contacts, r, on_contact, out), ==, 0);
+    g_assert_cmpint(replay_start(rp, r, &targets, on_done, out), ==, 0);
+    g_assert_cmpint(reactor_start(r, -1), ==, 0);
+    //drain the converter like display() does, until the replay is through
+    for (;;) {
+        gboolean done = g_atomic_int_get(&out->done);
+
+        n = sample_ring_drain(ring, batch, G_N_ELEMENTS(batch));
+        for (guint i = 0; i < n && out->n_raw < ADC_WORDS; i++) {out->raw[out->n_raw++] = batch[i].raw;}
+        if (n > 0) {continue;}
+        if (done) {break;}
+        g_usleep(1000);
+    }
+    //let the last contact transition settle
+    g_usleep(2 * DEBOUNCE_US);
+    reactor_stop(r);
+    replay_get_stats(rp, st);
+
+    n = dsp_filter_run(f, out->raw, out->n_raw, filtered, NULL);
+    hash_bytes(&out->hash, out->raw, out->n_raw * sizeof(out->raw[0]));
+    hash_bytes(&out->hash, filtered, n * sizeof(filtered[0]));
+
+    replay_free(rp);
+    gpio_input_stop(contacts);
+    gpio_input_free(contacts);
+    ads1115_stop(adc);
+    ads1115_free(adc);
+    mb_registry_stop(reg);
+    mb_registry_free(reg);
+    sample_ring_free(ring);
+    dsp_filter_free(f);
+    reactor_free(r);
+}
+
+static void check_counts(const output *out, const replay_stats *st)
+{
+    g_assert_true(st->done);
+    g_assert_cmpuint(st->records, ==, RECORDS);
+    g_assert_cmpuint(st->kind_records[CAPTURE_ADC], ==, ADC_WORDS);
+    g_assert_cmpuint(st->kind_records[CAPTURE_MODBUS], ==, POLLS + 1);
+    g_assert_cmpuint(st->kind_records[CAPTURE_GPIO], ==, EDGES);
+    //only the foreign slave is skipped, the timeout and the bad CRC are part of the recording
+    g_assert_cmpuint(st->skipped, ==, 1);
+    g_assert_cmpuint(out->mb_samples, ==, POLLS - 2);
+    g_assert_cmpuint(out->n_raw, ==, ADC_WORDS);
+    g_assert_cmpint(st->span_ns, >=, SPAN_NS - NSEC_PER_SEC);
+}
+
+static void test_fast(void)
+{
+    gchar *path = g_strdup_printf("/tmp/test_replay.%d.cap", (int)getpid());
+    output *a = g_new(output, 1), *b = g_new(output, 1);
+    replay_stats st;
+    gdouble rate;
+
+    write_capture(path);
+    run(path, 0, a, &st);
+    check_counts(a, &st);
+    rate = (gdouble)st.records * NSEC_PER_SEC / st.run_ns;
+    g_test_message("as fast as possible: %llu records in %.1f ms, %.0f records/s, %llu stalls",
+                   (unsigned long long)st.records, (double)st.run_ns / NSEC_PER_MSEC, rate,
+                   (unsigned long long)st.stalls);
+    g_assert_cmpfloat(rate, >=, MIN_RECORDS_PER_S);
+    run(path, 0, b, &st);
+    check_counts(b, &st);
+    g_assert_cmpuint(a->hash, ==, b->hash);
+    unlink(path);
+    g_free(path);
+    g_free(a);
+    g_free(b);
+}
+
+static void test_paced(void)
+{
+    gchar *path = g_strdup_printf("/tmp/test_replay.%d.cap", (int)getpid());
+    output *fast = g_new(output, 1), *paced = g_new(output, 1);
+    replay_stats st;
+
+    write_capture(path);
+    run(path, 0, fast, &st);
+    run(path, SPEED, paced, &st);
+    check_counts(paced, &st);
+    g_test_message("at %.0fx: %.1f s of capture in %.1f ms, worst %.1f us late",
+                   SPEED, (double)st.span_ns / NSEC_PER_SEC, (double)st.run_ns / NSEC_PER_MSEC,
+                   (double)st.late_max_ns / NSEC_PER_USEC);
+    g_assert_cmpint(st.run_ns, >=, st.span_ns / SPEED);
+    g_assert_cmpint(st.run_ns, <=, st.span_ns / SPEED + SLACK_NS);
+    g_assert_cmpint(st.late_max_ns, <=, SLACK_NS);
+    g_assert_cmpuint(paced->hash, ==, fast->hash);
+    g_assert_cmpuint(paced->transitions, ==, 2);
+    unlink(path);
+    g_free(path);
+    g_free(fast);
+    g_free(paced);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/replay/fast", test_fast);
+    g_test_add_func("/replay/paced", test_paced);
+    return g_test_run();
+}
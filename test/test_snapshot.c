@@ -0,0 +1,190 @@
+/**************************************************
+ * Stress test of the lock-free hand-over between the
+ * acquisition threads and the GUI.
+ * Snapshot cells: one writer publishes records whose
+ * words all carry the same count, readers on other
+ * threads check they never copy a mix of two records and
+ * never see the count go backwards.
+ * Sample ring: a producer pushes numbered samples into a
+ * small ring as fast as it can, the consumer checks that
+ * what arrives is in order and intact and that every
+ * sample was either delivered or counted as dropped.
+ * Run with -m=slow for ten times the iterations.
+ * ************************************************/
+#include <stdio.h>
+
+#include "snapshot.h"
+#include "sample_ring.h"
+
+#define READERS 3
+#define WRITES 2000000
+#define SAMPLES 2000000
+
+typedef struct {
+    guint32 count[SNAPSHOT_MAX_SIZE / 4];
+} record;
+
+typedef struct {
+    snapshot_cell *cell;
+    gint *done;
+    gboolean try_read;
+    guint64 reads;
+    guint64 gave_up;
+} reader;
+
+static guint iterations(guint n) {return g_test_slow() ? 10 * n : n;}
+
+static gpointer snapshot_reader(gpointer data)
+{
+    reader *rd = data;
+    record r;
+    guint32 last = 0, v;
+
+    while (!g_atomic_int_get(rd->done)) {
+        if (rd->try_read) {
+            v = snapshot_try_read(rd->cell, &r, sizeof(r), 4);
+            if (v == 0) {rd->gave_up++; continue;}
+        }
+        else {
+            v = snapshot_read(rd->cell, &r, sizeof(r));
+            if (v == 0) {continue;}
+        }
+        //every word from the same write, the version belongs to it
+        for (guint i = 1; i < G_N_ELEMENTS(r.count); i++) {g_assert_cmpuint(r.count[i], ==, r.count[0]);}
+        g_assert_cmpuint(v, ==, 2 * r.count[0]);
+        g_assert_cmpuint(r.count[0], >=, last);
+        last = r.count[0];
+        rd->reads++;
+    }
+    return NULL;
+}
+
+static void test_snapshot_empty(void)
+{
+    snapshot_cell cell;
+    climate_reading in = {2150, 4520, 7, 123456789}, out;
+
+    snapshot_init(&cell);
+    g_assert_cmpuint(climate_get(&cell, &out), ==, 0);
+    g_assert_cmpuint(snapshot_try_read(&cell, &out, sizeof(out), 1), ==, 0);
+    climate_publish(&cell, &in);
+    g_assert_cmpuint(climate_get(&cell, &out), ==, 2);
+    g_assert_cmpuint(out.temp, ==, in.temp);
+    g_assert_cmpuint(out.humid, ==, in.humid);
+    g_assert_cmpuint(out.seq, ==, in.seq);
+    g_assert_cmpint(out.ts_ns, ==, in.ts_ns);
+}
+
+static void test_snapshot_stress(void)
+{
+    snapshot_cell cell;
+    reader rd[READERS];
+    GThread *th[READERS];
+    gint done = 0;
+    record r;
+    guint n = iterations(WRITES);
+
+    snapshot_init(&cell);
+    for (guint i = 0; i < READERS; i++) {
+        rd[i] = (reader){&cell, &done, i == READERS - 1, 0, 0};
+        th[i] = g_thread_new("reader", snapshot_reader, &rd[i]);
+    }
+    for (guint32 c = 1; c <= n; c++) {
+        for (guint i = 0; i < G_N_ELEMENTS(r.count); i++) {r.count[i] = c;}
+        g_assert_cmpuint(snapshot_write(&cell, &r, sizeof(r)), ==, 2 * c);
+    }
+    g_atomic_int_set(&done, 1);
+    for (guint i = 0; i < READERS; i++) {
+        g_thread_join(th[i]);
+        g_test_message("reader %u: %llu consistent reads, %llu gave up", i,
+                       (unsigned long long)rd[i].reads, (unsigned long long)rd[i].gave_up);
+    }
+    //the writer finished, every reader gets its last record
+    g_assert_cmpuint(snapshot_read(&cell, &r, sizeof(r)), ==, 2 * n);
+    g_assert_cmpuint(r.count[G_N_ELEMENTS(r.count) - 1], ==, n);
+}
+
+static void test_ring_capacity(void)
+{
+    sample_ring *ring = sample_ring_new(100);
+    adc_sample s = {0, 0, 0}, out[256];
+    guint pushed = 0;
+
+    //rounded up to 128
+    while (!sample_ring_full(ring)) {
+        g_assert_true(sample_ring_push(ring, &s));
+        pushed++;
+    }
+    g_assert_cmpuint(pushed, ==, 128);
+    g_assert_false(sample_ring_push(ring, &s));
+    g_assert_cmpuint(sample_ring_dropped(ring), ==, 1);
+    g_assert_cmpuint(sample_ring_drain(ring, out, 100), ==, 100);
+    g_assert_cmpuint(sample_ring_drain(ring, out, G_N_ELEMENTS(out)), ==, 28);
+    g_assert_cmpuint(sample_ring_drain(ring, out, G_N_ELEMENTS(out)), ==, 0);
+    sample_ring_free(ring);
+}
+
+typedef struct {
+    sample_ring *ring;
+    guint n;
+    guint64 refused;
+    gint done;
+} producer;
+
+static gpointer ring_producer(gpointer data)
+{
+    producer *p = data;
+    adc_sample s;
+
+    for (guint i = 0; i < p->n; i++) {
+        s.ts_ns = i;
+        s.raw = (gint16)i;
+        s.channel = i % 4;
+        if (!sample_ring_push(p->ring, &s)) {p->refused++;}
+        //let a consumer on the same core run now and then
+        if ((i & 1023) == 1023) {g_thread_yield();}
+    }
+    g_atomic_int_set(&p->done, 1);
+    return NULL;
+}
+
+static void test_ring_stress(void)
+{
+    producer p = {sample_ring_new(64), iterations(SAMPLES), 0, 0};
+    GThread *th;
+    adc_sample out[16];
+    guint64 received = 0;
+    gint64 last = -1;
+    gboolean finished;
+    guint n;
+
+    th = g_thread_new("producer", ring_producer, &p);
+    do {
+        finished = g_atomic_int_get(&p.done);
+        while ((n = sample_ring_drain(p.ring, out, G_N_ELEMENTS(out))) > 0) {
+            for (guint i = 0; i < n; i++) {
+                g_assert_cmpint(out[i].ts_ns, >, last);
+                g_assert_cmpint(out[i].raw, ==, (gint16)out[i].ts_ns);
+                g_assert_cmpuint(out[i].channel, ==, out[i].ts_ns % 4);
+                last = out[i].ts_ns;
+            }
+            received += n;
+        }
+    } while (!finished);
+    g_thread_join(th);
+    g_test_message("%llu of %u samples delivered, %llu dropped", (unsigned long long)received, p.n,
+                   (unsigned long long)p.refused);
+    g_assert_cmpuint(sample_ring_dropped(p.ring), ==, p.refused);
+    g_assert_cmpuint(received + p.refused, ==, p.n);
+    sample_ring_free(p.ring);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/snapshot/empty", test_snapshot_empty);
+    g_test_add_func("/snapshot/stress", test_snapshot_stress);
+    g_test_add_func("/sample_ring/capacity", test_ring_capacity);
+    g_test_add_func("/sample_ring/stress", test_ring_stress);
+    return g_test_run();
+}
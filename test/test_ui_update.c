@@ -0,0 +1,222 @@
+/**************************************************
+ * Allocation test of the coalesced UI update path.
+ * The GTK calls ui_update makes are replaced by stand-ins
+ * that only record what would be shown, and malloc is
+ * wrapped to count every heap allocation. After a warm-up
+ * the test runs a few hours of one-second display ticks,
+ * formatting the clock, climate, pressure and countdown
+ * labels and swapping a status icon the way main.c does,
+ * and requires that none of them allocates.
+ * Needs glibc for the malloc wrappers.
+ * ************************************************/
+#include <stdio.h>
+#include <time.h>
+
+#include "ui_update.h"
+
+#define TICKS (3 * 3600)
+
+/************** allocation counter **********/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static gboolean counting;
+static guint64 allocs;
+
+void *malloc(size_t size)
+{
+    if (counting) {allocs++;}
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (counting) {allocs++;}
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    if (counting) {allocs++;}
+    return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    if (counting) {allocs++;}
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+    if (counting) {allocs++;}
+    *p = __libc_memalign(align, size);
+    return *p ? 0 : 12;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    if (counting) {allocs++;}
+    return __libc_memalign(align, size);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+/************** GTK stand-ins **********/
+typedef struct {
+    gchar text[UI_TEXT_MAX];
+    guint sets;
+} fake_widget;
+
+static fake_widget window;
+static GtkTickCallback tick_func;
+static gpointer tick_data;
+
+GType gtk_label_get_type(void) {return 1;}
+GType gtk_image_get_type(void) {return 2;}
+GTypeInstance *g_type_check_instance_cast(GTypeInstance *instance, GType type) {return instance;}
+
+const gchar *gtk_label_get_text(GtkLabel *label)
+{
+    return ((fake_widget *)label)->text;
+}
+
+void gtk_label_set_text(GtkLabel *label, const gchar *str)
+{
+    fake_widget *w = (fake_widget *)label;
+
+    g_strlcpy(w->text, str, sizeof(w->text));
+    w->sets++;
+}
+
+void gtk_image_set_from_pixbuf(GtkImage *image, GdkPixbuf *pixbuf)
+{
+    fake_widget *w = (fake_widget *)image;
+
+    g_snprintf(w->text, sizeof(w->text), "%p", (void *)pixbuf);
+    w->sets++;
+}
+
+guint gtk_widget_add_tick_callback(GtkWidget *widget, GtkTickCallback callback, gpointer user_data, GDestroyNotify notify)
+{
+    g_assert_null(tick_func);
+    tick_func = callback;
+    tick_data = user_data;
+    return 1;
+}
+
+gulong g_signal_connect_data(gpointer instance, const gchar *signal, GCallback handler, gpointer data,
+                             GClosureNotify destroy, GConnectFlags flags)
+{
+    return 1;
+}
+
+guint g_signal_handlers_disconnect_matched(gpointer instance, GSignalMatchType mask, guint signal_id, GQuark detail,
+                                           GClosure *closure, gpointer func, gpointer data)
+{
+    return 0;
+}
+
+//one frame clock tick, if anything asked for one
+static void frame(void)
+{
+    GtkTickCallback func = tick_func;
+
+    if (func == NULL) {return;}
+    tick_func = NULL;
+    if (func((GtkWidget *)&window, (GdkFrameClock *)&window, tick_data) == G_SOURCE_CONTINUE) {
+        tick_func = func;
+    }
+}
+
+/************** test **********/
+enum {W_DATE, W_TIME, W_TEMP, W_HUMID, W_PRESSURE, W_OP_HRS, W_OP_MNT, W_OP_SEC, W_ICON, N_WIDGETS};
+
+typedef struct {
+    fake_widget w[N_WIDGETS];
+    guint slot[N_WIDGETS];
+    ui_updater *ui;
+} screen;
+
+//what display(), clock_timer() and the countdowns do once a second
+static void second(screen *s, time_t t, GdkPixbuf **icons)
+{
+    struct tm local;
+    gchar dmy[16], hms[16];
+    gint elapsed = t % 86400;
+
+    localtime_r(&t, &local);
+    strftime(dmy, sizeof(dmy), "%d %b %y", &local);
+    strftime(hms, sizeof(hms), "%H:%M:%S", &local);
+    ui_set_text(s->ui, s->slot[W_DATE], "%s", dmy);
+    ui_set_text(s->ui, s->slot[W_TIME], "%s", hms);
+    //climate drifts slowly, pressure moves on every sample
+    ui_set_stamp(s->ui, s->slot[W_TEMP], 1);
+    ui_set_text(s->ui, s->slot[W_TEMP], "%.1f°C", 21.0 + (t / 60 % 10) / 10.0);
+    ui_set_text(s->ui, s->slot[W_HUMID], "%.1f %%", 45.2);
+    ui_set_text(s->ui, s->slot[W_PRESSURE], "%.1f Pa", 12.0 + (t % 7) / 10.0);
+    ui_set_text(s->ui, s->slot[W_OP_HRS], "%02d", elapsed / 3600);
+    ui_set_text(s->ui, s->slot[W_OP_MNT], "%02d", elapsed / 60 % 60);
+    ui_set_text(s->ui, s->slot[W_OP_SEC], "%02d", elapsed % 60);
+    ui_set_image(s->ui, s->slot[W_ICON], icons[t / 30 % 2]);
+}
+
+static void test_steady_state(void)
+{
+    screen s;
+    static gchar pixbuf_on, pixbuf_off;
+    GdkPixbuf *icons[2] = {(GdkPixbuf *)&pixbuf_on, (GdkPixbuf *)&pixbuf_off};
+    time_t t = 1790000000;
+    ui_update_stats st;
+    guint64 frames_before, sets_before = 0, sets = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.ui = ui_updater_new((GtkWidget *)&window, N_WIDGETS);
+    for (guint i = 0; i < N_WIDGETS; i++) {
+        s.slot[i] = i == W_ICON ? ui_updater_add_image(s.ui, (GtkWidget *)&s.w[i])
+                                : ui_updater_add_label(s.ui, (GtkWidget *)&s.w[i]);
+    }
+    //first ticks may set up the time zone and stdio
+    for (guint i = 0; i < 60; i++, t++) {
+        second(&s, t, icons);
+        frame();
+    }
+    ui_updater_get_stats(s.ui, &st);
+    frames_before = st.ticks;
+    for (guint i = 0; i < N_WIDGETS; i++) {sets_before += s.w[i].sets;}
+
+    counting = TRUE;
+    for (guint i = 0; i < TICKS; i++, t++) {
+        second(&s, t, icons);
+        frame();
+    }
+    counting = FALSE;
+
+    g_assert_cmpuint(allocs, ==, 0);
+    ui_updater_get_stats(s.ui, &st);
+    g_test_message("%llu frames, %llu labels applied, %llu unchanged values skipped",
+                   (unsigned long long)(st.ticks - frames_before), (unsigned long long)st.applied,
+                   (unsigned long long)st.unchanged);
+    //every second changes the clock, so every second is one frame
+    g_assert_cmpuint(st.ticks - frames_before, ==, TICKS);
+    //humidity never changed after the warm-up and was never set again
+    g_assert_cmpuint(s.w[W_HUMID].sets, ==, 1);
+    g_assert_cmpstr(s.w[W_HUMID].text, ==, "45.2 %");
+    //and most labels are left alone on most frames
+    for (guint i = 0; i < N_WIDGETS; i++) {sets += s.w[i].sets;}
+    g_assert_cmpuint(sets - sets_before, <, (guint64)TICKS * N_WIDGETS / 2);
+    ui_updater_free(s.ui);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/ui_update/steady_state_allocations", test_steady_state);
+    return g_test_run();
+}
@@ -0,0 +1,217 @@
+/**************************************************
+ * Fault injection test of the acquisition watchdog.
+ * The fake ADS1115 converts on a real reactor thread and
+ * its samples feed a pressure signal the way main.c feeds
+ * one; the test makes the converter NAK every transfer
+ * for a while, then stalls the reactor thread, and checks
+ * from a 10 ms check loop that each fault is reported
+ * stale no earlier than its deadline and no later than
+ * one check and one sample after it, and that the signal
+ * recovers within the converter's longest retry backoff
+ * once the fault is gone.
+ * Runs on the wall clock, about ten seconds.
+ * ************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "ads1115.h"
+#include "sample_ring.h"
+#include "watchdog.h"
+#include "monotime.h"
+
+#define CHECK_NS (10 * NSEC_PER_MSEC)
+//slack for a loaded machine on top of one check and one conversion
+#define SLACK_NS (100 * NSEC_PER_MSEC)
+#define PRESSURE_MS 500
+#define BEAT_MS 50
+#define ACQ_MS 300
+#define NAK_NS (3 * NSEC_PER_SEC)
+#define STALL_US 1000000
+//the converter retries at most this long after a failed transfer, see ads1115.c
+#define BACKOFF_MAX_NS (2 * NSEC_PER_SEC)
+
+typedef struct {
+    gint64 stale_at;
+    gint64 fresh_at;
+    guint stale;
+    guint fresh;
+} transitions;
+
+typedef struct {
+    reactor *r;
+    ads1115 *adc;
+    sample_ring *ring;
+    watchdog *wd;
+    gint pressure;
+    gint acq;
+    reactor_source *stall;  //timer that blocks the reactor thread when armed
+    transitions seen[WATCHDOG_MAX_SIGNALS];
+} rig;
+
+static void on_watchdog(gint id, const gchar *name, gboolean stale, gint64 age_ns, gpointer user_data)
+{
+    transitions *t = &((rig *)user_data)->seen[id];
+
+    g_test_message("%s %s, newest value %.3f s old", name, stale ? "stale" : "recovered", (double)age_ns / NSEC_PER_SEC);
+    if (stale) {
+        t->stale_at = mono_ns();
+        t->stale++;
+    }
+    else {
+        t->fresh_at = mono_ns();
+        t->fresh++;
+    }
+}
+
+//what display() does, for ns: drain the samples, feed their newest time, check
+static void run_checks(rig *g, gint64 ns)
+{
+    gint64 end = mono_ns() + ns;
+    adc_sample s[64];
+    guint n;
+
+    while (mono_ns() < end) {
+        g_usleep(CHECK_NS / NSEC_PER_USEC);
+        while ((n = sample_ring_drain(g->ring, s, G_N_ELEMENTS(s))) > 0) {
+            watchdog_feed(g->wd, g->pressure, s[n - 1].ts_ns);
+        }
+        watchdog_check(g->wd, mono_ns(), on_watchdog, g);
+    }
+}
+
+static void stall(reactor_source *src, guint32 events, gpointer user_data)
+{
+    g_usleep(STALL_US);
+}
+
+static void rig_start(rig *g)
+{
+    ads1115_config cfg = {{ADS1115_MUX_AIN0}, 1, ADS1115_DR_128};
+
+    memset(g, 0, sizeof(*g));
+    g->r = reactor_new();
+    g->adc = ads1115_open_fake();
+    g->ring = sample_ring_new(1024);
+    g->wd = watchdog_new();
+    g->acq = watchdog_add_heartbeat(g->wd, "acquisition", g->r, BEAT_MS, ACQ_MS);
+    g->pressure = watchdog_add(g->wd, "pressure", PRESSURE_MS);
+    g_assert_cmpint(g->acq, >=, 0);
+    g_assert_cmpint(g->pressure, >=, 0);
+    g->stall = reactor_add_timer(g->r, stall, NULL);
+    g_assert_cmpint(ads1115_start(g->adc, &cfg, g->r, g->ring), ==, 0);
+    g_assert_cmpint(reactor_start(g->r, -1), ==, 0);
+}
+
+static void rig_free(rig *g)
+{
+    reactor_stop(g->r);
+    reactor_remove(g->stall);
+    watchdog_stop(g->wd);
+    ads1115_free(g->adc);
+    watchdog_free(g->wd);
+    sample_ring_free(g->ring);
+    reactor_free(g->r);
+}
+
+static void test_adc_nak(void)
+{
+    rig g;
+    gint64 nak_on, nak_off, detect, recover;
+    ads1115_stats as;
+    watchdog_stats ws;
+
+    rig_start(&g);
+    run_checks(&g, NSEC_PER_SEC);
+    g_assert_cmpuint(g.seen[g.pressure].stale, ==, 0);
+
+    g_assert_cmpint(ads1115_fake_nak(g.adc, TRUE), ==, 0);
+    nak_on = mono_ns();
+    run_checks(&g, NAK_NS);
+    ads1115_fake_nak(g.adc, FALSE);
+    nak_off = mono_ns();
+    run_checks(&g, BACKOFF_MAX_NS + 2 * SLACK_NS);
+
+    //stale once, after the deadline but not a check later, and the reactor stayed alive
+    g_assert_cmpuint(g.seen[g.pressure].stale, ==, 1);
+    g_assert_cmpuint(g.seen[g.pressure].fresh, ==, 1);
+    g_assert_cmpuint(g.seen[g.acq].stale, ==, 0);
+    detect = g.seen[g.pressure].stale_at - nak_on;
+    recover = g.seen[g.pressure].fresh_at - nak_off;
+    g_test_message("NAK: stale after %.0f ms (deadline %u ms), recovered %.0f ms after the bus came back",
+                   (double)detect / NSEC_PER_MSEC, PRESSURE_MS, (double)recover / NSEC_PER_MSEC);
+    g_assert_cmpint(detect, >=, PRESSURE_MS * NSEC_PER_MSEC - CHECK_NS - SLACK_NS);
+    g_assert_cmpint(detect, <=, PRESSURE_MS * NSEC_PER_MSEC + SLACK_NS);
+    g_assert_cmpint(recover, >=, 0);
+    g_assert_cmpint(recover, <=, BACKOFF_MAX_NS + SLACK_NS);
+    //the converter retried, reopened the bus, and the outage covers the fault
+    ads1115_get_stats(g.adc, &as);
+    g_assert_cmpuint(as.errors, >, 3);
+    g_assert_cmpuint(as.reopens, >, 0);
+    watchdog_get_stats(g.wd, g.pressure, &ws);
+    g_assert_cmpint(ws.outage_max_ns, >=, NAK_NS);
+    g_assert_cmpint(ws.outage_max_ns, <=, NAK_NS + BACKOFF_MAX_NS + SLACK_NS);
+    rig_free(&g);
+}
+
+static void test_reactor_stall(void)
+{
+    rig g;
+    gint64 stall_on, stall_off, detect, recover;
+
+    rig_start(&g);
+    run_checks(&g, NSEC_PER_SEC);
+    g_assert_cmpuint(g.seen[g.acq].stale, ==, 0);
+
+    stall_on = mono_ns();
+    reactor_timer_arm(g.stall, stall_on);
+    stall_off = stall_on + STALL_US * NSEC_PER_USEC;
+    run_checks(&g, STALL_US * NSEC_PER_USEC + NSEC_PER_SEC);
+
+    //the heartbeat and the converter behind it both go quiet and come back
+    g_assert_cmpuint(g.seen[g.acq].stale, ==, 1);
+    g_assert_cmpuint(g.seen[g.acq].fresh, ==, 1);
+    g_assert_cmpuint(g.seen[g.pressure].stale, ==, 1);
+    g_assert_cmpuint(g.seen[g.pressure].fresh, ==, 1);
+    detect = g.seen[g.acq].stale_at - stall_on;
+    recover = g.seen[g.acq].fresh_at - stall_off;
+    g_test_message("stall: heartbeat stale after %.0f ms (deadline %u ms), back %.0f ms after the stall",
+                   (double)detect / NSEC_PER_MSEC, ACQ_MS, (double)recover / NSEC_PER_MSEC);
+    g_assert_cmpint(detect, >=, (ACQ_MS - BEAT_MS) * NSEC_PER_MSEC - SLACK_NS);
+    g_assert_cmpint(detect, <=, ACQ_MS * NSEC_PER_MSEC + SLACK_NS);
+    g_assert_cmpint(recover, <=, SLACK_NS);
+    g_assert_cmpint(g.seen[g.pressure].fresh_at - stall_off, <=, SLACK_NS);
+    rig_free(&g);
+}
+
+static void test_feed_order(void)
+{
+    watchdog *wd = watchdog_new();
+    gint id = watchdog_add(wd, "signal", 100);
+    gint64 t = mono_ns();
+    watchdog_stats st;
+
+    //a value delivered late by a slower producer does not make the signal older
+    watchdog_feed(wd, id, t + 50 * NSEC_PER_MSEC);
+    watchdog_feed(wd, id, t);
+    g_assert_cmpuint(watchdog_check(wd, t + 140 * NSEC_PER_MSEC, NULL, NULL), ==, 0);
+    g_assert_cmpuint(watchdog_check(wd, t + 160 * NSEC_PER_MSEC, NULL, NULL), ==, 1);
+    g_assert_true(watchdog_is_stale(wd, id));
+    watchdog_feed(wd, id, t + 400 * NSEC_PER_MSEC);
+    g_assert_cmpuint(watchdog_check(wd, t + 410 * NSEC_PER_MSEC, NULL, NULL), ==, 0);
+    watchdog_get_stats(wd, id, &st);
+    g_assert_cmpuint(st.stale, ==, 1);
+    g_assert_cmpint(st.outage_ns, ==, 350 * NSEC_PER_MSEC);
+    //unknown ids are ignored
+    watchdog_feed(wd, 7, t);
+    g_assert_false(watchdog_is_stale(wd, -1));
+    watchdog_free(wd);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/watchdog/feed_order", test_feed_order);
+    g_test_add_func("/watchdog/adc_nak", test_adc_nak);
+    g_test_add_func("/watchdog/reactor_stall", test_reactor_stall);
+    return g_test_run();
+}